@@ -0,0 +1,188 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file bench/connect.c
+ *
+ * @brief Connection setup latency benchmark.
+ *
+ * Opens a fresh connection per request against a running server and reports
+ * the time spent in `connect' and the time until the first response byte.
+ * Run it against the server once per listener option to see that option's
+ * effect, e.g.
+ *
+ *   ./tils 8080 &          ; ./tils-connbench -p 8080
+ *   ./tils -d 1 8080 &     ; ./tils-connbench -p 8080
+ *   ./tils -f 256 8080 &   ; ./tils-connbench -p 8080 -F
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_ITERS (10000)
+
+static const char request[] = "GET / HTTP/1.1\r\n"
+"Host: localhost\r\n"
+"User-Agent: tils-connbench\r\n"
+"\r\n";
+
+/**
+ * @brief Current monotonic time in nanoseconds.
+ */
+long _now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int _cmp_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Print min/avg/percentiles of samples in microseconds.
+ */
+void _report(const char *name, long *samples, int n) {
+    long sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += samples[i];
+
+    qsort(samples, n, sizeof(long), _cmp_long);
+    printf("%-8s min %8.1f  avg %8.1f  p50 %8.1f  p99 %8.1f  max %8.1f us\n",
+            name, samples[0] / 1e3, sum / (double)n / 1e3,
+            samples[n / 2] / 1e3, samples[(n * 99) / 100] / 1e3,
+            samples[n - 1] / 1e3);
+}
+
+/**
+ * @brief Connect, send one request, wait for the first byte of the reply.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int _one_request(struct sockaddr_in *addr, int fastopen, long *connect_ns,
+        long *ttfb_ns) {
+    char buf[256];
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+        return -1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    long start = _now_ns();
+    if (fastopen) {
+        /* The request rides in the SYN, so connect time isn't separable. */
+        if (sendto(fd, request, sizeof(request) - 1, MSG_FASTOPEN,
+                    (struct sockaddr *)addr, sizeof(*addr)) < 0)
+            goto fail;
+        *connect_ns = _now_ns() - start;
+    } else {
+        if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0)
+            goto fail;
+        *connect_ns = _now_ns() - start;
+
+        if (send(fd, request, sizeof(request) - 1, 0) < 0)
+            goto fail;
+    }
+
+    if (recv(fd, buf, sizeof(buf), 0) <= 0)
+        goto fail;
+    *ttfb_ns = _now_ns() - start;
+
+    close(fd);
+    return 0;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr;
+    int iters = DEFAULT_ITERS;
+    int port = 80;
+    int fastopen = 0;
+    int opt;
+    char *host = "127.0.0.1";
+
+    while ((opt = getopt(argc, argv, "h:p:n:F")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': iters = atoi(optarg); break;
+            case 'F': fastopen = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-n iters] "
+                        "[-F]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if (iters <= 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IPv4 address: %s\n", host);
+        return -1;
+    }
+
+    long *connect_ns = malloc(sizeof(long) * iters);
+    long *ttfb_ns = malloc(sizeof(long) * iters);
+    if (connect_ns == NULL || ttfb_ns == NULL)
+        return -1;
+
+    int done = 0, failed = 0;
+    while (done < iters) {
+        if (_one_request(&addr, fastopen, &connect_ns[done],
+                    &ttfb_ns[done]) < 0) {
+            if (++failed > iters)
+                break;
+            continue;
+        }
+        done++;
+    }
+
+    if (done == 0) {
+        fprintf(stderr, "No request succeeded\n");
+        return -1;
+    }
+
+    printf("%d connections (%d failed)%s\n", done, failed,
+            fastopen ? ", TCP fast open" : "");
+    _report("connect", connect_ns, done);
+    _report("ttfb", ttfb_ns, done);
+
+    free(connect_ns);
+    free(ttfb_ns);
+    return 0;
+}
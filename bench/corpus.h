@@ -0,0 +1,188 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file bench/corpus.h
+ *
+ * @brief Request headers as real clients send them, for the parser bench
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+static const char *_corpus[] = {
+    /* Chrome */
+    "GET / HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", "
+    "\"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,image/apng,*/*;q=0.8,"
+    "application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "If-None-Match: \"5f2b1c3a-1b4e\"\r\n"
+    "If-Modified-Since: Tue, 14 May 2024 09:12:44 GMT\r\n"
+    "\r\n",
+
+    /* Chrome, a stylesheet */
+    "GET /common.css HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", "
+    "\"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Referer: https://example.com/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n",
+
+    /* Firefox */
+    "GET /test/test.html HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:125.0) "
+    "Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "DNT: 1\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: cross-site\r\n"
+    "Priority: u=1\r\n"
+    "\r\n",
+
+    /* Safari on iOS */
+    "GET /apple-touch-icon.png HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Accept: image/webp,image/avif,video/*;q=0.8,image/png,image/svg+xml,"
+    "image/*;q=0.8,*/*;q=0.5\r\n"
+    "Accept-Language: en-GB,en;q=0.9\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_4_1 like Mac OS X) "
+    "AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4.1 Mobile/15E148 "
+    "Safari/604.1\r\n"
+    "\r\n",
+
+    /* A range request resuming a download */
+    "GET /favicon.png HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) "
+    "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36 "
+    "Edg/124.0.0.0\r\n"
+    "Accept: */*\r\n"
+    "Range: bytes=1024-\r\n"
+    "If-Range: \"5f2b1c3a-1b4e\"\r\n"
+    "Accept-Encoding: identity\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    /* curl */
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    /* curl -I, HTTP/1.0 */
+    "HEAD /common.css HTTP/1.0\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    /* wget */
+    "GET /favicon.png HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: Wget/1.21.4\r\n"
+    "Accept: */*\r\n"
+    "Accept-Encoding: identity\r\n"
+    "Connection: Keep-Alive\r\n"
+    "\r\n",
+
+    /* Googlebot */
+    "GET / HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept: text/html,application/xhtml+xml,application/signed-exchange;"
+    "v=b3,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "From: googlebot(at)googlebot.com\r\n"
+    "User-Agent: Mozilla/5.0 AppleWebKit/537.36 (KHTML, like Gecko; "
+    "compatible; Googlebot/2.1; +http://www.google.com/bot.html) "
+    "Chrome/124.0.6367.118 Safari/537.36\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "If-Modified-Since: Tue, 14 May 2024 09:12:44 GMT\r\n"
+    "\r\n",
+
+    /* Bingbot */
+    "GET /robots.txt HTTP/1.1\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: Keep-Alive\r\n"
+    "Pragma: no-cache\r\n"
+    "Accept: */*\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "From: bingbot(at)microsoft.com\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: Mozilla/5.0 (compatible; bingbot/2.0; "
+    "+http://www.bing.com/bingbot.htm)\r\n"
+    "\r\n",
+
+    /* python-requests */
+    "GET /test/test.html HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: python-requests/2.31.0\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept: */*\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    /* A scanner */
+    "GET /.env HTTP/1.1\r\n"
+    "Host: 203.0.113.7\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) "
+    "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/81.0.4044.129 "
+    "Safari/537.36\r\n"
+    "Accept-Encoding: gzip\r\n"
+    "Connection: close\r\n"
+    "\r\n",
+};
+
+#endif /* _CORPUS_H_ */
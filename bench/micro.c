@@ -0,0 +1,554 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file bench/micro.c
+ *
+ * @brief Microbenchmarks of the server's core primitives.
+ *
+ * Every benchmark is run with a doubling number of operations until a run
+ * takes at least the target time, and that run is reported as ns, cycles
+ * and heap allocations per operation. Cycles are time stamp counter ticks
+ * (x86 only), i.e. reference cycles rather than core clock cycles.
+ * Allocations are the malloc/calloc/realloc calls made by the benchmarking
+ * thread, counted through the linker's --wrap. `-j' prints JSON, to be
+ * kept & compared across builds:
+ *
+ *   ./tils-microbench -j > before.json
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include <lib/arena.h>
+#include <lib/hashtable.h>
+#include <lib/logging.h>
+#include <lib/queue.h>
+#include <tils/mime.h>
+#include <tils/out.h>
+#include <tils/request.h>
+#include <tils/response.h>
+
+#include "corpus.h"
+
+#define DEFAULT_TARGET_MS (200)
+
+/* Blocks the parser & header arenas grow by */
+#define ARENA_BLOCK (1 << 16)
+
+/* Capacity of each ping-pong queue */
+#define PINGPONG_CAPACITY (64)
+
+/* Failed queue operations before a ping-pong thread yields its core, so both
+ * threads make progress when they share one */
+#define PINGPONG_SPINS (1024)
+
+static const char *_paths[] = {
+    "/index.html", "/common.css", "/js/app.js", "/favicon.png",
+    "/fonts/roboto.woff2", "/images/header.jpg", "/data/feed.json",
+    "/robots.txt", "/LICENSE", "/archive.tar.gz", "/doc/manual.pdf",
+    "/unknown.ext",
+};
+
+/* Heap allocations made by this thread, see `__wrap_malloc' */
+static _Thread_local unsigned long _allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    _allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    _allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    _allocs++;
+    return __real_realloc(p, size);
+}
+
+/**
+ * @brief A benchmark: state is set up once, then run for any number of
+ *        operations.
+ */
+typedef struct {
+    const char *name;
+
+    /* Size of the data set, if the benchmark has one */
+    long param;
+
+    void *(*setup)(long param);
+    void (*run)(void *state, long n);
+    void (*teardown)(void *state);
+} micro_t;
+
+typedef struct {
+    long ops;
+    double ns;
+    double cycles;
+    double allocs;
+} micro_result_t;
+
+long _now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+uint64_t _now_cycles() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Results are written here so that nothing is optimized away */
+static volatile uintptr_t _sink;
+
+/*
+ * tils_parse_request
+ */
+
+typedef struct {
+    arena_t *arena;
+    int lens[sizeof(_corpus) / sizeof(_corpus[0])];
+} parse_state_t;
+
+void *_parse_setup(long param) {
+    parse_state_t *s = calloc(sizeof(parse_state_t), 1);
+    if (s == NULL || (s->arena = arena_new(ARENA_BLOCK)) == NULL) {
+        free(s);
+        return NULL;
+    }
+
+    for (int i = 0; i < sizeof(_corpus) / sizeof(_corpus[0]); i++)
+        s->lens[i] = strlen(_corpus[i]);
+
+    return s;
+}
+
+void _parse_run(void *state, long n) {
+    parse_state_t *s = state;
+    int count = sizeof(_corpus) / sizeof(_corpus[0]);
+    for (long i = 0; i < n; i++) {
+        tils_http_request_t *req = tils_parse_request(s->arena,
+                (char *)_corpus[i % count], s->lens[i % count]);
+        _sink = (uintptr_t)req;
+        arena_reset(s->arena);
+    }
+}
+
+void _parse_teardown(void *state) {
+    parse_state_t *s = state;
+    arena_free(s->arena);
+    free(s);
+}
+
+/*
+ * htable, with param keys
+ */
+
+typedef struct {
+    htable_t *table;
+    char **keys;
+    long count;
+
+    /* Keys never inserted, for the insert benchmark */
+    char **fresh;
+} htable_state_t;
+
+char **_htable_keys(long count, const char *format) {
+    char **res = calloc(sizeof(char *), count);
+    if (res == NULL)
+        return NULL;
+
+    for (long i = 0; i < count; i++) {
+        char key[64];
+        snprintf(key, sizeof(key), format, i);
+        if ((res[i] = strdup(key)) == NULL)
+            return NULL;
+    }
+
+    return res;
+}
+
+void *_htable_setup(long param) {
+    htable_state_t *s = calloc(sizeof(htable_state_t), 1);
+    if (s == NULL)
+        return NULL;
+
+    s->count = param;
+    if ((s->table = htable_new()) == NULL ||
+            (s->keys = _htable_keys(param, "/static/asset-%ld.css")) == NULL ||
+            (s->fresh = _htable_keys(param, "/fresh/page-%ld.html")) == NULL)
+        return NULL;
+
+    for (long i = 0; i < param; i++) {
+        if (htable_insert(s->table, s->keys[i], s->keys[i]) != 0)
+            return NULL;
+    }
+
+    return s;
+}
+
+/* Each insert is undone, so the table stays at param keys */
+void _htable_insert_run(void *state, long n) {
+    htable_state_t *s = state;
+    void *value;
+    for (long i = 0; i < n; i++) {
+        char *key = s->fresh[i % s->count];
+        htable_insert(s->table, key, key);
+        htable_delete(s->table, key, &value);
+        _sink = (uintptr_t)value;
+    }
+}
+
+void _htable_lookup_run(void *state, long n) {
+    htable_state_t *s = state;
+    void *value = NULL;
+    for (long i = 0; i < n; i++) {
+        htable_lookup(s->table, s->keys[(i * 7919) % s->count], &value);
+        _sink = (uintptr_t)value;
+    }
+}
+
+void _htable_teardown(void *state) {
+    htable_state_t *s = state;
+    htable_free(s->table, NULL);
+    for (long i = 0; i < s->count; i++) {
+        free(s->keys[i]);
+        free(s->fresh[i]);
+    }
+    free(s->keys);
+    free(s->fresh);
+    free(s);
+}
+
+/*
+ * queue, ping-pong between two threads
+ */
+
+typedef struct {
+    queue_t *ping;
+    queue_t *pong;
+    pthread_t thread;
+} pingpong_state_t;
+
+/* Sent to stop the echoing thread */
+static char _stop;
+
+void _pingpong_insert(queue_t *q, void *v) {
+    for (int spins = 0; queue_insert(q, v) < 0; spins++) {
+        if (spins >= PINGPONG_SPINS)
+            sched_yield();
+    }
+}
+
+void *_pingpong_remove(queue_t *q) {
+    void *v = NULL;
+    for (int spins = 0; queue_remove(q, &v) < 0; spins++) {
+        if (spins >= PINGPONG_SPINS)
+            sched_yield();
+    }
+
+    return v;
+}
+
+void *_pingpong_echo(void *arg) {
+    pingpong_state_t *s = arg;
+    void *v = NULL;
+    do {
+        v = _pingpong_remove(s->ping);
+        _pingpong_insert(s->pong, v);
+    } while (v != &_stop);
+
+    return NULL;
+}
+
+void *_pingpong_setup(long param) {
+    pingpong_state_t *s = calloc(sizeof(pingpong_state_t), 1);
+    if (s == NULL || (s->ping = queue_new(PINGPONG_CAPACITY)) == NULL ||
+            (s->pong = queue_new(PINGPONG_CAPACITY)) == NULL ||
+            pthread_create(&s->thread, NULL, _pingpong_echo, s) != 0)
+        return NULL;
+
+    return s;
+}
+
+/* One operation is a round trip: insert, then wait for it to come back */
+void _pingpong_run(void *state, long n) {
+    pingpong_state_t *s = state;
+    for (long i = 0; i < n; i++) {
+        _pingpong_insert(s->ping, (void *)(uintptr_t)(i + 1));
+        _sink = (uintptr_t)_pingpong_remove(s->pong);
+    }
+}
+
+void _pingpong_teardown(void *state) {
+    pingpong_state_t *s = state;
+    _pingpong_insert(s->ping, &_stop);
+    while (_pingpong_remove(s->pong) != &_stop)
+        ;
+
+    pthread_join(s->thread, NULL);
+    queue_free(s->ping, NULL);
+    queue_free(s->pong, NULL);
+    free(s);
+}
+
+/*
+ * tils_mime_lookup
+ */
+
+void *_mime_setup(long param) {
+    static int built = 0;
+    if (!built && (tils_mime_init() < 0 || tils_mime_build() < 0))
+        return NULL;
+
+    built = 1;
+    return &built;
+}
+
+void _mime_run(void *state, long n) {
+    int count = sizeof(_paths) / sizeof(_paths[0]);
+    for (long i = 0; i < n; i++)
+        _sink = (uintptr_t)tils_mime_lookup(_paths[i % count]);
+}
+
+void _mime_teardown(void *state) {
+}
+
+/*
+ * Response headers, as a file response's
+ */
+
+void *_hdr_setup(long param) {
+    return arena_new(ARENA_BLOCK);
+}
+
+void _hdr_run(void *state, long n) {
+    arena_t *arena = state;
+    for (long i = 0; i < n; i++) {
+        tils_hdr_t h;
+        tils_out_t *out = tils_out_new(arena);
+        if (out == NULL || tils_hdr_begin(&h, arena, TILS_STATUS_200) < 0)
+            return;
+
+        TILS_HDR_LIT(&h, "Content-Type: text/css; charset=utf-8\r\n");
+        tils_hdr_content_length(&h, 1000 + i % 100000);
+        TILS_HDR_LIT(&h, "Accept-Ranges: bytes\r\n");
+        TILS_HDR_LIT(&h, "Content-Encoding: gzip\r\n");
+        TILS_HDR_LIT(&h, "ETag: \"5f2b1c3a-1b4e\"\r\n"
+                "Last-Modified: Tue, 14 May 2024 09:12:44 GMT\r\n"
+                "Cache-Control: public, max-age=3600\r\n"
+                "Vary: Accept-Encoding\r\n");
+        tils_hdr_connection(&h, 1);
+        tils_hdr_end(&h, out);
+        _sink = (uintptr_t)out->total;
+        tils_out_release(out);
+        arena_reset(arena);
+    }
+}
+
+void _hdr_teardown(void *state) {
+    arena_free(state);
+}
+
+static const micro_t _benches[] = {
+    { "parse_request", 0, _parse_setup, _parse_run, _parse_teardown },
+    { "htable_insert_delete", 10, _htable_setup, _htable_insert_run,
+        _htable_teardown },
+    { "htable_insert_delete", 1000, _htable_setup, _htable_insert_run,
+        _htable_teardown },
+    { "htable_insert_delete", 100000, _htable_setup, _htable_insert_run,
+        _htable_teardown },
+    { "htable_lookup", 10, _htable_setup, _htable_lookup_run,
+        _htable_teardown },
+    { "htable_lookup", 1000, _htable_setup, _htable_lookup_run,
+        _htable_teardown },
+    { "htable_lookup", 100000, _htable_setup, _htable_lookup_run,
+        _htable_teardown },
+    { "queue_pingpong", 0, _pingpong_setup, _pingpong_run,
+        _pingpong_teardown },
+    { "mime_lookup", 0, _mime_setup, _mime_run, _mime_teardown },
+    { "response_header", 0, _hdr_setup, _hdr_run, _hdr_teardown },
+};
+
+/**
+ * @brief Run a benchmark with more & more operations until one run takes
+ *        the target time.
+ *
+ * @return 0 on success, -1 if the benchmark couldn't be set up.
+ */
+int _micro_run(const micro_t *bench, long target_ns, micro_result_t *res) {
+    void *state = bench->setup(bench->param);
+    if (state == NULL)
+        return -1;
+
+    /* Once unmeasured, to warm up caches & the branch predictor */
+    bench->run(state, 1);
+
+    for (long n = 1; ; n *= 2) {
+        unsigned long allocs = _allocs;
+        uint64_t cycles = _now_cycles();
+        long start = _now_ns();
+        bench->run(state, n);
+        long ns = _now_ns() - start;
+        cycles = _now_cycles() - cycles;
+        allocs = _allocs - allocs;
+
+        if (ns >= target_ns || n >= (1L << 40)) {
+            res->ops = n;
+            res->ns = (double)ns / n;
+            res->cycles = (double)cycles / n;
+            res->allocs = (double)allocs / n;
+            break;
+        }
+    }
+
+    bench->teardown(state);
+    return 0;
+}
+
+void _micro_name(const micro_t *bench, char *buf, int len) {
+    if (bench->param > 0)
+        snprintf(buf, len, "%s/%ld", bench->name, bench->param);
+    else
+        snprintf(buf, len, "%s", bench->name);
+}
+
+void _usage(char *name) {
+    fprintf(stderr, "usage: %s [-j] [-t ms] [name...]\n"
+            "  -j           print JSON\n"
+            "  -t ms        least time each benchmark runs (default: %d)\n"
+            "  name         only run benchmarks whose name starts with it\n",
+            name, DEFAULT_TARGET_MS);
+}
+
+int _micro_selected(const micro_t *bench, char **names, int count) {
+    if (count == 0)
+        return 1;
+
+    for (int i = 0; i < count; i++) {
+        if (strncmp(bench->name, names[i], strlen(names[i])) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long target_ms = DEFAULT_TARGET_MS;
+    int json = 0;
+    int first = 1;
+    int opt = 0;
+    int res = 0;
+
+    while ((opt = getopt(argc, argv, "jt:")) != -1) {
+        switch (opt) {
+            case 'j':
+                json = 1;
+                break;
+            case 't':
+                target_ms = atol(optarg);
+                break;
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (target_ms <= 0) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    /* The log is written to stdout, move it out of the way of results */
+    FILE *results = fdopen(dup(STDOUT_FILENO), "w");
+    if (results == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        perror("dup");
+        return 1;
+    }
+
+    log_start();
+
+    if (json)
+        fprintf(results, "{\"compiler\":\"%s\",\"target_ms\":%ld,"
+                "\"benchmarks\":[", __VERSION__, target_ms);
+    else
+        fprintf(results, "%-28s %12s %10s %10s %10s\n", "benchmark", "ops",
+                "ns/op", "cycles/op", "allocs/op");
+
+    for (int i = 0; i < sizeof(_benches) / sizeof(_benches[0]); i++) {
+        micro_result_t r;
+        char name[64];
+
+        if (!_micro_selected(&_benches[i], argv + optind, argc - optind))
+            continue;
+
+        _micro_name(&_benches[i], name, sizeof(name));
+        if (_micro_run(&_benches[i], target_ms * 1000000, &r) < 0) {
+            fprintf(stderr, "Failed to set up %s\n", name);
+            res = 1;
+            continue;
+        }
+
+        if (json) {
+            fprintf(results, "%s\n{\"name\":\"%s\",\"ops\":%ld,"
+                    "\"ns_per_op\":%.2f,", first ? "" : ",", name, r.ops,
+                    r.ns);
+            if (_now_cycles() != 0)
+                fprintf(results, "\"cycles_per_op\":%.2f,", r.cycles);
+            else
+                fprintf(results, "\"cycles_per_op\":null,");
+            fprintf(results, "\"allocs_per_op\":%.3f}", r.allocs);
+        } else {
+            fprintf(results, "%-28s %12ld %10.2f %10.2f %10.3f\n", name,
+                    r.ops, r.ns, r.cycles, r.allocs);
+        }
+
+        fflush(results);
+        first = 0;
+    }
+
+    if (json)
+        fprintf(results, "\n]}\n");
+
+    fclose(results);
+    return res;
+}
@@ -0,0 +1,43 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/lib/arena.h
+ *
+ * @brief Bump pointer arena
+ *
+ * Hands out memory that is released all at once by `arena_reset'. Not
+ * thread safe - meant to be owned by a single worker.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+struct _arena;
+typedef struct arena arena_t;
+
+arena_t *arena_new(size_t block_size);
+void *arena_alloc(arena_t *a, size_t size);
+char *arena_strndup(arena_t *a, const char *s, size_t len);
+void arena_reset(arena_t *a);
+void arena_free(arena_t *a);
+
+#endif /* _ARENA_H_ */
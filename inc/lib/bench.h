@@ -10,15 +10,27 @@
  *  but WITHOUT ANY WARRANTY; without even the implied warranty of
  *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  *  GNU General Public License for more details.
- * 
+ *
  *  You should have received a copy of the GNU General Public License
  *  along with tils.  If not, see <http://www.gnu.org/licenses/>
  */
 
 /**
- * @file lib/util.h
+ * @file inc/lib/bench.h
+ *
+ * @brief Hot path latency instrumentation.
+ *
+ * Built with `make TIMING=1' (CLOCK_MONOTONIC) or `make TIMING=tsc' (the
+ * x86 time stamp counter), timers record into histograms owned by the
+ * calling thread, so recording is a few uncontended stores. The histograms
+ * of every thread are only merged when a report is asked for, e.g. with
+ * SIGUSR1. Otherwise every macro here compiles to nothing.
  *
- * @brief Benchmarking tools.
+ *   BENCH_SCOPE(BENCH_PARSE);        times the rest of the enclosing block
+ *
+ *   BENCH_START(t);                  times the statements in between
+ *   ...
+ *   BENCH_STOP(t, BENCH_SEND);
  *
  * @author Lars Wander
  */
@@ -26,25 +38,91 @@
 #ifndef _BENCH_H_
 #define _BENCH_H_
 
-#include <sys/time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(TILS_BENCH_TSC) && defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/* Sub-buckets per power of 2, values are kept within 1 / 2^BENCH_SUB_BITS */
+#define BENCH_SUB_BITS (5)
+#define BENCH_SUB_COUNT (1 << BENCH_SUB_BITS)
+
+/* Largest power of 2 told apart, larger values land in the last bucket */
+#define BENCH_MAX_EXP (42)
+
+#define BENCH_BUCKETS ((BENCH_MAX_EXP - BENCH_SUB_BITS + 2) * BENCH_SUB_COUNT)
+
+typedef enum {
+    BENCH_ACCEPT = 0,
+    BENCH_RECV,
+    BENCH_PARSE,
+    BENCH_ROUTE,
+    BENCH_SERVE,
+    BENCH_SEND,
+    BENCH_PROBE_COUNT
+} bench_probe_e;
+
+/**
+ * @brief Samples of one probe, in clock ticks
+ */
+typedef struct {
+    uint64_t counts[BENCH_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} bench_hist_t;
+
+typedef struct {
+    bench_probe_e probe;
+    uint64_t start;
+} bench_timer_t;
+
+/**
+ * @brief The current time, in clock ticks.
+ */
+static inline uint64_t bench_now() {
+#if defined(TILS_BENCH_TSC) && defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void bench_init();
+void bench_record(bench_probe_e probe, uint64_t ticks);
+void bench_merge(bench_hist_t *hists);
+uint64_t bench_percentile(const bench_hist_t *hist, double q);
+double bench_tick_ns();
+void bench_report(FILE *out);
+void bench_poll();
+
+void _bench_scope_end(bench_timer_t *timer);
+
+#ifdef TILS_BENCH
 
-#include <lib/util.h>
+#define _BENCH_CAT(a, b) a ## b
+#define _BENCH_NAME(line) _BENCH_CAT(_bench_scope_, line)
 
-#ifdef USE_BENCH
+#define BENCH_INIT() bench_init()
+#define BENCH_POLL() bench_poll()
+#define BENCH_SCOPE(probe) \
+    bench_timer_t _BENCH_NAME(__LINE__) \
+    __attribute__((cleanup(_bench_scope_end))) = { (probe), bench_now() }
+#define BENCH_START(t) uint64_t t = bench_now()
+#define BENCH_STOP(t, probe) bench_record((probe), bench_now() - (t))
 
-#define INIT_BENCH struct timeval _b_start, _b_stop
-#define START_BENCH gettimeofday(&_b_start, NULL)
-#define STOP_BENCH gettimeofday(&_b_stop, NULL)
-#define LOG_BENCH(r) printf("ACTION %s : %lu us\n", (r), \
-        _b_stop.tv_usec - _b_start.tv_usec) \
-    
 #else
 
-#define INIT_BENCH 
-#define START_BENCH(r) 
-#define STOP_BENCH 
-#define LOG_BENCH 
+#define BENCH_INIT()
+#define BENCH_POLL()
+#define BENCH_SCOPE(probe)
+#define BENCH_START(t)
+#define BENCH_STOP(t, probe)
 
-#endif /* USE_BENCH */
+#endif /* TILS_BENCH */
 
 #endif /* _BENCH_H_ */
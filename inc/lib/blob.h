@@ -0,0 +1,43 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/lib/blob.h
+ *
+ * @brief Reference counted, immutable byte buffer
+ *
+ * Once filled, a blob may be shared between threads. The last `blob_unref'
+ * frees it.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _BLOB_H_
+#define _BLOB_H_
+
+#include <stddef.h>
+
+struct _blob;
+typedef struct blob blob_t;
+
+blob_t *blob_new(size_t len);
+blob_t *blob_ref(blob_t *b);
+void blob_unref(blob_t *b);
+char *blob_data(blob_t *b);
+size_t blob_len(blob_t *b);
+
+#endif /* _BLOB_H_ */
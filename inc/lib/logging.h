@@ -16,9 +16,23 @@
  */
 
 /**
- * @file inc/util.h
+ * @file inc/lib/logging.h
  *
- * @brief Basic utility functions / macros
+ * @brief Asynchronous logging
+ *
+ * A log call only packs its arguments into a fixed size record in a ring
+ * owned by the calling thread; a background thread formats and writes the
+ * records in batches. When a thread's ring is full the record is dropped and
+ * counted rather than blocking the caller.
+ *
+ * The format is the record's id, so it must be a string literal; the log_*
+ * macros don't compile with anything else. Only integers (`d i u x X o c`,
+ * with `hh h l ll z`), `s`, `p` and `f e g` are supported, with flags and
+ * widths & precisions given literally or as `*`. Strings are copied, up to
+ * their precision, and may be truncated.
+ *
+ * Levels below `TILS_LOG_LEVEL` are compiled out. `errno` is never read
+ * implicitly, only the `_errno` variants report it, as of the call.
  *
  * @author Lars Wander
  */
@@ -26,6 +40,8 @@
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
 
+#include <errno.h>
+
 #define ANSI_BOLD    "\x1b[1m"
 #define ANSI_RED     "\x1b[31m"
 #define ANSI_GREEN   "\x1b[32m"
@@ -40,12 +56,36 @@
 #define WARN   ANSI_BOLD ANSI_YELLOW " [WARN] " ANSI_RESET
 #define ERROR  ANSI_BOLD ANSI_RED "[ERROR] " ANSI_RESET
 
+#define LOG_LEVEL_INFO (0)
+#define LOG_LEVEL_WARN (1)
+#define LOG_LEVEL_ERR  (2)
+
+#ifndef TILS_LOG_LEVEL
+#define TILS_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
 #define MAX_LOG_LENGTH  (256)
 #define MAX_TIME_LENGTH  (26)
 #define MAX_ERRNO_LENGTH  (128)
 
-void log_info(const char *format, ...);
-void log_warn(const char *format, ...);
-void log_err(const char *format, ...);
+/* The level check is a constant, so calls below it are removed entirely
+ * while their arguments are still type checked. Pasting "" in front of the
+ * format only compiles if it's a string literal, which outlives the call. */
+#define _LOG(level, errnum, ...) \
+    do { if ((level) >= TILS_LOG_LEVEL) \
+        _log_write((level), (errnum), "" __VA_ARGS__); } while (0)
+
+#define log_info(...)       _LOG(LOG_LEVEL_INFO, 0, __VA_ARGS__)
+#define log_warn(...)       _LOG(LOG_LEVEL_WARN, 0, __VA_ARGS__)
+#define log_err(...)        _LOG(LOG_LEVEL_ERR, 0, __VA_ARGS__)
+#define log_warn_errno(...) _LOG(LOG_LEVEL_WARN, errno, __VA_ARGS__)
+#define log_err_errno(...)  _LOG(LOG_LEVEL_ERR, errno, __VA_ARGS__)
+
+void _log_write(int level, int errnum, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+int log_start();
+void log_stop();
+unsigned long log_dropped();
 
 #endif /* _LOGGING_H_ */
@@ -0,0 +1,40 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/lib/pool.h
+ *
+ * @brief Size class buffer pool
+ *
+ * Recycles buffers of a handful of fixed sizes. Not thread safe - meant to be
+ * owned by a single worker.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+struct _pool;
+typedef struct pool pool_t;
+
+pool_t *pool_new();
+void *pool_get(pool_t *p, int size, int *cap);
+void pool_put(pool_t *p, void *buf, int cap);
+void pool_free(pool_t *p);
+
+#endif /* _POOL_H_ */
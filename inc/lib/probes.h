@@ -0,0 +1,62 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/lib/probes.h
+ *
+ * @brief USDT (statically defined tracing) probes
+ *
+ * With systemtap's <sys/sdt.h> available, every TILS_PROBEn(name, ...)
+ * compiles to a single NOP plus a note in the binary describing where the
+ * arguments are, so `perf probe', bpftrace & co. can attach to a running
+ * server with no rebuild and nothing spent while nobody is attached:
+ *
+ *   bpftrace -e 'usdt:./tils:tils:accept { @[arg1] = count(); }'
+ *
+ * Without the header, or built with `make USDT=0', probes are left out.
+ * Arguments are still evaluated either way, so they should be free of side
+ * effects & costly calls.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+#if !defined(TILS_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TILS_USDT
+#endif
+#endif
+
+#ifdef TILS_USDT
+
+#define TILS_PROBE1(name, a) DTRACE_PROBE1(tils, name, a)
+#define TILS_PROBE2(name, a, b) DTRACE_PROBE2(tils, name, a, b)
+#define TILS_PROBE3(name, a, b, c) DTRACE_PROBE3(tils, name, a, b, c)
+
+#else
+
+#define TILS_PROBE1(name, a) do { (void)(a); } while (0)
+#define TILS_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define TILS_PROBE3(name, a, b, c) \
+    do { (void)(a); (void)(b); (void)(c); } while (0)
+
+#endif
+
+#endif /* _PROBES_H_ */
@@ -28,8 +28,6 @@
 
 #include <time.h>
 
-#define USE_BENCH 
-
 #define MAX(res, a, b) \
    do { __typeof__ (a) _a = (a); \
        __typeof__ (b) _b = (b); \
@@ -28,7 +28,8 @@
 
 #include <tils/conn.h>
 #include <tils/request.h>
+#include <tils/worker_thread.h>
 
-tils_http_request_t *tils_accept_request(tils_conn_t *conn);
+tils_http_request_t *tils_accept_request(tils_wt_t *self, tils_conn_t *conn);
 
 #endif /* _ACCEPT_H_ */
@@ -0,0 +1,161 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/access_log.h
+ *
+ * @brief Binary access log, one memory mapped segment per worker
+ *
+ * A segment is a tils_access_hdr_t followed by fixed size records, and is
+ * allocated up front at its full size. Records are stored straight into the
+ * mapping, so logging a request costs no system call and no formatting.
+ * Creating, mapping & trimming segments is left to a helper thread.
+ * Unused space is zero, so readers stop at the first record with no time.
+ * `tils-logcat' turns segments into text or JSON.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_ACCESS_LOG_H_
+#define _TILS_ACCESS_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tils/io_util.h>
+
+#define TILS_ACCESS_MAGIC "TILSACC1"
+#define TILS_ACCESS_VERSION (2)
+
+/* Default size a segment is rotated at */
+#define TILS_ACCESS_SEGMENT_SIZE (64 << 20)
+
+/* The body was gzipped as it was sent, only the headers are counted */
+#define TILS_ACCESS_CHUNKED (1 << 0)
+
+/* Route of requests that matched none */
+#define TILS_ACCESS_NO_ROUTE (-1)
+
+/**
+ * @brief Start of every segment
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+
+    /* sizeof(tils_access_rec_t) when the segment was written */
+    uint32_t record_size;
+
+    /* Writing process & worker */
+    uint32_t pid;
+    uint32_t worker;
+
+    /* Wall clock time the segment was opened */
+    int64_t created_ns;
+
+    uint8_t reserved[32];
+} tils_access_hdr_t;
+
+/**
+ * @brief One request, a cache line long
+ */
+typedef struct {
+    /* Wall clock time the response was started, 0 past the last record */
+    int64_t time_ns;
+
+    /* Response length, headers included */
+    uint64_t bytes;
+
+    /* Time spent parsing the request, and building & first writing the
+     * response */
+    uint64_t parse_ns;
+    uint64_t serve_ns;
+
+    tils_addr_t addr;
+
+    /* HTTP status code */
+    uint16_t status;
+
+    /* tils_route_t.id, TILS_ACCESS_NO_ROUTE if none matched */
+    int32_t route;
+
+    /* tils_http_request_e */
+    uint8_t method;
+
+    /* TILS_ACCESS_* */
+    uint8_t flags;
+
+    uint8_t reserved[2];
+} tils_access_rec_t;
+
+/**
+ * @brief A mapped segment
+ */
+typedef struct {
+    char *map;
+
+    /* Bytes of map written, and its full size */
+    size_t used;
+    size_t size;
+
+    int fd;
+
+    /* Number in the segment's file name */
+    int seq;
+} tils_access_seg_t;
+
+/**
+ * @brief A worker's log
+ *
+ * Only `cur' belongs to the worker. The next segment is created, and the
+ * last one trimmed, by a helper thread so rotating is a swap; both are
+ * handed over under a lock.
+ */
+typedef struct tils_access_log {
+    /* Segment records are written to */
+    tils_access_seg_t cur;
+
+    /* Ready to take over from cur, map is NULL until it is */
+    tils_access_seg_t spare;
+
+    /* Full segment waiting to be trimmed & closed, map NULL if none */
+    tils_access_seg_t full;
+
+    /* Nonzero while the helper should create a spare, or works on this
+     * log */
+    int want_spare;
+    int busy;
+
+    /* Nonzero once a spare was asked for, only read by the worker */
+    int asked;
+
+    /* Records dropped while no spare was ready */
+    unsigned long dropped;
+
+    int worker;
+
+    /* Next log the helper looks after */
+    struct tils_access_log *next;
+} tils_access_log_t;
+
+int tils_access_log_config(char *dir, size_t segment_size);
+int tils_access_log_open(tils_access_log_t **log, int worker);
+void tils_access_log_close(tils_access_log_t *log);
+void tils_access_log_append(tils_access_log_t *log, tils_access_rec_t *rec);
+int64_t tils_access_clock();
+
+#endif /* _TILS_ACCESS_LOG_H_ */
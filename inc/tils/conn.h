@@ -26,10 +26,23 @@
 #ifndef _TILS_CONN_H_
 #define _TILS_CONN_H_
 
-#include <arpa/inet.h>
+#include <stdint.h>
+
+#include <lib/pool.h>
+#include <tils/io_util.h>
+#include <tils/out.h>
 
 #define TTL (60)
 
+/* How long a closing connection waits for the client to close its side */
+#define LINGER_TTL (2)
+
+/* Most bytes a lingering connection drops per wakeup */
+#define LINGER_READ_MAX (1 << 16)
+
+/* Default number of requests served per connection */
+#define MAX_REQUESTS (1000)
+
 #define TILS_CONN_BUF_ELEM_AT(i, s) ((i) % (s))
 #define TILS_CONN_BUF_ELEM_NEXT(c, s) (TILS_CONN_BUF_ELEM_AT((c) + 1, (s)))
 
@@ -43,30 +56,144 @@ typedef enum tils_conn_state_e {
     /* Connection should be closed and marked as clean afterwards */
     CONN_DEAD,
 
+    /* Last response is out and our side is shut down. Whatever the client
+     * still sends is read & dropped until it closes its side too, so it
+     * isn't reset before it has read the response. */
+    CONN_LINGER,
+
     /* Not a connection */
     CONN_NONE
 } tils_conn_state;
 
+/* Why a connection was closed, see the conn-close probe */
+typedef enum tils_conn_close_reason_e {
+    /* Idle for too long. Expiry only touches the hot arrays, so this is also
+     * what a reason that was never set means. */
+    CLOSE_TIMEOUT = 0,
+
+    /* The client hung up */
+    CLOSE_PEER,
+
+    /* The last response was sent, and the client closed its side after */
+    CLOSE_DONE,
+
+    /* The request couldn't be parsed, or its headers didn't fit */
+    CLOSE_PROTOCOL,
+
+    /* A socket error, or no memory for the connection's buffers */
+    CLOSE_ERROR,
+
+    /* The slot was taken by a new client while the buffer was full */
+    CLOSE_EVICTED,
+
+    /* The worker retired */
+    CLOSE_RETIRED
+} tils_conn_close_reason;
+
 /**
- * @brief A single connection handled by a single thread
+ * @brief The cold part of a connection: only touched while it does I/O
+ *
+ * An idle keep-alive connection holds no buffers: they are attached from
+ * the worker's pool while a request is being read or a response sent, and
+ * given back as soon as they're empty. The fields every pass over the
+ * connections reads (fd, state, last activity) live in dense arrays of the
+ * `tils_conn_buf_t' instead, indexed by the same slot.
  */
 typedef struct tils_conn {
-    /* Last alive time (used for keepalive). */
-    double last_alive;
+    /* Bytes received but not yet consumed by a request, from the worker's
+     * pool. NULL whenever nothing is buffered. */
+    char *rbuf;
 
-    /* fd corresponding to socket client is on. */
+    /* Rest of a response the socket couldn't take yet, in a buffer from the
+     * worker's pool. NULL when everything has been sent. */
+    tils_out_t *out;
+
+    /* fd corresponding to socket client is on, the same as in the
+     * buffer's fd array. */
     int client_fd;
 
-    /* ipv4 address of client - used for logging purposes. */
-    char addr_buf[INET_ADDRSTRLEN];
+    /* Number of bytes in rbuf */
+    int rbuf_len;
+
+    /* Size of rbuf */
+    int rbuf_cap;
+
+    /* Size of out's buffer */
+    int out_cap;
+
+    /* Requests answered so far */
+    int requests;
 
-    /* Connection can be marked as dead and cleaned up lazily using this flag.
-     */
-    tils_conn_state state;
+    /* Nonzero once the response being sent is the last one */
+    uint8_t closing;
+
+    /* tils_conn_close_reason, once the connection is dead */
+    uint8_t close_reason;
+
+    /* Address of client - only formatted when it's logged. */
+    tils_addr_t addr;
 } tils_conn_t;
 
-void tils_conn_revitalize(tils_conn_t *conn);
-int tils_conn_check_alive(tils_conn_t *conn);
-tils_conn_state tils_conn_close(tils_conn_t *conn);
+/**
+ * @brief Ring of connections owned by a single worker thread
+ *
+ * Stored as parallel arrays, one entry per slot: the hot ones are scanned
+ * on every pass of the event loop, so timeouts & fd_set building stay within
+ * a few cache lines for thousands of connections, and only connections with
+ * something to do touch their `tils_conn_t'.
+ */
+typedef struct tils_conn_buf {
+    /* Client socket of every slot, -1 if clean. */
+    int *fds;
+
+    /* tils_conn_state of every slot. */
+    uint8_t *states;
+
+    /* Nonzero while a slot has a response pending, i.e. waits to write
+     * rather than to read. */
+    uint8_t *pending;
+
+    /* Last time every slot was heard from, in seconds of `tils_conn_clock'
+     * (used for keepalive). */
+    uint32_t *last_alive;
+
+    /* Everything else about every slot. */
+    tils_conn_t *conns;
+
+    /* Max number of connections held. */
+    int capacity;
+
+    /* One past the highest slot ever used - bounds iteration. */
+    int size;
+
+    /* Slot of the most recently pushed connection. */
+    int cur;
+
+    /* Pool connection buffers are returned to. */
+    pool_t *pool;
+} tils_conn_buf_t;
+
+uint32_t tils_conn_clock();
+void tils_conn_max_requests(int max);
+int tils_conn_count_request(tils_conn_t *conn);
+
+tils_conn_state tils_conn_get_state(tils_conn_buf_t *buf, tils_conn_t *conn);
+void tils_conn_kill(tils_conn_buf_t *buf, tils_conn_t *conn,
+        tils_conn_close_reason reason);
+void tils_conn_revitalize(tils_conn_buf_t *buf, tils_conn_t *conn);
+void tils_conn_hold(tils_conn_buf_t *buf, tils_conn_t *conn, tils_out_t *out,
+        int cap);
+void tils_conn_release_out(tils_conn_buf_t *buf, tils_conn_t *conn);
+void tils_conn_shutdown(tils_conn_buf_t *buf, tils_conn_t *conn);
+void tils_conn_linger(tils_conn_buf_t *buf, tils_conn_t *conn);
+tils_conn_state tils_conn_close(tils_conn_buf_t *buf, tils_conn_t *conn);
+
+int tils_conn_buf_init(tils_conn_buf_t **buf, int capacity, pool_t *pool);
+int tils_conn_buf_size(tils_conn_buf_t *buf);
+void tils_conn_buf_at(tils_conn_buf_t *buf, int i, tils_conn_t **conn);
+void tils_conn_buf_expire(tils_conn_buf_t *buf, uint32_t now);
+tils_conn_t *tils_conn_buf_push(tils_conn_buf_t *buf, int client_fd,
+        tils_addr_t *addr);
+void tils_conn_buf_free(tils_conn_buf_t *buf);
 
 #endif /* _TILS_CONN_H_ */
@@ -0,0 +1,105 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/deflate.h
+ *
+ * @brief Streaming gzip of files too large to keep compressed copies of
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_DEFLATE_H_
+#define _TILS_DEFLATE_H_
+
+#include <sys/types.h>
+
+#include <zlib.h>
+
+#include <lib/pool.h>
+
+/* Input read from the file per deflate call */
+#define TILS_DEFLATE_IN (1 << 14)
+
+/* Compressed bytes per chunk */
+#define TILS_DEFLATE_OUT (1 << 14)
+
+/* Most input compressed into one chunk, bounding the time a chunk takes */
+#define TILS_DEFLATE_FILL_MAX (1 << 18)
+
+/* Idle compressor contexts a worker holds on to */
+#define TILS_ZPOOL_MAX (16)
+
+/**
+ * @brief A compressor, reused across responses
+ */
+typedef struct tils_zctx {
+    z_stream zs;
+
+    /* Level zs was last set to */
+    int level;
+} tils_zctx_t;
+
+/**
+ * @brief A worker's idle compressors. Not thread safe.
+ */
+typedef struct tils_zpool {
+    tils_zctx_t *idle[TILS_ZPOOL_MAX];
+    int idle_count;
+} tils_zpool_t;
+
+/**
+ * @brief A file range being gzipped into chunked transfer coding
+ */
+typedef struct tils_deflate {
+    tils_zpool_t *zpool;
+    pool_t *pool;
+    tils_zctx_t *ctx;
+
+    /* Size of this struct's buffer, for `pool_put' */
+    int cap;
+
+    /* The file, owned by the stream, and what's left to read of it */
+    int file_fd;
+    off_t file_off;
+    size_t file_left;
+
+    /* Set once the compressor has been fed all of the input */
+    int eof;
+
+    /* Set once the last chunk has been produced */
+    int done;
+
+    /* Bytes of the current chunk still to be sent */
+    char *send;
+    size_t send_len;
+
+    char in[TILS_DEFLATE_IN];
+
+    /* Room for the chunk size line, data, CRLF and the last chunk */
+    char out[16 + TILS_DEFLATE_OUT + 2 + 5];
+} tils_deflate_t;
+
+tils_zpool_t *tils_zpool_new();
+void tils_zpool_free(tils_zpool_t *zp);
+
+tils_deflate_t *tils_deflate_new(tils_zpool_t *zp, pool_t *pool,
+        int file_fd, off_t off, size_t len, int level);
+int tils_deflate_fill(tils_deflate_t *d);
+void tils_deflate_free(tils_deflate_t *d);
+
+#endif /* _TILS_DEFLATE_H_ */
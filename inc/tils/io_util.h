@@ -23,7 +23,42 @@
  * @author Lars Wander (lars.wander@gmail.com)
  */
 
+#ifndef _IO_UTIL_H_
+#define _IO_UTIL_H_
+
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/* Long enough for any printable IPv4/IPv6 address, and for "unix" */
+#define TILS_ADDRSTRLEN INET6_ADDRSTRLEN
+
+/**
+ * @brief A client address, packed
+ */
+typedef struct {
+    /* IPv4 addresses use the first 4 bytes, network byte order */
+    uint8_t addr[16];
+
+    /* Network byte order */
+    uint16_t port;
+
+    /* AF_INET, AF_INET6 or AF_UNIX */
+    uint8_t family;
+} tils_addr_t;
+
+void tils_addr_pack(struct sockaddr_storage *addr, tils_addr_t *res);
+int tils_addr_format(const tils_addr_t *addr, char *buf, int buf_len);
 int tils_socket_keepalive(int sock);
+int tils_socket_reuseaddr(int sock);
+int tils_socket_nodelay(int sock);
+int tils_socket_quickack(int sock);
+int tils_socket_defer_accept(int sock, int seconds);
+int tils_socket_fastopen(int sock, int qlen);
+int tils_socket_bufsize(int sock, int sndbuf, int rcvbuf);
 int tils_fd_nonblocking(int fd);
 int tils_fd_blocking(int fd);
-int tils_fd_size(int fd);
+off_t tils_fd_size(int fd);
+
+#endif /* _IO_UTIL_H_ */
@@ -0,0 +1,47 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/mime.h
+ *
+ * @brief MIME type registry, keyed by file extension
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_MIME_H_
+#define _TILS_MIME_H_
+
+/**
+ * @brief A content type
+ */
+typedef struct tils_mime {
+    /* Content-Type header value */
+    char *type;
+    int type_len;
+
+    /* Nonzero if the type is worth compressing (text, not e.g. PNG) */
+    int compressible;
+} tils_mime_t;
+
+int tils_mime_init();
+int tils_mime_load(char *path);
+int tils_mime_build();
+const tils_mime_t *tils_mime_lookup(const char *path);
+void tils_mime_cleanup();
+
+#endif /* _TILS_MIME_H_ */
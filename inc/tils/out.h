@@ -0,0 +1,120 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/out.h
+ *
+ * @brief Output chains - responses assembled from segments without copying
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_OUT_H_
+#define _TILS_OUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <lib/arena.h>
+#include <lib/blob.h>
+#include <lib/pool.h>
+#include <tils/deflate.h>
+
+/* Most segments handed to a single writev */
+#define TILS_OUT_IOV_MAX (16)
+
+typedef enum tils_out_kind_e {
+    /* Bytes in the worker's arena, copied if the chain outlives it */
+    OUT_BYTES = 0,
+
+    /* Bytes that outlive any chain (e.g. string constants) */
+    OUT_CONST,
+
+    /* A slice of a shared blob, the segment holds a reference */
+    OUT_BLOB,
+
+    /* A range of a file, sent with sendfile. The segment owns the fd */
+    OUT_FILE,
+
+    /* A file range gzipped as it is sent, in chunked transfer coding. The
+     * segment owns the stream, its length is unknown */
+    OUT_DEFLATE
+} tils_out_kind;
+
+/**
+ * @brief One piece of a response
+ */
+typedef struct tils_out_seg {
+    struct tils_out_seg *next;
+
+    tils_out_kind kind;
+
+    /* Next byte to send, for every kind but OUT_FILE */
+    const char *data;
+
+    /* Held reference, OUT_BLOB only */
+    blob_t *blob;
+
+    /* File & offset of the next byte to send, OUT_FILE only */
+    int file_fd;
+    off_t file_off;
+
+    /* OUT_DEFLATE only */
+    tils_deflate_t *deflate;
+
+    /* Bytes left to send, 0 for OUT_DEFLATE */
+    size_t len;
+} tils_out_seg_t;
+
+/**
+ * @brief A response waiting to be written to a client
+ */
+typedef struct tils_out {
+    tils_out_seg_t *head;
+    tils_out_seg_t *tail;
+
+    /* Where segments are allocated from while the chain is built */
+    arena_t *arena;
+
+    /* Number of segments left */
+    int seg_count;
+
+    /* Bytes left to send, not counting OUT_DEFLATE segments */
+    size_t len;
+
+    /* HTTP status code, once a status line has been added */
+    int status;
+
+    /* Monotonic time of the first write, only kept for tracing */
+    int64_t sent_ns;
+
+    /* Bytes left when first written, reported once all are sent */
+    size_t total;
+} tils_out_t;
+
+tils_out_t *tils_out_new(arena_t *arena);
+int tils_out_bytes(tils_out_t *out, const char *data, size_t len);
+int tils_out_const(tils_out_t *out, const char *data, size_t len);
+int tils_out_blob(tils_out_t *out, blob_t *blob, size_t off, size_t len);
+int tils_out_file(tils_out_t *out, int file_fd, off_t off, size_t len);
+int tils_out_deflate(tils_out_t *out, tils_deflate_t *deflate);
+int tils_out_flush(tils_out_t *out, int fd);
+tils_out_t *tils_out_detach(tils_out_t *out, pool_t *pool, int *cap);
+void tils_out_release(tils_out_t *out);
+
+#endif /* _TILS_OUT_H_ */
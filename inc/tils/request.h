@@ -26,8 +26,15 @@
 #ifndef _REQUEST_H_
 #define _REQUEST_H_
 
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <lib/arena.h>
 #include <tils/conn.h>
 
+/* Headers past this many are ignored */
+#define MAX_HEADERS (32)
+
 typedef enum {
     TILS_GET,
     TILS_POST,
@@ -40,12 +47,63 @@ typedef enum {
     TILS_UNKNOWN
 } tils_http_request_e;
 
+/* Requests for more byte ranges than this get the whole body */
+#define TILS_RANGE_MAX (16)
+
+/* Content codings a response may be sent in */
+typedef enum {
+    TILS_ENC_IDENTITY = 0,
+    TILS_ENC_GZIP,
+    TILS_ENC_BR,
+    TILS_ENC_COUNT
+} tils_http_encoding_e;
+
+typedef struct {
+    char *name;
+    char *value;
+} tils_http_header_t;
+
+/**
+ * @brief A byte range of a body, both ends inclusive
+ */
+typedef struct {
+    off_t first;
+    off_t last;
+} tils_http_range_t;
+
+/**
+ * @brief A parsed request. Everything it points to lives in the worker's
+ *        arena, and is gone once the response is complete.
+ */
 typedef struct {
     tils_http_request_e request_type;
     char *resource;
+
+    /* x in HTTP/1.x */
+    int minor_version;
+
+    /* Length of the body following the headers (Content-Length) */
+    long body_len;
+
+    /* Nonzero if the client wants the connection kept open: the default in
+     * HTTP/1.1 unless it sent "Connection: close", only if it sent
+     * "Connection: keep-alive" in HTTP/1.0 */
+    int keep_alive;
+
+    tils_http_header_t *headers;
+    int header_count;
+
+    /* Time spent parsing, only measured for the access log */
+    uint64_t parse_ns;
 } tils_http_request_t;
 
-tils_http_request_t *tils_parse_request(char *request, int request_len);
-void tils_free_request(tils_http_request_t *request);
+int tils_request_length(char *request, int request_len);
+tils_http_request_t *tils_parse_request(arena_t *arena, char *request,
+        int request_len);
+char *tils_request_header(tils_http_request_t *request, char *name);
+const char *tils_request_method_name(tils_http_request_e type);
+int tils_request_encodings(tils_http_request_t *request);
+int tils_request_ranges(char *value, off_t size, tils_http_range_t *ranges,
+        int max);
 
 #endif /* _REQUEST_H_ */
@@ -0,0 +1,93 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/response.h
+ *
+ * @brief Response header builder
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_RESPONSE_H_
+#define _TILS_RESPONSE_H_
+
+#include <time.h>
+
+#include <lib/arena.h>
+#include <tils/out.h>
+#include <tils/request.h>
+
+#define SERVER_STRING "Server: lwander-tils/0.0.1\r\n"
+
+/* Largest header block a response may have */
+#define TILS_HDR_BUF_SIZE (1 << 10)
+
+/* "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define TILS_HTTP_DATE_LEN (29)
+
+/* Enough for any unsigned long in decimal */
+#define TILS_UTOA_LEN (20)
+
+typedef enum {
+    TILS_STATUS_200 = 0,
+    TILS_STATUS_206,
+    TILS_STATUS_304,
+    TILS_STATUS_404,
+    TILS_STATUS_416,
+    TILS_STATUS_501,
+    TILS_STATUS_COUNT
+} tils_http_status_e;
+
+/**
+ * @brief A header block being built in the worker's arena
+ */
+typedef struct {
+    char *buf;
+    int len;
+    int cap;
+
+    /* Set once something didn't fit, the block is then unusable */
+    int overflow;
+
+    /* Status code of the block's status line, 0 if it has none */
+    int status;
+} tils_hdr_t;
+
+/* Append a string literal, its length is known at compile time */
+#define TILS_HDR_LIT(h, s) tils_hdr_append((h), (s), sizeof(s) - 1)
+
+int tils_utoa(char *buf, unsigned long v);
+void tils_http_date(time_t t, char *buf);
+int tils_parse_http_date(const char *s, time_t *t);
+
+int tils_status_code(tils_http_status_e status);
+int tils_hdr_open(tils_hdr_t *h, arena_t *arena, int cap);
+int tils_hdr_begin(tils_hdr_t *h, arena_t *arena, tils_http_status_e status);
+void tils_hdr_append(tils_hdr_t *h, const char *frag, int len);
+void tils_hdr_num(tils_hdr_t *h, unsigned long v);
+void tils_hdr_content_length(tils_hdr_t *h, unsigned long len);
+void tils_hdr_connection(tils_hdr_t *h, int keep_alive);
+void tils_hdr_content_range(tils_hdr_t *h, const tils_http_range_t *range,
+        off_t size);
+int tils_hdr_end(tils_hdr_t *h, tils_out_t *out);
+
+int tils_response_const(arena_t *arena, tils_out_t *out,
+        tils_http_status_e status, int keep_alive, const char *rest,
+        int rest_len);
+
+#endif /* _TILS_RESPONSE_H_ */
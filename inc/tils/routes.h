@@ -26,9 +26,68 @@
 #ifndef _ROUTES_H_
 #define _ROUTES_H_
 
+#include <sys/types.h>
+#include <time.h>
+
+#include <lib/blob.h>
+#include <tils/mime.h>
+#include <tils/request.h>
+
+/* Longest entity tag, e.g. W/"<inode>-<mtime>-<size>-gz" */
+#define TILS_ROUTE_ETAG_LEN (64)
+
+/**
+ * @brief What is served for a resource
+ */
+typedef struct tils_route {
+    /* File being served */
+    char *path;
+
+    /* Index of the route's source, see `tils_route_source' */
+    int id;
+
+    /* Its type, resolved from the extension when the route was added */
+    const tils_mime_t *mime;
+
+    /* Contents of path in every coding, loaded (or compressed) when the
+     * route was added. The identity body is NULL if the file is too large to
+     * keep in memory - it is read from disk instead. Compressed bodies are
+     * NULL if they aren't any smaller. */
+    blob_t *body[TILS_ENC_COUNT];
+
+    /* Nonzero if a compressed body exists, so the response depends on
+     * Accept-Encoding */
+    int vary;
+
+    /* Modification time of path when the route was added, 0 if unknown */
+    time_t mtime;
+
+    /* Inode & size of path then. A file read from disk on every request is
+     * only still described by the validators below while all three match */
+    ino_t ino;
+    off_t size;
+
+    /* Entity tag of every coding, quotes included, empty if unknown */
+    char etag[TILS_ENC_COUNT][TILS_ROUTE_ETAG_LEN];
+
+    /* Validator & caching headers of every coding (ETag, Last-Modified,
+     * Cache-Control, Vary), ending in the blank line that closes a header
+     * block. A 304 is just these after the Date header. */
+    char *meta[TILS_ENC_COUNT];
+    int meta_len[TILS_ENC_COUNT];
+
+    /* The same less the validators, sent once the file read from disk has
+     * changed since the route was added */
+    char *bare;
+    int bare_len;
+} tils_route_t;
+
 int tils_routes_init();
 void tils_routes_cleanup();
-int tils_route_add(char *source, char *dest);
-int tils_route_lookup(char *source, char **dest);
+void tils_routes_cache_control(char *policy);
+int tils_route_add(char *source, char *dest, char *cache_control);
+int tils_route_lookup(char *source, tils_route_t **route);
+int tils_route_count();
+const char *tils_route_source(int id);
 
 #endif /* _ROUTES_H_ */
@@ -26,8 +26,6 @@
 #ifndef _SERVE_H_
 #define _SERVE_H_
 
-#define SERVER_STRING "Server: lwander-tils/0.0.1\r\n"
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -37,12 +35,10 @@
 
 #include <lib/util.h>
 #include <tils/request.h>
+#include <tils/worker_thread.h>
 
-#define HTML "text/html; charset=utf8"
-#define CSS "text/css"
-#define JS "application/javascript"
-#define TEXT "text"
-
-void tils_serve_resource(tils_conn_t *conn, tils_http_request_t *http_request);
+void tils_serve_resource(tils_wt_t *self, tils_conn_t *conn,
+        tils_http_request_t *http_request);
+int tils_serve_pending(tils_wt_t *self, tils_conn_t *conn);
 
 #endif /* _SERVE_H_ */
@@ -0,0 +1,104 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/stall.h
+ *
+ * @brief Event loop stall detection
+ *
+ * Every handler a worker runs is timed, and so is the busy part of every
+ * loop iteration. An iteration over the threshold is logged along with its
+ * slowest handler (phase, connection & route), and counted in a small table
+ * of the worst offenders that the stats page shows.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_STALL_H_
+#define _TILS_STALL_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <tils/conn.h>
+#include <tils/io_util.h>
+
+/* Offenders kept per worker */
+#define TILS_STALL_TOP (8)
+
+/**
+ * @brief What a worker was doing
+ */
+typedef enum {
+    /* Expiring & closing connections before select */
+    TILS_PHASE_CLEANUP = 0,
+    TILS_PHASE_ACCEPT,
+    TILS_PHASE_INBOX,
+    /* Reading and serving requests */
+    TILS_PHASE_READ,
+    /* Sending the rest of a pending response */
+    TILS_PHASE_WRITE,
+    TILS_PHASE_LINGER,
+    TILS_PHASE_COUNT
+} tils_phase_e;
+
+/**
+ * @brief Stalls with the same phase & route. Written only by the owning
+ *        worker, read by the stats page.
+ */
+typedef struct {
+    atomic_int phase;
+    atomic_int route;
+    atomic_ulong count;
+    atomic_ulong total_ns;
+    atomic_ulong max_ns;
+} tils_stall_entry_t;
+
+/**
+ * @brief A worker's stall detector
+ */
+typedef struct {
+    /* Slowest handler of the current iteration */
+    int64_t worst_ns;
+    tils_phase_e worst_phase;
+    int worst_fd;
+    int worst_route;
+    tils_addr_t worst_addr;
+
+    /* Request being served by the current handler, see
+     * `tils_stall_serving' */
+    int fd;
+    int route;
+    tils_addr_t addr;
+
+    /* Iterations over the threshold */
+    atomic_ulong stalls;
+
+    /* Entries with a count of 0 are unused */
+    tils_stall_entry_t top[TILS_STALL_TOP];
+} tils_stall_t;
+
+void tils_stall_threshold(int ms);
+void tils_stall_init(tils_stall_t *s);
+void tils_stall_begin(tils_stall_t *s);
+void tils_stall_serving(tils_stall_t *s, tils_conn_t *conn, int route);
+void tils_stall_handler(tils_stall_t *s, tils_phase_e phase,
+        tils_conn_t *conn, int64_t ns);
+void tils_stall_end(tils_stall_t *s, int worker, int64_t ns);
+const char *tils_stall_phase_name(tils_phase_e phase);
+
+#endif /* _TILS_STALL_H_ */
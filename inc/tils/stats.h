@@ -0,0 +1,118 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/stats.h
+ *
+ * @brief Per-worker counters, served in Prometheus' text format
+ *
+ * Each worker only ever writes its own counters, so they are bumped with a
+ * relaxed load & store instead of an atomic add. Whoever serves the stats
+ * page reads every worker's counters the same way, without stopping them.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_STATS_H_
+#define _TILS_STATS_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <lib/arena.h>
+#include <lib/util.h>
+#include <tils/request.h>
+#include <tils/response.h>
+#include <tils/tcp_info.h>
+
+/* Reserved resource the stats are served at, once enabled */
+#define TILS_STATS_PATH "/_tils/stats"
+
+/* Request latency buckets, the last one is +Inf */
+#define TILS_STATS_LATENCY_BUCKETS (18)
+
+/* Buckets of small counts (segments, queued connections): 0, then powers of
+ * 2 up to 1024, then +Inf */
+#define TILS_STATS_COUNT_BUCKETS (13)
+
+/* Delivery rate buckets, bytes per second: powers of 10 from 100k to 10G,
+ * then +Inf */
+#define TILS_STATS_RATE_BUCKETS (7)
+
+/* Add to a counter only its owning worker writes */
+#define TILS_STAT_ADD(counter, n) \
+    atomic_store_explicit(&(counter), \
+            atomic_load_explicit(&(counter), memory_order_relaxed) + (n), \
+            memory_order_relaxed)
+
+#define TILS_STAT_SET(counter, v) \
+    atomic_store_explicit(&(counter), (v), memory_order_relaxed)
+
+/**
+ * @brief What a worker has done since it was first started
+ */
+typedef struct {
+    atomic_ulong accepts;
+
+    /* Open connections as of the worker's last loop iteration */
+    atomic_ulong active;
+
+    atomic_ulong requests[TILS_UNKNOWN + 1][TILS_STATUS_COUNT];
+
+    /* Bytes of responses, headers included. Bodies gzipped as they're sent
+     * only count their headers. */
+    atomic_ulong bytes_out;
+
+    /* Files served from memory, and from disk */
+    atomic_ulong cache_hits;
+    atomic_ulong cache_misses;
+
+    atomic_ulong iterations;
+
+    /* Time from a request being parsed to its response first being
+     * written, counts per bucket (not cumulative) */
+    atomic_ulong latency[TILS_STATS_LATENCY_BUCKETS];
+    atomic_ulong latency_ns;
+
+    /* TCP_INFO of the connections sampled as they closed, see
+     * inc/tils/tcp_info.h */
+    atomic_ulong tcp_samples;
+    atomic_ulong tcp_rtt[TILS_STATS_LATENCY_BUCKETS];
+    atomic_ulong tcp_rtt_ns;
+    atomic_ulong tcp_retrans;
+    atomic_ulong tcp_cwnd[TILS_STATS_COUNT_BUCKETS];
+    atomic_ulong tcp_cwnd_sum;
+    atomic_ulong tcp_unacked[TILS_STATS_COUNT_BUCKETS];
+    atomic_ulong tcp_unacked_sum;
+    atomic_ulong tcp_delivery_rate[TILS_STATS_RATE_BUCKETS];
+    atomic_ulong tcp_delivery_rate_sum;
+
+    /* Accept queue length of the listeners, sampled while accepting */
+    atomic_ulong accept_queue[TILS_STATS_COUNT_BUCKETS];
+    atomic_ulong accept_queue_sum;
+    atomic_ulong accept_queue_limit;
+} tils_stats_t;
+
+void tils_stats_enable();
+int tils_stats_enabled();
+void tils_stats_request(tils_stats_t *stats, tils_http_request_e method,
+        int status, size_t bytes, int64_t ns);
+void tils_stats_tcp(tils_stats_t *stats, tils_tcp_sample_t *sample);
+void tils_stats_accept_queue(tils_stats_t *stats, int len, int limit);
+int tils_stats_render(arena_t *arena, char **body);
+
+#endif /* _TILS_STATS_H_ */
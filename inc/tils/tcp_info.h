@@ -0,0 +1,61 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/tcp_info.h
+ *
+ * @brief Sampling the kernel's TCP_INFO of clients & listeners
+ *
+ * Enabled with a rate: 1 in every N connections is sampled as it closes,
+ * and the listener's accept queue once every N accepts. Samples feed the
+ * stats page, so server side latency can be told apart from the network's.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_TCP_INFO_H_
+#define _TILS_TCP_INFO_H_
+
+#include <stdint.h>
+
+/**
+ * @brief What's kept of a connection's TCP_INFO
+ */
+typedef struct {
+    /* Smoothed round trip time */
+    uint32_t rtt_us;
+
+    /* Segments retransmitted over the connection's lifetime */
+    uint32_t retrans;
+
+    /* Congestion window, in segments */
+    uint32_t cwnd;
+
+    /* Segments sent but not yet acknowledged */
+    uint32_t unacked;
+
+    /* Most recent delivery rate in bytes per second, 0 if the kernel
+     * doesn't report it */
+    uint64_t delivery_rate;
+} tils_tcp_sample_t;
+
+void tils_tcp_sampling(int every);
+int tils_tcp_sampling_rate();
+int tils_tcp_sample(int fd, tils_tcp_sample_t *res);
+int tils_tcp_accept_queue(int fd, int *len, int *limit);
+
+#endif /* _TILS_TCP_INFO_H_ */
@@ -18,7 +18,43 @@
 #ifndef _LW_HTTP_H_
 #define _LW_HTTP_H_
 
-int init_server(int port);
+/* Listener addresses starting with this are unix domain socket paths */
+#define UNIX_PREFIX "unix:"
+
+/* Max number of listeners the workers accept on */
+#define MAX_LISTENERS (16)
+
+/* Used when /proc/sys/net/core/somaxconn can't be read */
+#define DEFAULT_BACKLOG (128)
+
+/**
+ * @brief Tuning applied to the listening socket and the sockets it accepts.
+ */
+typedef struct {
+    /* Length of the accept queue handed to `listen'. */
+    int backlog;
+
+    /* Seconds to wait for data before waking a worker on a new connection
+     * (TCP_DEFER_ACCEPT). 0 disables. */
+    int defer_accept;
+
+    /* Max pending TCP fast open requests. 0 disables. */
+    int fastopen;
+
+    /* Set TCP_NODELAY on accepted sockets. */
+    int nodelay;
+
+    /* Set TCP_QUICKACK on accepted sockets. */
+    int quickack;
+
+    /* SO_SNDBUF/SO_RCVBUF in bytes. 0 leaves the kernel default. */
+    int sndbuf;
+    int rcvbuf;
+} tils_listen_opts_t;
+
+void tils_listen_opts_default(tils_listen_opts_t *opts);
+int init_server(char *spec, tils_listen_opts_t *opts);
+int tils_tune_client(int client_fd, int family);
 int get_open_fd_limit();
 
 #endif /* _LW_HTTP_H_ */
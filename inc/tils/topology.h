@@ -0,0 +1,52 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/topology.h
+ *
+ * @brief CPU topology discovery, used to place worker threads.
+ *
+ * @author Lars Wander (lars.wander@gmail.com)
+ */
+
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+/**
+ * @brief A logical CPU a worker thread may be pinned to.
+ */
+typedef struct {
+    /* Logical CPU id, as used by sched_setaffinity */
+    int cpu;
+
+    /* Physical core id, unique within a package */
+    int core;
+
+    /* Socket the core sits in */
+    int package;
+
+    /* NUMA node owning the CPU's local memory, 0 if unknown */
+    int node;
+
+    /* 0 for the first hardware thread of a core, 1 for its SMT sibling... */
+    int smt_rank;
+} tils_cpu_t;
+
+int tils_topology_plan(int skip_smt, tils_cpu_t **cpus);
+int tils_topology_cpu_quota();
+
+#endif /* _TOPOLOGY_H_ */
@@ -0,0 +1,113 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file inc/tils/trace.h
+ *
+ * @brief Per-request spans, exported as Chrome trace events
+ *
+ * Each worker stamps the steps of the request it is serving into a record,
+ * and keeps finished records in a ring of its own. A ring is written out
+ * when it fills up, and by every worker after SIGUSR2. All workers append
+ * to a single file in the trace event JSON array format, which
+ * chrome://tracing and Perfetto load as is.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TILS_TRACE_H_
+#define _TILS_TRACE_H_
+
+#include <stdint.h>
+
+#include <lib/util.h>
+
+/* Records kept per worker between dumps */
+#define TILS_TRACE_RING (4096)
+
+/**
+ * @brief Steps of a request, stamped as they happen
+ */
+typedef enum {
+    /* The request was complete in the receive buffer */
+    TILS_TRACE_RECV = 0,
+    TILS_TRACE_PARSED,
+    /* The resource was found, and is being turned into a response */
+    TILS_TRACE_ROUTED,
+    /* The response is ready to be written */
+    TILS_TRACE_BUILT,
+    /* The first write returned */
+    TILS_TRACE_SENT,
+    /* The last byte was handed to the socket, 0 while some is pending */
+    TILS_TRACE_DONE,
+    TILS_TRACE_MARKS
+} tils_trace_mark_e;
+
+typedef enum {
+    TILS_TRACE_REQUEST = 0,
+
+    /* Spans other than requests only stamp their start as RECV, and their
+     * end as DONE */
+
+    /* Time in accept() */
+    TILS_TRACE_ACCEPT,
+
+    /* The rest of a response left pending, from the first write on */
+    TILS_TRACE_PENDING
+} tils_trace_kind_e;
+
+/**
+ * @brief One span, a cache line long
+ */
+typedef struct {
+    /* Monotonic nanoseconds, 0 for steps that didn't happen */
+    int64_t at[TILS_TRACE_MARKS];
+
+    /* Response length, headers included */
+    uint32_t bytes;
+
+    int32_t fd;
+
+    /* Route served, -1 if none */
+    int32_t route;
+
+    uint16_t status;
+    uint8_t kind;
+    uint8_t method;
+} tils_trace_rec_t;
+
+typedef struct tils_trace tils_trace_t;
+
+/* Stamp a step of the current request, if this worker traces */
+#define TILS_TRACE(trace, mark) do { \
+    if (UNLIKELY((trace) != NULL)) \
+        tils_trace_mark((trace), (mark)); \
+} while (0)
+
+int tils_trace_config(char *path);
+int tils_trace_open(tils_trace_t **trace, int worker);
+void tils_trace_close(tils_trace_t *trace);
+int64_t tils_trace_clock();
+void tils_trace_begin(tils_trace_t *trace);
+void tils_trace_mark(tils_trace_t *trace, tils_trace_mark_e mark);
+void tils_trace_request(tils_trace_t *trace, int fd, int route, int method,
+        int status, size_t bytes, int pending);
+void tils_trace_span(tils_trace_t *trace, tils_trace_kind_e kind, int fd,
+        int64_t start, int64_t end);
+void tils_trace_poll(tils_trace_t *trace);
+
+#endif /* _TILS_TRACE_H_ */
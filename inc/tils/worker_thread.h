@@ -26,10 +26,58 @@
 #ifndef _WORKER_THREAD_H_
 #define _WORKER_THREAD_H_
 
-#include <tils/conn.h>
 #include <pthread.h>
+#include <stdatomic.h>
+
+#include <lib/util.h>
+#include <lib/arena.h>
+#include <lib/pool.h>
+#include <tils/access_log.h>
+#include <tils/conn.h>
+#include <tils/deflate.h>
+#include <tils/stall.h>
+#include <tils/stats.h>
+#include <tils/trace.h>
+
+/* Upper bound on an explicitly requested worker count */
+#define MAX_THREADS (1024)
+
+/**
+ * @brief How many workers to run, and where.
+ */
+typedef struct {
+    /* Number of worker threads. 0 runs one per usable core, capped by the
+     * cgroup CPU quota. */
+    int thread_count;
+
+    /* Only use the first hardware thread of each physical core. */
+    int skip_smt;
+
+    /* Fewest workers kept running when idle. 0 disables scaling, all
+     * thread_count workers run all the time. */
+    int min_threads;
+
+    /* Utilization (% of time outside select) that starts another worker */
+    int scale_up;
+
+    /* Utilization below which workers are retired */
+    int scale_down;
+} tils_pool_opts_t;
+
+/* Lifecycle of a worker, see `_tils_supervise' */
+typedef enum {
+    /* No thread, not in the token ring */
+    WT_IDLE = 0,
+
+    /* Serving, and may be handed the token */
+    WT_ACTIVE,
+
+    /* Asked to retire, never handed the token again */
+    WT_DRAINING,
 
-#define THREAD_COUNT (1)
+    /* Thread has closed its connections and is exiting */
+    WT_RETIRED
+} tils_wt_state;
 
 /**
  * @brief Worker thread struct implementation.
@@ -44,23 +92,76 @@ typedef struct {
 
     /* List of managed connections */
     tils_conn_buf_t *conns;
+
+    /* Transient request & response data, reset after every response */
+    arena_t *arena;
+
+    /* Buffers that outlive a single request (e.g. partial reads) */
+    pool_t *pool;
+
+    /* Compressors for responses gzipped on the fly */
+    tils_zpool_t *zpool;
+
+    /* Where served requests are recorded, NULL if access logging is off */
+    tils_access_log_t *access;
+
+    /* Spans of the requests served, NULL if tracing is off */
+    tils_trace_t *trace;
+
+    /* Share (%) of the last LOAD_WINDOW_MS spent outside select. Only used
+     * by the thread itself. */
+    int load;
     
-    /* File descriptor to listen to new connections on */
-    int server_fd;
+    /* File descriptors to listen to new connections on, shared by all
+     * threads */
+    int *server_fds;
+
+    /* Number of entries in server_fds */
+    int server_fd_count;
+
+    /* Nonzero while this thread holds the leader token, and may accept */
+    int leader;
 
     /* Number of active connections */
     int size;
 
-    /* FD to listen for the leader token */
+    /* Read end of this thread's inbox, where the leader token arrives */
     int read_fd;
 
-    /* FD to pass the leader token to */
+    /* Write end of this thread's inbox */
     int write_fd;
 
+    /* tils_wt_state, written by the supervisor and the thread itself */
+    atomic_int state;
+
+    /* Time spent handling events, and blocked in select. Only written by the
+     * thread itself, read by the supervisor. */
+    atomic_long busy_ns;
+    atomic_long wait_ns;
+
+    /* Counters served on the stats page, only written by the thread
+     * itself */
+    tils_stats_t stats __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    /* Times handlers & iterations, its table is also on the stats page */
+    tils_stall_t stall;
+
+    /* Connections left to close until the next TCP_INFO sample */
+    int tcp_countdown;
+
     /* Readable ID */
     int id;
+
+    /* Logical CPU this thread is pinned to */
+    int cpu;
+
+    /* NUMA node of that CPU - the thread's allocations are local to it */
+    int node;
 } tils_wt_t;
 
-void tils_start_thread_pool(int server_fd);
+void tils_pool_opts_default(tils_pool_opts_t *opts);
+tils_wt_t *tils_workers(int *count);
+void tils_start_thread_pool(int *server_fds, int server_fd_count,
+        tils_pool_opts_t *opts);
 
 #endif /* _WORKER_THREAD_H_ */
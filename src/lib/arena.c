@@ -0,0 +1,156 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/arena.c
+ *
+ * @brief Bump pointer arena implementation
+ *
+ * The arena is a list of blocks. Allocation bumps an offset into the current
+ * block, moving on to the next block (or appending a new one) when it runs
+ * out. A reset only rewinds the offsets, so once the arena has grown to fit
+ * the largest burst it sees, it never calls malloc again.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <lib/arena.h>
+
+#include "arena_private.h"
+
+/**
+ * @brief Allocate a block with room for at least size bytes.
+ */
+arena_block_t *_arena_block_new(size_t size) {
+    arena_block_t *res = malloc(sizeof(arena_block_t) + size);
+    if (res == NULL)
+        return NULL;
+
+    res->next = NULL;
+    res->size = size;
+    res->used = 0;
+    return res;
+}
+
+/**
+ * @brief Allocate a fresh, empty arena
+ *
+ * @param block_size Size of each block the arena grows by
+ */
+arena_t *arena_new(size_t block_size) {
+    arena_t *res = calloc(sizeof(arena_t), 1);
+    if (res == NULL)
+        goto cleanup_none;
+
+    res->head = _arena_block_new(block_size);
+    if (res->head == NULL)
+        goto cleanup_res;
+
+    res->cur = res->head;
+    res->block_size = block_size;
+    return res;
+
+cleanup_res:
+    free(res);
+
+cleanup_none:
+    return NULL;
+}
+
+/**
+ * @brief Allocate memory that lives until the next reset
+ *
+ * @param a The arena being allocated from
+ * @param size Number of bytes needed
+ *
+ * @return The memory, NULL if it can't be allocated
+ */
+void *arena_alloc(arena_t *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    while (a->cur->used + size > a->cur->size) {
+        arena_block_t *next = a->cur->next;
+
+        /* Blocks kept from before the last reset are reused in order. A
+         * block too small for this allocation is skipped until the next
+         * reset. */
+        if (next == NULL) {
+            size_t block_size = size > a->block_size ? size : a->block_size;
+            if ((next = _arena_block_new(block_size)) == NULL)
+                return NULL;
+            a->cur->next = next;
+        }
+
+        next->used = 0;
+        a->cur = next;
+    }
+
+    void *res = a->cur->data + a->cur->used;
+    a->cur->used += size;
+    return res;
+}
+
+/**
+ * @brief Copy len bytes of s into the arena, NUL terminated
+ *
+ * @param a The arena being allocated from
+ * @param s The string being copied
+ * @param len The number of bytes copied
+ *
+ * @return The copy, NULL if it can't be allocated
+ */
+char *arena_strndup(arena_t *a, const char *s, size_t len) {
+    char *res = arena_alloc(a, len + 1);
+    if (res == NULL)
+        return NULL;
+
+    memcpy(res, s, len);
+    res[len] = '\0';
+    return res;
+}
+
+/**
+ * @brief Release everything allocated from the arena
+ *
+ * @param a The arena being reset
+ */
+void arena_reset(arena_t *a) {
+    a->head->used = 0;
+    a->cur = a->head;
+}
+
+/**
+ * @brief Free the arena and every block it holds
+ *
+ * @param a The arena being freed
+ */
+void arena_free(arena_t *a) {
+    if (a == NULL)
+        return;
+
+    arena_block_t *block = a->head;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(a);
+}
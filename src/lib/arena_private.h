@@ -0,0 +1,61 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/arena_private.h
+ *
+ * @brief Arena internals
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _ARENA_PRIVATE_H_
+#define _ARENA_PRIVATE_H_
+
+#include <stddef.h>
+
+/* Every allocation is aligned to this */
+#define ARENA_ALIGN (16)
+
+/**
+ * @brief A chunk of memory allocations are carved out of
+ */
+typedef struct arena_block {
+    /* Next block in the arena, kept across resets for reuse */
+    struct arena_block *next;
+
+    /* Bytes available in data */
+    size_t size;
+
+    /* Bytes handed out since the last reset */
+    size_t used;
+
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+} arena_block_t;
+
+typedef struct arena {
+    /* First block, where allocation restarts after a reset */
+    arena_block_t *head;
+
+    /* Block currently being allocated from */
+    arena_block_t *cur;
+
+    /* Size of freshly allocated blocks */
+    size_t block_size;
+} arena_t;
+
+#endif /* _ARENA_PRIVATE_H_ */
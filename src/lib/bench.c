@@ -0,0 +1,245 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/bench.c
+ *
+ * @brief Per-thread HDR histograms
+ *
+ * Values are bucketed log-linearly: exactly below BENCH_SUB_COUNT, then
+ * BENCH_SUB_COUNT buckets per power of 2, so every bucket is within
+ * 1 / BENCH_SUB_COUNT of the values in it whatever their magnitude.
+ *
+ * @author Lars Wander
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lib/bench.h>
+#include <lib/util.h>
+
+#include "bench_private.h"
+
+/* Every thread's histograms, newest first. Never freed, a thread's samples
+ * outlive it. */
+static _Atomic(bench_thread_t *) _threads = NULL;
+static _Thread_local bench_thread_t *_self = NULL;
+
+/* Nanoseconds per clock tick */
+static double _tick_ns = 1.0;
+
+/* Set by SIGUSR1, cleared by the thread printing the report */
+static atomic_int _report_pending = 0;
+
+/**
+ * @brief The bucket of a value.
+ */
+int _bench_bucket(uint64_t v) {
+    if (v < BENCH_SUB_COUNT)
+        return v;
+
+    int exp = 63 - __builtin_clzll(v);
+    if (exp > BENCH_MAX_EXP)
+        return BENCH_BUCKETS - 1;
+
+    /* The top BENCH_SUB_BITS + 1 bits, the first of which is always set */
+    int top = v >> (exp - BENCH_SUB_BITS);
+    return (exp - BENCH_SUB_BITS + 1) * BENCH_SUB_COUNT + top -
+        BENCH_SUB_COUNT;
+}
+
+/**
+ * @brief The largest value a bucket holds.
+ */
+uint64_t _bench_bucket_max(int bucket) {
+    if (bucket < BENCH_SUB_COUNT)
+        return bucket;
+
+    int exp = bucket / BENCH_SUB_COUNT + BENCH_SUB_BITS - 1;
+    uint64_t top = bucket % BENCH_SUB_COUNT + BENCH_SUB_COUNT;
+    int shift = exp - BENCH_SUB_BITS;
+    return ((top + 1) << shift) - 1;
+}
+
+/**
+ * @brief The calling thread's histograms, set up on first use.
+ */
+bench_thread_t *_bench_thread() {
+    if (LIKELY(_self != NULL))
+        return _self;
+
+    bench_thread_t *res = calloc(sizeof(bench_thread_t), 1);
+    if (res == NULL)
+        return NULL;
+
+    res->next = atomic_load_explicit(&_threads, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&_threads, &res->next, res,
+                memory_order_release, memory_order_relaxed))
+        ;
+
+    _self = res;
+    return res;
+}
+
+/**
+ * @brief Record a sample of probe, use the BENCH_* macros instead.
+ *
+ * @param probe What was timed.
+ * @param ticks How long it took, in clock ticks.
+ */
+void bench_record(bench_probe_e probe, uint64_t ticks) {
+    bench_thread_t *self = _bench_thread();
+    if (UNLIKELY(self == NULL))
+        return;
+
+    /* Single writer: a load & store, no locked instruction */
+    atomic_ulong *count = &self->counts[probe][_bench_bucket(ticks)];
+    atomic_store_explicit(count,
+            atomic_load_explicit(count, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+
+    if (ticks > atomic_load_explicit(&self->max[probe], memory_order_relaxed))
+        atomic_store_explicit(&self->max[probe], ticks, memory_order_relaxed);
+}
+
+void _bench_scope_end(bench_timer_t *timer) {
+    bench_record(timer->probe, bench_now() - timer->start);
+}
+
+/**
+ * @brief Sum the histograms of every thread.
+ *
+ * @param[out] hists One histogram per probe, indexed by bench_probe_e.
+ */
+void bench_merge(bench_hist_t *hists) {
+    memset(hists, 0, sizeof(bench_hist_t) * BENCH_PROBE_COUNT);
+
+    bench_thread_t *thread = atomic_load_explicit(&_threads,
+            memory_order_acquire);
+    for (; thread != NULL; thread = thread->next) {
+        for (int p = 0; p < BENCH_PROBE_COUNT; p++) {
+            bench_hist_t *hist = &hists[p];
+            for (int b = 0; b < BENCH_BUCKETS; b++) {
+                uint64_t n = atomic_load_explicit(&thread->counts[p][b],
+                        memory_order_relaxed);
+                hist->counts[b] += n;
+                hist->count += n;
+            }
+
+            uint64_t max = atomic_load_explicit(&thread->max[p],
+                    memory_order_relaxed);
+            if (max > hist->max)
+                hist->max = max;
+        }
+    }
+}
+
+/**
+ * @brief The value below which a share q of the samples fall.
+ *
+ * @param hist A merged histogram.
+ * @param q The share, e.g. 0.99.
+ *
+ * @return The value in clock ticks, within the histogram's precision.
+ */
+uint64_t bench_percentile(const bench_hist_t *hist, double q) {
+    uint64_t rank = q * hist->count;
+    uint64_t seen = 0;
+
+    if (rank >= hist->count)
+        return hist->max;
+
+    for (int b = 0; b < BENCH_BUCKETS; b++) {
+        seen += hist->counts[b];
+        if (seen > rank) {
+            uint64_t res = _bench_bucket_max(b);
+            return res < hist->max ? res : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+/**
+ * @return Nanoseconds per clock tick.
+ */
+double bench_tick_ns() {
+    return _tick_ns;
+}
+
+/**
+ * @brief Print the merged percentiles of every probe, in microseconds.
+ */
+void bench_report(FILE *out) {
+    bench_hist_t *hists = malloc(sizeof(bench_hist_t) * BENCH_PROBE_COUNT);
+    if (hists == NULL)
+        return;
+
+    bench_merge(hists);
+    fprintf(out, "%-8s %10s %10s %10s %10s %10s %10s\n", "probe", "count",
+            "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+    for (int p = 0; p < BENCH_PROBE_COUNT; p++) {
+        bench_hist_t *hist = &hists[p];
+        double us = _tick_ns / 1e3;
+        fprintf(out, "%-8s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                _probe_names[p], (unsigned long long)hist->count,
+                bench_percentile(hist, 0.5) * us,
+                bench_percentile(hist, 0.9) * us,
+                bench_percentile(hist, 0.99) * us,
+                bench_percentile(hist, 0.999) * us, hist->max * us);
+    }
+    fflush(out);
+
+    free(hists);
+}
+
+void _bench_signal(int sig) {
+    atomic_store_explicit(&_report_pending, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Print the report if one was asked for. Called regularly by every
+ *        worker, whichever gets there first prints it.
+ */
+void bench_poll() {
+    if (UNLIKELY(atomic_load_explicit(&_report_pending, memory_order_relaxed))
+            && atomic_exchange(&_report_pending, 0))
+        bench_report(stderr);
+}
+
+/**
+ * @brief Work out the clock's tick length, and print a report on SIGUSR1.
+ */
+void bench_init() {
+#if defined(TILS_BENCH_TSC) && defined(__x86_64__)
+    struct timespec wait = { 0, BENCH_CALIBRATE_NS };
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t ticks = bench_now();
+    nanosleep(&wait, NULL);
+    ticks = bench_now() - ticks;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    _tick_ns = ((end.tv_sec - start.tv_sec) * 1e9 +
+            (end.tv_nsec - start.tv_nsec)) / ticks;
+#endif
+
+    signal(SIGUSR1, _bench_signal);
+}
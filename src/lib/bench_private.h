@@ -0,0 +1,56 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/bench_private.h
+ *
+ * @brief Per-thread histogram internals
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _BENCH_PRIVATE_H_
+#define _BENCH_PRIVATE_H_
+
+#include <stdatomic.h>
+
+#include <lib/bench.h>
+
+/* How long the time stamp counter is compared against CLOCK_MONOTONIC */
+#define BENCH_CALIBRATE_NS (20000000)
+
+/**
+ * @brief The histograms a thread records into. Only the owner writes them,
+ *        with plain (relaxed) stores, anyone may read them.
+ */
+typedef struct bench_thread {
+    atomic_ulong counts[BENCH_PROBE_COUNT][BENCH_BUCKETS];
+    atomic_ulong max[BENCH_PROBE_COUNT];
+
+    struct bench_thread *next;
+} bench_thread_t;
+
+static const char *_probe_names[BENCH_PROBE_COUNT] = {
+    [BENCH_ACCEPT] = "accept",
+    [BENCH_RECV] = "recv",
+    [BENCH_PARSE] = "parse",
+    [BENCH_ROUTE] = "route",
+    [BENCH_SERVE] = "serve",
+    [BENCH_SEND] = "send",
+};
+
+#endif /* _BENCH_PRIVATE_H_ */
@@ -0,0 +1,85 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/blob.c
+ *
+ * @brief Reference counted buffer implementation
+ *
+ * The count is only touched when a reference is taken or dropped (e.g. once
+ * per response sending a cached file), never per byte sent.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+
+#include <lib/blob.h>
+
+#include "blob_private.h"
+
+/**
+ * @brief Allocate a blob of len bytes, holding a single reference
+ *
+ * @param len Size of the blob's data
+ *
+ * @return The blob, NULL on error
+ */
+blob_t *blob_new(size_t len) {
+    blob_t *res = malloc(sizeof(blob_t) + len);
+    if (res == NULL)
+        return NULL;
+
+    atomic_init(&res->refs, 1);
+    res->len = len;
+    return res;
+}
+
+/**
+ * @brief Take another reference to b
+ *
+ * @return b
+ */
+blob_t *blob_ref(blob_t *b) {
+    atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+    return b;
+}
+
+/**
+ * @brief Drop a reference to b, freeing it if it was the last one
+ */
+void blob_unref(blob_t *b) {
+    if (b == NULL)
+        return;
+
+    if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1)
+        free(b);
+}
+
+/**
+ * @brief The blob's bytes. Only to be written before the blob is shared.
+ */
+char *blob_data(blob_t *b) {
+    return b->data;
+}
+
+/**
+ * @brief Number of bytes in the blob
+ */
+size_t blob_len(blob_t *b) {
+    return b->len;
+}
@@ -0,0 +1,42 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/blob_private.h
+ *
+ * @brief Blob internals
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _BLOB_PRIVATE_H_
+#define _BLOB_PRIVATE_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct blob {
+    /* Owners of the blob, it is freed when this drops to 0 */
+    atomic_int refs;
+
+    /* Bytes in data */
+    size_t len;
+
+    char data[];
+} blob_t;
+
+#endif /* _BLOB_PRIVATE_H_ */
@@ -10,7 +10,7 @@
  *  but WITHOUT ANY WARRANTY; without even the implied warranty of
  *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  *  GNU General Public License for more details.
- * 
+ *
  *  You should have received a copy of the GNU General Public License
  *  along with tils.  If not, see <http://www.gnu.org/licenses/>
  */
@@ -20,75 +20,569 @@
  *
  * @brief Logging utilities
  *
+ * Each thread logs into its own single producer, single consumer ring, so a
+ * log call takes no lock and never waits on the terminal. The writer thread
+ * is the only consumer of every ring, and merges them by timestamp.
+ *
  * @author Lars Wander
  */
 
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <stdarg.h>
-#include <errno.h>
 
 #include <lib/logging.h>
 
-void _fmt_time(char *buf, int buf_len) {
-    time_t timer;
-    struct tm* tm_info;
+#include "logging_private.h"
 
-    time(&timer);
-    tm_info = localtime(&timer);
-    strftime(buf, buf_len, "%Y:%m:%d %H:%M:%S", tm_info);
-}
+/* Every ring ever handed out, newest first. Rings are never freed. */
+static _Atomic(log_ring_t *) _rings = NULL;
+static pthread_mutex_t _rings_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void _log_format(const char *format, char *msg_buf, va_list ap) {
-    char err_buf[MAX_LOG_LENGTH];
-    char time_buf[MAX_TIME_LENGTH];
+static pthread_key_t _ring_key;
+static pthread_once_t _ring_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local log_ring_t *_ring = NULL;
 
-    _fmt_time(time_buf, MAX_TIME_LENGTH);
+static pthread_t _writer;
+static atomic_int _running = 0;
+static atomic_int _stopping = 0;
 
-    if (errno != 0) {
-        char errno_buf[MAX_ERRNO_LENGTH];
-        strerror_r(errno, errno_buf, MAX_ERRNO_LENGTH);
-        sprintf(err_buf, "[%s] \t%s (%s)", time_buf, format, errno_buf);
+static const char *_level_prefix[] = { INFO, WARN, ERROR };
+
+/* Owned by whichever thread is draining the rings */
+static char _batch[LOG_BATCH_SIZE];
+static int _batch_len = 0;
+static time_t _time_sec = -1;
+static char _time_buf[MAX_TIME_LENGTH];
+
+/**
+ * @brief Find the arguments of the conversion starting at p.
+ *
+ * @param p A '%' in a format string.
+ * @param[out] arg The argument the conversion consumes.
+ * @param[out] stars Widths & precisions given as '*', each an int argument
+ *             ahead of arg.
+ * @param[out] precision Precision given literally, LOG_PRECISION_STAR if
+ *             it's a '*', -1 if there is none.
+ *
+ * @return The length of the conversion, including the '%'.
+ */
+int _log_spec(const char *p, log_arg_t *arg, int *stars, int *precision) {
+    const char *s = p + 1;
+    char mod = 0;
+
+    *stars = 0;
+    *precision = -1;
+    if (*s == '%') {
+        *arg = LOG_ARG_PERCENT;
+        return 2;
+    }
+
+    s += strspn(s, "-+ #0");
+    if (*s == '*') {
+        (*stars)++;
+        s++;
     } else {
-        sprintf(err_buf, "[%s] \t%s", time_buf, format);
+        s += strspn(s, "0123456789");
     }
 
-    vsnprintf(msg_buf, MAX_LOG_LENGTH, err_buf, ap);
+    if (*s == '.') {
+        s++;
+        if (*s == '*') {
+            (*stars)++;
+            *precision = LOG_PRECISION_STAR;
+            s++;
+        } else {
+            *precision = atoi(s);
+            s += strspn(s, "0123456789");
+        }
+    }
+
+    /* char & short are promoted to int */
+    if (*s == 'h') {
+        s += s[1] == 'h' ? 2 : 1;
+    } else if (*s == 'l') {
+        mod = s[1] == 'l' ? 'L' : 'l';
+        s += mod == 'L' ? 2 : 1;
+    } else if (*s == 'z') {
+        mod = *s++;
+    }
+
+    switch (*s) {
+        case 'd': case 'i': case 'c':
+            *arg = mod == 'z' ? LOG_ARG_SIZE : mod == 'L' ? LOG_ARG_LLONG :
+                mod == 'l' ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            *arg = mod == 'z' ? LOG_ARG_SIZE : mod == 'L' ? LOG_ARG_ULLONG :
+                mod == 'l' ? LOG_ARG_ULONG : LOG_ARG_UINT;
+            break;
+        case 'f': case 'e': case 'g':
+            *arg = LOG_ARG_DOUBLE;
+            break;
+        case 'p':
+            *arg = LOG_ARG_PTR;
+            break;
+        case 's':
+            *arg = LOG_ARG_STR;
+            break;
+        default:
+            *arg = LOG_ARG_UNKNOWN;
+            return s - p;
+    }
+
+    return s - p + 1;
 }
 
-void log_info(const char *format, ...) {
-    char msg_buf[MAX_LOG_LENGTH];
+/**
+ * @brief Copy the arguments of format into a record.
+ *
+ * Stops at the first argument that doesn't fit, or can't be read. A '*'
+ * width or precision is packed as an int ahead of its conversion's argument.
+ * Strings are only read up to their precision, they needn't end before it.
+ *
+ * @param format The record's format.
+ * @param ap Its arguments.
+ * @param[out] args The record's argument bytes.
+ *
+ * @return The bytes of args used.
+ */
+int _log_pack(const char *format, va_list ap, char *args) {
+    int len = 0;
+    log_arg_t arg;
+    int stars, precision;
+    union { int64_t i; uint64_t u; double d; } v;
+
+    for (const char *p = strchr(format, '%'); p != NULL; p = strchr(p, '%')) {
+        p += _log_spec(p, &arg, &stars, &precision);
+        for (int i = 0; i < stars; i++) {
+            v.i = va_arg(ap, int);
+            if (len + (int)sizeof(v) > LOG_ARGS_SIZE)
+                return len;
+
+            memcpy(args + len, &v, sizeof(v));
+            len += sizeof(v);
+
+            /* The precision comes last, a negative one is taken as none */
+            if (i == stars - 1 && precision == LOG_PRECISION_STAR)
+                precision = v.i < 0 ? -1 : v.i;
+        }
 
+        switch (arg) {
+            case LOG_ARG_PERCENT:
+                continue;
+            case LOG_ARG_INT:    v.i = va_arg(ap, int); break;
+            case LOG_ARG_LONG:   v.i = va_arg(ap, long); break;
+            case LOG_ARG_LLONG:  v.i = va_arg(ap, long long); break;
+            case LOG_ARG_UINT:   v.u = va_arg(ap, unsigned); break;
+            case LOG_ARG_ULONG:  v.u = va_arg(ap, unsigned long); break;
+            case LOG_ARG_ULLONG: v.u = va_arg(ap, unsigned long long); break;
+            case LOG_ARG_SIZE:   v.u = va_arg(ap, size_t); break;
+            case LOG_ARG_DOUBLE: v.d = va_arg(ap, double); break;
+            case LOG_ARG_PTR:    v.u = (uintptr_t)va_arg(ap, void *); break;
+            case LOG_ARG_STR: {
+                const char *str = va_arg(ap, const char *);
+                int room = LOG_ARGS_SIZE - len - 1;
+                if (room < 0)
+                    return len;
+
+                if (precision >= 0 && precision < room)
+                    room = precision;
+                int n = strnlen(str != NULL ? str : "(null)", room);
+                memcpy(args + len, str != NULL ? str : "(null)", n);
+                args[len + n] = '\0';
+                len += n + 1;
+                continue;
+            }
+            default:
+                return len;
+        }
+
+        if (len + (int)sizeof(v) > LOG_ARGS_SIZE)
+            return len;
+
+        memcpy(args + len, &v, sizeof(v));
+        len += sizeof(v);
+    }
+
+    return len;
+}
+
+/**
+ * @brief Append to buf, never past cap.
+ *
+ * @return The new length of buf.
+ */
+int _log_put(char *buf, int cap, int len, const char *format, ...) {
     va_list ap;
     va_start(ap, format);
+    int n = vsnprintf(buf + len, cap - len, format, ap);
+    va_end(ap);
 
-    _log_format(format, msg_buf, ap);
+    if (n < 0)
+        return len;
 
-    fprintf(stdout, INFO "%s\n", msg_buf);
-    va_end(ap);
+    return len + n < cap ? len + n : cap - 1;
 }
 
-void log_warn(const char *format, ...) {
-    char msg_buf[MAX_LOG_LENGTH];
+/**
+ * @brief Copy a conversion, with each '*' replaced by the int it stands for.
+ *
+ * @param p The conversion.
+ * @param n Its length.
+ * @param star The ints packed for its '*'s, in order.
+ * @param[out] spec LOG_SPEC_MAX bytes.
+ *
+ * @return 0 on success, -1 if it doesn't fit in spec.
+ */
+int _log_spec_fill(const char *p, int n, const int64_t *star, char *spec) {
+    int len = 0;
 
-    va_list ap;
-    va_start(ap, format);
+    for (int i = 0; i < n; i++) {
+        if (len >= LOG_SPEC_MAX - 1)
+            return -1;
 
-    _log_format(format, msg_buf, ap);
+        if (p[i] != '*') {
+            spec[len++] = p[i];
+            continue;
+        }
 
-    fprintf(stdout, WARN "%s\n", msg_buf);
-    va_end(ap);
+        /* A negative precision is as if there were none */
+        int v = *star++;
+        if (v < 0 && i > 0 && p[i - 1] == '.')
+            len--;
+        else
+            len += snprintf(spec + len, LOG_SPEC_MAX - len, "%d", v);
+    }
+
+    if (len >= LOG_SPEC_MAX)
+        return -1;
+
+    spec[len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Format a record's message from its packed arguments.
+ *
+ * @return The length of the message in buf.
+ */
+int _log_unpack(log_record_t *rec, char *buf, int cap) {
+    const char *format = rec->format;
+    const char *p = format;
+    int len = 0;
+    int off = 0;
+    char spec[LOG_SPEC_MAX];
+    int64_t star[LOG_STARS_MAX];
+    int stars, precision;
+    log_arg_t arg;
+    union { int64_t i; uint64_t u; double d; } v;
+
+    buf[0] = '\0';
+    while ((p = strchr(format, '%')) != NULL) {
+        len = _log_put(buf, cap, len, "%.*s", (int)(p - format), format);
+
+        int n = _log_spec(p, &arg, &stars, &precision);
+        format = p + n;
+        if (arg == LOG_ARG_PERCENT) {
+            len = _log_put(buf, cap, len, "%%");
+            continue;
+        }
+
+        /* The rest didn't fit in the record */
+        if (arg == LOG_ARG_UNKNOWN ||
+                off + stars * (int)sizeof(v) > rec->args_len)
+            return _log_put(buf, cap, len, "...");
+
+        for (int i = 0; i < stars && i < LOG_STARS_MAX; i++) {
+            memcpy(&star[i], rec->args + off, sizeof(v));
+            off += sizeof(v);
+        }
+
+        if (_log_spec_fill(p, n, star, spec) < 0)
+            return _log_put(buf, cap, len, "...");
+
+        if (arg == LOG_ARG_STR && off < rec->args_len) {
+            len = _log_put(buf, cap, len, spec, rec->args + off);
+            off += strlen(rec->args + off) + 1;
+            continue;
+        }
+
+        if (arg == LOG_ARG_STR || off + (int)sizeof(v) > rec->args_len)
+            return _log_put(buf, cap, len, "...");
+
+        memcpy(&v, rec->args + off, sizeof(v));
+        off += sizeof(v);
+        switch (arg) {
+            case LOG_ARG_INT:    len = _log_put(buf, cap, len, spec, (int)v.i); break;
+            case LOG_ARG_LONG:   len = _log_put(buf, cap, len, spec, (long)v.i); break;
+            case LOG_ARG_LLONG:  len = _log_put(buf, cap, len, spec, (long long)v.i); break;
+            case LOG_ARG_UINT:   len = _log_put(buf, cap, len, spec, (unsigned)v.u); break;
+            case LOG_ARG_ULONG:  len = _log_put(buf, cap, len, spec, (unsigned long)v.u); break;
+            case LOG_ARG_ULLONG: len = _log_put(buf, cap, len, spec, (unsigned long long)v.u); break;
+            case LOG_ARG_SIZE:   len = _log_put(buf, cap, len, spec, (size_t)v.u); break;
+            case LOG_ARG_DOUBLE: len = _log_put(buf, cap, len, spec, v.d); break;
+            case LOG_ARG_PTR:    len = _log_put(buf, cap, len, spec, (void *)(uintptr_t)v.u); break;
+            default: break;
+        }
+    }
+
+    return _log_put(buf, cap, len, "%s", format);
 }
 
-void log_err(const char *format, ...) {
+void _log_flush() {
+    if (_batch_len == 0)
+        return;
+
+    fwrite(_batch, 1, _batch_len, stdout);
+    fflush(stdout);
+    _batch_len = 0;
+}
+
+/**
+ * @brief Format a record as a line of the current batch.
+ */
+void _log_format(log_record_t *rec) {
     char msg_buf[MAX_LOG_LENGTH];
+    time_t sec = rec->ns / 1000000000;
+
+    /* localtime takes a lock, only pay it once a second */
+    if (sec != _time_sec) {
+        struct tm tm_info;
+        localtime_r(&sec, &tm_info);
+        strftime(_time_buf, MAX_TIME_LENGTH, "%Y:%m:%d %H:%M:%S", &tm_info);
+        _time_sec = sec;
+    }
+
+    if (LOG_BATCH_SIZE - _batch_len < 2 * MAX_LOG_LENGTH)
+        _log_flush();
+
+    _log_unpack(rec, msg_buf, MAX_LOG_LENGTH);
+    _batch_len = _log_put(_batch, LOG_BATCH_SIZE, _batch_len, "%s[%s] \t%s",
+            _level_prefix[rec->level], _time_buf, msg_buf);
+
+    if (rec->errnum != 0) {
+        char errno_buf[MAX_ERRNO_LENGTH];
+        strerror_r(rec->errnum, errno_buf, MAX_ERRNO_LENGTH);
+        _batch_len = _log_put(_batch, LOG_BATCH_SIZE, _batch_len, " (%s)",
+                errno_buf);
+    }
+
+    _batch_len = _log_put(_batch, LOG_BATCH_SIZE, _batch_len, "\n");
+}
+
+int64_t _log_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Format & write every waiting record, oldest first.
+ *
+ * Only one thread may drain at a time.
+ *
+ * @return The number of records written.
+ */
+int _log_drain() {
+    int res = 0;
+    log_ring_t *rings = atomic_load_explicit(&_rings, memory_order_acquire);
+
+    /* Merge the rings by time, there are only ever a handful */
+    for (;;) {
+        log_ring_t *oldest = NULL;
+        log_record_t *rec = NULL;
+        for (log_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+            unsigned tail = atomic_load_explicit(&ring->tail,
+                    memory_order_relaxed);
+            if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+                continue;
+
+            log_record_t *next = &ring->records[tail & (LOG_RING_SLOTS - 1)];
+            if (rec == NULL || next->ns < rec->ns) {
+                oldest = ring;
+                rec = next;
+            }
+        }
+
+        if (oldest == NULL)
+            break;
+
+        _log_format(rec);
+        atomic_fetch_add_explicit(&oldest->tail, 1, memory_order_release);
+        res++;
+    }
+
+    for (log_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+        unsigned long dropped = atomic_load_explicit(&ring->dropped,
+                memory_order_relaxed);
+        if (dropped == ring->reported)
+            continue;
+
+        log_record_t rec = {
+            .format = "Dropped %lu log records",
+            .ns = _log_clock_ns(),
+            .level = LOG_LEVEL_WARN,
+            .args_len = sizeof(uint64_t),
+        };
+        uint64_t count = dropped - ring->reported;
+        memcpy(rec.args, &count, sizeof(count));
+        _log_format(&rec);
+        ring->reported = dropped;
+    }
+
+    _log_flush();
+    return res;
+}
+
+void _log_orphan(void *ring) {
+    atomic_store_explicit(&((log_ring_t *)ring)->orphaned, 1,
+            memory_order_release);
+}
+
+void _log_make_key() {
+    pthread_key_create(&_ring_key, _log_orphan);
+}
+
+/**
+ * @brief The calling thread's ring, set up on first use.
+ *
+ * A ring left behind by an exited thread is reused once it's drained.
+ *
+ * @return The ring, NULL on error
+ */
+log_ring_t *_log_ring() {
+    log_ring_t *res = NULL;
+
+    if (_ring != NULL)
+        return _ring;
+
+    pthread_once(&_ring_key_once, _log_make_key);
+
+    pthread_mutex_lock(&_rings_lock);
+    res = atomic_load_explicit(&_rings, memory_order_relaxed);
+    for (; res != NULL; res = res->next) {
+        if (atomic_load_explicit(&res->orphaned, memory_order_acquire) &&
+                atomic_load_explicit(&res->tail, memory_order_acquire) ==
+                atomic_load_explicit(&res->head, memory_order_relaxed)) {
+            atomic_store_explicit(&res->orphaned, 0, memory_order_relaxed);
+            break;
+        }
+    }
+
+    if (res == NULL) {
+        if ((res = aligned_alloc(CACHE_LINE_SIZE, sizeof(log_ring_t))) == NULL)
+            goto cleanup_lock;
+
+        memset(res, 0, sizeof(log_ring_t));
+        res->next = atomic_load_explicit(&_rings, memory_order_relaxed);
+        atomic_store_explicit(&_rings, res, memory_order_release);
+    }
+
+    pthread_setspecific(_ring_key, res);
+    _ring = res;
+
+cleanup_lock:
+    pthread_mutex_unlock(&_rings_lock);
+    return res;
+}
+
+/**
+ * @brief Queue a record for the writer, use the log_* macros instead.
+ *
+ * Never blocks, & leaves errno as it was.
+ *
+ * @param level One of LOG_LEVEL_*.
+ * @param errnum errno to report with the message, 0 for none.
+ * @param format A string literal.
+ */
+void _log_write(int level, int errnum, const char *format, ...) {
+    int saved_errno = errno;
+    log_ring_t *ring = _log_ring();
+    if (ring == NULL)
+        goto cleanup_errno;
+
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        goto cleanup_errno;
+    }
+
+    log_record_t *rec = &ring->records[head & (LOG_RING_SLOTS - 1)];
+    rec->format = format;
+    rec->ns = _log_clock_ns();
+    rec->errnum = errnum;
+    rec->level = level;
 
     va_list ap;
     va_start(ap, format);
+    rec->args_len = _log_pack(format, ap, rec->args);
+    va_end(ap);
 
-    _log_format(format, msg_buf, ap);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
 
-    fprintf(stdout, ERROR "%s\n", msg_buf);
-    va_end(ap);
+cleanup_errno:
+    errno = saved_errno;
+}
+
+void *_log_writer(void *arg) {
+    struct timespec idle = { 0, LOG_FLUSH_MS * 1000000 };
+
+    while (!atomic_load_explicit(&_stopping, memory_order_acquire)) {
+        if (_log_drain() == 0)
+            nanosleep(&idle, NULL);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Start the thread writing log records.
+ *
+ * Records logged before this are kept until it runs. Anything left when the
+ * process exits is written by `log_stop'.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int log_start() {
+    if (atomic_exchange(&_running, 1))
+        return 0;
+
+    atomic_store(&_stopping, 0);
+    if (pthread_create(&_writer, NULL, _log_writer, NULL) != 0) {
+        atomic_store(&_running, 0);
+        return -1;
+    }
+
+    atexit(log_stop);
+    return 0;
+}
+
+/**
+ * @brief Stop the writer thread, and write whatever is still queued.
+ */
+void log_stop() {
+    if (atomic_exchange(&_running, 0)) {
+        atomic_store_explicit(&_stopping, 1, memory_order_release);
+        pthread_join(_writer, NULL);
+    }
+
+    _log_drain();
+}
+
+/**
+ * @return Records dropped so far because a thread's ring was full.
+ */
+unsigned long log_dropped() {
+    unsigned long res = 0;
+    log_ring_t *ring = atomic_load_explicit(&_rings, memory_order_acquire);
+
+    for (; ring != NULL; ring = ring->next)
+        res += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+
+    return res;
 }
@@ -0,0 +1,111 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/logging_private.h
+ *
+ * @brief Log record & ring internals
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _LOGGING_PRIVATE_H_
+#define _LOGGING_PRIVATE_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <lib/util.h>
+
+/* Records each thread can have waiting on the writer, a power of 2 */
+#define LOG_RING_SLOTS (512)
+
+#define LOG_RECORD_SIZE (128)
+
+/* Bytes of packed arguments a record holds */
+#define LOG_ARGS_SIZE (LOG_RECORD_SIZE - 24)
+
+/* How long the writer sleeps once every ring is empty */
+#define LOG_FLUSH_MS (20)
+
+/* Formatted bytes the writer gathers before writing them out */
+#define LOG_BATCH_SIZE (1 << 14)
+
+/* Longest conversion the writer formats, '*'s filled in included */
+#define LOG_SPEC_MAX (48)
+
+/* A conversion's '*'s, its width and precision */
+#define LOG_STARS_MAX (2)
+
+/* Precision of a conversion that takes it as an argument, see `_log_spec' */
+#define LOG_PRECISION_STAR (-2)
+
+typedef enum log_arg {
+    LOG_ARG_PERCENT,
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LLONG,
+    LOG_ARG_SIZE,
+    LOG_ARG_UINT,
+    LOG_ARG_ULONG,
+    LOG_ARG_ULLONG,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_PTR,
+    LOG_ARG_STR,
+    LOG_ARG_UNKNOWN,
+} log_arg_t;
+
+typedef struct log_record {
+    /* The call's format, also identifying it */
+    const char *format;
+
+    /* Wall clock time of the call */
+    int64_t ns;
+
+    /* errno to report, 0 for none */
+    int32_t errnum;
+
+    uint8_t level;
+
+    /* Bytes used in args */
+    uint8_t args_len;
+
+    /* Each argument in format's order: integers widened to 8 bytes, strings
+     * copied with their NUL */
+    char args[LOG_ARGS_SIZE];
+} log_record_t;
+
+typedef struct log_ring {
+    /* Next record the owning thread writes */
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head;
+
+    /* Next record the writer reads */
+    _Alignas(CACHE_LINE_SIZE) atomic_uint tail;
+
+    /* Records the owner couldn't fit, and how many were reported */
+    _Alignas(CACHE_LINE_SIZE) atomic_ulong dropped;
+    unsigned long reported;
+
+    /* Set once the owning thread exits, the ring goes to the next new one */
+    atomic_int orphaned;
+
+    struct log_ring *next;
+
+    log_record_t records[LOG_RING_SLOTS];
+} log_ring_t;
+
+#endif /* _LOGGING_PRIVATE_H_ */
@@ -0,0 +1,130 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/pool.c
+ *
+ * @brief Size class buffer pool implementation
+ *
+ * Requests are rounded up to the nearest size class. Returned buffers are
+ * pushed on that class's free list, so a steady state of connections
+ * churning through buffers never reaches malloc.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+
+#include <lib/pool.h>
+
+#include "pool_private.h"
+
+/**
+ * @brief Find the size class fitting size bytes
+ *
+ * @return The class index, -1 if size is larger than every class
+ */
+int _pool_class(int size) {
+    int cap = POOL_MIN_SIZE;
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        if (size <= cap)
+            return i;
+        cap <<= POOL_CLASS_SHIFT;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Allocate a fresh, empty pool
+ */
+pool_t *pool_new() {
+    return calloc(sizeof(pool_t), 1);
+}
+
+/**
+ * @brief Get a buffer of at least size bytes
+ *
+ * @param p The pool being allocated from
+ * @param size The number of bytes needed
+ * @param[out] cap The actual size of the buffer, to be handed back to
+ *                 `pool_put'
+ *
+ * @return The buffer, NULL on error
+ */
+void *pool_get(pool_t *p, int size, int *cap) {
+    int class = _pool_class(size);
+    if (class < 0) {
+        *cap = size;
+        return malloc(size);
+    }
+
+    *cap = POOL_MIN_SIZE << (POOL_CLASS_SHIFT * class);
+
+    pool_buf_t *res = p->free[class];
+    if (res != NULL) {
+        p->free[class] = res->next;
+        p->free_count[class]--;
+        return res;
+    }
+
+    return malloc(*cap);
+}
+
+/**
+ * @brief Return a buffer to the pool
+ *
+ * @param p The pool the buffer came from
+ * @param buf The buffer being returned
+ * @param cap The size reported by `pool_get'
+ */
+void pool_put(pool_t *p, void *buf, int cap) {
+    if (buf == NULL)
+        return;
+
+    int class = _pool_class(cap);
+    if (class < 0 || p->free_count[class] >= POOL_MAX_FREE) {
+        free(buf);
+        return;
+    }
+
+    pool_buf_t *node = buf;
+    node->next = p->free[class];
+    p->free[class] = node;
+    p->free_count[class]++;
+}
+
+/**
+ * @brief Free the pool and every buffer cached in it
+ *
+ * @param p The pool being freed
+ */
+void pool_free(pool_t *p) {
+    if (p == NULL)
+        return;
+
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        pool_buf_t *node = p->free[i];
+        while (node != NULL) {
+            pool_buf_t *next = node->next;
+            free(node);
+            node = next;
+        }
+    }
+
+    free(p);
+}
@@ -0,0 +1,53 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/lib/pool_private.h
+ *
+ * @brief Buffer pool internals
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _POOL_PRIVATE_H_
+#define _POOL_PRIVATE_H_
+
+/* Smallest size class, each following class is POOL_CLASS_SHIFT times
+ * larger: 1K, 4K, 16K, 64K */
+#define POOL_MIN_SIZE (1 << 10)
+#define POOL_CLASS_SHIFT (2)
+#define POOL_CLASS_COUNT (4)
+
+/* Max buffers cached per class, beyond this they go back to malloc */
+#define POOL_MAX_FREE (1 << 12)
+
+/**
+ * @brief A cached buffer - the link lives in the buffer itself
+ */
+typedef struct pool_buf {
+    struct pool_buf *next;
+} pool_buf_t;
+
+typedef struct pool {
+    /* Free buffers per size class */
+    pool_buf_t *free[POOL_CLASS_COUNT];
+
+    /* Length of each free list */
+    int free_count[POOL_CLASS_COUNT];
+} pool_t;
+
+#endif /* _POOL_PRIVATE_H_ */
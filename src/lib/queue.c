@@ -163,3 +163,23 @@ int queue_remove(queue_t *q, void **v) {
     atomic_fetch_sub(&q->size, 1);
     return 0;
 }
+
+/**
+ * @brief Free a queue & any elements still in it
+ *
+ * @param q The queue to free
+ * @param free_value Called on each remaining element, if not NULL
+ */
+void queue_free(queue_t *q, void (*free_value)(void *)) {
+    void *v = NULL;
+    if (q == NULL) {
+        return;
+    }
+
+    while (free_value != NULL && queue_remove(q, &v) == 0) {
+        free_value(v);
+    }
+
+    free(q->buf);
+    free(q);
+}
@@ -24,58 +24,271 @@
  */
 
 #include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <lib/bench.h>
 #include <lib/util.h>
 #include <lib/logging.h>
+#include <tils/access_log.h>
+#include <tils/conn.h>
+#include <tils/mime.h>
 #include <tils/routes.h>
+#include <tils/stall.h>
+#include <tils/stats.h>
+#include <tils/tcp_info.h>
+#include <tils/trace.h>
 #include <tils/worker_thread.h>
 #include <tils/tils.h>
 
 
+/**
+ * @brief Parse a non-negative integer command line value.
+ *
+ * @param arg The argument being parsed.
+ * @param max The largest acceptable value.
+ * @param[out] out Where the value is stored.
+ *
+ * @return 0 on success, -1 if arg isn't a number in [0, max].
+ */
+int _parse_int_arg(char *arg, long max, int *out) {
+    char *end = NULL;
+    long res = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || res < 0 || res > max)
+        return -1;
+
+    *out = (int)res;
+    return 0;
+}
+
+void _usage(char *name) {
+    fprintf(stderr, "usage: %s [options] [port]\n"
+            "  -l address   listen on address, may be repeated:\n"
+            "               port, a.b.c.d:port, [v6addr]:port,\n"
+            "               unix:/path (default: the port argument)\n"
+            "  -a dir       write a binary access log to dir\n"
+            "  -A megabytes size access log segments rotate at (default: 64)\n"
+            "  -b backlog   accept queue length (default: somaxconn)\n"
+            "  -c policy    Cache-Control of static assets (default: none)\n"
+            "  -d seconds   TCP_DEFER_ACCEPT timeout (default: off)\n"
+            "  -f qlen      TCP_FASTOPEN queue length (default: off)\n"
+            "  -i n         sample TCP_INFO of 1 in n connections, and the\n"
+            "               accept queue every n accepts (default: off)\n"
+            "  -k requests  requests per connection (default: 1000, 0: no limit)\n"
+            "  -m file      read MIME types from a mime.types file\n"
+            "  -n           TCP_NODELAY on accepted sockets\n"
+            "  -q           TCP_QUICKACK on accepted sockets\n"
+            "  -s bytes     SO_SNDBUF (default: kernel)\n"
+            "  -r bytes     SO_RCVBUF (default: kernel)\n"
+            "  -S           serve counters at " TILS_STATS_PATH "\n"
+            "  -t threads   worker count (default: one per usable core)\n"
+            "  -H           one worker per physical core, skip SMT siblings\n"
+            "  -T min       scale between min and -t workers with load\n"
+            "  -U percent   utilization that adds a worker (default: 75)\n"
+            "  -D percent   utilization that retires a worker (default: 25)\n"
+            "  -w ms        report loop iterations busy for longer "
+            "(default: 100, 0: off)\n"
+            "  -x file      trace requests to file, dumped on SIGUSR2\n",
+            name);
+}
+
 int main(int argc, char *argv[]) {
-    int server_fd = 0;
+    char *listen_addrs[MAX_LISTENERS];
+    int listen_addr_count = 0;
+    char port_addr[8];
+    char *mime_file = NULL;
+    char *access_dir = NULL;
+    char *trace_file = NULL;
+    int access_mb = 0;
+    int server_fds[MAX_LISTENERS];
+    int server_fd_count = 0;
     int res = 0;
     int port = 80;
+    int max_requests = 0;
+    int stall_ms = 0;
+    int tcp_every = 0;
+    int opt = 0;
+    int bad = 0;
+    tils_listen_opts_t listen_opts;
+    tils_pool_opts_t pool_opts;
+
+    log_start();
+    BENCH_INIT();
+    tils_listen_opts_default(&listen_opts);
+    tils_pool_opts_default(&pool_opts);
+
+    while ((opt = getopt(argc, argv, "a:A:b:c:d:D:f:Hi:k:l:m:nqs:r:St:T:U:w:x:")) != -1) {
+        switch (opt) {
+            case 'a':
+                access_dir = optarg;
+                break;
+            case 'A':
+                bad = _parse_int_arg(optarg, INT_MAX >> 20, &access_mb);
+                break;
+            case 'b':
+                bad = _parse_int_arg(optarg, INT_MAX, &listen_opts.backlog);
+                break;
+            case 'c':
+                tils_routes_cache_control(optarg);
+                break;
+            case 'd':
+                bad = _parse_int_arg(optarg, INT_MAX,
+                        &listen_opts.defer_accept);
+                break;
+            case 'D':
+                bad = _parse_int_arg(optarg, 100, &pool_opts.scale_down);
+                break;
+            case 'f':
+                bad = _parse_int_arg(optarg, INT_MAX, &listen_opts.fastopen);
+                break;
+            case 'H':
+                pool_opts.skip_smt = 1;
+                break;
+            case 'i':
+                bad = _parse_int_arg(optarg, INT_MAX, &tcp_every);
+                if (bad == 0)
+                    tils_tcp_sampling(tcp_every);
+                break;
+            case 'k':
+                bad = _parse_int_arg(optarg, INT_MAX, &max_requests);
+                if (bad == 0)
+                    tils_conn_max_requests(max_requests);
+                break;
+            case 'l':
+                if (listen_addr_count == MAX_LISTENERS) {
+                    log_err("At most %d listeners are supported",
+                            MAX_LISTENERS);
+                    exit(-1);
+                }
+                listen_addrs[listen_addr_count++] = optarg;
+                break;
+            case 'm':
+                mime_file = optarg;
+                break;
+            case 'n':
+                listen_opts.nodelay = 1;
+                break;
+            case 'q':
+                listen_opts.quickack = 1;
+                break;
+            case 's':
+                bad = _parse_int_arg(optarg, INT_MAX, &listen_opts.sndbuf);
+                break;
+            case 'r':
+                bad = _parse_int_arg(optarg, INT_MAX, &listen_opts.rcvbuf);
+                break;
+            case 'S':
+                tils_stats_enable();
+                break;
+            case 't':
+                bad = _parse_int_arg(optarg, MAX_THREADS,
+                        &pool_opts.thread_count);
+                break;
+            case 'T':
+                bad = _parse_int_arg(optarg, MAX_THREADS,
+                        &pool_opts.min_threads);
+                break;
+            case 'U':
+                bad = _parse_int_arg(optarg, 100, &pool_opts.scale_up);
+                break;
+            case 'w':
+                bad = _parse_int_arg(optarg, INT_MAX, &stall_ms);
+                if (bad == 0)
+                    tils_stall_threshold(stall_ms);
+                break;
+            case 'x':
+                trace_file = optarg;
+                break;
+            default:
+                bad = -1;
+                break;
+        }
 
-    if (argc > 1) {
-        char *end = NULL;
-        long res = strtol(argv[1], &end, 10);
-        if (*end != '\0' || res < 0 || res >= (1 << 16) - 1) {
-            log_err("Invalid port: %s", argv[1]);
+        if (bad < 0) {
+            _usage(argv[0]);
             exit(-1);
         }
+    }
 
-        port = (int)res;
+    if (optind < argc) {
+        if (_parse_int_arg(argv[optind], (1 << 16) - 2, &port) < 0) {
+            log_err("Invalid port: %s", argv[optind]);
+            exit(-1);
+        }
+    }
+
+    /* The bare port keeps its old meaning: IPv4 on every interface. It's
+     * only implied when no listener was given explicitly. */
+    if (optind < argc || listen_addr_count == 0) {
+        snprintf(port_addr, sizeof(port_addr), "%d", port);
+        if (listen_addr_count < MAX_LISTENERS)
+            listen_addrs[listen_addr_count++] = port_addr;
+    }
+
+    if (tils_mime_init() < 0 ||
+            (mime_file != NULL && tils_mime_load(mime_file) < 0) ||
+            tils_mime_build() < 0) {
+        log_err("Failed to build MIME types");
+        res = -1;
+        goto cleanup_mime;
     }
 
     log_info("Building routes...");
+    /* Pages are always revalidated, assets follow -c */
     if (tils_routes_init() < 0 || 
-           tils_route_add("/", "html/index.html") < 0 ||
-           tils_route_add("/apple-touch-icon.png", "html/apple-touch-icon.png") < 0 ||
-           tils_route_add("/favicon.png", "html/favicon.png") < 0 ||
-           tils_route_add("/common.css", "html/common.css") < 0 ||
-           tils_route_add("/test/test.html", "html/test/test.html") < 0) {
+           tils_route_add("/", "html/index.html", "no-cache") < 0 ||
+           tils_route_add("/apple-touch-icon.png", "html/apple-touch-icon.png", NULL) < 0 ||
+           tils_route_add("/favicon.png", "html/favicon.png", NULL) < 0 ||
+           tils_route_add("/common.css", "html/common.css", NULL) < 0 ||
+           tils_route_add("/test/test.html", "html/test/test.html", "no-cache") < 0) {
         log_err("Failed to build routes");
         res = -1;
         goto cleanup_routes;
     } 
 
-    log_info("Opening connection on port %d", port);
-    if ((server_fd = init_server(port)) < 0) {
-        log_err("Failed to open port");
+    if (access_dir != NULL &&
+            tils_access_log_config(access_dir, (size_t)access_mb << 20) < 0) {
+        log_err("Failed to set up the access log in %s", access_dir);
+        res = -1;
+        goto cleanup_routes;
+    }
+
+    if (trace_file != NULL && tils_trace_config(trace_file) < 0) {
+        log_err("Failed to set up tracing to %s", trace_file);
         res = -1;
         goto cleanup_routes;
     }
 
+    for (int i = 0; i < listen_addr_count; i++) {
+        log_info("Opening connection on %s", listen_addrs[i]);
+        if ((server_fds[i] = init_server(listen_addrs[i], &listen_opts)) < 0) {
+            log_err("Failed to open %s", listen_addrs[i]);
+            res = -1;
+            goto cleanup_servers;
+        }
+        server_fd_count++;
+    }
+
+    /* A client hanging up mid-response is reported by the write failing,
+     * it mustn't take the whole server down. */
+    signal(SIGPIPE, SIG_IGN);
+
     log_info("Starting thread pool...");
-    tils_start_thread_pool(server_fd);
+    tils_start_thread_pool(server_fds, server_fd_count, &pool_opts);
 
-    close(server_fd);
+cleanup_servers:
+    for (int i = 0; i < server_fd_count; i++)
+        close(server_fds[i]);
 
 cleanup_routes:
     tils_routes_cleanup();
+
+cleanup_mime:
+    tils_mime_cleanup();
+    log_stop();
     return res;
 }
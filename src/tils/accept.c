@@ -23,27 +23,124 @@
  * @author Lars Wander
  */
 
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include <lib/bench.h>
+#include <lib/probes.h>
 #include <tils/accept.h>
 #include <tils/serve.h>
+#include <tils/trace.h>
+
+/**
+ * @brief Drop the first len bytes of the connection's receive buffer.
+ *
+ * @param self The worker owning the connection.
+ * @param conn The connection whose buffer is consumed.
+ * @param len The number of bytes consumed.
+ */
+void _tils_consume(tils_wt_t *self, tils_conn_t *conn, int len) {
+    conn->rbuf_len -= len;
+    if (conn->rbuf_len > 0) {
+        /* Pipelined requests - keep what follows. */
+        memmove(conn->rbuf, conn->rbuf + len, conn->rbuf_len);
+    } else {
+        /* Nothing left to hold on to until the client speaks again. */
+        pool_put(self->pool, conn->rbuf, conn->rbuf_cap);
+        conn->rbuf = NULL;
+        conn->rbuf_len = 0;
+    }
+}
 
 /**
- * @brief Process the HTTP request, and respond accordingly.
- * 
+ * @brief Read the next HTTP request off of a connection.
+ *
+ * Data is accumulated in a buffer from the worker's pool until the request
+ * headers are complete, so requests split across packets are handled. The
+ * parsed request lives in the worker's arena.
+ *
+ * @param self The worker owning the connection.
  * @param conn Connection being communicated with
+ *
+ * @return The request, NULL if there is no complete request (yet).
  */
-tils_http_request_t *tils_accept_request(tils_conn_t *conn) {
-    char request[REQUEST_BUF_SIZE];
+tils_http_request_t *tils_accept_request(tils_wt_t *self, tils_conn_t *conn) {
     int request_len = 0;
     tils_http_request_t *http_request;
 
-    /* First grab the full HTTP request */
-    request_len = recv(conn->client_fd, request, REQUEST_BUF_SIZE, 0);
+    if (conn->rbuf != NULL)
+        request_len = tils_request_length(conn->rbuf, conn->rbuf_len);
+
+    /* Only go to the socket if what's buffered isn't a full request */
+    if (request_len == 0) {
+        if (conn->rbuf == NULL &&
+                (conn->rbuf = pool_get(self->pool, REQUEST_BUF_SIZE,
+                                       &conn->rbuf_cap)) == NULL) {
+            tils_conn_kill(self->conns, conn, CLOSE_ERROR);
+            return NULL;
+        }
 
-    if (request_len <= 0) {
+        /* Headers larger than the buffer aren't something we serve. */
+        if (conn->rbuf_len == conn->rbuf_cap) {
+            tils_conn_kill(self->conns, conn, CLOSE_PROTOCOL);
+            return NULL;
+        }
+
+        BENCH_START(recv_start);
+        int res = recv(conn->client_fd, conn->rbuf + conn->rbuf_len,
+                conn->rbuf_cap - conn->rbuf_len, 0);
+        BENCH_STOP(recv_start, BENCH_RECV);
+
+        if (res <= 0) {
+            /* The client hung up (or the socket broke) - nothing more will
+             * be read from it, so have it cleaned up instead of polled
+             * forever. */
+            if (res == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                tils_conn_kill(self->conns, conn,
+                        res == 0 ? CLOSE_PEER : CLOSE_ERROR);
+
+            if (conn->rbuf_len == 0)
+                _tils_consume(self, conn, 0);
+
+            return NULL;
+        }
+
+        conn->rbuf_len += res;
+        request_len = tils_request_length(conn->rbuf, conn->rbuf_len);
+        if (request_len == 0)
+            return NULL;
+    }
+
+    if (self->trace != NULL)
+        tils_trace_begin(self->trace);
+
+    int64_t parse_start = self->access != NULL ? tils_access_clock() : 0;
+    BENCH_START(bench_parse);
+    http_request = tils_parse_request(self->arena, conn->rbuf, request_len);
+    BENCH_STOP(bench_parse, BENCH_PARSE);
+    if (http_request == NULL) {
+        tils_conn_kill(self->conns, conn, CLOSE_PROTOCOL);
         return NULL;
     }
 
-    http_request = tils_parse_request(request, request_len);
+    TILS_PROBE3(request__recv, conn->client_fd, request_len,
+            conn->requests);
+
+    http_request->parse_ns = self->access != NULL ?
+        tils_access_clock() - parse_start : 0;
+    TILS_TRACE(self->trace, TILS_TRACE_PARSED);
+
+    /* Bodies aren't used by anything we serve - skip them. If it hasn't all
+     * arrived we can't find the next request, so close the connection after
+     * this response. */
+    if (http_request->body_len > conn->rbuf_len - request_len) {
+        conn->closing = 1;
+        _tils_consume(self, conn, conn->rbuf_len);
+    } else {
+        _tils_consume(self, conn, request_len + http_request->body_len);
+    }
 
     return http_request;
 }
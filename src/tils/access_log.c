@@ -0,0 +1,426 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/access_log.c
+ *
+ * @brief Binary access log implementation
+ *
+ * Every worker owns its segment, so appending takes no lock and makes no
+ * system call. Once a segment is half full a helper thread creates,
+ * allocates & faults in the next one; when the segment is full the worker
+ * swaps the two under `_helper_lock' and leaves the full one to the helper
+ * to trim. A worker only waits for the helper if it fills a whole half of a
+ * segment before the next one is ready, and then drops records rather than
+ * blocking.
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <lib/logging.h>
+#include <lib/util.h>
+#include <tils/access_log.h>
+#include <tils/routes.h>
+
+#include "access_log_private.h"
+
+/* Directory segments are written to, NULL if access logging is off */
+static char *_dir = NULL;
+
+static size_t _segment_size = TILS_ACCESS_SEGMENT_SIZE;
+
+/* Numbers segments, so rotated & restarted workers never collide */
+static atomic_int _segment_seq = 0;
+
+/* Wall clock time less monotonic time, records are stamped with the sum */
+static int64_t _wall_offset = 0;
+
+/* Logs the helper thread looks after, and the handovers with it */
+static tils_access_log_t *_logs = NULL;
+static pthread_mutex_t _helper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _helper_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _helper_idle = PTHREAD_COND_INITIALIZER;
+static pthread_t _helper;
+
+/**
+ * @brief Monotonic time in nanoseconds, what record times are taken with.
+ */
+int64_t tils_access_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Write the route id to source table next to the segments.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int _tils_access_routes(char *dir) {
+    char path[ACCESS_PATH_LEN];
+    snprintf(path, ACCESS_PATH_LEN, ACCESS_ROUTES_NAME, dir);
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        log_err_errno("Can't write %s", path);
+        return -1;
+    }
+
+    for (int i = 0; i < tils_route_count(); i++)
+        fprintf(file, "%d\t%s\n", i, tils_route_source(i));
+
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Map a new, preallocated segment.
+ *
+ * Its header is written, but only stamped once records go into it.
+ *
+ * @param[out] seg The segment.
+ * @param worker The worker it is for.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int _tils_access_segment(tils_access_seg_t *seg, int worker) {
+    char path[ACCESS_PATH_LEN];
+    int err;
+
+    seg->seq = atomic_fetch_add(&_segment_seq, 1);
+    snprintf(path, ACCESS_PATH_LEN, ACCESS_SEGMENT_NAME, _dir, (int)getpid(),
+            seg->seq);
+
+    seg->map = NULL;
+    seg->used = 0;
+    seg->size = 0;
+    if ((seg->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0644)) < 0) {
+        log_warn_errno("Can't create %s", path);
+        return -1;
+    }
+
+    /* Reserve the blocks now, so filling the mapping never finds the disk
+     * full (which would be a SIGBUS) */
+    if ((err = posix_fallocate(seg->fd, 0, _segment_size)) != 0) {
+        errno = err;
+        log_warn_errno("Can't allocate %s", path);
+        goto cleanup_fd;
+    }
+
+    seg->map = mmap(NULL, _segment_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, seg->fd, 0);
+    if (seg->map == MAP_FAILED) {
+        log_warn_errno("Can't map %s", path);
+        seg->map = NULL;
+        goto cleanup_fd;
+    }
+
+    tils_access_hdr_t *hdr = (tils_access_hdr_t *)seg->map;
+    memcpy(hdr->magic, TILS_ACCESS_MAGIC, sizeof(hdr->magic));
+    hdr->version = TILS_ACCESS_VERSION;
+    hdr->record_size = sizeof(tils_access_rec_t);
+    hdr->pid = getpid();
+    hdr->worker = worker;
+
+    seg->used = sizeof(tils_access_hdr_t);
+    seg->size = _segment_size;
+    return 0;
+
+cleanup_fd:
+    unlink(path);
+    close(seg->fd);
+    seg->fd = -1;
+    return -1;
+}
+
+/**
+ * @brief Start writing records to a segment.
+ */
+void _tils_access_stamp(tils_access_seg_t *seg) {
+    tils_access_hdr_t *hdr = (tils_access_hdr_t *)seg->map;
+    hdr->created_ns = tils_access_clock() + _wall_offset;
+}
+
+/**
+ * @brief Unmap a segment, trimmed to the records written.
+ */
+void _tils_access_finish(tils_access_seg_t *seg) {
+    if (seg->map == NULL)
+        return;
+
+    munmap(seg->map, seg->size);
+    if (ftruncate(seg->fd, seg->used) < 0)
+        log_warn_errno("Can't trim access log segment");
+
+    close(seg->fd);
+    seg->map = NULL;
+    seg->fd = -1;
+}
+
+/**
+ * @brief Unmap & remove a segment no record was written to.
+ */
+void _tils_access_discard(tils_access_seg_t *seg) {
+    char path[ACCESS_PATH_LEN];
+    if (seg->map == NULL)
+        return;
+
+    snprintf(path, ACCESS_PATH_LEN, ACCESS_SEGMENT_NAME, _dir, (int)getpid(),
+            seg->seq);
+    munmap(seg->map, seg->size);
+    unlink(path);
+    close(seg->fd);
+    seg->map = NULL;
+    seg->fd = -1;
+}
+
+/**
+ * @brief Find a log with work for the helper. Called under `_helper_lock'.
+ */
+tils_access_log_t *_tils_access_pending() {
+    for (tils_access_log_t *log = _logs; log != NULL; log = log->next) {
+        if (!log->busy && (log->full.map != NULL ||
+                    (log->want_spare && log->spare.map == NULL)))
+            return log;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Create the spares & trim the full segments of every log, forever.
+ */
+void *_tils_access_helper(void *arg) {
+    tils_access_seg_t full, spare;
+
+    pthread_mutex_lock(&_helper_lock);
+    while (1) {
+        tils_access_log_t *log = _tils_access_pending();
+        if (log == NULL) {
+            pthread_cond_wait(&_helper_work, &_helper_lock);
+            continue;
+        }
+
+        int want = log->want_spare && log->spare.map == NULL;
+        full = log->full;
+        log->full.map = NULL;
+        log->busy = 1;
+        pthread_mutex_unlock(&_helper_lock);
+
+        _tils_access_finish(&full);
+        int res = want ? _tils_access_segment(&spare, log->worker) : -1;
+
+        pthread_mutex_lock(&_helper_lock);
+        if (want && res == 0)
+            log->spare = spare;
+
+        /* Asked for again by the worker if this failed */
+        if (want)
+            log->want_spare = 0;
+
+        log->busy = 0;
+        pthread_cond_broadcast(&_helper_idle);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Turn access logging on. Every route must already be added.
+ *
+ * @param dir Directory segments are written to, it must exist.
+ * @param segment_size Bytes a segment is rotated at, 0 for the default.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tils_access_log_config(char *dir, size_t segment_size) {
+    struct timespec wall;
+
+    if (segment_size != 0)
+        _segment_size = segment_size;
+
+    if (_segment_size < ACCESS_SEGMENT_MIN)
+        _segment_size = ACCESS_SEGMENT_MIN;
+
+    clock_gettime(CLOCK_REALTIME, &wall);
+    _wall_offset = (int64_t)wall.tv_sec * 1000000000 + wall.tv_nsec -
+        tils_access_clock();
+
+    if (_tils_access_routes(dir) < 0)
+        return -1;
+
+    _dir = dir;
+    if (pthread_create(&_helper, NULL, _tils_access_helper, NULL) != 0) {
+        log_err("Failed to start the access log helper");
+        _dir = NULL;
+        return -1;
+    }
+
+    pthread_detach(_helper);
+    return 0;
+}
+
+/**
+ * @brief Start a worker's access log.
+ *
+ * @param[out] log The log, NULL if access logging is off.
+ * @param worker The id of the worker it belongs to.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tils_access_log_open(tils_access_log_t **log, int worker) {
+    *log = NULL;
+    if (_dir == NULL)
+        return 0;
+
+    tils_access_log_t *res = calloc(sizeof(tils_access_log_t), 1);
+    if (res == NULL)
+        return -1;
+
+    res->worker = worker;
+    res->spare.fd = -1;
+    res->full.fd = -1;
+    if (_tils_access_segment(&res->cur, worker) < 0) {
+        free(res);
+        return -1;
+    }
+    _tils_access_stamp(&res->cur);
+
+    pthread_mutex_lock(&_helper_lock);
+    res->next = _logs;
+    _logs = res;
+    pthread_mutex_unlock(&_helper_lock);
+
+    *log = res;
+    return 0;
+}
+
+/**
+ * @brief Finish the log's last segment, and free it.
+ */
+void tils_access_log_close(tils_access_log_t *log) {
+    if (log == NULL)
+        return;
+
+    pthread_mutex_lock(&_helper_lock);
+    for (tils_access_log_t **at = &_logs; *at != NULL; at = &(*at)->next) {
+        if (*at == log) {
+            *at = log->next;
+            break;
+        }
+    }
+
+    while (log->busy)
+        pthread_cond_wait(&_helper_idle, &_helper_lock);
+    pthread_mutex_unlock(&_helper_lock);
+
+    _tils_access_finish(&log->full);
+    _tils_access_discard(&log->spare);
+    _tils_access_finish(&log->cur);
+    free(log);
+}
+
+/**
+ * @brief Ask the helper for the next segment.
+ */
+void _tils_access_ask(tils_access_log_t *log) {
+    pthread_mutex_lock(&_helper_lock);
+    log->want_spare = 1;
+    pthread_cond_signal(&_helper_work);
+    pthread_mutex_unlock(&_helper_lock);
+    log->asked = 1;
+}
+
+/**
+ * @brief Swap a full segment for the spare, if it is ready.
+ *
+ * @return 0 if records can be written again, -1 if not.
+ */
+int _tils_access_rotate(tils_access_log_t *log) {
+    int res = -1;
+
+    pthread_mutex_lock(&_helper_lock);
+    if (log->spare.map != NULL && log->full.map == NULL) {
+        log->full = log->cur;
+        log->cur = log->spare;
+        log->spare.map = NULL;
+        log->spare.fd = -1;
+        pthread_cond_signal(&_helper_work);
+        res = 0;
+    } else if (!log->want_spare && !log->busy &&
+            log->dropped % ACCESS_RETRY_RECORDS == 0) {
+        /* Creating it failed, try again */
+        log->want_spare = 1;
+        pthread_cond_signal(&_helper_work);
+    }
+    pthread_mutex_unlock(&_helper_lock);
+
+    if (res < 0)
+        return -1;
+
+    _tils_access_stamp(&log->cur);
+    log->asked = 0;
+    if (log->dropped > 0) {
+        log_warn("Dropped %lu access records of worker %d waiting for a "
+                "segment", log->dropped, log->worker);
+        log->dropped = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Append a record, rotating to the next segment once this one is
+ *        full.
+ *
+ * Records are dropped while the next segment isn't ready.
+ *
+ * @param log The worker's log.
+ * @param rec The record. Its time is `tils_access_clock' at the start of
+ *        the response, and is stored as wall clock time.
+ */
+void tils_access_log_append(tils_access_log_t *log, tils_access_rec_t *rec) {
+    tils_access_seg_t *seg = &log->cur;
+
+    if (UNLIKELY(seg->used + sizeof(tils_access_rec_t) > seg->size)) {
+        if (_tils_access_rotate(log) < 0) {
+            log->dropped++;
+            return;
+        }
+    } else if (UNLIKELY(!log->asked && seg->used > seg->size / 2)) {
+        _tils_access_ask(log);
+    }
+
+    rec->time_ns += _wall_offset;
+    memcpy(seg->map + seg->used, rec, sizeof(tils_access_rec_t));
+    seg->used += sizeof(tils_access_rec_t);
+}
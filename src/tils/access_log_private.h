@@ -0,0 +1,49 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/access_log_private.h
+ *
+ * @brief Access log segment naming & limits
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _ACCESS_LOG_PRIVATE_H_
+#define _ACCESS_LOG_PRIVATE_H_
+
+#include <tils/access_log.h>
+
+#define ACCESS_PATH_LEN (4096)
+
+/* <dir>/access-<pid>-<sequence>.tlog, numbered across every worker */
+#define ACCESS_SEGMENT_NAME "%s/access-%d-%06d.tlog"
+
+/* Route id to source table, written next to the segments */
+#define ACCESS_ROUTES_NAME "%s/routes"
+
+/* Smallest segment worth rotating to */
+#define ACCESS_SEGMENT_MIN (sizeof(tils_access_hdr_t) + \
+        64 * sizeof(tils_access_rec_t))
+
+/* Dropped records between asking again for a spare that failed */
+#define ACCESS_RETRY_RECORDS (4096)
+
+_Static_assert(sizeof(tils_access_hdr_t) == 64, "segment header size");
+_Static_assert(sizeof(tils_access_rec_t) == 64, "access record size");
+
+#endif /* _ACCESS_LOG_PRIVATE_H_ */
@@ -25,74 +25,368 @@
  * @author Lars Wander
  */
 
+#include <errno.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#include <sys/socket.h>
+
 #include <lib/util.h>
 #include <lib/logging.h>
+#include <lib/probes.h>
 #include <tils/conn.h>
 
+#include "conn_private.h"
+
+/* Requests served per connection, 0 for no limit */
+static int _max_requests = MAX_REQUESTS;
+
+/**
+ * @brief Coarse monotonic time, in seconds, for connection timeouts.
+ */
+uint32_t tils_conn_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
 /**
- * @brief Initialize a new connection.
+ * @brief Set how many requests a connection may make before it's closed.
  *
- * @param client_fd The client connection this connection listens to.
+ * @param max The limit, 0 for none.
+ */
+void tils_conn_max_requests(int max) {
+    _max_requests = max;
+}
+
+/**
+ * @brief Count a request made on a connection.
  *
- * @return The new connection object. NULL on error.
+ * @param conn The connection the request came in on.
+ *
+ * @return 1 if the connection has to close once it's answered, 0 if not.
  */
-void tils_conn_new(int client_fd, char *addr_buf, tils_conn_t *conn) {
-    conn->client_fd = client_fd;
-    conn->last_alive = TIME_NOW;
-    conn->state = CONN_ALIVE;
-    memcpy(conn->addr_buf, addr_buf, sizeof(conn->addr_buf));
+int tils_conn_count_request(tils_conn_t *conn) {
+    conn->requests++;
+    return conn->closing ||
+        (_max_requests > 0 && conn->requests >= _max_requests);
+}
+
+/**
+ * @brief Get the state of a connection.
+ *
+ * @param buf The buffer holding the connection.
+ * @param conn The connection being examined.
+ */
+tils_conn_state tils_conn_get_state(tils_conn_buf_t *buf, tils_conn_t *conn) {
+    return buf->states[_SLOT(buf, conn)];
+}
+
+/**
+ * @brief Mark a connection as dead, to be closed by the worker shortly.
+ *
+ * @param buf The buffer holding the connection.
+ * @param conn The connection that failed.
+ * @param reason Why it is closed.
+ */
+void tils_conn_kill(tils_conn_buf_t *buf, tils_conn_t *conn,
+        tils_conn_close_reason reason) {
+    buf->states[_SLOT(buf, conn)] = CONN_DEAD;
+    conn->close_reason = reason;
 }
 
 /**
  * @brief Update the last time a connection was heard from.
  *
+ * @param buf The buffer holding the connection.
  * @param conn The connection being updated.
  */
-void tils_conn_revitalize(tils_conn_t *conn) {
-    conn->last_alive = TIME_NOW;
+void tils_conn_revitalize(tils_conn_buf_t *buf, tils_conn_t *conn) {
+    buf->last_alive[_SLOT(buf, conn)] = tils_conn_clock();
 }
 
 /**
- * @brief Check if connection is still alive.
+ * @brief Keep the rest of a response until the socket takes it.
  *
- * @param conn The connection being checked.
+ * @param buf The buffer holding the connection.
+ * @param conn The connection the response is for.
+ * @param out The rest of the response, in a buffer from the pool.
+ * @param cap The size of out's buffer.
+ */
+void tils_conn_hold(tils_conn_buf_t *buf, tils_conn_t *conn, tils_out_t *out,
+        int cap) {
+    conn->out = out;
+    conn->out_cap = cap;
+    buf->pending[_SLOT(buf, conn)] = 1;
+}
+
+/**
+ * @brief Drop a connection's pending response, and give back its buffer.
  *
- * This function also marks the result of the check in the connection state.
+ * @param buf The buffer holding the connection.
+ * @param conn The connection whose response is done (or abandoned).
+ */
+void tils_conn_release_out(tils_conn_buf_t *buf, tils_conn_t *conn) {
+    tils_out_release(conn->out);
+    pool_put(buf->pool, conn->out, conn->out_cap);
+    conn->out = NULL;
+    buf->pending[_SLOT(buf, conn)] = 0;
+}
+
+/**
+ * @brief Shut down our side of a connection whose last response is out.
+ *
+ * Closing outright could make the kernel reset the connection if the
+ * client sent more (e.g. pipelined requests), and a reset can throw away
+ * the response before the client has read it. So only a FIN is sent, and
+ * the connection lingers until the client closes too.
+ *
+ * @param buf The buffer holding the connection.
+ * @param conn The connection being shut down.
+ */
+void tils_conn_shutdown(tils_conn_buf_t *buf, tils_conn_t *conn) {
+    int slot = _SLOT(buf, conn);
+
+    /* Nothing buffered will ever be answered */
+    pool_put(buf->pool, conn->rbuf, conn->rbuf_cap);
+    conn->rbuf = NULL;
+    conn->rbuf_len = 0;
+
+    if (shutdown(conn->client_fd, SHUT_WR) < 0) {
+        tils_conn_kill(buf, conn, CLOSE_ERROR);
+        return;
+    }
+
+    buf->states[slot] = CONN_LINGER;
+    buf->last_alive[slot] = tils_conn_clock();
+}
+
+/**
+ * @brief Drop whatever a lingering connection's client sent.
+ *
+ * Marks the connection dead once the client has closed its side.
  *
- * @return 1 if true, 0 otherwise.
+ * @param buf The buffer holding the connection.
+ * @param conn The lingering connection, now readable.
  */
-int tils_conn_check_alive(tils_conn_t *conn) {
-    if (conn->state == CONN_DEAD || conn->state == CONN_CLEAN) {
-        return 0;
-    } else if (TIME_NOW - conn->last_alive >= TTL) {
-        conn->state = CONN_DEAD;
-        return 0;
-    } else {
-        return 1;
+void tils_conn_linger(tils_conn_buf_t *buf, tils_conn_t *conn) {
+    char scratch[4096];
+
+    for (int total = 0; total < LINGER_READ_MAX; ) {
+        ssize_t n = recv(conn->client_fd, scratch, sizeof(scratch), 0);
+        if (n > 0) {
+            total += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                tils_conn_kill(buf, conn, n == 0 ? CLOSE_DONE : CLOSE_ERROR);
+            return;
+        }
     }
 }
 
 /**
- * @brief Close a connections file descriptors.
+ * @brief Close a connections file descriptors, and release its buffers.
  *
+ * @param buf The buffer holding the connection.
  * @param conn The connection being closed.
  *
  * @return The original state of conn before close.
  */
-tils_conn_state tils_conn_close(tils_conn_t *conn) {
-    tils_conn_state res = conn->state;
+tils_conn_state tils_conn_close(tils_conn_buf_t *buf, tils_conn_t *conn) {
+    int slot = _SLOT(buf, conn);
+    tils_conn_state res = buf->states[slot];
     if (res != CONN_CLEAN) {
+        TILS_PROBE3(conn__close, conn->client_fd, conn->close_reason,
+                conn->requests);
         close(conn->client_fd);
 
+        pool_put(buf->pool, conn->rbuf, conn->rbuf_cap);
+        conn->rbuf = NULL;
+        conn->rbuf_len = 0;
+
+        tils_conn_release_out(buf, conn);
+
         /* TODO Log forced death here */
-        conn->state = CONN_CLEAN;
+        buf->fds[slot] = -1;
+        buf->states[slot] = CONN_CLEAN;
     }
 
     return res;
 }
+
+/**
+ * @brief Allocate an empty connection buffer.
+ *
+ * @param[out] buf Where the new buffer is stored.
+ * @param capacity Max number of connections the buffer can hold.
+ * @param pool Pool the connections' buffers come from.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_conn_buf_init(tils_conn_buf_t **buf, int capacity, pool_t *pool) {
+    tils_conn_buf_t *res = calloc(sizeof(tils_conn_buf_t), 1);
+    if (res == NULL)
+        goto fail;
+
+    /* calloc leaves every slot as CONN_CLEAN. Slots past `size' are never
+     * read, so their fds needn't be set to -1 until they're used. */
+    if ((res->fds = calloc(sizeof(int), capacity)) == NULL)
+        goto cleanup_res;
+
+    if ((res->states = calloc(sizeof(uint8_t), capacity)) == NULL)
+        goto cleanup_fds;
+
+    if ((res->pending = calloc(sizeof(uint8_t), capacity)) == NULL)
+        goto cleanup_states;
+
+    if ((res->last_alive = calloc(sizeof(uint32_t), capacity)) == NULL)
+        goto cleanup_pending;
+
+    if ((res->conns = calloc(sizeof(tils_conn_t), capacity)) == NULL)
+        goto cleanup_last_alive;
+
+    res->capacity = capacity;
+    res->pool = pool;
+    res->size = 0;
+    res->cur = capacity - 1;
+
+    *buf = res;
+    return 0;
+
+cleanup_last_alive:
+    free(res->last_alive);
+
+cleanup_pending:
+    free(res->pending);
+
+cleanup_states:
+    free(res->states);
+
+cleanup_fds:
+    free(res->fds);
+
+cleanup_res:
+    free(res);
+
+fail:
+    *buf = NULL;
+    return -1;
+}
+
+/**
+ * @brief Number of slots that have to be visited to see every connection.
+ *
+ * @param buf The buffer being examined.
+ */
+int tils_conn_buf_size(tils_conn_buf_t *buf) {
+    return buf->size;
+}
+
+/**
+ * @brief Get the connection stored in slot i.
+ *
+ * @param buf The buffer being examined.
+ * @param i The slot, wraps around capacity.
+ * @param[out] conn The connection in that slot.
+ */
+void tils_conn_buf_at(tils_conn_buf_t *buf, int i, tils_conn_t **conn) {
+    *conn = &buf->conns[TILS_CONN_BUF_ELEM_AT(i, buf->capacity)];
+}
+
+/**
+ * @brief Mark every connection that has been quiet for too long as dead.
+ *
+ * A single branch free pass over the state & timestamp arrays, which the
+ * compiler can vectorize.
+ *
+ * @param buf The buffer being examined.
+ * @param now The current `tils_conn_clock'.
+ */
+void tils_conn_buf_expire(tils_conn_buf_t *buf, uint32_t now) {
+    uint8_t *states = buf->states;
+    uint32_t *last_alive = buf->last_alive;
+
+    for (int i = 0; i < buf->size; i++) {
+        uint8_t state = states[i];
+        uint32_t ttl = state == CONN_LINGER ? LINGER_TTL : TTL;
+        int expired = (state == CONN_ALIVE || state == CONN_LINGER) &
+            (now - last_alive[i] >= ttl);
+        states[i] = expired ? CONN_DEAD : state;
+    }
+}
+
+/**
+ * @brief Store a freshly accepted client in the buffer.
+ *
+ * Takes the first clean slot after the last one used. If the buffer is full,
+ * the oldest slot is forcibly closed and reused.
+ *
+ * @param buf The buffer being modified.
+ * @param client_fd The socket the client is on.
+ * @param addr The client's address.
+ *
+ * @return The connection now tracking client_fd.
+ */
+tils_conn_t *tils_conn_buf_push(tils_conn_buf_t *buf, int client_fd,
+        tils_addr_t *addr) {
+    int slot = TILS_CONN_BUF_ELEM_NEXT(buf->cur, buf->capacity);
+    for (int i = 0; i < buf->capacity; i++) {
+        int at = TILS_CONN_BUF_ELEM_AT(slot + i, buf->capacity);
+        if (buf->states[at] == CONN_CLEAN) {
+            slot = at;
+            break;
+        }
+    }
+
+    tils_conn_t *conn = &buf->conns[slot];
+    if (buf->states[slot] != CONN_CLEAN) {
+        char addr_buf[TILS_ADDRSTRLEN];
+        tils_addr_format(&conn->addr, addr_buf, sizeof(addr_buf));
+        log_warn("Connection buffer full, dropping %s", addr_buf);
+        conn->close_reason = CLOSE_EVICTED;
+        tils_conn_close(buf, conn);
+    }
+
+    memset(conn, 0, sizeof(*conn));
+    conn->client_fd = client_fd;
+    conn->addr = *addr;
+
+    buf->fds[slot] = client_fd;
+    buf->states[slot] = CONN_ALIVE;
+    buf->pending[slot] = 0;
+    buf->last_alive[slot] = tils_conn_clock();
+
+    buf->cur = slot;
+    if (slot >= buf->size)
+        buf->size = slot + 1;
+
+    return conn;
+}
+
+/**
+ * @brief Close every connection in the buffer and free it.
+ *
+ * @param buf The buffer being freed.
+ */
+void tils_conn_buf_free(tils_conn_buf_t *buf) {
+    if (buf == NULL)
+        return;
+
+    for (int i = 0; i < buf->size; i++) {
+        if (buf->states[i] != CONN_DEAD)
+            buf->conns[i].close_reason = CLOSE_RETIRED;
+        tils_conn_close(buf, &buf->conns[i]);
+    }
+
+    free(buf->conns);
+    free(buf->last_alive);
+    free(buf->pending);
+    free(buf->states);
+    free(buf->fds);
+    free(buf);
+}
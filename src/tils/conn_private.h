@@ -0,0 +1,32 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/conn_private.h
+ *
+ * @brief 'secret' details of connection implementation go here.
+ *
+ * @author Lars Wander (lars.wander@gmail.com)
+ */
+
+#ifndef _CONN_PRIVATE_H_
+#define _CONN_PRIVATE_H_
+
+/* Slot of a connection, i.e. its index in every array of buf */
+#define _SLOT(buf, conn) ((int)((conn) - (buf)->conns))
+
+#endif /* _CONN_PRIVATE_H_ */
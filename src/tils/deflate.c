@@ -0,0 +1,252 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/deflate.c
+ *
+ * @brief Streaming compression implementation
+ *
+ * A stream reads its file a block at a time, as the socket drains, and
+ * produces one chunk of chunked transfer coding at a time. Compressor
+ * contexts (a few hundred KB each) and the stream's buffers come from the
+ * worker, and go back to it, so once warmed up nothing is allocated per
+ * response.
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tils/deflate.h>
+
+/**
+ * @brief Allocate an empty compressor pool
+ */
+tils_zpool_t *tils_zpool_new() {
+    return calloc(sizeof(tils_zpool_t), 1);
+}
+
+/**
+ * @brief Free a pool and every idle compressor in it
+ */
+void tils_zpool_free(tils_zpool_t *zp) {
+    if (zp == NULL)
+        return;
+
+    for (int i = 0; i < zp->idle_count; i++) {
+        deflateEnd(&zp->idle[i]->zs);
+        free(zp->idle[i]);
+    }
+
+    free(zp);
+}
+
+/**
+ * @brief Take a compressor out of the pool, ready for a new gzip stream.
+ *
+ * @return The compressor, NULL on error.
+ */
+tils_zctx_t *_tils_zpool_get(tils_zpool_t *zp, int level) {
+    tils_zctx_t *ctx = NULL;
+
+    if (zp->idle_count > 0) {
+        ctx = zp->idle[--zp->idle_count];
+        if (deflateReset(&ctx->zs) != Z_OK)
+            goto cleanup_ctx;
+
+        /* Nothing has been fed in since the reset, so this can't fail for
+         * lack of output space. */
+        if (ctx->level != level) {
+            if (deflateParams(&ctx->zs, level, Z_DEFAULT_STRATEGY) != Z_OK)
+                goto cleanup_ctx;
+            ctx->level = level;
+        }
+
+        return ctx;
+    }
+
+    if ((ctx = calloc(sizeof(tils_zctx_t), 1)) == NULL)
+        return NULL;
+
+    /* 16 + window bits asks for a gzip rather than a zlib wrapper */
+    if (deflateInit2(&ctx->zs, level, Z_DEFLATED, 16 + MAX_WBITS,
+                MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(ctx);
+        return NULL;
+    }
+
+    ctx->level = level;
+    return ctx;
+
+cleanup_ctx:
+    deflateEnd(&ctx->zs);
+    free(ctx);
+    return NULL;
+}
+
+/**
+ * @brief Hand a compressor back to the pool.
+ */
+void _tils_zpool_put(tils_zpool_t *zp, tils_zctx_t *ctx) {
+    if (zp->idle_count == TILS_ZPOOL_MAX) {
+        deflateEnd(&ctx->zs);
+        free(ctx);
+        return;
+    }
+
+    zp->idle[zp->idle_count++] = ctx;
+}
+
+/**
+ * @brief Start gzipping a file range.
+ *
+ * @param zp Where the compressor comes from.
+ * @param pool Where the stream's buffers come from.
+ * @param file_fd The file, owned by the stream from here on, even on error.
+ * @param off Offset of the range.
+ * @param len Length of the range.
+ * @param level zlib compression level.
+ *
+ * @return The stream, NULL on error.
+ */
+tils_deflate_t *tils_deflate_new(tils_zpool_t *zp, pool_t *pool,
+        int file_fd, off_t off, size_t len, int level) {
+    int cap = 0;
+    tils_deflate_t *d = pool_get(pool, sizeof(tils_deflate_t), &cap);
+    if (d == NULL)
+        goto fail;
+
+    if ((d->ctx = _tils_zpool_get(zp, level)) == NULL)
+        goto cleanup_d;
+
+    d->zpool = zp;
+    d->pool = pool;
+    d->cap = cap;
+    d->file_fd = file_fd;
+    d->file_off = off;
+    d->file_left = len;
+    d->eof = 0;
+    d->done = 0;
+    d->send = NULL;
+    d->send_len = 0;
+    d->ctx->zs.next_in = NULL;
+    d->ctx->zs.avail_in = 0;
+    return d;
+
+cleanup_d:
+    pool_put(pool, d, cap);
+
+fail:
+    close(file_fd);
+    return NULL;
+}
+
+/**
+ * @brief Produce the next chunk, once the previous one has been sent.
+ *
+ * @param d The stream.
+ *
+ * At most TILS_DEFLATE_FILL_MAX bytes of the file are read, so the chunk can
+ * be empty when the input compresses very well; d->send_len is 0 then.
+ *
+ * @return 1 if the stream goes on, 0 if it is over, -1 on error.
+ */
+int tils_deflate_fill(tils_deflate_t *d) {
+    z_stream *zs = &d->ctx->zs;
+    char *data = d->out + 16;
+    size_t read = 0;
+    int res = Z_OK;
+
+    if (d->done)
+        return 0;
+
+    zs->next_out = (unsigned char *)data;
+    zs->avail_out = TILS_DEFLATE_OUT;
+
+    /* Deflate may swallow a lot of input before producing anything, keep
+     * going until there's a full chunk or the stream ends. */
+    while (zs->avail_out > 0 && res != Z_STREAM_END) {
+        if (zs->avail_in == 0 && !d->eof) {
+            if (read >= TILS_DEFLATE_FILL_MAX)
+                break;
+
+            size_t want = d->file_left < TILS_DEFLATE_IN ?
+                d->file_left : TILS_DEFLATE_IN;
+            ssize_t n = want == 0 ? 0 : pread(d->file_fd, d->in, want,
+                    d->file_off);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return -1;
+
+            read += n;
+            d->file_off += n;
+            d->file_left -= n;
+            if (n == 0 || d->file_left == 0)
+                d->eof = 1;
+
+            zs->next_in = (unsigned char *)d->in;
+            zs->avail_in = n;
+        }
+
+        res = deflate(zs, d->eof ? Z_FINISH : Z_NO_FLUSH);
+        if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+            return -1;
+    }
+
+    size_t len = TILS_DEFLATE_OUT - zs->avail_out;
+    char *end = data + len;
+    d->send = data;
+
+    if (len > 0) {
+        /* Chunk size line goes right in front of the data */
+        static const char hex[] = "0123456789abcdef";
+        *--d->send = '\n';
+        *--d->send = '\r';
+        for (size_t v = len; v > 0; v >>= 4)
+            *--d->send = hex[v & 0xf];
+
+        memcpy(end, "\r\n", 2);
+        end += 2;
+    }
+
+    if (res == Z_STREAM_END) {
+        memcpy(end, "0\r\n\r\n", 5);
+        end += 5;
+        d->done = 1;
+    }
+
+    d->send_len = end - d->send;
+    return 1;
+}
+
+/**
+ * @brief Release a stream, its file, buffers & compressor.
+ */
+void tils_deflate_free(tils_deflate_t *d) {
+    if (d == NULL)
+        return;
+
+    close(d->file_fd);
+    _tils_zpool_put(d->zpool, d->ctx);
+    pool_put(d->pool, d, d->cap);
+}
@@ -23,6 +23,7 @@
  * @author Lars Wander (lars.wander@gmail.com)
  */
 
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <ctype.h>
@@ -34,12 +35,64 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include <lib/util.h>
 #include <lib/logging.h>
 #include <tils/io_util.h>
 
+/**
+ * @brief Pack a client address into what a connection keeps of it
+ *
+ * @param addr The address as accept returned it
+ * @param[out] res The packed address
+ */
+void tils_addr_pack(struct sockaddr_storage *addr, tils_addr_t *res) {
+    memset(res, 0, sizeof(*res));
+    res->family = addr->ss_family;
+
+    if (addr->ss_family == AF_INET) {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        memcpy(res->addr, &in->sin_addr, sizeof(in->sin_addr));
+        res->port = in->sin_port;
+    } else if (addr->ss_family == AF_INET6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+        memcpy(res->addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+        res->port = in6->sin6_port;
+    }
+}
+
+/**
+ * @brief Print a client address for logging
+ *
+ * @param addr The address being printed
+ * @param buf Where the printable address is stored
+ * @param buf_len Length of buf, at least TILS_ADDRSTRLEN
+ *
+ * @return 0 on success, < 0 otherwise
+ */
+int tils_addr_format(const tils_addr_t *addr, char *buf, int buf_len) {
+    const char *res = NULL;
+
+    switch (addr->family) {
+        case AF_INET:
+        case AF_INET6:
+            res = inet_ntop(addr->family, addr->addr, buf, buf_len);
+            break;
+        case AF_UNIX:
+            res = strncpy(buf, "unix", buf_len);
+            break;
+    }
+
+    if (res == NULL) {
+        strncpy(buf, "?", buf_len);
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * @brief set keepalive state for input socket
  *
@@ -52,7 +105,129 @@ int tils_socket_keepalive(int sock) {
     socklen_t optlen = sizeof(optval);
     /* Set keepalive status */
     if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &optval, optlen) < 0) {
-        log_err("Unable to set keepalive to %d", optval);
+        log_err_errno("Unable to set keepalive to %d", optval);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Allow binding a listener's address while old connections to it are
+ *        still in TIME_WAIT
+ *
+ * @param sock The socket being modified
+ *
+ * @return 0 on success, < 0 otherwise
+ */
+int tils_socket_reuseaddr(int sock) {
+    int optval = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval,
+                sizeof(optval)) < 0) {
+        log_err_errno("Unable to set SO_REUSEADDR");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Disable Nagle's algorithm on the input socket
+ *
+ * @param sock The socket being modified
+ *
+ * @return 0 on success, < 0 otherwise
+ */
+int tils_socket_nodelay(int sock) {
+    int optval = 1;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval,
+                sizeof(optval)) < 0) {
+        log_err_errno("Unable to set TCP_NODELAY");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Ask the kernel to ACK immediately rather than delaying the ACK
+ *
+ * The kernel may fall back to delayed ACKs later on, so this is only a hint
+ * for the start of the connection (which is what we care about).
+ *
+ * @param sock The socket being modified
+ *
+ * @return 0 on success, < 0 otherwise
+ */
+int tils_socket_quickack(int sock) {
+    int optval = 1;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_QUICKACK, &optval,
+                sizeof(optval)) < 0) {
+        log_err_errno("Unable to set TCP_QUICKACK");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Don't report a connection as acceptable until data has arrived
+ *
+ * @param sock The listening socket being modified
+ * @param seconds How long to wait for data before accepting anyway
+ *
+ * @return 0 on success, < 0 otherwise
+ */
+int tils_socket_defer_accept(int sock, int seconds) {
+    if (setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds,
+                sizeof(seconds)) < 0) {
+        log_err_errno("Unable to set TCP_DEFER_ACCEPT to %d", seconds);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Allow clients to send data in the SYN (TCP fast open)
+ *
+ * @param sock The listening socket being modified
+ * @param qlen Max number of pending fast open requests
+ *
+ * @return 0 on success, < 0 otherwise
+ */
+int tils_socket_fastopen(int sock, int qlen) {
+    if (setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &qlen,
+                sizeof(qlen)) < 0) {
+        log_err_errno("Unable to set TCP_FASTOPEN to %d", qlen);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Set the kernel send & receive buffer sizes of the input socket
+ *
+ * Set these on the listening socket before `listen' so the window scale
+ * negotiated with the client reflects them - accepted sockets inherit them.
+ *
+ * @param sock The socket being modified
+ * @param sndbuf SO_SNDBUF in bytes, 0 leaves the kernel default
+ * @param rcvbuf SO_RCVBUF in bytes, 0 leaves the kernel default
+ *
+ * @return 0 on success, < 0 otherwise
+ */
+int tils_socket_bufsize(int sock, int sndbuf, int rcvbuf) {
+    if (sndbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf,
+                sizeof(sndbuf)) < 0) {
+        log_err_errno("Unable to set SO_SNDBUF to %d", sndbuf);
+        return -1;
+    }
+
+    if (rcvbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                sizeof(rcvbuf)) < 0) {
+        log_err_errno("Unable to set SO_RCVBUF to %d", rcvbuf);
         return -1;
     }
 
@@ -70,7 +245,7 @@ int tils_fd_nonblocking(int fd) {
     int res;
     if ((res = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) |
                     O_NONBLOCK)) < 0) {
-        log_err("Unable set status to non-blocking");
+        log_err_errno("Unable set status to non-blocking");
         return res;
     }
 
@@ -88,7 +263,7 @@ int tils_fd_blocking(int fd) {
     int res;
     if ((res = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) &
                     ~O_NONBLOCK)) < 0) {
-        log_err("Unable set status to blocking");
+        log_err_errno("Unable set status to blocking");
         return res;
     }
 
@@ -102,11 +277,11 @@ int tils_fd_blocking(int fd) {
  *
  * @return size on success, < 0 on failure
  */
-int tils_fd_size(int fd) {
+off_t tils_fd_size(int fd) {
     struct stat st;
     int res;
     if ((res = fstat(fd, &st)) < 0) {
-        log_err("Getting file info");
+        log_err_errno("Getting file info");
         return res;
     }
 
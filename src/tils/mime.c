@@ -0,0 +1,441 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/mime.c
+ *
+ * @brief MIME registry implementation
+ *
+ * Extensions are registered from a built in table, then optionally from a
+ * mime.types file. `tils_mime_build' then compiles them into a perfect hash
+ * (hash & displace): every extension is first hashed into a bucket, and each
+ * bucket gets a displacement that sends all of its extensions to slots no
+ * other extension uses. A lookup is two hashes and one comparison, and is
+ * done once per route rather than per request.
+ *
+ * @author Lars Wander
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <lib/logging.h>
+#include <tils/mime.h>
+
+#include "mime_private.h"
+
+static mime_ext_t *_exts = NULL;
+static int _ext_count = 0;
+static int _ext_cap = 0;
+
+static tils_mime_t **_types = NULL;
+static int _type_count = 0;
+static int _type_cap = 0;
+
+static tils_mime_t _default_mime = {
+    MIME_DEFAULT, sizeof(MIME_DEFAULT) - 1, 0
+};
+
+/* The perfect hash: a displacement per bucket, an index into _exts (or -1)
+ * per slot */
+static uint32_t *_displace = NULL;
+static int _bucket_count = 0;
+static int *_slots = NULL;
+static uint32_t _slot_mask = 0;
+
+/**
+ * @brief Case insensitive FNV-1a of an extension, seeded & finalized so that
+ *        different seeds give unrelated hashes.
+ */
+uint32_t _tils_mime_hash(const char *ext, int len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)tolower((unsigned char)ext[i]);
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * @brief Guess whether a type compresses well.
+ *
+ * @param type A bare type, e.g. "text/css".
+ */
+int _tils_mime_compressible(const char *type) {
+    static const char *compressible[] = {
+        "application/javascript", "application/x-javascript",
+        "application/ecmascript", "application/json", "application/xml",
+        "application/wasm", "application/vnd.ms-fontobject",
+        "image/x-icon", "image/vnd.microsoft.icon", "font/ttf", "font/otf",
+    };
+    int len = strlen(type);
+
+    if (strncmp(type, "text/", 5) == 0)
+        return 1;
+
+    if (len > 4 && (strcmp(type + len - 4, "+xml") == 0 ||
+                (len > 5 && strcmp(type + len - 5, "+json") == 0)))
+        return 1;
+
+    for (size_t i = 0; i < sizeof(compressible) / sizeof(*compressible); i++) {
+        if (strcmp(type, compressible[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Find or create a type.
+ *
+ * @param type A bare type, e.g. "text/css". Text types are served as UTF-8.
+ * @param compressible Whether the type is worth compressing.
+ *
+ * @return The type, NULL on error.
+ */
+tils_mime_t *_tils_mime_type(const char *type, int compressible) {
+    int text = strncmp(type, "text/", 5) == 0;
+    int len = strlen(type) + (text ? sizeof(MIME_CHARSET) - 1 : 0);
+
+    for (int i = 0; i < _type_count; i++) {
+        if (_types[i]->type_len == len &&
+                strncmp(_types[i]->type, type, strlen(type)) == 0)
+            return _types[i];
+    }
+
+    if (_type_count == _type_cap) {
+        int cap = _type_cap == 0 ? 64 : _type_cap * 2;
+        tils_mime_t **types = realloc(_types, cap * sizeof(*types));
+        if (types == NULL)
+            return NULL;
+
+        _types = types;
+        _type_cap = cap;
+    }
+
+    tils_mime_t *res = malloc(sizeof(tils_mime_t) + len + 1);
+    if (res == NULL)
+        return NULL;
+
+    res->type = (char *)(res + 1);
+    res->type_len = len;
+    res->compressible = compressible;
+    snprintf(res->type, len + 1, "%s%s", type, text ? MIME_CHARSET : "");
+
+    _types[_type_count++] = res;
+    return res;
+}
+
+/**
+ * @brief Map an extension to a type, replacing any earlier mapping.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int _tils_mime_add_ext(const char *ext, tils_mime_t *mime) {
+    int len = strlen(ext);
+
+    for (int i = 0; i < _ext_count; i++) {
+        if (_exts[i].ext_len == len && strcasecmp(_exts[i].ext, ext) == 0) {
+            _exts[i].mime = mime;
+            return 0;
+        }
+    }
+
+    if (_ext_count == _ext_cap) {
+        int cap = _ext_cap == 0 ? 64 : _ext_cap * 2;
+        mime_ext_t *exts = realloc(_exts, cap * sizeof(*exts));
+        if (exts == NULL)
+            return -1;
+
+        _exts = exts;
+        _ext_cap = cap;
+    }
+
+    char *copy = malloc(len + 1);
+    if (copy == NULL)
+        return -1;
+
+    for (int i = 0; i <= len; i++)
+        copy[i] = tolower((unsigned char)ext[i]);
+
+    _exts[_ext_count].ext = copy;
+    _exts[_ext_count].ext_len = len;
+    _exts[_ext_count].mime = mime;
+    _ext_count++;
+    return 0;
+}
+
+/**
+ * @brief Register the built in types.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_mime_init() {
+    for (size_t i = 0; i < sizeof(_mime_builtin) / sizeof(*_mime_builtin);
+            i++) {
+        tils_mime_t *mime = _tils_mime_type(_mime_builtin[i].type,
+                _mime_builtin[i].compressible);
+        if (mime == NULL || _tils_mime_add_ext(_mime_builtin[i].ext, mime) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Register the types listed in a mime.types file.
+ *
+ * Every line is a type followed by its extensions, '#' starts a comment.
+ * Extensions listed here replace the built in ones.
+ *
+ * @param path The file being read.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_mime_load(char *path) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    int res = -1;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        log_err_errno("Can't open %s", path);
+        goto fail;
+    }
+
+    while (getline(&line, &line_cap, file) >= 0) {
+        char *save = NULL;
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char *type = strtok_r(line, " \t\r\n", &save);
+        if (type == NULL || strlen(type) >= MIME_MAX_WORD ||
+                strchr(type, '/') == NULL)
+            continue;
+
+        tils_mime_t *mime = NULL;
+        char *ext;
+        while ((ext = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            if (strlen(ext) >= MIME_MAX_WORD)
+                continue;
+
+            /* Types without extensions aren't worth keeping around */
+            if (mime == NULL && (mime = _tils_mime_type(type,
+                            _tils_mime_compressible(type))) == NULL)
+                goto cleanup_line;
+
+            if (_tils_mime_add_ext(ext, mime) < 0)
+                goto cleanup_line;
+        }
+    }
+
+    res = 0;
+
+cleanup_line:
+    free(line);
+    fclose(file);
+
+fail:
+    return res;
+}
+
+/**
+ * @brief Try to place every extension in a table of slot_count slots.
+ *
+ * @return 0 on success, -1 if no placement was found (or on error).
+ */
+int _tils_mime_place(int bucket_count, uint32_t slot_count) {
+    int res = -1;
+    int *first = calloc(bucket_count + 1, sizeof(int));
+    int *members = malloc(_ext_count * sizeof(int));
+    int *order = malloc(bucket_count * sizeof(int));
+    uint32_t *displace = calloc(bucket_count, sizeof(uint32_t));
+    int *slots = malloc(slot_count * sizeof(int));
+    uint32_t mask = slot_count - 1;
+    int max_size = 0;
+
+    if (first == NULL || members == NULL || order == NULL ||
+            displace == NULL || slots == NULL)
+        goto cleanup;
+
+    for (uint32_t s = 0; s < slot_count; s++)
+        slots[s] = -1;
+
+    /* Group the extensions by bucket */
+    for (int i = 0; i < _ext_count; i++)
+        first[_tils_mime_hash(_exts[i].ext, _exts[i].ext_len, 0) %
+            bucket_count + 1]++;
+
+    for (int b = 0; b < bucket_count; b++) {
+        if (first[b + 1] > max_size)
+            max_size = first[b + 1];
+        first[b + 1] += first[b];
+        order[b] = first[b];
+    }
+
+    for (int i = 0; i < _ext_count; i++) {
+        int b = _tils_mime_hash(_exts[i].ext, _exts[i].ext_len, 0) %
+            bucket_count;
+        members[order[b]++] = i;
+    }
+
+    /* Place the largest buckets first, while the table is still empty */
+    int placed = 0;
+    for (int size = max_size; size > 0; size--) {
+        for (int b = 0; b < bucket_count; b++) {
+            if (first[b + 1] - first[b] == size)
+                order[placed++] = b;
+        }
+    }
+
+    for (int i = 0; i < placed; i++) {
+        int b = order[i];
+        uint32_t d;
+
+        for (d = 1; d < MIME_MAX_DISPLACE; d++) {
+            int k;
+            for (k = first[b]; k < first[b + 1]; k++) {
+                mime_ext_t *e = &_exts[members[k]];
+                uint32_t s = _tils_mime_hash(e->ext, e->ext_len, d) & mask;
+                if (slots[s] != -1)
+                    break;
+                slots[s] = members[k];
+            }
+
+            if (k == first[b + 1])
+                break;
+
+            /* Collision, undo this attempt */
+            for (int j = first[b]; j < k; j++) {
+                mime_ext_t *e = &_exts[members[j]];
+                slots[_tils_mime_hash(e->ext, e->ext_len, d) & mask] = -1;
+            }
+        }
+
+        if (d == MIME_MAX_DISPLACE)
+            goto cleanup;
+
+        displace[b] = d;
+    }
+
+    _displace = displace;
+    _bucket_count = bucket_count;
+    _slots = slots;
+    _slot_mask = mask;
+    displace = NULL;
+    slots = NULL;
+    res = 0;
+
+cleanup:
+    free(first);
+    free(members);
+    free(order);
+    free(displace);
+    free(slots);
+    return res;
+}
+
+/**
+ * @brief Compile every registered extension into the lookup table. Must be
+ *        called after the last `tils_mime_load', before any lookup.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_mime_build() {
+    uint32_t slot_count = 1;
+
+    free(_displace);
+    free(_slots);
+    _displace = NULL;
+    _slots = NULL;
+
+    if (_ext_count == 0)
+        return 0;
+
+    /* Start at a load of at most 80%, and grow if nothing fits */
+    while (slot_count < (uint32_t)(_ext_count + _ext_count / 4 + 1))
+        slot_count <<= 1;
+
+    for (; slot_count <= (1u << 24); slot_count <<= 1) {
+        if (_tils_mime_place(_ext_count / MIME_BUCKET_LOAD + 1,
+                    slot_count) == 0) {
+            log_info("Loaded %d MIME extensions (%u slots)", _ext_count,
+                    slot_count);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Find the type of a file by its extension.
+ *
+ * @param path The file's name.
+ *
+ * @return The type, application/octet-stream if it's unknown.
+ */
+const tils_mime_t *tils_mime_lookup(const char *path) {
+    const char *ext = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+
+    if (ext == NULL || (slash != NULL && slash > ext) || _slots == NULL)
+        return &_default_mime;
+
+    ext++;
+    int len = strlen(ext);
+    uint32_t b = _tils_mime_hash(ext, len, 0) % _bucket_count;
+    int i = _slots[_tils_mime_hash(ext, len, _displace[b]) & _slot_mask];
+
+    if (i >= 0 && _exts[i].ext_len == len &&
+            strncasecmp(_exts[i].ext, ext, len) == 0)
+        return _exts[i].mime;
+
+    return &_default_mime;
+}
+
+/**
+ * @brief Free every registered type.
+ */
+void tils_mime_cleanup() {
+    for (int i = 0; i < _ext_count; i++)
+        free(_exts[i].ext);
+
+    for (int i = 0; i < _type_count; i++)
+        free(_types[i]);
+
+    free(_exts);
+    free(_types);
+    free(_displace);
+    free(_slots);
+
+    _exts = NULL;
+    _types = NULL;
+    _displace = NULL;
+    _slots = NULL;
+    _ext_count = _ext_cap = 0;
+    _type_count = _type_cap = 0;
+}
@@ -0,0 +1,95 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/mime_private.h
+ *
+ * @brief 'secret' details of the MIME registry go here.
+ *
+ * @author Lars Wander (lars.wander@gmail.com)
+ */
+
+#ifndef _MIME_PRIVATE_H_
+#define _MIME_PRIVATE_H_
+
+#include <stdint.h>
+
+#include <tils/mime.h>
+
+/* Served when the extension is unknown */
+#define MIME_DEFAULT "application/octet-stream"
+
+/* Appended to text types */
+#define MIME_CHARSET "; charset=utf-8"
+
+/* Longest extension (and type) read from a mime.types file */
+#define MIME_MAX_WORD (128)
+
+/* Average number of extensions per bucket of the perfect hash */
+#define MIME_BUCKET_LOAD (4)
+
+/* Displacements tried for one bucket before the table is grown */
+#define MIME_MAX_DISPLACE (1 << 16)
+
+/**
+ * @brief An extension, and the type it maps to
+ */
+typedef struct mime_ext {
+    char *ext;
+    int ext_len;
+    tils_mime_t *mime;
+} mime_ext_t;
+
+/* Types known without any mime.types file */
+static const struct {
+    const char *ext;
+    const char *type;
+    int compressible;
+} _mime_builtin[] = {
+    { "html",  "text/html", 1 },
+    { "htm",   "text/html", 1 },
+    { "css",   "text/css", 1 },
+    { "js",    "application/javascript", 1 },
+    { "mjs",   "application/javascript", 1 },
+    { "json",  "application/json", 1 },
+    { "map",   "application/json", 1 },
+    { "xml",   "application/xml", 1 },
+    { "txt",   "text/plain", 1 },
+    { "md",    "text/markdown", 1 },
+    { "csv",   "text/csv", 1 },
+    { "svg",   "image/svg+xml", 1 },
+    { "ico",   "image/x-icon", 1 },
+    { "png",   "image/png", 0 },
+    { "jpg",   "image/jpeg", 0 },
+    { "jpeg",  "image/jpeg", 0 },
+    { "gif",   "image/gif", 0 },
+    { "webp",  "image/webp", 0 },
+    { "avif",  "image/avif", 0 },
+    { "woff",  "font/woff", 0 },
+    { "woff2", "font/woff2", 0 },
+    { "ttf",   "font/ttf", 1 },
+    { "otf",   "font/otf", 1 },
+    { "wasm",  "application/wasm", 1 },
+    { "pdf",   "application/pdf", 0 },
+    { "zip",   "application/zip", 0 },
+    { "gz",    "application/gzip", 0 },
+    { "mp3",   "audio/mpeg", 0 },
+    { "mp4",   "video/mp4", 0 },
+    { "webm",  "video/webm", 0 },
+};
+
+#endif /* _MIME_PRIVATE_H_ */
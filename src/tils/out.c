@@ -0,0 +1,417 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/out.c
+ *
+ * @brief Output chain implementation
+ *
+ * A response is a list of segments - headers formatted into the arena,
+ * slices of cached files shared by every connection sending them, and file
+ * ranges too large to cache. Memory segments are written together with a
+ * single sendmsg, file ranges go out with sendfile, so nothing is copied into
+ * an intermediate buffer. Streams compressed on the fly are sent one chunk
+ * at a time, as the socket drains.
+ *
+ * Chains are built in the worker's arena. If the socket can't take the whole
+ * response at once, the rest is moved into a single pool buffer (copying only
+ * the arena bytes), and written whenever the socket becomes writable again.
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <lib/bench.h>
+#include <tils/out.h>
+
+/**
+ * @brief Allocate an empty chain in the arena.
+ *
+ * @param arena Where the chain & its segments live until sent.
+ *
+ * @return The chain, NULL on error.
+ */
+tils_out_t *tils_out_new(arena_t *arena) {
+    tils_out_t *res = arena_alloc(arena, sizeof(tils_out_t));
+    if (res == NULL)
+        return NULL;
+
+    res->head = NULL;
+    res->tail = NULL;
+    res->arena = arena;
+    res->seg_count = 0;
+    res->len = 0;
+    res->status = 0;
+    res->sent_ns = 0;
+    res->total = 0;
+    return res;
+}
+
+/**
+ * @brief Append a segment of the given kind.
+ *
+ * @return The new segment, NULL on error.
+ */
+tils_out_seg_t *_tils_out_push(tils_out_t *out, tils_out_kind kind,
+        size_t len) {
+    /* Detached chains are only ever drained. */
+    if (out->arena == NULL)
+        return NULL;
+
+    tils_out_seg_t *seg = arena_alloc(out->arena, sizeof(tils_out_seg_t));
+    if (seg == NULL)
+        return NULL;
+
+    memset(seg, 0, sizeof(*seg));
+    seg->kind = kind;
+    seg->len = len;
+    seg->file_fd = -1;
+
+    if (out->tail == NULL)
+        out->head = seg;
+    else
+        out->tail->next = seg;
+
+    out->tail = seg;
+    out->seg_count++;
+    out->len += len;
+    return seg;
+}
+
+/**
+ * @brief Release whatever the first segment holds, and drop it.
+ */
+void _tils_out_pop(tils_out_t *out) {
+    tils_out_seg_t *seg = out->head;
+
+    if (seg->kind == OUT_BLOB)
+        blob_unref(seg->blob);
+    else if (seg->kind == OUT_FILE)
+        close(seg->file_fd);
+    else if (seg->kind == OUT_DEFLATE)
+        tils_deflate_free(seg->deflate);
+
+    out->len -= seg->len;
+    out->head = seg->next;
+    if (out->head == NULL)
+        out->tail = NULL;
+    out->seg_count--;
+}
+
+/**
+ * @brief Mark n bytes from the front of the chain as sent.
+ */
+void _tils_out_advance(tils_out_t *out, size_t n) {
+    while (n > 0) {
+        tils_out_seg_t *seg = out->head;
+        if (n < seg->len) {
+            if (seg->kind == OUT_FILE)
+                seg->file_off += n;
+            else
+                seg->data += n;
+
+            seg->len -= n;
+            out->len -= n;
+            return;
+        }
+
+        n -= seg->len;
+        _tils_out_pop(out);
+    }
+}
+
+/**
+ * @brief Append len bytes living in the chain's arena.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_out_bytes(tils_out_t *out, const char *data, size_t len) {
+    tils_out_seg_t *seg;
+    if (len == 0)
+        return 0;
+
+    if ((seg = _tils_out_push(out, OUT_BYTES, len)) == NULL)
+        return -1;
+
+    seg->data = data;
+    return 0;
+}
+
+/**
+ * @brief Append len bytes that are never freed, they are never copied.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_out_const(tils_out_t *out, const char *data, size_t len) {
+    tils_out_seg_t *seg;
+    if (len == 0)
+        return 0;
+
+    if ((seg = _tils_out_push(out, OUT_CONST, len)) == NULL)
+        return -1;
+
+    seg->data = data;
+    return 0;
+}
+
+/**
+ * @brief Append a slice of a blob. The chain takes its own reference.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_out_blob(tils_out_t *out, blob_t *blob, size_t off, size_t len) {
+    tils_out_seg_t *seg;
+    if (len == 0)
+        return 0;
+
+    if ((seg = _tils_out_push(out, OUT_BLOB, len)) == NULL)
+        return -1;
+
+    seg->blob = blob_ref(blob);
+    seg->data = blob_data(blob) + off;
+    return 0;
+}
+
+/**
+ * @brief Append a file range. The chain owns file_fd from here on, even if
+ *        this fails.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_out_file(tils_out_t *out, int file_fd, off_t off, size_t len) {
+    tils_out_seg_t *seg;
+    if (len == 0) {
+        close(file_fd);
+        return 0;
+    }
+
+    if ((seg = _tils_out_push(out, OUT_FILE, len)) == NULL) {
+        close(file_fd);
+        return -1;
+    }
+
+    seg->file_fd = file_fd;
+    seg->file_off = off;
+    return 0;
+}
+
+/**
+ * @brief Append a compressed stream. The chain owns it from here on, even
+ *        if this fails.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_out_deflate(tils_out_t *out, tils_deflate_t *deflate) {
+    tils_out_seg_t *seg;
+    if ((seg = _tils_out_push(out, OUT_DEFLATE, 0)) == NULL) {
+        tils_deflate_free(deflate);
+        return -1;
+    }
+
+    seg->deflate = deflate;
+    return 0;
+}
+
+/**
+ * @brief Send what a compressed stream has ready, producing at most one more
+ *        chunk.
+ *
+ * Compressing a whole file in one go would hold up every other connection
+ * of the worker, so only a chunk is produced each time the socket is
+ * writable & the rest waits for the next pass of the event loop.
+ *
+ * @return 1 once the stream is over, 0 if there's more to send later, -1 on
+ *         error.
+ */
+int _tils_out_flush_deflate(tils_deflate_t *d, int fd) {
+    int filled = 0;
+    while (1) {
+        if (d->send_len == 0) {
+            if (d->done)
+                return 1;
+            if (filled)
+                return 0;
+
+            filled = 1;
+            if (tils_deflate_fill(d) < 0)
+                return -1;
+            continue;
+        }
+
+        ssize_t sent = send(fd, d->send, d->send_len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        d->send += sent;
+        d->send_len -= sent;
+    }
+}
+
+/**
+ * @brief Write as much of the chain to fd as it will take without blocking.
+ *
+ * Sent segments are released as soon as they are done with.
+ *
+ * @param out The chain being sent.
+ * @param fd The (non blocking) client socket.
+ *
+ * @return 1 once everything was sent, 0 if the socket is full or a compressed
+ *         stream has more to produce, -1 on error.
+ */
+int tils_out_flush(tils_out_t *out, int fd) {
+    struct iovec iov[TILS_OUT_IOV_MAX];
+    struct msghdr msg;
+    ssize_t res;
+    BENCH_SCOPE(BENCH_SEND);
+
+    while (out->head != NULL) {
+        tils_out_seg_t *seg = out->head;
+
+        if (seg->kind == OUT_DEFLATE) {
+            int done = _tils_out_flush_deflate(seg->deflate, fd);
+            if (done <= 0)
+                return done;
+
+            _tils_out_pop(out);
+            continue;
+        } else if (seg->kind == OUT_FILE) {
+            off_t off = seg->file_off;
+            res = sendfile(fd, seg->file_fd, &off, seg->len);
+        } else {
+            int n = 0;
+            while (seg != NULL && seg->kind != OUT_FILE &&
+                    seg->kind != OUT_DEFLATE && n < TILS_OUT_IOV_MAX) {
+                iov[n].iov_base = (void *)seg->data;
+                iov[n].iov_len = seg->len;
+                n++;
+                seg = seg->next;
+            }
+
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+
+            /* Don't push a partial packet out ahead of what follows. */
+            res = sendmsg(fd, &msg,
+                    MSG_NOSIGNAL | (seg != NULL ? MSG_MORE : 0));
+        }
+
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        /* Only sendfile returns 0 - the file shrank under us. */
+        if (res == 0)
+            return -1;
+
+        _tils_out_advance(out, res);
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Move what's left of a chain out of the arena, into one pool buffer.
+ *
+ * References to blobs & files move over to the new chain, bytes from the
+ * arena are copied. The old chain is left empty.
+ *
+ * @param out The chain, built in an arena that is about to be reset.
+ * @param pool Where the new chain is allocated.
+ * @param[out] cap Size of the new chain's buffer, for `pool_put'.
+ *
+ * @return The new chain, NULL on error (out is left untouched).
+ */
+tils_out_t *tils_out_detach(tils_out_t *out, pool_t *pool, int *cap) {
+    size_t size = sizeof(tils_out_t) + out->seg_count * sizeof(tils_out_seg_t);
+    tils_out_seg_t *seg = NULL;
+    int i = 0;
+
+    for (seg = out->head; seg != NULL; seg = seg->next) {
+        if (seg->kind == OUT_BYTES)
+            size += seg->len;
+    }
+
+    if (size > INT_MAX)
+        return NULL;
+
+    tils_out_t *res = pool_get(pool, size, cap);
+    if (res == NULL)
+        return NULL;
+
+    tils_out_seg_t *segs = (tils_out_seg_t *)(res + 1);
+    char *bytes = (char *)(segs + out->seg_count);
+
+    for (seg = out->head; seg != NULL; seg = seg->next, i++) {
+        segs[i] = *seg;
+        segs[i].next = NULL;
+        if (i > 0)
+            segs[i - 1].next = &segs[i];
+
+        if (seg->kind == OUT_BYTES) {
+            memcpy(bytes, seg->data, seg->len);
+            segs[i].data = bytes;
+            bytes += seg->len;
+        }
+    }
+
+    res->head = i > 0 ? &segs[0] : NULL;
+    res->tail = i > 0 ? &segs[i - 1] : NULL;
+    res->arena = NULL;
+    res->seg_count = out->seg_count;
+    res->len = out->len;
+    res->sent_ns = out->sent_ns;
+    res->total = out->total;
+
+    out->head = NULL;
+    out->tail = NULL;
+    out->seg_count = 0;
+    out->len = 0;
+    return res;
+}
+
+/**
+ * @brief Drop everything the chain still holds without sending it.
+ *
+ * @param out The chain being released, may be NULL.
+ */
+void tils_out_release(tils_out_t *out) {
+    if (out == NULL)
+        return;
+
+    while (out->head != NULL)
+        _tils_out_pop(out);
+}
@@ -23,128 +23,399 @@
  * @author Lars Wander
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 
 #include <tils/request.h>
+#include <lib/probes.h>
 #include <lib/util.h>
 
+#define METHOD(m) { #m, sizeof(#m) - 1, TILS_ ## m }
+
+static const struct {
+    const char *name;
+    int len;
+    tils_http_request_e type;
+} _methods[] = {
+    METHOD(GET),
+    METHOD(POST),
+    METHOD(PUT),
+    METHOD(HEAD),
+    METHOD(OPTIONS),
+    METHOD(DELETE),
+    METHOD(TRACE),
+    METHOD(CONNECT),
+};
+
+#define ENCODING(n, e) { n, sizeof(n) - 1, TILS_ENC_ ## e }
+
+static const struct {
+    const char *name;
+    int len;
+    tils_http_encoding_e encoding;
+} _encodings[] = {
+    ENCODING("identity", IDENTITY),
+    ENCODING("gzip", GZIP),
+    ENCODING("x-gzip", GZIP),
+    ENCODING("br", BR),
+};
+
+/* Digits a Range position may have, so it can't overflow an off_t */
+#define RANGE_POS_DIGITS (18)
+
 /**
- * @brief Get the request type from an HTTP header.
+ * @brief The name of a method, e.g. "GET".
+ */
+const char *tils_request_method_name(tils_http_request_e type) {
+    for (int i = 0; i < sizeof(_methods) / sizeof(_methods[0]); i++) {
+        if (_methods[i].type == type)
+            return _methods[i].name;
+    }
+
+    return "UNKNOWN";
+}
+
+/**
+ * @brief Get the request type from an HTTP method.
  *
- * @param request The HTTP request in string form.
- * @param request_len The size of the request (cannot be greater than the size
- *                    of the buffer).
+ * @param method The method, not NUL terminated.
+ * @param method_len The length of the method.
  *
  * @return The request type.
  */
-tils_http_request_e _tils_request_type(char *request, int request_len) {
-    if (strncmp("GET", request, request_len) == 0)
-        return TILS_GET;
-    else if (strncmp("POST", request, request_len) == 0)
-        return TILS_POST;
-    else if (strncmp("PUT", request, request_len) == 0)
-        return TILS_PUT;
-    else if (strncmp("HEAD", request, request_len) == 0)
-        return TILS_HEAD;
-    else if (strncmp("OPTIONS", request, request_len) == 0)
-        return TILS_OPTIONS;
-    else if (strncmp("DELETE", request, request_len) == 0)
-        return TILS_DELETE;
-    else if (strncmp("TRACE", request, request_len) == 0)
-        return TILS_TRACE;
-    else if (strncmp("CONNECT", request, request_len) == 0)
-        return TILS_CONNECT;
-    else
-        return TILS_UNKNOWN;
+tils_http_request_e _tils_request_type(char *method, int method_len) {
+    for (int i = 0; i < (int)(sizeof(_methods) / sizeof(_methods[0])); i++) {
+        if (_methods[i].len == method_len &&
+                memcmp(_methods[i].name, method, method_len) == 0)
+            return _methods[i].type;
+    }
+
+    return TILS_UNKNOWN;
+}
+
+/**
+ * @brief Trim whitespace off both ends of [*start, *end).
+ */
+void _tils_trim(char **start, char **end) {
+    while (*start < *end && isspace((int)**start))
+        (*start)++;
+    while (*end > *start && isspace((int)(*end)[-1]))
+        (*end)--;
+}
+
+/**
+ * @brief Find how much of a buffer the request headers take up.
+ *
+ * @param request The buffer received so far.
+ * @param request_len The number of bytes received.
+ *
+ * @return Length of the request line and headers, including the blank line
+ *         ending them. 0 if they haven't all arrived yet.
+ */
+int tils_request_length(char *request, int request_len) {
+    char *end = memmem(request, request_len, "\r\n\r\n", 4);
+    if (end == NULL)
+        return 0;
+
+    return end - request + 4;
 }
 
 /**
- * @brief Read a whitespace delinated word out of ibuf and into obuf.
+ * @brief Look up a header by (case insensitive) name.
  *
- * @param ibuf The input buffer being read from.
- * @param ibuf_len The input buffer length.
- * @param obuf The output buffer being read from.
- * @param obuf_len The output buffer length.
- * @param word_start The start of the word being read.
+ * @param request The parsed request.
+ * @param name The header name.
  *
- * @return The length of the word that was read.
+ * @return The header value, NULL if it wasn't sent.
  */
-int _read_word(char *ibuf, int ibuf_len, char *obuf, int obuf_len,
-        int word_start) {
-    int len = 0;
-    int i = word_start;
-    while (i < ibuf_len && len < obuf_len - 1 && !isspace((int)ibuf[i])) {
-        obuf[len] = ibuf[i];
-        i++;
-        len++;
+char *tils_request_header(tils_http_request_t *request, char *name) {
+    for (int i = 0; i < request->header_count; i++) {
+        if (strcasecmp(request->headers[i].name, name) == 0)
+            return request->headers[i].value;
     }
 
-    obuf[len] = '\0';
-    return len;
+    return NULL;
 }
 
 /**
- * @brief Finds the next non-whitespace character starting at index.
+ * @brief Check a comma separated header value for a (case insensitive) token.
  *
- * @param buf The buffer being searched.
- * @param buf_len The length of the buffer being searched.
- * @param index The index the search starts from.
+ * @param value The header value, e.g. "keep-alive, Upgrade".
+ * @param token The token looked for.
  *
- * @return The index of the first non-whitespace charcter after index.
+ * @return 1 if it's listed, 0 if not.
  */
-int _next_word(char *buf, int buf_len, int index) {
-    while (index < buf_len && isspace((int)buf[index]))
-        index++;
-    return index;
+int _tils_request_has_token(char *value, const char *token) {
+    size_t token_len = strlen(token);
+
+    while (*value != '\0') {
+        char *end = strchr(value, ',');
+        if (end == NULL)
+            end = value + strlen(value);
+        char *next = *end == ',' ? end + 1 : end;
+
+        _tils_trim(&value, &end);
+        if ((size_t)(end - value) == token_len &&
+                strncasecmp(value, token, token_len) == 0)
+            return 1;
+
+        value = next;
+    }
+
+    return 0;
 }
 
 /**
- * @brief Frees a tils request.
+ * @brief Find which content codings the client accepts.
+ *
+ * Codings listed in Accept-Encoding with a nonzero q value are accepted,
+ * as is everything else when "*" is. Identity is always acceptable.
  *
- * @param request Request to free.
+ * @param request The parsed request.
+ *
+ * @return A bit mask, 1 << TILS_ENC_* for every acceptable coding.
  */
-void tils_free_request(tils_http_request_t *request) {
-    if (request == NULL)
-        return;
-    if (request->resource != NULL)
-        free(request->resource);
-    free(request);
+int tils_request_encodings(tils_http_request_t *request) {
+    int accepted = 1 << TILS_ENC_IDENTITY;
+    int refused = 0;
+    int star = 0;
+    char *p = tils_request_header(request, "Accept-Encoding");
+    if (p == NULL)
+        return accepted;
+
+    while (*p != '\0') {
+        char *end = strchr(p, ',');
+        if (end == NULL)
+            end = p + strlen(p);
+
+        /* coding [; q=value] */
+        char *name_end = memchr(p, ';', end - p);
+        char *params = name_end;
+        if (name_end == NULL)
+            name_end = end;
+        _tils_trim(&p, &name_end);
+
+        int q = 1;
+        if (params != NULL) {
+            char *qv = params + 1;
+            while (qv < end && isspace((int)*qv))
+                qv++;
+            if (end - qv >= 2 && (qv[0] == 'q' || qv[0] == 'Q') &&
+                    qv[1] == '=')
+                q = strtod(qv + 2, NULL) > 0;
+        }
+
+        if (name_end - p == 1 && *p == '*') {
+            star = q;
+        } else {
+            for (int i = 0; i < (int)(sizeof(_encodings) /
+                        sizeof(_encodings[0])); i++) {
+                if (_encodings[i].len == name_end - p &&
+                        strncasecmp(_encodings[i].name, p, name_end - p) == 0) {
+                    if (q)
+                        accepted |= 1 << _encodings[i].encoding;
+                    else
+                        refused |= 1 << _encodings[i].encoding;
+                }
+            }
+        }
+
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (star)
+        accepted |= ((1 << TILS_ENC_COUNT) - 1) & ~refused;
+
+    return accepted | (1 << TILS_ENC_IDENTITY);
+}
+
+/**
+ * @brief Parse a decimal byte position off the front of [*p, end).
+ *
+ * @return The position, -1 if there are no digits or too many.
+ */
+off_t _tils_request_pos(char **p, char *end) {
+    off_t res = 0;
+    char *start = *p;
+
+    for (; *p < end && isdigit((int)**p); (*p)++) {
+        /* Any more could overflow */
+        if (*p - start == RANGE_POS_DIGITS)
+            return -1;
+        res = res * 10 + (**p - '0');
+    }
+
+    return *p == start ? -1 : res;
+}
+
+/**
+ * @brief Resolve a Range header against a body.
+ *
+ * Ranges are kept in the order they were asked for. Ranges starting past
+ * the end of the body are dropped, ones running past it are cut short.
+ *
+ * @param value The Range header value, e.g. "bytes=0-99,200-,-50".
+ * @param size The length of the body.
+ * @param[out] ranges At least max ranges.
+ * @param max The most ranges honored.
+ *
+ * @return The number of ranges, 0 if the header should be ignored (it isn't
+ *         valid, isn't in bytes, or asks for too many ranges), -1 if no range
+ *         can be satisfied.
+ */
+int tils_request_ranges(char *value, off_t size, tils_http_range_t *ranges,
+        int max) {
+    int count = 0;
+    int asked = 0;
+
+    while (isspace((int)*value))
+        value++;
+
+    if (strncasecmp(value, "bytes=", 6) != 0)
+        return 0;
+
+    char *p = value + 6;
+    while (*p != '\0') {
+        char *end = strchr(p, ',');
+        if (end == NULL)
+            end = p + strlen(p);
+        char *next = *end == ',' ? end + 1 : end;
+
+        /* first-last, first- or -suffix. Empty list elements are allowed */
+        _tils_trim(&p, &end);
+        if (p == end) {
+            p = next;
+            continue;
+        }
+
+        off_t first = -1, last = -1;
+        if (*p != '-' && (first = _tils_request_pos(&p, end)) < 0)
+            return 0;
+        if (p == end || *p++ != '-')
+            return 0;
+        if (p < end && (last = _tils_request_pos(&p, end)) < 0)
+            return 0;
+        if (p != end || (first < 0 && last < 0) ||
+                (first >= 0 && last >= 0 && first > last))
+            return 0;
+
+        if (++asked > max)
+            return 0;
+
+        if (first < 0) {
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        } else if (last < 0 || last >= size) {
+            last = size - 1;
+        }
+
+        if (first < size && first <= last) {
+            ranges[count].first = first;
+            ranges[count].last = last;
+            count++;
+        }
+
+        p = next;
+    }
+
+    if (asked == 0)
+        return 0;
+
+    return count > 0 ? count : -1;
 }
 
 /**
  * @brief Parse an incoming HTTP request.
  *
- * @param request A buffer containing the actual request.
- * @param request_len The length of the request buffer.
+ * @param arena Where the result is allocated.
+ * @param request A buffer containing the request line and headers.
+ * @param request_len The length given by `tils_request_length'.
  *
- * @return The parsed request as a `tils_http_request_t`.
+ * @return The parsed request as a `tils_http_request_t`, NULL if malformed.
  */
-tils_http_request_t *tils_parse_request(char *request, int request_len) {
-    char word[WORD_BUF_SIZE];
-    char resource[WORD_BUF_SIZE];
-    int word_len = 0;
-    tils_http_request_e request_type = TILS_UNKNOWN;
-    tils_http_request_t *result = malloc(sizeof(tils_http_request_t));
+tils_http_request_t *tils_parse_request(arena_t *arena, char *request,
+        int request_len) {
+    char *end = request + request_len;
+    char *p = request;
+    char *sp, *eol;
+
+    tils_http_request_t *result = arena_alloc(arena,
+            sizeof(tils_http_request_t));
     if (result == NULL)
-        return result;
+        return NULL;
+
+    result->headers = arena_alloc(arena,
+            sizeof(tils_http_header_t) * MAX_HEADERS);
+    if (result->headers == NULL)
+        return NULL;
+
+    result->header_count = 0;
+    result->body_len = 0;
+
+    /* Request line: METHOD SP resource SP HTTP/1.x CRLF */
+    if ((eol = memchr(p, '\r', end - p)) == NULL ||
+            (sp = memchr(p, ' ', eol - p)) == NULL)
+        return NULL;
+
+    result->request_type = _tils_request_type(p, sp - p);
 
-    /* Start parsing it word by word */
-    /* TODO More robust parsing of requests */
-    int index = _next_word(request, request_len, 0);
-    word_len = _read_word(request, REQUEST_BUF_SIZE, word, WORD_BUF_SIZE, index);
-    request_type = _tils_request_type(word, word_len);
+    p = sp + 1;
+    if ((sp = memchr(p, ' ', eol - p)) == NULL || sp == p)
+        return NULL;
 
-    index = _next_word(request, request_len, index + word_len);
-    word_len = _read_word(request, REQUEST_BUF_SIZE, resource, WORD_BUF_SIZE,
-            index);
+    if ((result->resource = arena_strndup(arena, p, sp - p)) == NULL)
+        return NULL;
 
-    result->request_type = request_type;
-    result->resource = malloc(word_len + 1);
-    strncpy(result->resource, resource, word_len);
-    result->resource[word_len] = '\0';
+    p = sp + 1;
+    if (eol - p != 8 || memcmp(p, "HTTP/1.", 7) != 0 || !isdigit((int)p[7]))
+        return NULL;
+
+    result->minor_version = p[7] - '0';
+
+    /* Headers: name ":" value CRLF, until the blank line */
+    p = eol + 2;
+    while (p < end && (eol = memchr(p, '\r', end - p)) != NULL && eol != p) {
+        char *colon = memchr(p, ':', eol - p);
+        if (colon == NULL || colon == p)
+            return NULL;
+
+        if (result->header_count < MAX_HEADERS) {
+            tils_http_header_t *header =
+                &result->headers[result->header_count++];
+            char *value = colon + 1, *value_end = eol;
+            _tils_trim(&value, &value_end);
+
+            header->name = arena_strndup(arena, p, colon - p);
+            header->value = arena_strndup(arena, value, value_end - value);
+            if (header->name == NULL || header->value == NULL)
+                return NULL;
+        }
+
+        p = eol + 2;
+    }
+
+    char *content_length = tils_request_header(result, "Content-Length");
+    if (content_length != NULL) {
+        char *num_end = NULL;
+        result->body_len = strtol(content_length, &num_end, 10);
+        if (*num_end != '\0' || result->body_len < 0)
+            return NULL;
+    }
+
+    char *connection = tils_request_header(result, "Connection");
+    if (result->minor_version >= 1)
+        result->keep_alive = connection == NULL ||
+            !_tils_request_has_token(connection, "close");
+    else
+        result->keep_alive = connection != NULL &&
+            _tils_request_has_token(connection, "keep-alive");
 
+    TILS_PROBE3(request__parsed, result->request_type, result->resource,
+            request_len);
     return result;
 }
@@ -0,0 +1,321 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/response.c
+ *
+ * @brief Response header builder implementation
+ *
+ * Headers are pasted together from fragments known at compile time, with
+ * memcpy. The only things printed per response are numbers (with
+ * `tils_utoa') and the Date header, which each thread formats at most once a
+ * second.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <lib/util.h>
+#include <tils/response.h>
+
+#include "response_private.h"
+
+static _Thread_local date_cache_t _date = { .now = -1 };
+
+/**
+ * @brief Print v in decimal.
+ *
+ * @param[out] buf At least TILS_UTOA_LEN bytes, not NUL terminated.
+ * @param v The value being printed.
+ *
+ * @return The number of characters written.
+ */
+int tils_utoa(char *buf, unsigned long v) {
+    char tmp[TILS_UTOA_LEN];
+    char *p = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        int pair = (v % 100) * 2;
+        v /= 100;
+        p -= 2;
+        p[0] = _digit_pairs[pair];
+        p[1] = _digit_pairs[pair + 1];
+    }
+
+    if (v >= 10) {
+        p -= 2;
+        p[0] = _digit_pairs[v * 2];
+        p[1] = _digit_pairs[v * 2 + 1];
+    } else {
+        *--p = '0' + v;
+    }
+
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+/**
+ * @brief Format a time as an HTTP date.
+ *
+ * @param t The time.
+ * @param[out] buf At least TILS_HTTP_DATE_LEN + 1 bytes.
+ */
+void tils_http_date(time_t t, char *buf) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, TILS_HTTP_DATE_LEN + 1, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/**
+ * @brief Parse a date in the preferred HTTP format, as sent in e.g.
+ *        If-Modified-Since: "Sun, 06 Nov 1994 08:49:37 GMT".
+ *
+ * @param s The date.
+ * @param[out] t The time it stands for.
+ *
+ * @return 0 on success, -1 if s isn't such a date.
+ */
+int tils_parse_http_date(const char *s, time_t *t) {
+    char month[4];
+    int day, year, hour, min, sec, mon = -1, n = 0;
+
+    if (strlen(s) != TILS_HTTP_DATE_LEN ||
+            sscanf(s + 5, "%2d %3s %4d %2d:%2d:%2d GMT%n", &day, month, &year,
+                &hour, &min, &sec, &n) != 6 || n != TILS_HTTP_DATE_LEN - 5)
+        return -1;
+
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(month, _month_names[i]) == 0)
+            mon = i;
+    }
+
+    if (mon < 0 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60)
+        return -1;
+
+    /* Days since the epoch of the civil date, without going through the
+     * local timezone like mktime does. */
+    int y = year - (mon < 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mon + (mon < 2 ? 10 : -2)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = era * 146097L + doe - 719468;
+
+    *t = days * 86400 + hour * 3600 + min * 60 + sec;
+    return 0;
+}
+
+/**
+ * @brief The Date header line for the current second.
+ *
+ * @return DATE_LINE_LEN bytes, valid until the next call on this thread.
+ */
+const char *_tils_date_line() {
+    time_t now = time(NULL);
+
+    if (now != _date.now) {
+        memcpy(_date.line, "Date: ", 6);
+        tils_http_date(now, _date.line + 6);
+        memcpy(_date.line + 6 + TILS_HTTP_DATE_LEN, "\r\n", 3);
+        _date.now = now;
+    }
+
+    return _date.line;
+}
+
+/**
+ * @return The numeric code of a status, e.g. 404.
+ */
+int tils_status_code(tils_http_status_e status) {
+    return _status_lines[status].code;
+}
+
+/**
+ * @brief Start an empty block of header bytes, e.g. those of the parts of a
+ *        multipart body.
+ *
+ * @param[out] h The block being started.
+ * @param arena Where the block is allocated.
+ * @param cap The most bytes it will hold.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_hdr_open(tils_hdr_t *h, arena_t *arena, int cap) {
+    if ((h->buf = arena_alloc(arena, cap)) == NULL)
+        return -1;
+
+    h->len = 0;
+    h->cap = cap;
+    h->overflow = 0;
+    h->status = 0;
+    return 0;
+}
+
+/**
+ * @brief Start a header block: status line, Server & Date.
+ *
+ * @param[out] h The block being started.
+ * @param arena Where the block is allocated.
+ * @param status The response status.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_hdr_begin(tils_hdr_t *h, arena_t *arena, tils_http_status_e status) {
+    if (tils_hdr_open(h, arena, TILS_HDR_BUF_SIZE) < 0)
+        return -1;
+
+    tils_hdr_append(h, _status_lines[status].line, _status_lines[status].len);
+    tils_hdr_append(h, _tils_date_line(), DATE_LINE_LEN);
+    h->status = _status_lines[status].code;
+    return 0;
+}
+
+/**
+ * @brief Append raw header bytes.
+ *
+ * @param h The block being built.
+ * @param frag The bytes, e.g. a complete "Name: value\r\n" line.
+ * @param len The number of bytes.
+ */
+void tils_hdr_append(tils_hdr_t *h, const char *frag, int len) {
+    if (UNLIKELY(len > h->cap - h->len)) {
+        h->overflow = 1;
+        return;
+    }
+
+    memcpy(h->buf + h->len, frag, len);
+    h->len += len;
+}
+
+/**
+ * @brief Append a number in decimal.
+ *
+ * @param h The block being built.
+ * @param v The number.
+ */
+void tils_hdr_num(tils_hdr_t *h, unsigned long v) {
+    if (UNLIKELY(h->cap - h->len < TILS_UTOA_LEN)) {
+        h->overflow = 1;
+        return;
+    }
+
+    h->len += tils_utoa(h->buf + h->len, v);
+}
+
+/**
+ * @brief Append the Content-Length header.
+ *
+ * @param h The block being built.
+ * @param len The length of the body.
+ */
+void tils_hdr_content_length(tils_hdr_t *h, unsigned long len) {
+    TILS_HDR_LIT(h, "Content-Length: ");
+    tils_hdr_num(h, len);
+    TILS_HDR_LIT(h, "\r\n");
+}
+
+/**
+ * @brief Append the Connection header.
+ *
+ * @param h The block being built.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ */
+void tils_hdr_connection(tils_hdr_t *h, int keep_alive) {
+    tils_hdr_append(h, _connection_lines[!!keep_alive].line,
+            _connection_lines[!!keep_alive].len);
+}
+
+/**
+ * @brief Append the Content-Range header.
+ *
+ * @param h The block being built.
+ * @param range The range being sent, NULL if none could be (416).
+ * @param size The length of the whole body.
+ */
+void tils_hdr_content_range(tils_hdr_t *h, const tils_http_range_t *range,
+        off_t size) {
+    TILS_HDR_LIT(h, "Content-Range: bytes ");
+    if (range == NULL) {
+        TILS_HDR_LIT(h, "*");
+    } else {
+        tils_hdr_num(h, range->first);
+        TILS_HDR_LIT(h, "-");
+        tils_hdr_num(h, range->last);
+    }
+    TILS_HDR_LIT(h, "/");
+    tils_hdr_num(h, size);
+    TILS_HDR_LIT(h, "\r\n");
+}
+
+/**
+ * @brief Terminate the header block, and append it to the response.
+ *
+ * @param h The block being finished.
+ * @param out The response.
+ *
+ * @return 0 on success, -1 if the block overflowed or on error.
+ */
+int tils_hdr_end(tils_hdr_t *h, tils_out_t *out) {
+    TILS_HDR_LIT(h, "\r\n");
+    if (h->overflow)
+        return -1;
+
+    if (h->status != 0)
+        out->status = h->status;
+
+    return tils_out_bytes(out, h->buf, h->len);
+}
+
+/**
+ * @brief Append a response whose headers & body never change.
+ *
+ * The status line, Connection header and everything after them are sent
+ * straight out of constant memory, only the Date header is copied.
+ *
+ * @param arena Where the Date header is copied.
+ * @param out The response.
+ * @param status The response status.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param rest The remaining headers, blank line and body.
+ * @param rest_len The length of rest.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tils_response_const(arena_t *arena, tils_out_t *out,
+        tils_http_status_e status, int keep_alive, const char *rest,
+        int rest_len) {
+    char *date = arena_alloc(arena, DATE_LINE_LEN);
+    if (date == NULL)
+        return -1;
+
+    memcpy(date, _tils_date_line(), DATE_LINE_LEN);
+    out->status = _status_lines[status].code;
+
+    if (tils_out_const(out, _status_lines[status].line,
+                _status_lines[status].len) < 0 ||
+            tils_out_bytes(out, date, DATE_LINE_LEN) < 0 ||
+            tils_out_const(out, _connection_lines[!!keep_alive].line,
+                _connection_lines[!!keep_alive].len) < 0 ||
+            tils_out_const(out, rest, rest_len) < 0)
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/response_private.h
+ *
+ * @brief 'secret' details of the response builder go here.
+ *
+ * @author Lars Wander (lars.wander@gmail.com)
+ */
+
+#ifndef _RESPONSE_PRIVATE_H_
+#define _RESPONSE_PRIVATE_H_
+
+#include <time.h>
+
+#include <tils/response.h>
+
+/* "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n" */
+#define DATE_LINE_LEN (37)
+
+#define STATUS_LINE(code, reason) \
+    [TILS_STATUS_ ## code] = { "HTTP/1.1 " #code " " reason "\r\n" \
+        SERVER_STRING, sizeof("HTTP/1.1 " #code " " reason "\r\n" \
+                SERVER_STRING) - 1, code }
+
+/* Status line & Server header, the start of every response */
+static const struct {
+    const char *line;
+    int len;
+    int code;
+} _status_lines[TILS_STATUS_COUNT] = {
+    STATUS_LINE(200, "OK"),
+    STATUS_LINE(206, "Partial Content"),
+    STATUS_LINE(304, "Not Modified"),
+    STATUS_LINE(404, "Not Found"),
+    STATUS_LINE(416, "Range Not Satisfiable"),
+    STATUS_LINE(501, "Not Implemented"),
+};
+
+/* "00" through "99", so digits are printed two at a time */
+static const char _digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+#define CONNECTION_LINE(v) { "Connection: " v "\r\n", \
+    sizeof("Connection: " v "\r\n") - 1 }
+
+/* Connection header, by whether the connection is kept alive */
+static const struct {
+    const char *line;
+    int len;
+} _connection_lines[2] = {
+    CONNECTION_LINE("close"),
+    CONNECTION_LINE("keep-alive"),
+};
+
+static const char *_month_names[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/**
+ * @brief The current Date header, rebuilt at most once a second per thread
+ */
+typedef struct {
+    time_t now;
+    char line[DATE_LINE_LEN + 1];
+} date_cache_t;
+
+#endif /* _RESPONSE_PRIVATE_H_ */
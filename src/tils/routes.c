@@ -25,11 +25,36 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include <zlib.h>
+#ifdef TILS_BROTLI
+#include <brotli/encode.h>
+#endif /* TILS_BROTLI */
+
+#include <lib/bench.h>
 #include <lib/hashtable.h>
+#include <lib/logging.h>
+#include <tils/io_util.h>
+#include <tils/response.h>
+#include <tils/routes.h>
+
+#include "routes_private.h"
 
 static htable_t *_routes = NULL;
 
+/* Cache-Control of routes that don't set their own, NULL for none */
+static char *_cache_control = NULL;
+
+/* Source of every route, indexed by route id */
+static char **_sources = NULL;
+static int _source_count = 0;
+
 /**
  * @brief Setup routing table 
  */
@@ -42,23 +67,407 @@ int tils_routes_init() {
     }
 }
 
+/**
+ * @brief Read a whole file into a blob.
+ *
+ * @param path The file being read.
+ * @param[out] size The file's size, -1 if it can't be opened.
+ *
+ * @return The blob, NULL if the file can't (or shouldn't) be cached.
+ */
+blob_t *_tils_route_load(char *path, off_t *size) {
+    blob_t *res = NULL;
+    int fd = open(path, O_RDONLY);
+    *size = -1;
+    if (fd < 0)
+        goto fail;
+
+    if ((*size = tils_fd_size(fd)) < 0 || *size > ROUTE_CACHE_MAX)
+        goto cleanup_fd;
+
+    if ((res = blob_new(*size)) == NULL)
+        goto cleanup_fd;
+
+    for (off_t total = 0; total < *size; ) {
+        int n = read(fd, blob_data(res) + total, *size - total);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            if (n < 0)
+                log_warn_errno("Failed to read %s", path);
+            else
+                log_warn("%s shrank while being read", path);
+            goto cleanup_res;
+        }
+
+        total += n;
+    }
+
+    close(fd);
+    return res;
+
+cleanup_res:
+    blob_unref(res);
+    res = NULL;
+
+cleanup_fd:
+    close(fd);
+
+fail:
+    return res;
+}
+
+/**
+ * @brief Copy the first len bytes of buf into a new blob.
+ */
+blob_t *_tils_route_blob(const char *buf, size_t len) {
+    blob_t *res = blob_new(len);
+    if (res != NULL)
+        memcpy(blob_data(res), buf, len);
+
+    return res;
+}
+
+/**
+ * @brief gzip a body, as hard as zlib can.
+ *
+ * @return The compressed body, NULL on error.
+ */
+blob_t *_tils_route_gzip(blob_t *body) {
+    blob_t *res = NULL;
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+
+    /* 16 + window bits asks for a gzip rather than a zlib wrapper */
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS,
+                MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        goto fail;
+
+    uLong bound = deflateBound(&zs, blob_len(body));
+    unsigned char *buf = malloc(bound);
+    if (buf == NULL)
+        goto cleanup_zs;
+
+    zs.next_in = (unsigned char *)blob_data(body);
+    zs.avail_in = blob_len(body);
+    zs.next_out = buf;
+    zs.avail_out = bound;
+
+    if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+        res = _tils_route_blob((char *)buf, zs.total_out);
+
+    free(buf);
+
+cleanup_zs:
+    deflateEnd(&zs);
+
+fail:
+    return res;
+}
+
+/**
+ * @brief Brotli compress a body at the highest quality.
+ *
+ * @return The compressed body, NULL on error (or without brotli support).
+ */
+blob_t *_tils_route_brotli(blob_t *body, const tils_mime_t *mime) {
+#ifdef TILS_BROTLI
+    blob_t *res = NULL;
+    size_t len = BrotliEncoderMaxCompressedSize(blob_len(body));
+    uint8_t *buf = len == 0 ? NULL : malloc(len);
+    if (buf == NULL)
+        return NULL;
+
+    if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+                strncmp(mime->type, "text/", 5) == 0 ?
+                BROTLI_MODE_TEXT : BROTLI_MODE_GENERIC,
+                blob_len(body), (uint8_t *)blob_data(body), &len, buf))
+        res = _tils_route_blob((char *)buf, len);
+
+    free(buf);
+    return res;
+#else
+    return NULL;
+#endif /* TILS_BROTLI */
+}
+
+/**
+ * @brief Find or make the compressed bodies of a route.
+ *
+ * A precompressed sibling (dest.gz, dest.br) wins, otherwise the body is
+ * compressed here if it's cached. Only done for compressible types, and a
+ * body only kept if it's smaller than the original. Files too large to cache
+ * can still be compressed while they're sent.
+ *
+ * @param route The route, with its identity body loaded.
+ * @param size Size of the identity body.
+ */
+void _tils_route_compress(tils_route_t *route, off_t size) {
+    char sibling[PATH_MAX];
+    blob_t *identity = route->body[TILS_ENC_IDENTITY];
+
+    for (int enc = TILS_ENC_IDENTITY + 1; enc < TILS_ENC_COUNT; enc++) {
+        blob_t *body = NULL;
+        off_t sibling_size = 0;
+
+        if (snprintf(sibling, sizeof(sibling), "%s%s", route->path,
+                    _encoding_suffix[enc]) < (int)sizeof(sibling))
+            body = _tils_route_load(sibling, &sibling_size);
+
+        if (body == NULL && identity != NULL) {
+            if (enc == TILS_ENC_GZIP)
+                body = _tils_route_gzip(identity);
+            else if (enc == TILS_ENC_BR)
+                body = _tils_route_brotli(identity, route->mime);
+        }
+
+        if (body != NULL && (off_t)blob_len(body) >= size) {
+            blob_unref(body);
+            body = NULL;
+        }
+
+        route->body[enc] = body;
+        if (body != NULL)
+            route->vary = 1;
+    }
+
+    /* Too large to keep compressed, it's gzipped as it is sent instead. */
+    if (identity == NULL && route->body[TILS_ENC_GZIP] == NULL)
+        route->vary = 1;
+}
+
+/**
+ * @brief Hash a body into a strong entity tag.
+ */
+void _tils_route_hash_etag(blob_t *body, char *etag) {
+    unsigned long long h = FNV_OFFSET;
+    const unsigned char *p = (const unsigned char *)blob_data(body);
+    for (size_t i = 0; i < blob_len(body); i++)
+        h = (h ^ p[i]) * FNV_PRIME;
+
+    snprintf(etag, TILS_ROUTE_ETAG_LEN, "\"%016llx\"", h);
+}
+
+/**
+ * @brief Work out the validators of every coding of a route.
+ *
+ * Cached bodies are tagged by their contents. A file read from disk on each
+ * request is tagged by its inode, modification time & size instead, and its
+ * gzipped stream gets a weak tag since the level it's compressed at varies
+ * with load.
+ *
+ * @param route The route, with its bodies loaded.
+ * @param st The routed file's status, NULL if it couldn't be read.
+ */
+void _tils_route_etags(tils_route_t *route, struct stat *st) {
+    char *identity = route->etag[TILS_ENC_IDENTITY];
+
+    if (route->body[TILS_ENC_IDENTITY] != NULL)
+        _tils_route_hash_etag(route->body[TILS_ENC_IDENTITY], identity);
+    else if (st != NULL)
+        snprintf(identity, TILS_ROUTE_ETAG_LEN, "\"%lx-%llx-%llx\"",
+                (unsigned long)st->st_ino, (unsigned long long)st->st_mtime,
+                (unsigned long long)st->st_size);
+
+    for (int enc = TILS_ENC_IDENTITY + 1; enc < TILS_ENC_COUNT; enc++) {
+        if (route->body[enc] != NULL)
+            _tils_route_hash_etag(route->body[enc], route->etag[enc]);
+        else if (enc == TILS_ENC_GZIP && route->vary && identity[0] != '\0')
+            snprintf(route->etag[enc], TILS_ROUTE_ETAG_LEN, "W/%.*s-gz\"",
+                    (int)strlen(identity) - 1, identity);
+    }
+}
+
+/**
+ * @brief Build one validator & caching header block of a route.
+ *
+ * @param route The route.
+ * @param etag Its ETag, empty for none.
+ * @param last_modified Its Last-Modified, empty for none.
+ * @param cache_control The route's Cache-Control, NULL for none.
+ * @param[out] meta The block, malloc'd.
+ * @param[out] meta_len Its length.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int _tils_route_meta_block(tils_route_t *route, char *etag,
+        char *last_modified, char *cache_control, char **meta,
+        int *meta_len) {
+    char buf[ROUTE_META_MAX];
+    int len = 0;
+
+    if (etag[0] != '\0')
+        len += snprintf(buf + len, sizeof(buf) - len, "ETag: %s\r\n", etag);
+    if (last_modified[0] != '\0' && len < (int)sizeof(buf))
+        len += snprintf(buf + len, sizeof(buf) - len,
+                "Last-Modified: %s\r\n", last_modified);
+    if (cache_control != NULL && len < (int)sizeof(buf))
+        len += snprintf(buf + len, sizeof(buf) - len,
+                "Cache-Control: %s\r\n", cache_control);
+    if (route->vary && len < (int)sizeof(buf))
+        len += snprintf(buf + len, sizeof(buf) - len,
+                "Vary: Accept-Encoding\r\n");
+    if (len < (int)sizeof(buf))
+        len += snprintf(buf + len, sizeof(buf) - len, "\r\n");
+
+    if (len >= (int)sizeof(buf)) {
+        log_warn("Headers of %s are too long", route->path);
+        return -1;
+    }
+
+    if ((*meta = malloc(len)) == NULL)
+        return -1;
+
+    memcpy(*meta, buf, len);
+    *meta_len = len;
+    return 0;
+}
+
+/**
+ * @brief Build the validator & caching headers of every coding of a route.
+ *
+ * @param route The route, with its entity tags worked out.
+ * @param cache_control The route's Cache-Control, NULL for none.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int _tils_route_meta(tils_route_t *route, char *cache_control) {
+    char last_modified[TILS_HTTP_DATE_LEN + 1] = "";
+    if (route->mtime != 0)
+        tils_http_date(route->mtime, last_modified);
+
+    for (int enc = 0; enc < TILS_ENC_COUNT; enc++) {
+        if (_tils_route_meta_block(route, route->etag[enc], last_modified,
+                    cache_control, &route->meta[enc],
+                    &route->meta_len[enc]) < 0)
+            return -1;
+    }
+
+    return _tils_route_meta_block(route, "", "", cache_control, &route->bare,
+            &route->bare_len);
+}
+
+/**
+ * @brief Free a route entry, responses still sending its body keep it alive
+ */
+void _tils_route_free(void *_route) {
+    tils_route_t *route = (tils_route_t *)_route;
+    for (int enc = 0; enc < TILS_ENC_COUNT; enc++) {
+        blob_unref(route->body[enc]);
+        free(route->meta[enc]);
+    }
+    free(route->bare);
+    free(route);
+}
+
+/**
+ * @brief Set the Cache-Control of routes that don't have their own.
+ *
+ * @param policy e.g. "max-age=3600", NULL for no Cache-Control header.
+ */
+void tils_routes_cache_control(char *policy) {
+    _cache_control = policy;
+}
+
 /**
  * @brief Add a route entry. Whenever source is encountered, dest is served 
+ *
+ * Small files are loaded once, here, and every response shares that copy.
+ * Compressed copies are made here too, so no request ever pays for
+ * compression, and so are the validators clients revalidate against. The
+ * MIME registry must already be built.
+ *
+ * @param cache_control The route's Cache-Control, NULL for the default set
+ *        by `tils_routes_cache_control'.
  */
-int tils_route_add(char *source, char *dest) {
-    return htable_insert(_routes, source, (void *)dest);    
+int tils_route_add(char *source, char *dest, char *cache_control) {
+    tils_route_t *route = calloc(sizeof(tils_route_t), 1);
+    if (route == NULL)
+        return -1;
+
+    tils_route_t *old = NULL;
+    struct stat st;
+    off_t size = 0;
+    int have_st = stat(dest, &st) == 0;
+    route->path = dest;
+    route->mtime = have_st ? st.st_mtime : 0;
+    route->ino = have_st ? st.st_ino : 0;
+    route->size = have_st ? st.st_size : 0;
+    route->mime = tils_mime_lookup(dest);
+    route->body[TILS_ENC_IDENTITY] = _tils_route_load(dest, &size);
+
+    if (size < 0)
+        log_warn_errno("Can't open %s, it will be read on every request", dest);
+    else if (route->mime->compressible)
+        _tils_route_compress(route, size);
+
+    _tils_route_etags(route, have_st ? &st : NULL);
+    if (_tils_route_meta(route, cache_control != NULL ? cache_control :
+                _cache_control) < 0) {
+        _tils_route_free(route);
+        return -1;
+    }
+
+    /* Replacing a route drops the old entry, but keeps its id */
+    if (htable_lookup(_routes, source, (void **)&old) != 0)
+        old = NULL;
+
+    if (old != NULL) {
+        route->id = old->id;
+    } else {
+        char **sources = realloc(_sources,
+                sizeof(char *) * (_source_count + 1));
+        if (sources == NULL) {
+            _tils_route_free(route);
+            return -1;
+        }
+
+        _sources = sources;
+        route->id = _source_count;
+    }
+
+    if (htable_insert(_routes, source, (void *)route) != 0) {
+        _tils_route_free(route);
+        return -1;
+    }
+
+    if (old != NULL)
+        _tils_route_free(old);
+    else
+        _sources[_source_count++] = source;
+
+    return 0;
 }
 
 /**
  * @brief Lookup a route entry.
  */
-int tils_route_lookup(char *source, char **dest) {
-    return htable_lookup(_routes, source, (void **)dest);
+int tils_route_lookup(char *source, tils_route_t **route) {
+    BENCH_SCOPE(BENCH_ROUTE);
+    return htable_lookup(_routes, source, (void **)route);
+}
+
+/**
+ * @return The number of routes ever added, ids are below this.
+ */
+int tils_route_count() {
+    return _source_count;
+}
+
+/**
+ * @return The source the route with this id was added for.
+ */
+const char *tils_route_source(int id) {
+    return _sources[id];
 }
 
 /**
  * @brief free all route resources
  */
 void tils_routes_cleanup() {
-    htable_free(_routes, NULL);
+    htable_free(_routes, _tils_route_free);
+    free(_sources);
+    _sources = NULL;
+    _source_count = 0;
 }
@@ -0,0 +1,47 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/routes_private.h
+ *
+ * @brief 'secret' details of routing implementation go here.
+ *
+ * @author Lars Wander (lars.wander@gmail.com)
+ */
+
+#ifndef _ROUTES_PRIVATE_H_
+#define _ROUTES_PRIVATE_H_
+
+#include <tils/request.h>
+
+/* Files up to this size are kept in memory & shared by every response */
+#define ROUTE_CACHE_MAX (1 << 20)
+
+/* Precompressed siblings of a routed file, e.g. index.html.gz */
+static const char *_encoding_suffix[TILS_ENC_COUNT] = {
+    [TILS_ENC_GZIP] = ".gz",
+    [TILS_ENC_BR] = ".br",
+};
+
+/* Largest validator & caching header block of a route */
+#define ROUTE_META_MAX (512)
+
+/* 64 bit FNV-1a, hashes cached bodies into their entity tags */
+#define FNV_OFFSET (14695981039346656037ULL)
+#define FNV_PRIME (1099511628211ULL)
+
+#endif /* _ROUTES_PRIVATE_H_ */
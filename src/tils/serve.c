@@ -35,134 +35,750 @@
 #include <errno.h>
 #include <fcntl.h>
 
+#include <lib/bench.h>
+#include <lib/probes.h>
+#include <tils/access_log.h>
 #include <tils/serve.h>
+#include <tils/stats.h>
+#include <tils/trace.h>
 #include <tils/request.h>
 #include <tils/routes.h>
+#include <tils/out.h>
+#include <tils/response.h>
 #include <tils/io_util.h>
 
 #include "serve_private.h"
 
 /**
- * @brief Send data & vaargs to client
+ * @brief Send the unimplemented header to the client
  *
- * @param client_fd The client being communicated with.
- * @param msg The message with format specifiers to be sent.
- * @param ... variable args being formated into msg.
+ * @param out The response being assembled.
+ * @param keep_alive Nonzero if the connection stays open after this.
  */
-void _tils_serve_to_client(int client_fd, char *msg, ...) {
-    va_list ap;
-    char buf[REQUEST_BUF_SIZE + 1];
+int _tils_serve_unimplemented(tils_wt_t *self, tils_out_t *out,
+        int keep_alive) {
+    return tils_response_const(self->arena, out, TILS_STATUS_501, keep_alive,
+            msg_unimplemented, sizeof(msg_unimplemented) - 1);
+}
 
-    va_start(ap, msg);
-    vsnprintf(buf, sizeof(buf), msg, ap);
-    va_end(ap);
+/**
+ * @brief Send the not found header to the client
+ *
+ * @param out The response being assembled.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param head Nonzero to leave out the body.
+ */
+int _tils_serve_not_found(tils_wt_t *self, tils_out_t *out, int keep_alive,
+        int head) {
+    return tils_response_const(self->arena, out, TILS_STATUS_404, keep_alive,
+            msg_not_found, head ? sizeof(NOT_FOUND_HEADERS) - 1 :
+            sizeof(msg_not_found) - 1);
+}
 
-    send(client_fd, buf, strlen(buf), 0);
+/**
+ * @brief Tell the client which methods it may use
+ *
+ * @param out The response being assembled.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ */
+int _tils_serve_options(tils_wt_t *self, tils_out_t *out, int keep_alive) {
+    return tils_response_const(self->arena, out, TILS_STATUS_200, keep_alive,
+            msg_options, sizeof(msg_options) - 1);
 }
 
 /**
- * @brief Get the content type by filename extension.
+ * @brief Send every worker's counters.
  *
- * @param filename The filename being examined.
- * @param filename_len The length of the filename in question.
+ * @param out The response being assembled.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param head Nonzero to leave out the body.
+ */
+int _tils_serve_stats(tils_wt_t *self, tils_out_t *out, int keep_alive,
+        int head) {
+    char *body = NULL;
+    int len = tils_stats_render(self->arena, &body);
+    if (len < 0)
+        return -1;
+
+    tils_hdr_t h;
+    if (tils_hdr_begin(&h, self->arena, TILS_STATUS_200) < 0)
+        return -1;
+
+    TILS_HDR_LIT(&h, "Content-Type: text/plain; version=0.0.4; "
+            "charset=utf-8\r\n");
+    tils_hdr_content_length(&h, len);
+    TILS_HDR_LIT(&h, "Cache-Control: no-store\r\n");
+    tils_hdr_connection(&h, keep_alive);
+    if (tils_hdr_end(&h, out) < 0)
+        return -1;
+
+    return head ? 0 : tils_out_bytes(out, body, len);
+}
+
+/**
+ * @brief Append the headers every file response ends with.
  *
- * @return The content filetype - TEXT if unsure
+ * @param h The block being built.
+ * @param route The route being served.
+ * @param enc The coding the body is sent in.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param current Nonzero if the body is still what the route's validators
+ *        describe, see `_tils_serve_current'.
  */
-char *_tils_get_content_type(char *filename, int filename_len) {
-    int p_ind = filename_len - 1;
-    while (p_ind > 0 && filename[p_ind] != '.')
-        p_ind--;
+void _tils_serve_entity_header(tils_hdr_t *h, tils_route_t *route,
+        tils_http_encoding_e enc, int keep_alive, int current) {
+    tils_hdr_append(h, _encoding_lines[enc].line, _encoding_lines[enc].len);
+    /* Less the blank line, the block isn't over yet */
+    if (current)
+        tils_hdr_append(h, route->meta[enc], route->meta_len[enc] - 2);
+    else
+        tils_hdr_append(h, route->bare, route->bare_len - 2);
+    tils_hdr_connection(h, keep_alive);
+}
 
-    p_ind += 1;
+/**
+ * @brief Append the headers of a file being served.
+ *
+ * @param out The response being assembled.
+ * @param route The route being served.
+ * @param enc The coding the body is sent in.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param current Nonzero if the body is still what the route's validators
+ *        describe.
+ * @param size The body's length, -1 if it's sent chunked.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int _tils_serve_file_header(tils_wt_t *self, tils_out_t *out,
+        tils_route_t *route, tils_http_encoding_e enc, int keep_alive,
+        int current, off_t size) {
+    tils_hdr_t h;
+    if (tils_hdr_begin(&h, self->arena, TILS_STATUS_200) < 0)
+        return -1;
 
-    if (strncmp("html", filename + p_ind, filename_len - p_ind) == 0) {
-        return HTML;
-    } else if (strncmp("css", filename + p_ind, filename_len - p_ind) == 0) {
-        return CSS;
-    } else if (strncmp("js", filename + p_ind, filename_len - p_ind) == 0) {
-        return JS;
+    TILS_HDR_LIT(&h, "Content-Type: ");
+    tils_hdr_append(&h, route->mime->type, route->mime->type_len);
+    TILS_HDR_LIT(&h, "\r\n");
+    if (size < 0) {
+        TILS_HDR_LIT(&h, "Transfer-Encoding: chunked\r\n");
     } else {
-        return TEXT;
+        tils_hdr_content_length(&h, size);
+        TILS_HDR_LIT(&h, "Accept-Ranges: bytes\r\n");
     }
+    _tils_serve_entity_header(&h, route, enc, keep_alive, current);
+    return tils_hdr_end(&h, out);
 }
 
 /**
- * @brief Send the unimplemented header to the client
+ * @brief Append the headers of a single range of a file.
+ *
+ * @param out The response being assembled.
+ * @param route The route being served.
+ * @param enc The coding the body is in.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param current Nonzero if the body is still what the route's validators
+ *        describe.
+ * @param range The range being sent.
+ * @param size The whole body's length.
  *
- * @param client_fd The client being communicated with
+ * @return 0 on success, -1 on error.
  */
-void _tils_serve_unimplemented(tils_conn_t *conn) {
-    _tils_serve_to_client(conn->client_fd, (char *)msg_unimplemented);
+int _tils_serve_range_header(tils_wt_t *self, tils_out_t *out,
+        tils_route_t *route, tils_http_encoding_e enc, int keep_alive,
+        int current, tils_http_range_t *range, off_t size) {
+    tils_hdr_t h;
+    if (tils_hdr_begin(&h, self->arena, TILS_STATUS_206) < 0)
+        return -1;
+
+    TILS_HDR_LIT(&h, "Content-Type: ");
+    tils_hdr_append(&h, route->mime->type, route->mime->type_len);
+    TILS_HDR_LIT(&h, "\r\n");
+    tils_hdr_content_length(&h, range->last - range->first + 1);
+    tils_hdr_content_range(&h, range, size);
+    _tils_serve_entity_header(&h, route, enc, keep_alive, current);
+    return tils_hdr_end(&h, out);
 }
 
 /**
- * @brief Send the unimplemented header to the client
+ * @brief Tell the client none of the ranges it asked for exist.
+ *
+ * @param out The response being assembled.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param size The body's length.
  *
- * @param client_fd The client being communicated with
+ * @return 0 on success, -1 on error.
  */
-void _tils_serve_not_found(tils_conn_t *conn) {
-    _tils_serve_to_client(conn->client_fd, (char *)msg_not_found);
+int _tils_serve_unsatisfiable(tils_wt_t *self, tils_out_t *out,
+        int keep_alive, off_t size) {
+    tils_hdr_t h;
+    if (tils_hdr_begin(&h, self->arena, TILS_STATUS_416) < 0)
+        return -1;
+
+    tils_hdr_content_range(&h, NULL, size);
+    tils_hdr_content_length(&h, 0);
+    tils_hdr_connection(&h, keep_alive);
+    return tils_hdr_end(&h, out);
 }
 
-void _tils_serve_file(tils_conn_t *conn, int file_fd, char *content_type, 
-        int size) {
-    _tils_serve_to_client(conn->client_fd, (char *)header_file, content_type, 
-            size);
+/**
+ * @brief Append a range of a body, out of its cached copy or its file.
+ *
+ * @param out The response being assembled.
+ * @param body The cached body, NULL to send from file_fd.
+ * @param file_fd The file, owned by out from here on. -1 if body is cached.
+ * @param range The range being sent.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int _tils_serve_body(tils_out_t *out, blob_t *body, int file_fd,
+        tils_http_range_t *range) {
+    size_t len = range->last - range->first + 1;
+    if (body != NULL)
+        return tils_out_blob(out, body, range->first, len);
+    else
+        return tils_out_file(out, file_fd, range->first, len);
+}
 
-    char buf[REQUEST_BUF_SIZE];
-    int res = 0;
+/**
+ * @brief Send several ranges of a file as a multipart/byteranges body.
+ *
+ * The part headers are built in one block up front, since the body's
+ * length has to be known before it starts. Every part of a file read from
+ * disk gets its own descriptor, as each file segment owns one.
+ *
+ * @param out The response being assembled.
+ * @param route The route being served.
+ * @param enc The coding the body is in.
+ * @param keep_alive Nonzero if the connection stays open after this.
+ * @param current Nonzero if the body is still what the route's validators
+ *        describe.
+ * @param body The cached body, NULL to send from file_fd.
+ * @param file_fd The file, owned by this from here on. -1 if body is cached.
+ * @param ranges The ranges being sent.
+ * @param count The number of ranges.
+ * @param size The whole body's length.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int _tils_serve_multipart(tils_wt_t *self, tils_out_t *out,
+        tils_route_t *route, tils_http_encoding_e enc, int keep_alive,
+        int current, blob_t *body, int file_fd, tils_http_range_t *ranges,
+        int count, off_t size) {
+    int part_start[TILS_RANGE_MAX + 1];
+    unsigned long len = 0;
+    tils_hdr_t parts, h;
+
+    if (tils_hdr_open(&parts, self->arena,
+                (count + 1) * (MULTIPART_PART_MAX + route->mime->type_len)) < 0)
+        goto fail;
 
-    int sum_total = 0;
-    while ((res = read(file_fd, buf, REQUEST_BUF_SIZE)) > 0) {
-        int total = 0;
-        while (res > 0) {
-            int sent = send(conn->client_fd, &buf[total], res, 0);
+    for (int i = 0; i < count; i++) {
+        part_start[i] = parts.len;
+        TILS_HDR_LIT(&parts, "\r\n--" MULTIPART_BOUNDARY "\r\n"
+                "Content-Type: ");
+        tils_hdr_append(&parts, route->mime->type, route->mime->type_len);
+        TILS_HDR_LIT(&parts, "\r\n");
+        tils_hdr_content_range(&parts, &ranges[i], size);
+        TILS_HDR_LIT(&parts, "\r\n");
+        len += ranges[i].last - ranges[i].first + 1;
+    }
+    part_start[count] = parts.len;
+    TILS_HDR_LIT(&parts, "\r\n--" MULTIPART_BOUNDARY "--\r\n");
+
+    if (parts.overflow ||
+            tils_hdr_begin(&h, self->arena, TILS_STATUS_206) < 0)
+        goto fail;
+
+    TILS_HDR_LIT(&h, "Content-Type: multipart/byteranges; boundary="
+            MULTIPART_BOUNDARY "\r\n");
+    tils_hdr_content_length(&h, len + parts.len);
+    _tils_serve_entity_header(&h, route, enc, keep_alive, current);
+    if (tils_hdr_end(&h, out) < 0)
+        goto fail;
+
+    for (int i = 0; i < count; i++) {
+        int fd = file_fd;
+        if (fd >= 0 && i < count - 1 && (fd = dup(file_fd)) < 0)
+            goto fail;
+        if (i == count - 1)
+            file_fd = -1;
+
+        if (tils_out_bytes(out, parts.buf + part_start[i],
+                    part_start[i + 1] - part_start[i]) < 0 ||
+                _tils_serve_body(out, body, fd, &ranges[i]) < 0)
+            goto fail;
+    }
 
-            /* Mark connection as dead to be cleaned up later */
-            if (sent <= 0) {
-                conn->state = CONN_DEAD;
-                return;
-            }
+    return tils_out_bytes(out, parts.buf + part_start[count],
+            parts.len - part_start[count]);
 
-            res -= sent;
-            total += sent;
+fail:
+    if (file_fd >= 0)
+        close(file_fd);
+    return -1;
+}
+
+/**
+ * @brief Pick the smallest body of a route the client can decode.
+ *
+ * @param route The route being served.
+ * @param accepted Codings the client accepts, see `tils_request_encodings'.
+ *
+ * @return The coding to send the body in.
+ */
+tils_http_encoding_e _tils_serve_encoding(tils_route_t *route, int accepted) {
+    tils_http_encoding_e res = TILS_ENC_IDENTITY;
+
+    for (int enc = TILS_ENC_IDENTITY + 1; enc < TILS_ENC_COUNT; enc++) {
+        /* Compressed bodies are always smaller than the identity one. */
+        if (route->body[enc] == NULL || !(accepted & (1 << enc)))
+            continue;
+
+        if (res == TILS_ENC_IDENTITY ||
+                blob_len(route->body[enc]) < blob_len(route->body[res]))
+            res = enc;
+    }
+
+    return res;
+}
+
+/**
+ * @brief Decide whether to gzip an uncached file while sending it.
+ *
+ * Compression costs far more CPU than sending, so as the worker gets busy
+ * the level drops, and close to saturation compression is skipped.
+ *
+ * @param route The route being served.
+ * @param request The request being answered.
+ * @param accepted Codings the client accepts.
+ *
+ * @return The zlib level to use, -1 to send the file as is.
+ */
+int _tils_serve_deflate_level(tils_wt_t *self, tils_route_t *route,
+        tils_http_request_t *request, int accepted) {
+    /* Chunked transfer coding is HTTP/1.1 only */
+    if (!route->mime->compressible || request->minor_version < 1 ||
+            !(accepted & (1 << TILS_ENC_GZIP)) ||
+            self->load >= DEFLATE_OFF_LOAD)
+        return -1;
+
+    return self->load >= DEFLATE_FAST_LOAD ? DEFLATE_FAST_LEVEL :
+        DEFLATE_LEVEL;
+}
+
+/**
+ * @brief Compare an entity tag against an If-None-Match list.
+ *
+ * Uses the weak comparison, i.e. a W/ prefix on either side is ignored.
+ *
+ * @param list The If-None-Match header value.
+ * @param etag The entity tag of the representation being served.
+ *
+ * @return 1 if it's listed (or the list is "*"), 0 if not.
+ */
+int _tils_serve_etag_match(char *list, char *etag) {
+    if (strncmp(etag, "W/", 2) == 0)
+        etag += 2;
+    size_t etag_len = strlen(etag);
+
+    while (*list != '\0') {
+        while (*list == ',' || isspace((int)*list))
+            list++;
+
+        char *end = list;
+        while (*end != '\0' && *end != ',' && !isspace((int)*end))
+            end++;
+
+        if (end - list == 1 && *list == '*')
+            return 1;
+
+        char *tag = strncmp(list, "W/", 2) == 0 ? list + 2 : list;
+        if ((size_t)(end - tag) == etag_len &&
+                memcmp(tag, etag, etag_len) == 0)
+            return 1;
+
+        list = end;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check a file read from disk is still the one the route describes.
+ *
+ * Its validators were made when the route was added. Once the file has been
+ * edited or replaced they describe content that is gone.
+ *
+ * @param route The route being served.
+ * @param st The status of the file as it's being served.
+ *
+ * @return 1 if the route's validators still apply, 0 if not.
+ */
+int _tils_serve_current(tils_route_t *route, struct stat *st) {
+    return route->mtime != 0 && st->st_mtime == route->mtime &&
+        st->st_ino == route->ino && st->st_size == route->size;
+}
+
+/**
+ * @brief Decide whether the client's copy of a representation is current.
+ *
+ * If-None-Match wins when both it and If-Modified-Since are sent.
+ *
+ * @param route The route being served.
+ * @param enc The coding the body would be sent in.
+ * @param request The request being answered.
+ * @param current Nonzero if the body is still what the route's validators
+ *        describe. If not, nothing the client holds can be vouched for.
+ *
+ * @return 1 if a 304 will do, 0 if the body has to be sent.
+ */
+int _tils_serve_not_modified(tils_route_t *route, tils_http_encoding_e enc,
+        tils_http_request_t *request, int current) {
+    if (!current)
+        return 0;
+
+    char *none_match = tils_request_header(request, "If-None-Match");
+    if (none_match != NULL)
+        return route->etag[enc][0] != '\0' &&
+            _tils_serve_etag_match(none_match, route->etag[enc]);
+
+    char *modified_since = tils_request_header(request, "If-Modified-Since");
+    time_t since;
+    return modified_since != NULL && route->mtime != 0 &&
+        tils_parse_http_date(modified_since, &since) == 0 &&
+        route->mtime <= since;
+}
+
+/**
+ * @brief Decide whether a Range request still applies to the body.
+ *
+ * If-Range must name the current representation exactly: by a strong entity
+ * tag, or by its modification date.
+ *
+ * @param route The route being served.
+ * @param enc The coding the body is sent in.
+ * @param request The request being answered.
+ * @param current Nonzero if the body is still what the route's validators
+ *        describe. If not, the client's partial copy is of something else.
+ *
+ * @return 1 if the ranges should be sent, 0 if the whole body should.
+ */
+int _tils_serve_if_range(tils_route_t *route, tils_http_encoding_e enc,
+        tils_http_request_t *request, int current) {
+    char *if_range = tils_request_header(request, "If-Range");
+    time_t date;
+    if (if_range == NULL)
+        return 1;
+
+    if (!current)
+        return 0;
+
+    /* Weak tags (W/"...") never match */
+    if (if_range[0] == '"')
+        return strcmp(if_range, route->etag[enc]) == 0;
+
+    return route->mtime != 0 && tils_parse_http_date(if_range, &date) == 0 &&
+        date == route->mtime;
+}
+
+/**
+ * @brief Send a routed file to the client.
+ *
+ * Cached files are sent straight out of the shared copy, anything else is
+ * sent from disk with sendfile, or gzipped on the way out. Clients holding
+ * a current copy get a 304 built from the route's prebuilt headers, unless
+ * the file read from disk has changed since they were built. Ranges
+ * are slices of the shared copy or sendfile offsets, so any range costs the
+ * same to send as a small file. HEAD gets the same headers without the
+ * file ever being opened.
+ *
+ * @param out The response being assembled.
+ * @param route The route being served.
+ * @param request The request being answered.
+ *
+ * @return 0 on success, -1 if the file can't be served.
+ */
+int _tils_serve_file(tils_wt_t *self, tils_out_t *out, tils_route_t *route,
+        tils_http_request_t *request) {
+    tils_http_range_t ranges[TILS_RANGE_MAX];
+    int range_count = 0;
+    int accepted = route->vary ? tils_request_encodings(request) :
+        1 << TILS_ENC_IDENTITY;
+    tils_http_encoding_e enc = _tils_serve_encoding(route, accepted);
+    blob_t *body = route->body[enc];
+    int head = request->request_type == TILS_HEAD;
+    char *range = head ? NULL : tils_request_header(request, "Range");
+    int file_fd = -1;
+    int level = -1;
+    int current = 1;
+    struct stat st;
+    off_t size;
+
+    TILS_TRACE(self->trace, TILS_TRACE_ROUTED);
+    TILS_PROBE2(route__hit, request->resource, route->id);
+
+    /* Finding a range of a stream gzipped as it's sent means compressing
+     * everything before it, so ranges come from the file as is. */
+    if (body == NULL && range == NULL &&
+            (level = _tils_serve_deflate_level(self, route, request,
+                accepted)) >= 0)
+        enc = TILS_ENC_GZIP;
+
+    if (body != NULL) {
+        size = blob_len(body);
+    } else {
+        if (!head && (file_fd = open(route->path, O_RDONLY)) < 0)
+            return -1;
+
+        /* What's checked against the route is the file that gets sent */
+        if ((head ? stat(route->path, &st) : fstat(file_fd, &st)) < 0) {
+            if (file_fd >= 0)
+                close(file_fd);
+            return -1;
+        }
+
+        size = st.st_size;
+        current = _tils_serve_current(route, &st);
+    }
+
+    if (_tils_serve_not_modified(route, enc, request, current)) {
+        if (file_fd >= 0)
+            close(file_fd);
+        return tils_response_const(self->arena, out, TILS_STATUS_304,
+                request->keep_alive, route->meta[enc], route->meta_len[enc]);
+    }
+
+    if (body != NULL)
+        TILS_STAT_ADD(self->stats.cache_hits, 1);
+    else
+        TILS_STAT_ADD(self->stats.cache_misses, 1);
+
+    if (head)
+        return _tils_serve_file_header(self, out, route, enc,
+                request->keep_alive, current, level >= 0 ? -1 : size);
+
+    if (range != NULL && _tils_serve_if_range(route, enc, request, current))
+        range_count = tils_request_ranges(range, size, ranges,
+                TILS_RANGE_MAX);
+
+    if (range_count < 0) {
+        if (file_fd >= 0)
+            close(file_fd);
+        return _tils_serve_unsatisfiable(self, out, request->keep_alive,
+                size);
+    }
+
+    if (range_count > 1)
+        return _tils_serve_multipart(self, out, route, enc,
+                request->keep_alive, current, body, file_fd, ranges,
+                range_count, size);
+
+    if (level >= 0) {
+        tils_deflate_t *deflate = tils_deflate_new(self->zpool, self->pool,
+                file_fd, 0, size, level);
+        if (deflate == NULL ||
+                _tils_serve_file_header(self, out, route, TILS_ENC_GZIP,
+                    request->keep_alive, current, -1) < 0) {
+            tils_deflate_free(deflate);
+            return -1;
+        }
+
+        return tils_out_deflate(out, deflate);
+    }
+
+    int res;
+    if (range_count == 1) {
+        res = _tils_serve_range_header(self, out, route, enc,
+                request->keep_alive, current, &ranges[0], size);
+    } else {
+        ranges[0].first = 0;
+        ranges[0].last = size - 1;
+        res = _tils_serve_file_header(self, out, route, enc,
+                request->keep_alive, current, size);
+    }
+
+    if (res < 0) {
+        if (file_fd >= 0)
+            close(file_fd);
+        return -1;
+    }
+
+    return _tils_serve_body(out, body, file_fd, &ranges[0]);
+}
+
+/**
+ * @brief Write a response, keeping whatever the socket won't take yet.
+ *
+ * @param self The worker serving the connection.
+ * @param conn The connection the response is for.
+ * @param out The response, in the worker's arena.
+ */
+void _tils_serve_out(tils_wt_t *self, tils_conn_t *conn, tils_out_t *out) {
+    out->total = out->len;
+    int res = tils_out_flush(out, conn->client_fd);
+    TILS_TRACE(self->trace, TILS_TRACE_SENT);
+    if (res > 0)
+        TILS_PROBE2(response__done, conn->client_fd, out->total);
+
+    if (res > 0 && conn->closing)
+        tils_conn_shutdown(self->conns, conn);
+
+    if (res == 0) {
+        /* The arena is about to be reset - move the rest out of it. */
+        int cap;
+        tils_out_t *pending = tils_out_detach(out, self->pool, &cap);
+        if (pending != NULL) {
+            if (self->trace != NULL)
+                pending->sent_ns = tils_trace_clock();
+            tils_conn_hold(self->conns, conn, pending, cap);
+            return;
         }
+    }
 
-        sum_total += total;
+    if (res <= 0) {
+        /* Mark connection as dead to be cleaned up later */
+        tils_out_release(out);
+        tils_conn_kill(self->conns, conn, CLOSE_ERROR);
     }
-} 
+}
+
+/**
+ * @brief Continue sending a response the socket couldn't take at once.
+ *
+ * @param self The worker serving the connection.
+ * @param conn The connection, now writable.
+ *
+ * @return 1 if the response is done, 0 if some is still pending, -1 on error.
+ */
+int tils_serve_pending(tils_wt_t *self, tils_conn_t *conn) {
+    int res = tils_out_flush(conn->out, conn->client_fd);
+    if (res != 0 && self->trace != NULL)
+        tils_trace_span(self->trace, TILS_TRACE_PENDING, conn->client_fd,
+                conn->out->sent_ns, tils_trace_clock());
+
+    if (res > 0)
+        TILS_PROBE2(response__done, conn->client_fd, conn->out->total);
+
+    if (res != 0)
+        tils_conn_release_out(self->conns, conn);
+
+    if (res > 0 && conn->closing)
+        tils_conn_shutdown(self->conns, conn);
+    else if (res < 0)
+        tils_conn_kill(self->conns, conn, CLOSE_ERROR);
+
+    return res;
+}
+
+/**
+ * @brief Fill in what the access log needs to know about a response.
+ *
+ * Called before the response is written, which consumes it.
+ *
+ * @param[out] rec The request's record.
+ * @param conn The connection the response is for.
+ * @param request The request being answered.
+ * @param route The route served, NULL if none matched.
+ * @param out The response.
+ */
+void _tils_serve_access(tils_access_rec_t *rec, tils_conn_t *conn,
+        tils_http_request_t *request, tils_route_t *route, tils_out_t *out) {
+    memset(rec, 0, sizeof(tils_access_rec_t));
+    rec->bytes = out->len;
+    rec->parse_ns = request->parse_ns;
+    rec->addr = conn->addr;
+    rec->status = out->status;
+    rec->route = route != NULL && out->status != 404 ? route->id :
+        TILS_ACCESS_NO_ROUTE;
+    rec->method = request->request_type;
+    if (out->tail != NULL && out->tail->kind == OUT_DEFLATE)
+        rec->flags |= TILS_ACCESS_CHUNKED;
+}
 
 /**
  * @brief Serve a resource to the input connection based on the request.
  *
+ * @param self The worker serving the request.
  * @param conn The connection being served the resource.
  * @param http_request The request specifying the resource.
  */
-void tils_serve_resource(tils_conn_t *conn, tils_http_request_t *http_request) {
-    tils_http_request_e request_type = http_request->request_type;
-    char *resource = http_request->resource;
+void tils_serve_resource(tils_wt_t *self, tils_conn_t *conn,
+        tils_http_request_t *http_request) {
+    tils_route_t *route = NULL;
+    tils_access_rec_t rec;
+    int timed = self->access != NULL || tils_stats_enabled();
+    int64_t start = timed ? tils_access_clock() : 0;
+    int res = 0;
+    BENCH_START(bench_serve);
 
-    if (request_type != TILS_GET) {
-        _tils_serve_unimplemented(conn);
+    tils_out_t *out = tils_out_new(self->arena);
+    if (out == NULL) {
+        tils_conn_kill(self->conns, conn, CLOSE_ERROR);
         return;
     }
 
-    char *remap_resource;
-    int file_fd;
-    int size;
+    /* The response says whether the connection survives it */
+    if (tils_conn_count_request(conn))
+        http_request->keep_alive = 0;
+    if (!http_request->keep_alive)
+        conn->closing = 1;
 
-    /* Find if we are allowed to serve this resource */
-    if (tils_route_lookup(resource, &remap_resource) == 0 &&
-            (file_fd = open(remap_resource, O_RDONLY)) >= 0) {
-        if ((size = tils_fd_size(file_fd)) < 0)
-            return;
+    int keep_alive = http_request->keep_alive;
+    tils_http_request_e type = http_request->request_type;
+    if (type == TILS_OPTIONS && (strcmp(http_request->resource, "*") == 0 ||
+                tils_route_lookup(http_request->resource, &route) == 0)) {
+        res = _tils_serve_options(self, out, keep_alive);
+    } else if (type != TILS_GET && type != TILS_HEAD &&
+            type != TILS_OPTIONS) {
+        res = _tils_serve_unimplemented(self, out, keep_alive);
+    } else if (type != TILS_OPTIONS && tils_stats_enabled() &&
+            strcmp(http_request->resource, TILS_STATS_PATH) == 0) {
+        res = _tils_serve_stats(self, out, keep_alive, type == TILS_HEAD);
+    } else if (type != TILS_OPTIONS &&
+            tils_route_lookup(http_request->resource, &route) == 0 &&
+            _tils_serve_file(self, out, route, http_request) == 0) {
+        res = 0;
+    } else {
+        /* Start over, the file may have made it partway into out. */
+        TILS_PROBE1(route__miss, http_request->resource);
+        tils_out_release(out);
+        res = _tils_serve_not_found(self, out, keep_alive,
+                type == TILS_HEAD);
+    }
+
+    if (res < 0) {
+        tils_out_release(out);
+        tils_conn_kill(self->conns, conn, CLOSE_ERROR);
+        return;
+    }
 
-        char *content_type = _tils_get_content_type(remap_resource, 
-                strlen(remap_resource));
+    BENCH_STOP(bench_serve, BENCH_SERVE);
+    if (self->access != NULL)
+        _tils_serve_access(&rec, conn, http_request, route, out);
 
-        _tils_serve_file(conn, file_fd, content_type, size);
-        close(file_fd);
-    } else {
-        _tils_serve_not_found(conn);
+    /* Writing consumes the response */
+    int status = out->status;
+    size_t bytes = out->len;
+    int route_id = route != NULL && status != 404 ? route->id : -1;
+    tils_stall_serving(&self->stall, conn, route_id);
+    TILS_TRACE(self->trace, TILS_TRACE_BUILT);
+    TILS_PROBE3(response__start, conn->client_fd, status, bytes);
+    _tils_serve_out(self, conn, out);
+
+    if (self->trace != NULL)
+        tils_trace_request(self->trace, conn->client_fd, route_id, type,
+                status, bytes, conn->out != NULL);
+
+    if (!timed)
+        return;
+
+    int64_t serve_ns = tils_access_clock() - start;
+    if (tils_stats_enabled())
+        tils_stats_request(&self->stats, type, status, bytes, serve_ns);
+
+    if (self->access != NULL) {
+        rec.time_ns = start;
+        rec.serve_ns = serve_ns;
+        tils_access_log_append(self->access, &rec);
     }
 }
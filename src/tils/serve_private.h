@@ -26,25 +26,51 @@
 #ifndef _SERVE_PRIVATE_H_
 #define _SERVE_PRIVATE_H_
 
-const char* msg_unimplemented = "HTTP/1.1 501 Method Not Implemented\r\n"
-SERVER_STRING
-"Content-Type: text\r\n"
+#include <tils/request.h>
+
+/* Constant responses, everything following the Date header */
+static const char msg_unimplemented[] = "Content-Type: text\r\n"
 "Content-Length: 18\r\n"
 "\r\n"
 "Not implemented.\r\n";
 
-const char *msg_not_found = "HTTP/1.1 404 Not Found\r\n"
-SERVER_STRING
-"Content-Type: text/html\r\n"
-"Content-Length: 5\r\n"
+/* Sent without its body to HEAD requests */
+#define NOT_FOUND_HEADERS "Content-Type: text/html\r\n" \
+"Content-Length: 5\r\n" \
 "\r\n"
-"404\r\n";
 
-const char *header_file = "HTTP/1.1 200 OK\r\n"
-SERVER_STRING
-"Content-Type: %s\r\n"
-"Content-Length: %d\r\n"
-"Connection: keep-alive\r\n"
+static const char msg_not_found[] = NOT_FOUND_HEADERS "404\r\n";
+
+static const char msg_options[] = "Allow: GET, HEAD, OPTIONS\r\n"
+"Content-Length: 0\r\n"
 "\r\n";
 
+/* zlib level for responses gzipped on the fly... */
+#define DEFLATE_LEVEL (6)
+
+/* ...once the worker's load (%) passes this, the fastest level is used... */
+#define DEFLATE_FAST_LOAD (50)
+#define DEFLATE_FAST_LEVEL (1)
+
+/* ...and past this they aren't compressed at all */
+#define DEFLATE_OFF_LOAD (85)
+
+/* Separates the parts of a multipart/byteranges body */
+#define MULTIPART_BOUNDARY "tils-byteranges-5f0c9e3a7d21b864"
+
+/* Room each part's headers need, less the content type */
+#define MULTIPART_PART_MAX (192)
+
+/* Content-Encoding header per coding */
+static const struct {
+    const char *line;
+    int len;
+} _encoding_lines[TILS_ENC_COUNT] = {
+    [TILS_ENC_IDENTITY] = { "", 0 },
+    [TILS_ENC_GZIP] = { "Content-Encoding: gzip\r\n",
+        sizeof("Content-Encoding: gzip\r\n") - 1 },
+    [TILS_ENC_BR] = { "Content-Encoding: br\r\n",
+        sizeof("Content-Encoding: br\r\n") - 1 },
+};
+
 #endif /* _SERVE_PRIVATE_H_ */
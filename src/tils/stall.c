@@ -0,0 +1,184 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/stall.c
+ *
+ * @brief Event loop stall detection
+ *
+ * A worker calls `tils_stall_handler' after everything it does for one
+ * ready file descriptor, reusing the end of one handler as the start of the
+ * next, so timing costs a single clock read per handler. Only iterations
+ * over the threshold do any more work than a comparison.
+ *
+ * @author Lars Wander
+ */
+
+#include <lib/logging.h>
+#include <lib/util.h>
+#include <tils/routes.h>
+#include <tils/stall.h>
+#include <tils/stats.h>
+
+#include "stall_private.h"
+
+static int64_t _threshold_ns = STALL_DEFAULT_MS * 1000000L;
+
+/**
+ * @brief Set the busy time per iteration that counts as a stall.
+ *
+ * @param ms The threshold in milliseconds, 0 to never report stalls.
+ */
+void tils_stall_threshold(int ms) {
+    _threshold_ns = (int64_t)ms * 1000000L;
+}
+
+void tils_stall_init(tils_stall_t *s) {
+    s->route = STALL_NO_ROUTE;
+    s->fd = -1;
+    tils_stall_begin(s);
+}
+
+/**
+ * @brief Forget the previous iteration's slowest handler.
+ */
+void tils_stall_begin(tils_stall_t *s) {
+    s->worst_ns = -1;
+}
+
+/**
+ * @brief Note the request the current handler is serving.
+ *
+ * @param s The serving worker's detector.
+ * @param conn The connection being served.
+ * @param route ID of the route served, -1 if none.
+ */
+void tils_stall_serving(tils_stall_t *s, tils_conn_t *conn, int route) {
+    s->fd = conn->client_fd;
+    s->addr = conn->addr;
+    s->route = route;
+}
+
+/**
+ * @brief Account for one handler.
+ *
+ * @param s The worker's detector.
+ * @param phase What the handler did.
+ * @param conn The connection handled, NULL if the handler didn't know it
+ *        (e.g. accept) or there was none.
+ * @param ns How long the handler ran.
+ */
+void tils_stall_handler(tils_stall_t *s, tils_phase_e phase,
+        tils_conn_t *conn, int64_t ns) {
+    if (ns > s->worst_ns) {
+        if (conn != NULL) {
+            s->fd = conn->client_fd;
+            s->addr = conn->addr;
+        }
+
+        s->worst_ns = ns;
+        s->worst_phase = phase;
+        s->worst_route = s->route;
+        s->worst_fd = s->fd;
+        s->worst_addr = s->addr;
+    }
+
+    s->route = STALL_NO_ROUTE;
+    s->fd = -1;
+}
+
+/**
+ * @brief Find the offender a stall is counted against.
+ *
+ * When the table is full the entry with the mildest worst case makes room,
+ * unless it was worse than this stall.
+ *
+ * @return The entry, NULL if this stall doesn't make the table.
+ */
+tils_stall_entry_t *_tils_stall_entry(tils_stall_t *s, int phase, int route,
+        uint64_t ns) {
+    tils_stall_entry_t *mildest = NULL;
+
+    for (int i = 0; i < TILS_STALL_TOP; i++) {
+        tils_stall_entry_t *e = &s->top[i];
+        if (atomic_load_explicit(&e->count, memory_order_relaxed) == 0) {
+            atomic_store_explicit(&e->phase, phase, memory_order_relaxed);
+            atomic_store_explicit(&e->route, route, memory_order_relaxed);
+            return e;
+        }
+
+        if (atomic_load_explicit(&e->phase, memory_order_relaxed) == phase &&
+                atomic_load_explicit(&e->route, memory_order_relaxed) ==
+                route)
+            return e;
+
+        if (mildest == NULL || atomic_load_explicit(&e->max_ns,
+                    memory_order_relaxed) < atomic_load_explicit(
+                    &mildest->max_ns, memory_order_relaxed))
+            mildest = e;
+    }
+
+    if (atomic_load_explicit(&mildest->max_ns, memory_order_relaxed) >= ns)
+        return NULL;
+
+    TILS_STAT_SET(mildest->count, 0);
+    TILS_STAT_SET(mildest->total_ns, 0);
+    TILS_STAT_SET(mildest->max_ns, 0);
+    atomic_store_explicit(&mildest->phase, phase, memory_order_relaxed);
+    atomic_store_explicit(&mildest->route, route, memory_order_relaxed);
+    return mildest;
+}
+
+/**
+ * @brief Finish an iteration, reporting it if it stalled.
+ *
+ * @param s The worker's detector.
+ * @param worker The worker's ID.
+ * @param ns Time the iteration spent outside select.
+ */
+void tils_stall_end(tils_stall_t *s, int worker, int64_t ns) {
+    if (LIKELY(_threshold_ns == 0 || ns < _threshold_ns ||
+                s->worst_ns < 0))
+        return;
+
+    char addr[TILS_ADDRSTRLEN] = "-";
+    const char *route = s->worst_route != STALL_NO_ROUTE ?
+        tils_route_source(s->worst_route) : "-";
+    if (s->worst_fd >= 0)
+        tils_addr_format(&s->worst_addr, addr, sizeof(addr));
+
+    log_warn("Thread %d stalled for %ld ms, %ld ms in %s on fd %d (%s) "
+            "for %s", worker, (long)(ns / 1000000),
+            (long)(s->worst_ns / 1000000), _phase_names[s->worst_phase],
+            s->worst_fd, addr, route);
+
+    TILS_STAT_ADD(s->stalls, 1);
+    tils_stall_entry_t *e = _tils_stall_entry(s, s->worst_phase,
+            s->worst_route, s->worst_ns);
+    if (e == NULL)
+        return;
+
+    TILS_STAT_ADD(e->count, 1);
+    TILS_STAT_ADD(e->total_ns, s->worst_ns);
+    if (atomic_load_explicit(&e->max_ns, memory_order_relaxed) <
+            (uint64_t)s->worst_ns)
+        TILS_STAT_SET(e->max_ns, s->worst_ns);
+}
+
+const char *tils_stall_phase_name(tils_phase_e phase) {
+    return _phase_names[phase];
+}
@@ -0,0 +1,46 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/stall_private.h
+ *
+ * @brief Stall detector defaults
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _STALL_PRIVATE_H_
+#define _STALL_PRIVATE_H_
+
+#include <tils/stall.h>
+
+/* Busy time per iteration that counts as a stall, unless set with -w */
+#define STALL_DEFAULT_MS (100)
+
+/* Handler route when no route was matched */
+#define STALL_NO_ROUTE (-1)
+
+static const char *_phase_names[TILS_PHASE_COUNT] = {
+    [TILS_PHASE_CLEANUP] = "cleanup",
+    [TILS_PHASE_ACCEPT] = "accept",
+    [TILS_PHASE_INBOX] = "inbox",
+    [TILS_PHASE_READ] = "read",
+    [TILS_PHASE_WRITE] = "write",
+    [TILS_PHASE_LINGER] = "linger",
+};
+
+#endif /* _STALL_PRIVATE_H_ */
@@ -0,0 +1,323 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/stats.c
+ *
+ * @brief Stats page, in Prometheus' text exposition format
+ *
+ * @author Lars Wander
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <lib/logging.h>
+#include <tils/routes.h>
+#include <tils/stats.h>
+#include <tils/worker_thread.h>
+
+#include "stats_private.h"
+
+static int _enabled = 0;
+
+/**
+ * @brief Serve the stats page at TILS_STATS_PATH.
+ */
+void tils_stats_enable() {
+    _enabled = 1;
+}
+
+int tils_stats_enabled() {
+    return _enabled;
+}
+
+/**
+ * @brief Find the bucket a value falls in.
+ *
+ * @param bounds Upper bounds of every bucket but +Inf, ascending.
+ * @param count Number of bounds.
+ * @param value The value being counted.
+ *
+ * @return The bucket's index, count for +Inf.
+ */
+int _tils_stats_bucket(const stats_bound_t *bounds, int count,
+        int64_t value) {
+    int res = 0;
+    while (res < count && value > bounds[res].value)
+        res++;
+
+    return res;
+}
+
+/**
+ * @brief Count a response.
+ *
+ * @param stats The counters of the worker that sent it.
+ * @param method The request's method.
+ * @param status The response's status code.
+ * @param bytes The response's length.
+ * @param ns Time from the request being parsed to the response first being
+ *        written.
+ */
+void tils_stats_request(tils_stats_t *stats, tils_http_request_e method,
+        int status, size_t bytes, int64_t ns) {
+    int bucket = _tils_stats_bucket(_latency_bounds,
+            TILS_STATS_LATENCY_BUCKETS - 1, ns);
+
+    for (int i = 0; i < TILS_STATUS_COUNT; i++) {
+        if (tils_status_code(i) == status) {
+            TILS_STAT_ADD(stats->requests[method][i], 1);
+            break;
+        }
+    }
+
+    TILS_STAT_ADD(stats->latency[bucket], 1);
+    TILS_STAT_ADD(stats->latency_ns, ns);
+    TILS_STAT_ADD(stats->bytes_out, bytes);
+}
+
+/**
+ * @brief Count a connection's TCP_INFO sample.
+ *
+ * @param stats The counters of the worker that owned the connection.
+ * @param sample The sample.
+ */
+void tils_stats_tcp(tils_stats_t *stats, tils_tcp_sample_t *sample) {
+    int64_t rtt_ns = (int64_t)sample->rtt_us * 1000;
+
+    TILS_STAT_ADD(stats->tcp_samples, 1);
+    TILS_STAT_ADD(stats->tcp_rtt[_tils_stats_bucket(_latency_bounds,
+                TILS_STATS_LATENCY_BUCKETS - 1, rtt_ns)], 1);
+    TILS_STAT_ADD(stats->tcp_rtt_ns, rtt_ns);
+    TILS_STAT_ADD(stats->tcp_retrans, sample->retrans);
+    TILS_STAT_ADD(stats->tcp_cwnd[_tils_stats_bucket(_count_bounds,
+                TILS_STATS_COUNT_BUCKETS - 1, sample->cwnd)], 1);
+    TILS_STAT_ADD(stats->tcp_cwnd_sum, sample->cwnd);
+    TILS_STAT_ADD(stats->tcp_unacked[_tils_stats_bucket(_count_bounds,
+                TILS_STATS_COUNT_BUCKETS - 1, sample->unacked)], 1);
+    TILS_STAT_ADD(stats->tcp_unacked_sum, sample->unacked);
+    TILS_STAT_ADD(stats->tcp_delivery_rate[_tils_stats_bucket(_rate_bounds,
+                TILS_STATS_RATE_BUCKETS - 1, sample->delivery_rate)], 1);
+    TILS_STAT_ADD(stats->tcp_delivery_rate_sum, sample->delivery_rate);
+}
+
+/**
+ * @brief Count a sample of a listener's accept queue.
+ *
+ * @param stats The counters of the accepting worker.
+ * @param len Connections waiting to be accepted.
+ * @param limit The queue's limit.
+ */
+void tils_stats_accept_queue(tils_stats_t *stats, int len, int limit) {
+    TILS_STAT_ADD(stats->accept_queue[_tils_stats_bucket(_count_bounds,
+                TILS_STATS_COUNT_BUCKETS - 1, len)], 1);
+    TILS_STAT_ADD(stats->accept_queue_sum, len);
+    TILS_STAT_SET(stats->accept_queue_limit, limit);
+}
+
+/**
+ * @brief Append to the page, never past cap.
+ *
+ * Once something doesn't fit, len is left at cap and nothing more is
+ * appended, for the page to be rendered again into a larger buffer.
+ */
+void _tils_stats_put(char *buf, int cap, int *len, const char *format, ...) {
+    if (*len >= cap)
+        return;
+
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buf + *len, cap - *len, format, ap);
+    va_end(ap);
+
+    if (n > 0)
+        *len = *len + n < cap ? *len + n : cap;
+}
+
+unsigned long _tils_stats_load(atomic_ulong *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/**
+ * @brief Append a worker's series of one of `_histograms'.
+ *
+ * @param w The worker's ID.
+ * @param stats The worker's counters.
+ * @param h The histogram's index.
+ */
+void _tils_stats_histogram(char *buf, int cap, int *len, int w,
+        tils_stats_t *stats, int h) {
+    atomic_ulong *buckets = (atomic_ulong *)
+        ((char *)stats + _histograms[h].buckets);
+    atomic_ulong *sum = (atomic_ulong *)((char *)stats + _histograms[h].sum);
+    const char *name = _histograms[h].name;
+    unsigned long total = 0;
+
+    for (int b = 0; b <= _histograms[h].count; b++) {
+        total += _tils_stats_load(&buckets[b]);
+        _tils_stats_put(buf, cap, len, "%s_bucket{worker=\"%d\",le=\"%s\"} "
+                "%lu\n", name, w, b < _histograms[h].count ?
+                _histograms[h].bounds[b].le : "+Inf", total);
+    }
+
+    if (_histograms[h].scale == 1)
+        _tils_stats_put(buf, cap, len, "%s_sum{worker=\"%d\"} %lu\n", name,
+                w, _tils_stats_load(sum));
+    else
+        _tils_stats_put(buf, cap, len, "%s_sum{worker=\"%d\"} %.9f\n", name,
+                w, _tils_stats_load(sum) * _histograms[h].scale);
+
+    _tils_stats_put(buf, cap, len, "%s_count{worker=\"%d\"} %lu\n", name, w,
+            total);
+}
+
+/**
+ * @brief Append one metric of a worker's worst stall offenders.
+ *
+ * @param w The worker's ID.
+ * @param stall The worker's stall detector.
+ * @param metric Which of `_offender_metrics' to print.
+ */
+void _tils_stats_offenders(char *buf, int cap, int *len, int w,
+        tils_stall_t *stall, int metric) {
+    for (int i = 0; i < TILS_STALL_TOP; i++) {
+        tils_stall_entry_t *e = &stall->top[i];
+        unsigned long count = _tils_stats_load(&e->count);
+        if (count == 0)
+            continue;
+
+        int route = atomic_load_explicit(&e->route, memory_order_relaxed);
+        int phase = atomic_load_explicit(&e->phase, memory_order_relaxed);
+        _tils_stats_put(buf, cap, len, "%s{worker=\"%d\",phase=\"%s\","
+                "route=\"%s\"} ", _offender_metrics[metric].name, w,
+                tils_stall_phase_name(phase),
+                route >= 0 ? tils_route_source(route) : "");
+
+        if (metric == STATS_OFFENDER_COUNT)
+            _tils_stats_put(buf, cap, len, "%lu\n", count);
+        else if (metric == STATS_OFFENDER_SUM)
+            _tils_stats_put(buf, cap, len, "%.6f\n",
+                    _tils_stats_load(&e->total_ns) / 1e9);
+        else
+            _tils_stats_put(buf, cap, len, "%.6f\n",
+                    _tils_stats_load(&e->max_ns) / 1e9);
+    }
+}
+
+/**
+ * @brief Render the counters of every worker into buf.
+ *
+ * @return The length of the page, cap if it didn't fit.
+ */
+int _tils_stats_page(char *buf, int cap) {
+    int count = 0;
+    tils_wt_t *workers = tils_workers(&count);
+    int len = 0;
+
+    for (int c = 0; c < sizeof(_counters) / sizeof(_counters[0]); c++) {
+        _tils_stats_put(buf, cap, &len, "# HELP %s %s\n# TYPE %s %s\n",
+                _counters[c].name, _counters[c].help, _counters[c].name,
+                _counters[c].type);
+        for (int w = 0; w < count; w++) {
+            atomic_ulong *counter = (atomic_ulong *)
+                ((char *)&workers[w].stats + _counters[c].offset);
+            _tils_stats_put(buf, cap, &len, "%s{worker=\"%d\"} %lu\n",
+                    _counters[c].name, w, _tils_stats_load(counter));
+        }
+    }
+
+    _tils_stats_put(buf, cap, &len, "# HELP tils_requests_total Responses "
+            "sent\n# TYPE tils_requests_total counter\n");
+    for (int w = 0; w < count; w++) {
+        tils_stats_t *stats = &workers[w].stats;
+        for (int m = 0; m <= TILS_UNKNOWN; m++) {
+            for (int s = 0; s < TILS_STATUS_COUNT; s++) {
+                unsigned long n = _tils_stats_load(&stats->requests[m][s]);
+                if (n == 0)
+                    continue;
+
+                _tils_stats_put(buf, cap, &len, "tils_requests_total"
+                        "{worker=\"%d\",method=\"%s\",code=\"%d\"} %lu\n", w,
+                        tils_request_method_name(m), tils_status_code(s), n);
+            }
+        }
+    }
+
+    for (int h = 0; h < sizeof(_histograms) / sizeof(_histograms[0]); h++) {
+        _tils_stats_put(buf, cap, &len, "# HELP %s %s\n# TYPE %s histogram\n",
+                _histograms[h].name, _histograms[h].help, _histograms[h].name);
+        for (int w = 0; w < count; w++)
+            _tils_stats_histogram(buf, cap, &len, w, &workers[w].stats, h);
+    }
+
+    _tils_stats_put(buf, cap, &len, "# HELP tils_stalls_total Loop "
+            "iterations busy for longer than the stall threshold\n"
+            "# TYPE tils_stalls_total counter\n");
+    for (int w = 0; w < count; w++)
+        _tils_stats_put(buf, cap, &len, "tils_stalls_total{worker=\"%d\"} "
+                "%lu\n", w, _tils_stats_load(&workers[w].stall.stalls));
+
+    for (int m = 0; m < sizeof(_offender_metrics) /
+            sizeof(_offender_metrics[0]); m++) {
+        _tils_stats_put(buf, cap, &len, "# HELP %s %s\n# TYPE %s %s\n",
+                _offender_metrics[m].name, _offender_metrics[m].help,
+                _offender_metrics[m].name, _offender_metrics[m].type);
+        for (int w = 0; w < count; w++)
+            _tils_stats_offenders(buf, cap, &len, w, &workers[w].stall, m);
+    }
+
+    _tils_stats_put(buf, cap, &len, "# HELP tils_log_dropped_total Log "
+            "records dropped on full rings\n# TYPE tils_log_dropped_total "
+            "counter\ntils_log_dropped_total %lu\n", log_dropped());
+
+    return len;
+}
+
+/**
+ * @brief Render the counters of every worker.
+ *
+ * Workers are read while they run, so counters of different workers (and
+ * the buckets of a histogram) may be a few requests apart. A page that
+ * outgrows its buffer is rendered again into one twice the size, it is
+ * never cut short.
+ *
+ * @param arena Where the page is allocated.
+ * @param[out] body The page.
+ *
+ * @return The length of the page, -1 on error.
+ */
+int tils_stats_render(arena_t *arena, char **body) {
+    int count = 0;
+    tils_workers(&count);
+
+    for (int cap = STATS_FIXED_BYTES + count * STATS_WORKER_BYTES;
+            cap <= STATS_MAX_BYTES; cap *= 2) {
+        char *buf = arena_alloc(arena, cap);
+        if (buf == NULL)
+            return -1;
+
+        int len = _tils_stats_page(buf, cap);
+        if (len < cap) {
+            *body = buf;
+            return len;
+        }
+    }
+
+    log_warn("Stats page is larger than %d bytes", STATS_MAX_BYTES);
+    return -1;
+}
@@ -0,0 +1,179 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/stats_private.h
+ *
+ * @brief Stats page layout
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _STATS_PRIVATE_H_
+#define _STATS_PRIVATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tils/stats.h>
+
+/* Stats page space first reserved per worker, and for everything else */
+#define STATS_WORKER_BYTES (24 << 10)
+#define STATS_FIXED_BYTES (4 << 10)
+
+/* Largest the page may grow to */
+#define STATS_MAX_BYTES (64 << 20)
+
+/* Upper bound of a histogram bucket, and that bound as Prometheus prints
+ * it */
+typedef struct {
+    int64_t value;
+    const char *le;
+} stats_bound_t;
+
+/* Every latency bucket but +Inf, in nanoseconds */
+static const stats_bound_t _latency_bounds[TILS_STATS_LATENCY_BUCKETS - 1] = {
+    { 1000, "1e-06" },
+    { 2500, "2.5e-06" },
+    { 5000, "5e-06" },
+    { 10000, "1e-05" },
+    { 25000, "2.5e-05" },
+    { 50000, "5e-05" },
+    { 100000, "0.0001" },
+    { 250000, "0.00025" },
+    { 500000, "0.0005" },
+    { 1000000, "0.001" },
+    { 2500000, "0.0025" },
+    { 5000000, "0.005" },
+    { 10000000, "0.01" },
+    { 25000000, "0.025" },
+    { 50000000, "0.05" },
+    { 100000000, "0.1" },
+    { 250000000, "0.25" },
+};
+
+static const stats_bound_t _count_bounds[TILS_STATS_COUNT_BUCKETS - 1] = {
+    { 0, "0" },
+    { 1, "1" },
+    { 2, "2" },
+    { 4, "4" },
+    { 8, "8" },
+    { 16, "16" },
+    { 32, "32" },
+    { 64, "64" },
+    { 128, "128" },
+    { 256, "256" },
+    { 512, "512" },
+    { 1024, "1024" },
+};
+
+static const stats_bound_t _rate_bounds[TILS_STATS_RATE_BUCKETS - 1] = {
+    { 100000, "1e+05" },
+    { 1000000, "1e+06" },
+    { 10000000, "1e+07" },
+    { 100000000, "1e+08" },
+    { 1000000000, "1e+09" },
+    { 10000000000, "1e+10" },
+};
+
+/* Counters of every worker, as one Prometheus metric each */
+#define STATS_COUNTER(field, name, type, help) \
+    { offsetof(tils_stats_t, field), name, type, help }
+
+static const struct {
+    size_t offset;
+    const char *name;
+    const char *type;
+    const char *help;
+} _counters[] = {
+    STATS_COUNTER(accepts, "tils_accepts_total", "counter",
+            "Connections accepted"),
+    STATS_COUNTER(active, "tils_connections_active", "gauge",
+            "Open connections"),
+    STATS_COUNTER(bytes_out, "tils_response_bytes_total", "counter",
+            "Bytes of responses, headers included"),
+    STATS_COUNTER(cache_hits, "tils_cache_hits_total", "counter",
+            "Files served from memory"),
+    STATS_COUNTER(cache_misses, "tils_cache_misses_total", "counter",
+            "Files served from disk"),
+    STATS_COUNTER(iterations, "tils_loop_iterations_total", "counter",
+            "Event loop iterations"),
+    STATS_COUNTER(tcp_samples, "tils_tcp_samples_total", "counter",
+            "Connections whose TCP_INFO was sampled as they closed"),
+    STATS_COUNTER(tcp_retrans, "tils_tcp_retransmits_total", "counter",
+            "Segments retransmitted over the sampled connections"),
+    STATS_COUNTER(accept_queue_limit, "tils_accept_queue_limit", "gauge",
+            "Accept queue length past which a listener drops connections"),
+};
+
+/* Histograms of every worker */
+#define STATS_HISTOGRAM(buckets, sum, bounds, scale, name, help) \
+    { offsetof(tils_stats_t, buckets), offsetof(tils_stats_t, sum), bounds, \
+        sizeof(bounds) / sizeof(bounds[0]), scale, name, help }
+
+static const struct {
+    size_t buckets;
+    size_t sum;
+    const stats_bound_t *bounds;
+
+    /* Buckets less +Inf */
+    int count;
+
+    /* Unit of the sum, 1 if it's printed as is */
+    double scale;
+
+    const char *name;
+    const char *help;
+} _histograms[] = {
+    STATS_HISTOGRAM(latency, latency_ns, _latency_bounds, 1e-9,
+            "tils_request_duration_seconds",
+            "Time from a request being parsed to its response being written"),
+    STATS_HISTOGRAM(tcp_rtt, tcp_rtt_ns, _latency_bounds, 1e-9,
+            "tils_tcp_rtt_seconds", "Smoothed RTT of the sampled connections"),
+    STATS_HISTOGRAM(tcp_cwnd, tcp_cwnd_sum, _count_bounds, 1,
+            "tils_tcp_cwnd_segments",
+            "Congestion window of the sampled connections"),
+    STATS_HISTOGRAM(tcp_unacked, tcp_unacked_sum, _count_bounds, 1,
+            "tils_tcp_unacked_segments",
+            "Unacknowledged segments of the sampled connections"),
+    STATS_HISTOGRAM(tcp_delivery_rate, tcp_delivery_rate_sum, _rate_bounds,
+            1, "tils_tcp_delivery_rate_bytes_per_second",
+            "Delivery rate of the sampled connections"),
+    STATS_HISTOGRAM(accept_queue, accept_queue_sum, _count_bounds, 1,
+            "tils_accept_queue_length",
+            "Connections waiting in the listener's accept queue"),
+};
+
+/* Metrics of the stall offender table, labelled by phase & route */
+#define STATS_OFFENDER_COUNT (0)
+#define STATS_OFFENDER_SUM (1)
+#define STATS_OFFENDER_MAX (2)
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} _offender_metrics[] = {
+    [STATS_OFFENDER_COUNT] = { "tils_stall_offender_total", "counter",
+        "Stalls whose slowest handler ran in this phase & route" },
+    [STATS_OFFENDER_SUM] = { "tils_stall_offender_seconds_total", "counter",
+        "Time spent in those handlers" },
+    [STATS_OFFENDER_MAX] = { "tils_stall_offender_seconds_max", "gauge",
+        "Slowest of those handlers" },
+};
+
+#endif /* _STATS_PRIVATE_H_ */
@@ -0,0 +1,99 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/tcp_info.c
+ *
+ * @brief Sampling the kernel's TCP_INFO of clients & listeners
+ *
+ * Uses the kernel's own struct tcp_info, as libc's lacks newer fields like
+ * the delivery rate. That header clashes with <netinet/tcp.h>, hence this
+ * file of its own.
+ *
+ * @author Lars Wander
+ */
+
+#include <stddef.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+
+#include <tils/tcp_info.h>
+
+#include "tcp_info_private.h"
+
+/* Sample 1 in every _every connections, 0 never */
+static int _every = 0;
+
+void tils_tcp_sampling(int every) {
+    _every = every;
+}
+
+int tils_tcp_sampling_rate() {
+    return _every;
+}
+
+/**
+ * @brief Read a connected socket's TCP_INFO.
+ *
+ * @param fd The client's socket.
+ * @param[out] res The sample.
+ *
+ * @return 0 on success, -1 if fd isn't a TCP socket.
+ */
+int tils_tcp_sample(int fd, tils_tcp_sample_t *res) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0 ||
+            len < offsetof(struct tcp_info, tcpi_total_retrans) +
+            sizeof(info.tcpi_total_retrans))
+        return -1;
+
+    res->rtt_us = info.tcpi_rtt;
+    res->retrans = info.tcpi_total_retrans;
+    res->cwnd = info.tcpi_snd_cwnd;
+    res->unacked = info.tcpi_unacked;
+    res->delivery_rate = len >= offsetof(struct tcp_info,
+            tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate) ?
+        info.tcpi_delivery_rate : 0;
+    return 0;
+}
+
+/**
+ * @brief Read how full a listener's accept queue is.
+ *
+ * On a listening socket the kernel reports the queue's length as unacked,
+ * and its limit (the backlog) as sacked.
+ *
+ * @param fd The listener.
+ * @param[out] len Connections waiting to be accepted.
+ * @param[out] limit Connections the queue holds before dropping SYNs.
+ *
+ * @return 0 on success, -1 if fd isn't a TCP listener.
+ */
+int tils_tcp_accept_queue(int fd, int *len, int *limit) {
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) < 0 ||
+            info.tcpi_state != TCPI_STATE_LISTEN)
+        return -1;
+
+    *len = info.tcpi_unacked;
+    *limit = info.tcpi_sacked;
+    return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/tcp_info_private.h
+ *
+ * @brief What <linux/tcp.h> leaves to <netinet/tcp.h>
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TCP_INFO_PRIVATE_H_
+#define _TCP_INFO_PRIVATE_H_
+
+/* tcpi_state of a listening socket, TCP_LISTEN in <netinet/tcp.h> */
+#define TCPI_STATE_LISTEN (10)
+
+#endif /* _TCP_INFO_PRIVATE_H_ */
@@ -37,15 +37,20 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include <lib/util.h>
 #include <lib/logging.h>
 #include <tils/io_util.h>
+#include <tils/tils.h>
 
 static int _fd_limit;
 
+/* Options the listener was opened with, applied to each accepted socket. */
+static tils_listen_opts_t _listen_opts;
+
 /**
  * @brief Increase open file descriptors to max
  *
@@ -55,13 +60,13 @@ rlim_t set_open_fd_limit() {
     struct rlimit r;
 
     if (getrlimit(RLIMIT_NOFILE, &r) < 0)
-        log_err("Unable to get file descriptor limit");
+        log_err_errno("Unable to get file descriptor limit");
 
     if (r.rlim_cur < r.rlim_max)
         r.rlim_cur = r.rlim_max;
 
     if (setrlimit(RLIMIT_NOFILE, &r) < 0)
-        log_err("Unable to set file descriptor limit");
+        log_err_errno("Unable to set file descriptor limit");
 
     return r.rlim_cur;
 }
@@ -74,45 +79,232 @@ int get_open_fd_limit() {
 }
 
 /**
- * @brief Bind server to HTTP TCP socket.
+ * @brief Read the kernel's cap on the accept queue length.
+ *
+ * @return somaxconn, or DEFAULT_BACKLOG if it can't be read.
+ */
+int _tils_somaxconn() {
+    int res = DEFAULT_BACKLOG;
+    FILE *f = fopen("/proc/sys/net/core/somaxconn", "r");
+    if (f == NULL)
+        return res;
+
+    if (fscanf(f, "%d", &res) != 1 || res <= 0)
+        res = DEFAULT_BACKLOG;
+
+    fclose(f);
+    return res;
+}
+
+/**
+ * @brief Fill in the default listener tuning.
+ *
+ * @param opts The options being initialized.
+ */
+void tils_listen_opts_default(tils_listen_opts_t *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->backlog = _tils_somaxconn();
+}
+
+/**
+ * @brief Apply the per-connection half of the listener tuning.
+ *
+ * @param client_fd A freshly accepted client socket.
+ * @param family Address family of the listener it was accepted on.
+ *
+ * @return 0 on success, < 0 otherwise.
+ */
+int tils_tune_client(int client_fd, int family) {
+    int res = 0;
+
+    /* Nothing below applies to unix domain sockets. */
+    if (family == AF_UNIX)
+        return 0;
+
+    if (tils_socket_keepalive(client_fd) < 0)
+        res = -1;
+
+    if (_listen_opts.nodelay && tils_socket_nodelay(client_fd) < 0)
+        res = -1;
+
+    if (_listen_opts.quickack && tils_socket_quickack(client_fd) < 0)
+        res = -1;
+
+    return res;
+}
+
+/**
+ * @brief Parse a listener address.
+ *
+ * Accepted forms are "port" (IPv4, any interface), "a.b.c.d:port",
+ * "[v6 address]:port" and "unix:/path/to/socket".
+ *
+ * @param spec The address being parsed.
+ * @param[out] addr The parsed socket address.
+ * @param[out] addr_len The length of the parsed socket address.
+ *
+ * @return 0 on success, -1 if spec is malformed.
+ */
+int _tils_parse_addr(char *spec, struct sockaddr_storage *addr,
+        socklen_t *addr_len) {
+    char host[INET6_ADDRSTRLEN];
+    char *port_str = spec;
+    char *end = NULL;
+    long port;
+
+    memset(addr, 0, sizeof(*addr));
+
+    if (strncmp(spec, UNIX_PREFIX, sizeof(UNIX_PREFIX) - 1) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        char *path = spec + sizeof(UNIX_PREFIX) - 1;
+        size_t path_len = strlen(path);
+        if (path_len == 0 || path_len >= sizeof(un->sun_path))
+            return -1;
+
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path, path_len + 1);
+        *addr_len = sizeof(*un);
+        return 0;
+    }
+
+    host[0] = '\0';
+    if (spec[0] == '[') {
+        char *close = strchr(spec, ']');
+        if (close == NULL || close[1] != ':' ||
+                close - spec - 1 >= (long)sizeof(host))
+            return -1;
+
+        memcpy(host, spec + 1, close - spec - 1);
+        host[close - spec - 1] = '\0';
+        port_str = close + 2;
+    } else if ((end = strrchr(spec, ':')) != NULL) {
+        if (end - spec >= (long)sizeof(host))
+            return -1;
+
+        memcpy(host, spec, end - spec);
+        host[end - spec] = '\0';
+        port_str = end + 1;
+    }
+
+    port = strtol(port_str, &end, 10);
+    if (*port_str == '\0' || *end != '\0' || port < 0 || port > 0xffff)
+        return -1;
+
+    if (spec[0] == '[') {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        if (inet_pton(AF_INET6, host, &in6->sin6_addr) != 1)
+            return -1;
+        *addr_len = sizeof(*in6);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        if (host[0] == '\0')
+            in->sin_addr.s_addr = htonl(INADDR_ANY);
+        else if (inet_pton(AF_INET, host, &in->sin_addr) != 1)
+            return -1;
+        *addr_len = sizeof(*in);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Bind a listening socket.
+ *
+ * IPv6 listeners are dual-stack, so "[::]:80" also accepts IPv4 clients.
+ * A stale unix domain socket left at the same path is replaced.
+ *
+ * @param spec The address to listen on, see `_tils_parse_addr'.
+ * @param opts Listener tuning, NULL for the defaults.
  *
  * @return -1 on error, the server file descriptor otherwise.
  */
-int init_server(int port) {
-    struct sockaddr_in ip4server;
+int init_server(char *spec, tils_listen_opts_t *opts) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
     int server_fd = 0;
+    int family;
     _fd_limit = 0;
 
-    ip4server.sin_family = AF_INET; /* Address family internet */
-    ip4server.sin_port = htons(port); /* Bind to given port */
-    ip4server.sin_addr.s_addr = htonl(INADDR_ANY);  /* Bind to any interface */
+    if (opts == NULL)
+        tils_listen_opts_default(&_listen_opts);
+    else
+        _listen_opts = *opts;
 
-    /* Get a file descriptor for our socket */
-    if ((server_fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-        log_err("Unable to create socket");
+    if (_tils_parse_addr(spec, &addr, &addr_len) < 0) {
+        log_err("Invalid listen address: %s", spec);
         goto fail;
     }
 
-    if (tils_socket_keepalive(server_fd) < 0) {
+    family = addr.ss_family;
+
+    /* Get a file descriptor for our socket */
+    if ((server_fd = socket(family, SOCK_STREAM, 0)) < 0) {
+        log_err_errno("Unable to create socket");
         goto fail;
     }
 
+    if (family == AF_UNIX) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        struct stat st;
+        if (stat(un->sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(un->sun_path);
+    } else {
+        if (family == AF_INET6) {
+            int v6only = 0;
+            if (setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only,
+                        sizeof(v6only)) < 0)
+                log_warn_errno("Unable to make %s dual-stack", spec);
+        }
+
+        if (tils_socket_keepalive(server_fd) < 0) {
+            goto cleanup_socket;
+        }
+
+        /* Connections we close linger in TIME_WAIT on our side, which would
+         * otherwise keep a restarted server from binding. */
+        if (tils_socket_reuseaddr(server_fd) < 0) {
+            goto cleanup_socket;
+        }
+
+        /* Buffer sizes have to be set before `listen' to affect the window
+         * scale advertised in the SYN-ACK. Accepted sockets inherit them. */
+        if (tils_socket_bufsize(server_fd, _listen_opts.sndbuf,
+                    _listen_opts.rcvbuf) < 0) {
+            goto cleanup_socket;
+        }
+
+        /* Both of these are optimizations - a kernel without them still
+         * serves requests, so only warn. */
+        if (_listen_opts.defer_accept > 0 &&
+                tils_socket_defer_accept(server_fd,
+                    _listen_opts.defer_accept) < 0)
+            log_warn("Continuing without TCP_DEFER_ACCEPT");
+
+        if (_listen_opts.fastopen > 0 &&
+                tils_socket_fastopen(server_fd, _listen_opts.fastopen) < 0)
+            log_warn("Continuing without TCP_FASTOPEN");
+    }
+
     /* At first block, because we don't need to spin waiting for connections
      * if we know there are none */
     if (tils_fd_nonblocking(server_fd) < 0) {
-        goto fail;
+        goto cleanup_socket;
     }
 
     /* Bind the socket file descriptor to our network interface */
-    if (bind(server_fd, (struct sockaddr *)&ip4server, sizeof(ip4server)) < 0) {
-        log_err("Unable to bind socket");
+    if (bind(server_fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        log_err_errno("Unable to bind socket");
         goto cleanup_socket;
     }
 
-    /* Listen for connections on this socket. AFAIK, the second argument
-     * (backlog) is a suggestion, not a hard value. */
-    if (listen(server_fd, 16) < 0) {
-        log_err("Unable to listen on socket");
+    /* Listen for connections on this socket. The kernel silently caps the
+     * backlog at somaxconn. */
+    if (listen(server_fd, _listen_opts.backlog) < 0) {
+        log_err_errno("Unable to listen on socket");
         goto cleanup_socket;
     }
 
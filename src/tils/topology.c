@@ -0,0 +1,231 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/topology.c
+ *
+ * @brief CPU topology discovery.
+ *
+ * Everything is read out of sysfs, so there is no dependency on libnuma or
+ * hwloc. The resulting plan lists the CPUs we are allowed to run on in the
+ * order workers should claim them: the first hardware thread of every
+ * physical core, then (unless skipped) the SMT siblings.
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+
+#include <lib/logging.h>
+#include <tils/topology.h>
+
+#define SYS_CPU "/sys/devices/system/cpu/cpu%d/"
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define PATH_LEN (256)
+
+/**
+ * @brief Read a single integer out of a sysfs/procfs file.
+ *
+ * @return The value, or def if the file can't be read.
+ */
+int _tils_read_int(char *path, int def) {
+    int res = def;
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return def;
+
+    if (fscanf(f, "%d", &res) != 1)
+        res = def;
+
+    fclose(f);
+    return res;
+}
+
+/**
+ * @brief Find the NUMA node a CPU belongs to.
+ *
+ * sysfs exposes it as a `nodeN' link inside the CPU's directory.
+ *
+ * @return The node, 0 on a kernel without NUMA support.
+ */
+int _tils_cpu_node(int cpu) {
+    char path[PATH_LEN];
+    struct dirent *ent;
+    int node = 0;
+
+    snprintf(path, sizeof(path), SYS_CPU, cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "node", 4) == 0 &&
+                sscanf(ent->d_name + 4, "%d", &node) == 1)
+            break;
+    }
+
+    closedir(dir);
+    return node;
+}
+
+/**
+ * @brief Order CPUs so that every physical core is used before any SMT
+ *        sibling, and consecutive workers stay on the same node.
+ */
+int _tils_cpu_cmp(const void *_a, const void *_b) {
+    const tils_cpu_t *a = _a, *b = _b;
+    if (a->smt_rank != b->smt_rank)
+        return a->smt_rank - b->smt_rank;
+    if (a->node != b->node)
+        return a->node - b->node;
+    return a->cpu - b->cpu;
+}
+
+/**
+ * @brief Build the list of CPUs workers should be pinned to, in order.
+ *
+ * Only CPUs in our affinity mask (taskset, cpuset cgroup) are considered.
+ *
+ * @param skip_smt Leave out every hardware thread but the first per core.
+ * @param[out] cpus The plan, to be freed by the caller.
+ *
+ * @return Number of entries in cpus, -1 on error.
+ */
+int tils_topology_plan(int skip_smt, tils_cpu_t **cpus) {
+    char path[PATH_LEN];
+    cpu_set_t mask;
+    int count = 0;
+
+    if (sched_getaffinity(0, sizeof(mask), &mask) < 0) {
+        log_err_errno("Unable to read CPU affinity");
+        return -1;
+    }
+
+    tils_cpu_t *res = calloc(sizeof(tils_cpu_t), CPU_COUNT(&mask));
+    if (res == NULL)
+        return -1;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < CPU_COUNT(&mask); cpu++) {
+        if (!CPU_ISSET(cpu, &mask))
+            continue;
+
+        tils_cpu_t *c = &res[count++];
+        c->cpu = cpu;
+
+        snprintf(path, sizeof(path), SYS_CPU "topology/core_id", cpu);
+        c->core = _tils_read_int(path, cpu);
+
+        snprintf(path, sizeof(path), SYS_CPU "topology/physical_package_id",
+                cpu);
+        c->package = _tils_read_int(path, 0);
+
+        c->node = _tils_cpu_node(cpu);
+
+        /* CPUs are visited in increasing order, so the rank is the number
+         * of siblings on the same core seen so far. */
+        for (int i = 0; i < count - 1; i++) {
+            if (res[i].core == c->core && res[i].package == c->package)
+                c->smt_rank++;
+        }
+    }
+
+    qsort(res, count, sizeof(tils_cpu_t), _tils_cpu_cmp);
+
+    if (skip_smt) {
+        int physical = 0;
+        while (physical < count && res[physical].smt_rank == 0)
+            physical++;
+        count = physical;
+    }
+
+    *cpus = res;
+    return count;
+}
+
+/**
+ * @brief Find the cgroup v2 directory this process is in.
+ *
+ * @return 0 on success, -1 if we aren't in a unified hierarchy.
+ */
+int _tils_cgroup2_dir(char *buf, int buf_len) {
+    char line[PATH_LEN];
+    int res = -1;
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (f == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "0::", 3) != 0)
+            continue;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (snprintf(buf, buf_len, CGROUP_ROOT "%s", line + 3) < buf_len)
+            res = 0;
+        break;
+    }
+
+    fclose(f);
+    return res;
+}
+
+/**
+ * @brief How many CPUs worth of time the cgroup CPU controller grants us.
+ *
+ * Checks cgroup v2 `cpu.max', then the v1 CFS quota. Fractional quotas are
+ * rounded up - a worker that gets throttled part of the time still beats an
+ * idle core.
+ *
+ * @return The number of CPUs, 0 if there is no quota.
+ */
+int tils_topology_cpu_quota() {
+    char dir[PATH_LEN / 2];
+    char path[PATH_LEN];
+    char quota_str[32];
+    long quota = -1, period = 0;
+
+    if (_tils_cgroup2_dir(dir, sizeof(dir)) == 0) {
+        FILE *f = NULL;
+        if (snprintf(path, sizeof(path), "%s/cpu.max", dir) <
+                (int)sizeof(path))
+            f = fopen(path, "r");
+        if (f == NULL)
+            f = fopen(CGROUP_ROOT "/cpu.max", "r");
+
+        if (f != NULL) {
+            if (fscanf(f, "%31s %ld", quota_str, &period) == 2 &&
+                    strcmp(quota_str, "max") != 0)
+                quota = atol(quota_str);
+            fclose(f);
+        }
+    }
+
+    if (quota < 0) {
+        quota = _tils_read_int(CGROUP_ROOT "/cpu/cpu.cfs_quota_us", -1);
+        period = _tils_read_int(CGROUP_ROOT "/cpu/cpu.cfs_period_us", 0);
+    }
+
+    if (quota <= 0 || period <= 0)
+        return 0;
+
+    return (int)((quota + period - 1) / period);
+}
@@ -0,0 +1,320 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/trace.c
+ *
+ * @brief Per-request spans, exported as Chrome trace events
+ *
+ * The file starts with the opening bracket of the event array, and every
+ * event after is written with a leading comma, so workers can append whole
+ * events in any order and the file stays loadable at any point. The closing
+ * bracket is optional in the format and never written.
+ *
+ * @author Lars Wander
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lib/logging.h>
+#include <tils/request.h>
+#include <tils/routes.h>
+#include <tils/trace.h>
+
+#include "trace_private.h"
+
+/* Trace file, -1 if tracing is off */
+static int _fd = -1;
+
+/* Monotonic time the trace starts at, event times are relative to it */
+static int64_t _epoch = 0;
+
+static int _pid = 0;
+
+/* Bumped by SIGUSR2, every worker dumps its ring when it sees a change */
+static atomic_uint _generation = 0;
+
+int64_t tils_trace_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void _tils_trace_signal(int sig) {
+    atomic_fetch_add_explicit(&_generation, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Turn tracing on.
+ *
+ * @param path The trace file, truncated if it exists.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tils_trace_config(char *path) {
+    char head[128];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        log_err_errno("Can't write %s", path);
+        return -1;
+    }
+
+    _pid = getpid();
+    _epoch = tils_trace_clock();
+    int len = snprintf(head, sizeof(head), "[{\"name\":\"process_name\","
+            "\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"tils\"}}", _pid);
+    if (write(fd, head, len) != len) {
+        log_err_errno("Can't write %s", path);
+        close(fd);
+        return -1;
+    }
+
+    _fd = fd;
+    signal(SIGUSR2, _tils_trace_signal);
+    return 0;
+}
+
+/**
+ * @brief Set up a worker's ring.
+ *
+ * @param[out] trace The ring, NULL if tracing is off.
+ * @param worker The id of the worker it belongs to.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tils_trace_open(tils_trace_t **trace, int worker) {
+    *trace = NULL;
+    if (_fd < 0)
+        return 0;
+
+    tils_trace_t *res = calloc(sizeof(tils_trace_t), 1);
+    if (res == NULL)
+        return -1;
+
+    res->worker = worker;
+    res->seen = atomic_load_explicit(&_generation, memory_order_relaxed);
+    *trace = res;
+    return 0;
+}
+
+/**
+ * @brief Write out the formatted events.
+ */
+void _tils_trace_write(tils_trace_t *trace) {
+    /* O_APPEND: a single write lands whole, after every other worker's */
+    if (trace->len > 0 && write(_fd, trace->buf, trace->len) != trace->len)
+        log_warn_errno("Thread %d couldn't write its trace", trace->worker);
+
+    trace->len = 0;
+}
+
+/**
+ * @brief Format one event.
+ */
+__attribute__((format(printf, 2, 3)))
+void _tils_trace_put(tils_trace_t *trace, const char *format, ...) {
+    va_list ap;
+
+    if (TRACE_BUF_BYTES - trace->len < TRACE_EVENT_MAX)
+        _tils_trace_write(trace);
+
+    va_start(ap, format);
+    int n = vsnprintf(trace->buf + trace->len, TRACE_EVENT_MAX, format, ap);
+    va_end(ap);
+
+    if (n > 0)
+        trace->len += n < TRACE_EVENT_MAX ? n : TRACE_EVENT_MAX - 1;
+}
+
+/**
+ * @brief Format a complete event, skipping steps that never happened.
+ *
+ * @param name The span's name.
+ * @param start Monotonic time the span began.
+ * @param end Monotonic time the span ended.
+ * @param fd The client the span was about.
+ */
+void _tils_trace_span(tils_trace_t *trace, const char *name, int64_t start,
+        int64_t end, int fd) {
+    if (start == 0 || end < start)
+        return;
+
+    _tils_trace_put(trace, ",\n{\"name\":\"%s\",\"cat\":\"tils\",\"ph\":\"X\","
+            "\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"fd\":%d}}", name, _pid, trace->worker,
+            (start - _epoch) / 1e3, (end - start) / 1e3, fd);
+}
+
+/**
+ * @brief Format a request as a span per step, nested in one for the whole.
+ */
+void _tils_trace_request(tils_trace_t *trace, tils_trace_rec_t *rec) {
+    int64_t *at = rec->at;
+    int64_t end = at[TILS_TRACE_DONE] != 0 ? at[TILS_TRACE_DONE] :
+        at[TILS_TRACE_SENT];
+    int64_t built = at[TILS_TRACE_ROUTED] != 0 ? at[TILS_TRACE_ROUTED] :
+        at[TILS_TRACE_PARSED];
+
+    _tils_trace_put(trace, ",\n{\"name\":\"%s %s\",\"cat\":\"tils\","
+            "\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"fd\":%d,\"status\":%d,\"bytes\":%u,"
+            "\"pending\":%s}}", tils_request_method_name(rec->method),
+            rec->route >= 0 ? tils_route_source(rec->route) : "-", _pid,
+            trace->worker, (at[TILS_TRACE_RECV] - _epoch) / 1e3,
+            (end - at[TILS_TRACE_RECV]) / 1e3, rec->fd, rec->status,
+            rec->bytes, at[TILS_TRACE_DONE] == 0 ? "true" : "false");
+
+    _tils_trace_span(trace, "parse", at[TILS_TRACE_RECV],
+            at[TILS_TRACE_PARSED], rec->fd);
+    if (at[TILS_TRACE_ROUTED] != 0)
+        _tils_trace_span(trace, "lookup", at[TILS_TRACE_PARSED],
+                at[TILS_TRACE_ROUTED], rec->fd);
+    _tils_trace_span(trace, "build", built, at[TILS_TRACE_BUILT], rec->fd);
+    _tils_trace_span(trace, "write", at[TILS_TRACE_BUILT],
+            at[TILS_TRACE_SENT], rec->fd);
+}
+
+/**
+ * @brief Write out and empty a worker's ring.
+ */
+void _tils_trace_dump(tils_trace_t *trace) {
+    if (!trace->named) {
+        _tils_trace_put(trace, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+                _pid, trace->worker, trace->worker);
+        trace->named = 1;
+    }
+
+    for (int i = 0; i < trace->count; i++) {
+        tils_trace_rec_t *rec = &trace->ring[i];
+        switch (rec->kind) {
+            case TILS_TRACE_REQUEST:
+                _tils_trace_request(trace, rec);
+                break;
+            case TILS_TRACE_ACCEPT:
+                _tils_trace_span(trace, "accept", rec->at[TILS_TRACE_RECV],
+                        rec->at[TILS_TRACE_DONE], rec->fd);
+                break;
+            case TILS_TRACE_PENDING:
+                _tils_trace_span(trace, "pending write",
+                        rec->at[TILS_TRACE_RECV], rec->at[TILS_TRACE_DONE],
+                        rec->fd);
+                break;
+        }
+    }
+
+    _tils_trace_write(trace);
+    trace->count = 0;
+}
+
+/**
+ * @brief Keep a finished record, dumping the ring once it's full.
+ */
+void _tils_trace_push(tils_trace_t *trace, tils_trace_rec_t *rec) {
+    trace->ring[trace->count++] = *rec;
+    if (trace->count == TILS_TRACE_RING)
+        _tils_trace_dump(trace);
+}
+
+/**
+ * @brief Dump what's left, and free the ring.
+ */
+void tils_trace_close(tils_trace_t *trace) {
+    if (trace == NULL)
+        return;
+
+    _tils_trace_dump(trace);
+    free(trace);
+}
+
+/**
+ * @brief Start a new request, stamping it as received.
+ */
+void tils_trace_begin(tils_trace_t *trace) {
+    memset(&trace->cur, 0, sizeof(tils_trace_rec_t));
+    trace->cur.at[TILS_TRACE_RECV] = tils_trace_clock();
+}
+
+void tils_trace_mark(tils_trace_t *trace, tils_trace_mark_e mark) {
+    trace->cur.at[mark] = tils_trace_clock();
+}
+
+/**
+ * @brief Finish the current request.
+ *
+ * @param fd The client's socket.
+ * @param route ID of the route served, -1 if none.
+ * @param method The request's method.
+ * @param status The response's status code.
+ * @param bytes The response's length.
+ * @param pending Nonzero if some of the response is left to send.
+ */
+void tils_trace_request(tils_trace_t *trace, int fd, int route, int method,
+        int status, size_t bytes, int pending) {
+    tils_trace_rec_t *rec = &trace->cur;
+    rec->kind = TILS_TRACE_REQUEST;
+    rec->fd = fd;
+    rec->route = route;
+    rec->method = method;
+    rec->status = status;
+    rec->bytes = bytes;
+    if (!pending)
+        rec->at[TILS_TRACE_DONE] = rec->at[TILS_TRACE_SENT];
+
+    _tils_trace_push(trace, rec);
+}
+
+/**
+ * @brief Record a span other than a request.
+ *
+ * @param kind What the span is.
+ * @param fd The client the span is about.
+ * @param start Monotonic time the span began.
+ * @param end Monotonic time the span ended.
+ */
+void tils_trace_span(tils_trace_t *trace, tils_trace_kind_e kind, int fd,
+        int64_t start, int64_t end) {
+    tils_trace_rec_t rec;
+    memset(&rec, 0, sizeof(tils_trace_rec_t));
+    rec.kind = kind;
+    rec.fd = fd;
+    rec.at[TILS_TRACE_RECV] = start;
+    rec.at[TILS_TRACE_DONE] = end;
+    _tils_trace_push(trace, &rec);
+}
+
+/**
+ * @brief Dump the ring if SIGUSR2 arrived since the last call. Called by
+ *        the owning worker once per loop iteration.
+ */
+void tils_trace_poll(tils_trace_t *trace) {
+    unsigned int generation = atomic_load_explicit(&_generation,
+            memory_order_relaxed);
+    if (UNLIKELY(generation != trace->seen)) {
+        trace->seen = generation;
+        _tils_trace_dump(trace);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file src/tils/trace_private.h
+ *
+ * @brief Trace rings & output
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TRACE_PRIVATE_H_
+#define _TRACE_PRIVATE_H_
+
+#include <tils/trace.h>
+
+/* Events are formatted into a buffer this size between writes... */
+#define TRACE_BUF_BYTES (64 << 10)
+
+/* ...which is written out once less than this is left */
+#define TRACE_EVENT_MAX (1 << 10)
+
+/**
+ * @brief A worker's spans
+ */
+struct tils_trace {
+    /* Request being served */
+    tils_trace_rec_t cur;
+
+    tils_trace_rec_t ring[TILS_TRACE_RING];
+    int count;
+
+    int worker;
+
+    /* Dump requests (SIGUSR2) seen so far */
+    unsigned int seen;
+
+    /* Nonzero once this worker's thread name is in the trace */
+    int named;
+
+    /* Where events are formatted */
+    char buf[TRACE_BUF_BYTES];
+    int len;
+};
+
+#endif /* _TRACE_PRIVATE_H_ */
@@ -25,15 +25,26 @@
  * of connections - accepting, reading, and writing are all done on each
  * thread.
  *
+ * Only the thread holding the leader token accepts new connections. The
+ * token travels between the inboxes (pipes) of the active workers. A
+ * supervisor running on the calling thread can grow and shrink the set of
+ * active workers with load; membership of the ring only changes under
+ * `_ring_lock', so a token is never written to a worker that is leaving.
+ *
  * @author Lars Wander
  */
 
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -42,172 +53,591 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <lib/bench.h>
 #include <lib/logging.h>
+#include <lib/probes.h>
 #include <tils/io_util.h>
+#include <tils/tcp_info.h>
 #include <tils/serve.h>
 #include <tils/accept.h>
 #include <tils/worker_thread.h>
+#include <tils/topology.h>
 #include <tils/tils.h>
 
 #include "worker_thread_private.h"
 
-static tils_wt_t _worker_threads[THREAD_COUNT];
+static tils_wt_t *_worker_threads;
+static int _worker_count;
+
+/* CPUs workers are pinned to, in placement order */
+static tils_cpu_t *_cpus;
+static int _planned;
+
+/* Guards who may be handed the leader token */
+static pthread_mutex_t _ring_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * @brief assign the current thread to a single core
+ * @brief assign the current thread to the core picked for it
  */
 void _tils_sched_thread(tils_wt_t *self) {
-    int core_cnt = sysconf(_SC_NPROCESSORS_ONLN);
-    int assigned_core = self->id % core_cnt;
-
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
-    CPU_SET(assigned_core, &cpuset);
+    CPU_SET(self->cpu, &cpuset);
 
     pthread_t thread = pthread_self();
     if (pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset) != 0) {
         log_warn("Couldn't bind thread %d", self->id);
     } else {
-        log_info("Bound thread %d to core %d", self->id, assigned_core);
+        log_info("Bound thread %d to core %d (node %d)", self->id, self->cpu,
+                self->node);
+    }
+}
+
+/**
+ * @brief Every worker there is room for, running or not.
+ *
+ * @param[out] count Number of workers.
+ */
+tils_wt_t *tils_workers(int *count) {
+    *count = _worker_count;
+    return _worker_threads;
+}
+
+/**
+ * @brief Decide how many workers to run.
+ *
+ * An explicit count wins. Otherwise there is one worker per CPU in the plan,
+ * capped by the cgroup CPU quota so a container limited to 2 CPUs on a 64
+ * core host doesn't run 64 throttled workers.
+ *
+ * @param opts The pool options.
+ * @param planned Number of CPUs in the placement plan.
+ */
+int _tils_thread_count(tils_pool_opts_t *opts, int planned) {
+    if (opts->thread_count > 0)
+        return opts->thread_count;
+
+    int res = planned;
+    int quota = tils_topology_cpu_quota();
+    if (quota > 0 && quota < res) {
+        log_info("Limiting workers to the cgroup CPU quota of %d", quota);
+        res = quota;
+    }
+
+    return res > 0 ? res : 1;
+}
+
+/**
+ * @brief Fill in the default pool options.
+ *
+ * @param opts The options being initialized.
+ */
+void tils_pool_opts_default(tils_pool_opts_t *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->scale_up = SCALE_UP_UTIL;
+    opts->scale_down = SCALE_DOWN_UTIL;
+}
+
+/**
+ * @brief Hand the leader token to the next active worker.
+ *
+ * If no other worker is active we simply keep it.
+ *
+ * @param self The current leader.
+ */
+void _tils_pass_token(tils_wt_t *self) {
+    int token = WT_MSG_TOKEN;
+    tils_wt_t *next = NULL;
+
+    pthread_mutex_lock(&_ring_lock);
+    for (int i = 1; i < _worker_count; i++) {
+        tils_wt_t *wt = &_worker_threads[(self->id + i) % _worker_count];
+        if (atomic_load_explicit(&wt->state, memory_order_relaxed) ==
+                WT_ACTIVE) {
+            next = wt;
+            break;
+        }
+    }
+
+    if (next == NULL) {
+        self->leader = 1;
+    } else {
+        /* First pass the leader token on to the next thread.
+         * This wakes up the next thread, causing it to listen for unopened
+         * connections. If it is already awake, it will either:
+         * 1. Discover it can read from read_fd, and start listening on
+         *    the listeners.
+         * 2. Not read from read_fd, call select, and wake up at once. */
+        if (write(next->write_fd, &token, sizeof(int)) <= 0) {
+            log_err_errno("Failed to pass token.");
+            exit(-1);
+        }
+        self->leader = 0;
     }
+    pthread_mutex_unlock(&_ring_lock);
 }
 
+/**
+ * @brief Read one message out of our inbox.
+ *
+ * @param self The receiving worker.
+ *
+ * @return 0 if a message was read, -1 if the inbox was empty.
+ */
+int _tils_read_inbox(tils_wt_t *self) {
+    int msg;
+    int res = read(self->read_fd, &msg, sizeof(int));
+    if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return -1;
+
+    if (res <= 0) {
+        log_err("Failed to get token");
+        exit(-1);
+    }
+
+    /* Is it our turn to become leader? */
+    if (msg == WT_MSG_TOKEN)
+        self->leader = 1;
+
+    return 0;
+}
+
+/**
+ * @brief Serve every complete request a connection has sent.
+ *
+ * Transient request & response data comes out of the worker's arena, which
+ * is reset as soon as each response has been handed to the socket. Once a
+ * response is left pending, later requests wait until it has been sent.
+ *
+ * @param self The worker owning the connection.
+ * @param conn The connection that is readable.
+ */
+void _tils_serve_conn(tils_wt_t *self, tils_conn_t *conn) {
+    tils_http_request_t *request = NULL;
+
+    while (tils_conn_get_state(self->conns, conn) == CONN_ALIVE &&
+            conn->out == NULL) {
+        if ((request = tils_accept_request(self, conn)) == NULL)
+            break;
+
+        tils_conn_revitalize(self->conns, conn);
+        tils_serve_resource(self, conn, request);
+        arena_reset(self->arena);
+
+        if (conn->rbuf_len == 0)
+            break;
+    }
+}
+
+/**
+ * @brief Continue a pending response, then move on to pipelined requests.
+ *
+ * @param self The worker owning the connection.
+ * @param conn The connection that is writable.
+ */
+void _tils_flush_conn(tils_wt_t *self, tils_conn_t *conn) {
+    if (tils_serve_pending(self, conn) < 0)
+        return;
+
+    tils_conn_revitalize(self->conns, conn);
+    if (conn->out == NULL)
+        _tils_serve_conn(self, conn);
+}
+
+/**
+ * @brief Close a connection, sampling its TCP_INFO first if it's its turn.
+ *
+ * @param self The worker owning the connection.
+ * @param conn The (dead) connection.
+ */
+void _tils_close_conn(tils_wt_t *self, tils_conn_t *conn) {
+    int every = tils_tcp_sampling_rate();
+    tils_tcp_sample_t sample;
+
+    if (UNLIKELY(every > 0) && conn->addr.family != AF_UNIX &&
+            --self->tcp_countdown <= 0) {
+        self->tcp_countdown = every;
+        if (tils_tcp_sample(conn->client_fd, &sample) == 0)
+            tils_stats_tcp(&self->stats, &sample);
+    }
+
+    tils_conn_close(self->conns, conn);
+}
+
+/**
+ * @brief Sample a listener's accept queue once every so many accepts.
+ *
+ * @param self The accepting worker.
+ * @param server_fd The listener a client was just accepted on.
+ */
+void _tils_sample_accept_queue(tils_wt_t *self, int server_fd) {
+    int every = tils_tcp_sampling_rate();
+    int len, limit;
+
+    if (LIKELY(every == 0) || atomic_load_explicit(&self->stats.accepts,
+                memory_order_relaxed) % every != 0)
+        return;
+
+    if (tils_tcp_accept_queue(server_fd, &len, &limit) == 0)
+        tils_stats_accept_queue(&self->stats, len, limit);
+}
+
+/**
+ * @brief Accept a client on one of the listeners, and serve its first request.
+ *
+ * @param self The accepting (leader) thread.
+ * @param server_fd The listener reported as readable.
+ *
+ * @return 0 if a client was accepted, -1 otherwise.
+ */
+int _tils_accept_client(tils_wt_t *self, int server_fd) {
+    struct sockaddr_storage client;
+    socklen_t client_len = sizeof(client);
+    tils_addr_t addr;
+    tils_conn_t *conn = NULL;
+
+    int64_t start = self->trace != NULL ? tils_trace_clock() : 0;
+    BENCH_START(bench_accept);
+    int client_fd = accept(server_fd, (struct sockaddr *)&client,
+            &client_len);
+    if (client_fd < 0)
+        return -1;
+
+    if (self->trace != NULL)
+        tils_trace_span(self->trace, TILS_TRACE_ACCEPT, client_fd, start,
+                tils_trace_clock());
+    TILS_PROBE2(accept, client_fd, self->id);
+
+    BENCH_STOP(bench_accept, BENCH_ACCEPT);
+    TILS_STAT_ADD(self->stats.accepts, 1);
+    _tils_sample_accept_queue(self, server_fd);
+
+    _tils_pass_token(self);
+
+    /* Kept for logging purposes. */
+    tils_addr_pack(&client, &addr);
+
+    /* Socket options can fail.
+     * TODO if the error hints at a larger problem, do something here.
+     */
+    tils_tune_client(client_fd, client.ss_family);
+
+    if (UNLIKELY(client_fd >= FD_SETSIZE)) {
+        /* select can't watch it */
+        log_warn("Dropping client on fd %d, past FD_SETSIZE", client_fd);
+        close(client_fd);
+    } else if (UNLIKELY(tils_fd_nonblocking(client_fd) < 0)) {
+        /* If non blocking fails, every call to `accept' will take too
+         * long. This connection is then no longer viable. */
+        close(client_fd);
+    } else {
+        conn = tils_conn_buf_push(self->conns, client_fd, &addr);
+        _tils_serve_conn(self, conn);
+        if (tils_conn_get_state(self->conns, conn) == CONN_DEAD)
+            _tils_close_conn(self, conn);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Start leaving the pool: give up the token, and answer what clients
+ *        already sent with the last response on their connection.
+ *
+ * Every connection is marked as closing, so responses still to be built say
+ * `Connection: close' and a connection shuts down once its response is out.
+ * Idle keep-alive clients are closed right away, see an ordinary close
+ * between requests and reconnect, landing on a worker that is still active.
+ * Responses in flight are left to the event loop to finish.
+ *
+ * @param self The retiring worker.
+ */
+void _tils_retire_begin(tils_wt_t *self) {
+    tils_conn_t *conn = NULL;
+    int pending = 0;
+
+    /* No token can be written to us any more, so whatever is in the inbox
+     * now is all there will ever be. */
+    while (_tils_read_inbox(self) == 0)
+        ;
+
+    if (self->leader)
+        _tils_pass_token(self);
+
+    for (int i = 0; i < tils_conn_buf_size(self->conns); i++) {
+        if (self->conns->states[i] != CONN_ALIVE)
+            continue;
+
+        tils_conn_buf_at(self->conns, i, &conn);
+        conn->closing = 1;
+        if (conn->out == NULL)
+            _tils_serve_conn(self, conn);
+
+        if (tils_conn_get_state(self->conns, conn) != CONN_ALIVE)
+            continue;
+
+        if (conn->out != NULL)
+            pending++;
+        else
+            tils_conn_kill(self->conns, conn, CLOSE_RETIRED);
+    }
+
+    log_info("Retiring thread %d, %d responses left to send", self->id,
+            pending);
+}
+
+/**
+ * @brief Leave the pool for good, closing whatever connection is left.
+ *
+ * @param self The retiring worker, done draining.
+ * @param left Connections still open, cut off by the drain deadline.
+ */
+void _tils_retire(tils_wt_t *self, unsigned long left) {
+    if (left > 0)
+        log_warn("Thread %d retires with %lu connections unfinished",
+                self->id, left);
+
+    tils_conn_buf_free(self->conns);
+    self->conns = NULL;
+    arena_free(self->arena);
+    self->arena = NULL;
+    tils_zpool_free(self->zpool);
+    self->zpool = NULL;
+    pool_free(self->pool);
+    self->pool = NULL;
+    tils_access_log_close(self->access);
+    self->access = NULL;
+    tils_trace_close(self->trace);
+    self->trace = NULL;
+
+    log_info("Retired thread %d", self->id);
+    atomic_store_explicit(&self->state, WT_RETIRED, memory_order_release);
+}
 
 /**
  * @brief Wait to be connected to a client, then handle the client's request,
  *        and repeat.
  *
- * @param server_fd The socket fd to accept connections on
+ * @param _self The worker thread being run
  */
 void *_tils_handle_connections(void *_self) {
     tils_wt_t *self = (tils_wt_t *)_self;
     _tils_sched_thread(self);
 
-    struct sockaddr_in ip4client;
-    unsigned int ip4client_len = sizeof(ip4client);
+    /* Allocate only once pinned: pages are placed on the node of the CPU that
+     * first touches them, so the connection slab & buffers end up local to
+     * us. */
+    if ((self->arena = arena_new(ARENA_BLOCK_SIZE)) == NULL ||
+            (self->pool = pool_new()) == NULL ||
+            (self->zpool = tils_zpool_new()) == NULL ||
+            tils_conn_buf_init(&self->conns,
+                get_open_fd_limit() / _worker_count, self->pool) < 0) {
+        log_err("Failed to allocate connections for thread %d", self->id);
+        exit(-1);
+    }
+
+    if (tils_access_log_open(&self->access, self->id) < 0)
+        log_warn("Thread %d runs without an access log", self->id);
+
+    if (tils_trace_open(&self->trace, self->id) < 0)
+        log_warn("Thread %d runs without tracing", self->id);
 
-    int client_fd = 0;
+    tils_stall_init(&self->stall);
 
-    char addr_buf[INET_ADDRSTRLEN];
     tils_conn_t *conn = NULL;
-    tils_http_request_t *request = NULL;
     tils_conn_buf_t *conn_buf = self->conns;
 
+    /* Utilization is only published once per iteration, from here. */
+    long busy_ns = atomic_load_explicit(&self->busy_ns, memory_order_relaxed);
+    long wait_ns = atomic_load_explicit(&self->wait_ns, memory_order_relaxed);
+
+    /* Start of the current load window, and busy time at that point */
+    long window_start = _tils_clock_ns();
+    long window_busy = busy_ns;
+
     fd_set read_fs;
+    fd_set write_fs;
     int nfds = 0;
 
+    /* Once retiring, when whatever is still being sent gets cut off */
+    int draining = 0;
+    long drain_deadline = 0;
+
     int i = 0;
     while (1) {
         i++;
-        struct timeval timeout = { .tv_sec = 5, .tv_usec = 0 };
+        struct timeval timeout = { .tv_sec = draining ? 1 : 5, .tv_usec = 0 };
+        long iter_start = _tils_clock_ns();
+        tils_stall_begin(&self->stall);
+        BENCH_POLL();
+        if (self->trace != NULL)
+            tils_trace_poll(self->trace);
+        TILS_STAT_ADD(self->stats.iterations, 1);
         FD_ZERO(&read_fs);
+        FD_ZERO(&write_fs);
+
+        if (UNLIKELY(!draining && atomic_load_explicit(&self->state,
+                        memory_order_acquire) == WT_DRAINING)) {
+            _tils_retire_begin(self);
+            draining = 1;
+            drain_deadline = iter_start + RETIRE_DRAIN_NS;
+        }
+
+        /* Always listen for the token, and for the supervisor */
+        FD_SET(self->read_fd, &read_fs);
+        nfds = self->read_fd;
 
         /* Are we the leader? */
-        if (self->server_fd >= 0) {
-            /* If so, listen on the incomming connection port */
-            FD_SET(self->server_fd, &read_fs);
-            nfds = self->server_fd;
-        } else {
-            /* This may be risky */
-            FD_SET(self->read_fd, &read_fs);
-        //    if (self->read_fd > nfds)
-            nfds = self->read_fd;
+        if (self->leader && !draining) {
+            /* If so, listen on every incoming connection port */
+            for (int j = 0; j < self->server_fd_count; j++) {
+                FD_SET(self->server_fds[j], &read_fs);
+                if (self->server_fds[j] > nfds)
+                    nfds = self->server_fds[j];
+            }
         }
 
-        /* Do cleanup, and simultaneously record connections in our fd_set. */
+        /* Do cleanup, and simultaneously record connections in our fd_set.
+         * Only the dense per-slot arrays are read here; a connection's own
+         * state is only touched to close it. */
+        tils_conn_buf_expire(conn_buf, tils_conn_clock());
+        unsigned long active = 0;
         for (int i = 0; i < tils_conn_buf_size(conn_buf); i++) {
-            tils_conn_buf_at(conn_buf, i, &conn);
-            if (conn == NULL || conn->state == CONN_CLEAN)
+            uint8_t state = conn_buf->states[i];
+            if (state == CONN_CLEAN)
                 continue;
 
-            /* Update connection state. */
-            tils_conn_check_alive(conn);
+            /* While retiring, nothing new is read: only responses in
+             * flight & lingering closes are waited for. */
+            if (UNLIKELY(draining) && state == CONN_ALIVE &&
+                    !conn_buf->pending[i]) {
+                tils_conn_buf_at(conn_buf, i, &conn);
+                tils_conn_kill(conn_buf, conn, CLOSE_RETIRED);
+                state = CONN_DEAD;
+            }
 
-            if (conn->state == CONN_DEAD) {
-                tils_conn_close(conn);
+            if (state == CONN_DEAD) {
+                tils_conn_buf_at(conn_buf, i, &conn);
+                _tils_close_conn(self, conn);
                 continue;
             }
 
-            FD_SET(conn->client_fd, &read_fs);
-            if (conn->client_fd > nfds)
-                nfds = conn->client_fd;
-        }
-        
-        int res = 0;
-        if (UNLIKELY((res = select(nfds + 1, &read_fs, 
-                            NULL, NULL, &timeout)) < 0)) {
-            log_err("Select failed.");
-            exit(-1);
+            /* Until a pending response is out, only wait to write more. */
+            int fd = conn_buf->fds[i];
+            active++;
+            if (conn_buf->pending[i])
+                FD_SET(fd, &write_fs);
+            else
+                FD_SET(fd, &read_fs);
+
+            if (fd > nfds)
+                nfds = fd;
         }
+        TILS_STAT_SET(self->stats.active, active);
 
-        /* 0 means no file descriptors are active and the timeout woke us up. */
-        if (res == 0)
-            continue;
+        if (UNLIKELY(draining) && (active == 0 || iter_start >=
+                    drain_deadline)) {
+            _tils_retire(self, active);
+            return NULL;
+        }
 
-        /* If our server_fd (leader token) is positive, 
-         * we can accept connections */
-        if (self->server_fd >= 0 && FD_ISSET(self->server_fd, &read_fs) &&
-                (client_fd = accept(self->server_fd, 
-                                    (struct sockaddr *)&ip4client,
-                                    &ip4client_len)) > 0) {
-            /* First pass the leader token on to the next thread. 
-             * This wakes up the next thread in the token chain, causing it 
-             * to listen for unopened connections. If it is already awake,
-             * it will either: 
-             * 1. Discover it can read from read_fd, and start listening on
-             *    it's newly assigned server_fd.
-             * 2. Not read from read_fd, call select, and wake up at once. */
-            if (write(self->write_fd, &self->server_fd, sizeof(int)) <= 0) {
-                log_err("Failed to pass token.");
+        int res = 0;
+        long select_start = _tils_clock_ns();
+        tils_stall_handler(&self->stall, TILS_PHASE_CLEANUP, NULL,
+                select_start - iter_start);
+        if (UNLIKELY((res = select(nfds + 1, &read_fs,
+                            &write_fs, NULL, &timeout)) < 0)) {
+            /* e.g. SIGUSR1 asking for a latency report */
+            if (errno != EINTR) {
+                log_err_errno("Select failed.");
                 exit(-1);
             }
+            res = 0;
+        }
+        long select_end = _tils_clock_ns();
 
-            self->server_fd = -1;
+        wait_ns += select_end - select_start;
+        atomic_store_explicit(&self->wait_ns, wait_ns, memory_order_relaxed);
 
-            /* Load the IP address for logging purposes. */
-            inet_ntop(AF_INET, (const void *)&ip4client.sin_addr, addr_buf,
-                    INET_ADDRSTRLEN);
+        if (select_end - window_start >= LOAD_WINDOW_NS) {
+            self->load = (busy_ns - window_busy) * 100 /
+                (select_end - window_start);
+            window_start = select_end;
+            window_busy = busy_ns;
+        }
 
-            /* Keep alive can fail.
-             * TODO if the error hints at a larger problem, do something here.
-             */
-            tils_socket_keepalive(client_fd);
+        /* 0 means no file descriptors are active and the timeout woke us up. */
+        if (res == 0) {
+            tils_stall_end(&self->stall, self->id, select_start - iter_start);
+            continue;
+        }
 
-            if (UNLIKELY(tils_fd_nonblocking(client_fd) < 0)) {
-                /* If non blocking fails, every call to `accept' will take too
-                 * long. This connection is then no longer viable. */
-                close(client_fd);
-            } else {
-                conn = tils_conn_buf_push(conn_buf, client_fd, addr_buf);
-                request = tils_accept_request(conn);
-                if (request) {
-                    tils_conn_revitalize(conn);
-                    tils_serve_resource(conn, request);
-                }
+        /* Each handler ends where the next one starts */
+        long handler_start = select_end;
+        long handler_end = 0;
+
+        /* If we hold the leader token, we can accept connections. Only one
+         * is accepted before the token moves on. */
+        if (self->leader && !draining) {
+            for (int j = 0; j < self->server_fd_count; j++) {
+                if (FD_ISSET(self->server_fds[j], &read_fs) &&
+                        _tils_accept_client(self, self->server_fds[j]) == 0)
+                    break;
             }
+
+            handler_end = _tils_clock_ns();
+            tils_stall_handler(&self->stall, TILS_PHASE_ACCEPT, NULL,
+                    handler_end - handler_start);
+            handler_start = handler_end;
         }
 
-        /* Is it our turn to become leader? */
         if (FD_ISSET(self->read_fd, &read_fs)) {
-            if (read(self->read_fd, &self->server_fd, sizeof(int)) <= 0) {
-                log_err("Failed to get token");
-                exit(-1);
-            }
-            assert(self->server_fd >= 0);
+            _tils_read_inbox(self);
+            handler_end = _tils_clock_ns();
+            tils_stall_handler(&self->stall, TILS_PHASE_INBOX, NULL,
+                    handler_end - handler_start);
+            handler_start = handler_end;
         }
 
-        /* Respond to sockets that are ready to be read from. */
+        /* Respond to sockets that are ready to be read from, finish
+         * responses to sockets that can be written to again, and drain
+         * connections waiting for their client to close. */
         for (int i = 0; i < tils_conn_buf_size(conn_buf); i++) {
-            tils_conn_buf_at(conn_buf, i, &conn);
-            if (conn == NULL || !FD_ISSET(conn->client_fd, &read_fs))
+            uint8_t state = conn_buf->states[i];
+            int fd = conn_buf->fds[i];
+            if (state != CONN_ALIVE && state != CONN_LINGER)
                 continue;
 
-            request = tils_accept_request(conn);
-            if (request) {
-                tils_conn_revitalize(conn);
-                tils_serve_resource(conn, request);
+            if (!FD_ISSET(fd, conn_buf->pending[i] ? &write_fs : &read_fs))
+                continue;
+
+            tils_phase_e phase = TILS_PHASE_READ;
+            tils_conn_buf_at(conn_buf, i, &conn);
+            if (state == CONN_LINGER) {
+                phase = TILS_PHASE_LINGER;
+                tils_conn_linger(conn_buf, conn);
+            } else if (conn->out != NULL) {
+                phase = TILS_PHASE_WRITE;
+                _tils_flush_conn(self, conn);
+            } else {
+                _tils_serve_conn(self, conn);
             }
+
+            handler_end = _tils_clock_ns();
+            tils_stall_handler(&self->stall, phase, conn,
+                    handler_end - handler_start);
+            handler_start = handler_end;
+
+            /* Free the slot & fd now rather than on the next pass */
+            if (conn_buf->states[i] == CONN_DEAD)
+                _tils_close_conn(self, conn);
         }
+
+        handler_end = _tils_clock_ns();
+        busy_ns += handler_end - select_end;
+        atomic_store_explicit(&self->busy_ns, busy_ns, memory_order_relaxed);
+        tils_stall_end(&self->stall, self->id, select_start - iter_start +
+                handler_end - select_end);
     }
 
     /* Just for you, compiler. */
@@ -215,49 +645,191 @@ void *_tils_handle_connections(void *_self) {
 }
 
 /**
- * @brief Run the thread pool - the master thread is roped into this as well.
+ * @brief Add a worker to the token ring and start its thread.
  *
- * @param server_fd The server socket to listen on.
+ * @param wt The (idle) worker being started.
  */
-void tils_start_thread_pool(int server_fd) {
-    int pipefd[2];
-    int conns_per_thread = get_open_fd_limit() / THREAD_COUNT;
+void _tils_start_worker(tils_wt_t *wt) {
+    pthread_mutex_lock(&_ring_lock);
+    atomic_store_explicit(&wt->state, WT_ACTIVE, memory_order_relaxed);
+    pthread_mutex_unlock(&_ring_lock);
+
+    if (pthread_create(&wt->thread, NULL, _tils_handle_connections,
+                (void *)wt) != 0) {
+        log_err("Failed to start thread %d", wt->id);
+        exit(-1);
+    }
+}
 
-    for (;;) {
-        int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK);
-        if (UNLIKELY(client_fd < 0)) {
-            log_warn("accept4 failure");
-            continue;
+/**
+ * @brief Take a worker out of the token ring and ask it to retire.
+ *
+ * @param wt The (active) worker being stopped.
+ */
+void _tils_stop_worker(tils_wt_t *wt) {
+    int wake = WT_MSG_WAKE;
+
+    pthread_mutex_lock(&_ring_lock);
+    atomic_store_explicit(&wt->state, WT_DRAINING, memory_order_release);
+    pthread_mutex_unlock(&_ring_lock);
+
+    /* Don't leave it sleeping in select until its timeout. */
+    if (write(wt->write_fd, &wake, sizeof(int)) <= 0)
+        log_warn_errno("Failed to wake thread %d", wt->id);
+}
+
+/**
+ * @brief Grow and shrink the set of active workers with their utilization.
+ *
+ * Utilization is the share of wall time active workers spent outside of
+ * select. Above opts->scale_up percent another pinned worker is started;
+ * below opts->scale_down for SCALE_DOWN_INTERVALS in a row, the highest
+ * numbered worker is retired. Never returns.
+ *
+ * @param opts The pool options.
+ */
+void _tils_supervise(tils_pool_opts_t *opts) {
+    long *last_busy = calloc(sizeof(long), _worker_count);
+    int quiet = 0;
+    long last = _tils_clock_ns();
+    struct timespec interval = {
+        .tv_sec = SUPERVISE_INTERVAL_MS / 1000,
+        .tv_nsec = (SUPERVISE_INTERVAL_MS % 1000) * 1000000L
+    };
+
+    if (last_busy == NULL) {
+        log_err("Failed to allocate supervisor state");
+        exit(-1);
+    }
+
+    while (1) {
+        nanosleep(&interval, NULL);
+
+        long now = _tils_clock_ns();
+        long busy = 0;
+        int active = 0;
+        int newest = -1;
+        int idle = -1;
+
+        for (int i = 0; i < _worker_count; i++) {
+            tils_wt_t *wt = &_worker_threads[i];
+            long wt_busy = atomic_load_explicit(&wt->busy_ns,
+                    memory_order_relaxed);
+            int state = atomic_load_explicit(&wt->state, memory_order_acquire);
+
+            if (state == WT_RETIRED) {
+                pthread_join(wt->thread, NULL);
+                atomic_store_explicit(&wt->state, WT_IDLE,
+                        memory_order_relaxed);
+                state = WT_IDLE;
+            }
+
+            if (state == WT_ACTIVE) {
+                busy += wt_busy - last_busy[i];
+                active++;
+                newest = i;
+            } else if (state == WT_IDLE && idle < 0) {
+                idle = i;
+            }
+
+            last_busy[i] = wt_busy;
+        }
+
+        int util = active == 0 ? 0 :
+            (int)(busy * 100 / ((now - last) * (long)active));
+        last = now;
+
+        if (util >= opts->scale_up && idle >= 0) {
+            log_info("Utilization at %d%%, starting thread %d", util, idle);
+            _tils_start_worker(&_worker_threads[idle]);
+            quiet = 0;
+        } else if (util <= opts->scale_down && active > opts->min_threads) {
+            if (++quiet >= SCALE_DOWN_INTERVALS) {
+                log_info("Utilization at %d%%, retiring thread %d", util,
+                        newest);
+                _tils_stop_worker(&_worker_threads[newest]);
+                quiet = 0;
+            }
+        } else {
+            quiet = 0;
         }
     }
+}
+
+/**
+ * @brief Run the thread pool - the master thread supervises it.
+ *
+ * @param server_fds The server sockets to listen on.
+ * @param server_fd_count The number of server sockets.
+ * @param opts Thread count & placement, NULL for the defaults.
+ */
+void tils_start_thread_pool(int *server_fds, int server_fd_count,
+        tils_pool_opts_t *opts) {
+    int pipefd[2];
+    tils_pool_opts_t def_opts;
+    int initial;
 
-    for (int i = 0; i < THREAD_COUNT; i++) {
-        if (pipe(pipefd) < 0) {
-            log_err("Failed to create pipe between threads");
+    if (opts == NULL) {
+        tils_pool_opts_default(&def_opts);
+        opts = &def_opts;
+    }
+
+    if ((_planned = tils_topology_plan(opts->skip_smt, &_cpus)) <= 0) {
+        log_err("Failed to read CPU topology");
+        exit(-1);
+    }
+
+    _worker_count = _tils_thread_count(opts, _planned);
+    _worker_threads = calloc(sizeof(tils_wt_t), _worker_count);
+    if (_worker_threads == NULL) {
+        log_err("Failed to allocate worker threads");
+        exit(-1);
+    }
+
+    /* min_threads == 0 means the pool doesn't scale. */
+    if (opts->min_threads <= 0 || opts->min_threads > _worker_count)
+        opts->min_threads = _worker_count;
+    initial = opts->min_threads;
+
+    if (initial < _worker_count)
+        log_info("Running %d-%d workers on %d usable cores", initial,
+                _worker_count, _planned);
+    else
+        log_info("Running %d workers on %d usable cores", _worker_count,
+                _planned);
+
+    /* Give every worker an inbox before any thread can pass the token. */
+    for (int i = 0; i < _worker_count; i++) {
+        if (pipe(pipefd) < 0 || tils_fd_nonblocking(pipefd[0]) < 0) {
+            log_err_errno("Failed to create pipe between threads");
             exit(-1);
         }
 
         _worker_threads[i].id = i;
 
-        /* Connect writer. */
+        /* More workers than planned CPUs wrap around the plan. */
+        _worker_threads[i].cpu = _cpus[i % _planned].cpu;
+        _worker_threads[i].node = _cpus[i % _planned].node;
+
+        _worker_threads[i].read_fd = pipefd[0];
         _worker_threads[i].write_fd = pipefd[1];
-        /* Connect reader. */
-        _worker_threads[(i + 1) % THREAD_COUNT].read_fd = pipefd[0];
 
         /* At first, thread 0 will be the leader. */
-        if (i == 0)
-            _worker_threads[i].server_fd = server_fd;
-        else 
-            _worker_threads[i].server_fd = -1;
-
-        tils_conn_buf_init(&_worker_threads[i].conns, conns_per_thread);
+        _worker_threads[i].leader = (i == 0);
+        _worker_threads[i].server_fds = server_fds;
+        _worker_threads[i].server_fd_count = server_fd_count;
         _worker_threads[i].size = 0;
+        atomic_init(&_worker_threads[i].state, WT_IDLE);
+        atomic_init(&_worker_threads[i].busy_ns, 0);
+        atomic_init(&_worker_threads[i].wait_ns, 0);
+    }
+
+    for (int i = 0; i < initial; i++)
+        _tils_start_worker(&_worker_threads[i]);
+
+    if (initial < _worker_count)
+        _tils_supervise(opts);
 
-        /* THREAD_COUNT - 1 is the calling thread. */
-        if (i == THREAD_COUNT - 1)
-            _tils_handle_connections((void *)&_worker_threads[i]);
-        else 
-            pthread_create(&_worker_threads[i].thread, NULL, _tils_handle_connections,
-                    (void *)&_worker_threads[i]);
-    } 
+    for (int i = 0; i < initial; i++)
+        pthread_join(_worker_threads[i].thread, NULL);
 }
@@ -29,9 +29,44 @@
 #include <arpa/inet.h>
 
 #include <pthread.h>
+#include <time.h>
 
 #include <lib/util.h>
 
 #define LOG_FREQ (200000)
 
+/* Size of the blocks a worker's arena grows by */
+#define ARENA_BLOCK_SIZE (1 << 16)
+
+/* How often a worker recomputes its own load */
+#define LOAD_WINDOW_NS (100 * 1000000L)
+
+/* Longest a retiring worker keeps sending responses in flight */
+#define RETIRE_DRAIN_NS (30 * 1000000000L)
+
+/* Inbox messages */
+#define WT_MSG_WAKE (0)
+#define WT_MSG_TOKEN (1)
+
+/* How often the supervisor samples worker utilization */
+#define SUPERVISE_INTERVAL_MS (1000)
+
+/* Default utilization (%) above which a worker is added */
+#define SCALE_UP_UTIL (75)
+
+/* Default utilization (%) below which a worker is retired... */
+#define SCALE_DOWN_UTIL (25)
+
+/* ...once it has stayed there this many intervals in a row */
+#define SCALE_DOWN_INTERVALS (5)
+
+/**
+ * @brief Monotonic time in nanoseconds, for utilization accounting.
+ */
+static inline long _tils_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
 #endif /* _WORKER_THREAD_PRIVATE_H_ */
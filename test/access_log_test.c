@@ -0,0 +1,177 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/access_log_test.c
+ *
+ * @brief Tests of writing access records through a segment rotation and
+ *        reading them back
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <glob.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <tils/access_log.h>
+
+#include "../src/tils/access_log_private.h"
+
+#include "test.h"
+
+/* Records a segment of ACCESS_SEGMENT_MIN holds */
+#define TEST_ACCESS_PER_SEG ((int)((ACCESS_SEGMENT_MIN - \
+                sizeof(tils_access_hdr_t)) / sizeof(tils_access_rec_t)))
+
+/* Fills the first segment & half of the second */
+#define TEST_ACCESS_RECORDS (TEST_ACCESS_PER_SEG * 3 / 2)
+
+/* Worker the log is opened for */
+#define TEST_ACCESS_WORKER (3)
+
+/**
+ * @brief Wait for the helper to hand the log its next segment.
+ *
+ * @return 0 once it did, -1 if it didn't within a few seconds.
+ */
+int _access_wait_spare(tils_access_log_t *log) {
+    for (int i = 0; i < 5000; i++) {
+        if (__atomic_load_n(&log->spare.map, __ATOMIC_ACQUIRE) != NULL)
+            return 0;
+        usleep(1000);
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Check a segment read back from disk.
+ *
+ * @param path The segment.
+ * @param first Index of the first record it should hold.
+ * @param count Records it should hold.
+ * @param[in,out] last_ns Time of the record before it, then its last one.
+ */
+void _access_check_segment(const char *path, int first, int count,
+        int64_t *last_ns) {
+    tils_access_hdr_t hdr;
+    tils_access_rec_t rec;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+
+    /* Trimmed to exactly the records written */
+    CHECK(fstat(fd, &st) == 0);
+    CHECK_INT(st.st_size, sizeof(hdr) + count * sizeof(rec));
+
+    CHECK_INT(read(fd, &hdr, sizeof(hdr)), sizeof(hdr));
+    CHECK(memcmp(hdr.magic, TILS_ACCESS_MAGIC, sizeof(hdr.magic)) == 0);
+    CHECK_INT(hdr.version, TILS_ACCESS_VERSION);
+    CHECK_INT(hdr.record_size, sizeof(tils_access_rec_t));
+    CHECK_INT(hdr.pid, getpid());
+    CHECK_INT(hdr.worker, TEST_ACCESS_WORKER);
+    CHECK(hdr.created_ns > 0);
+
+    for (int i = first; i < first + count; i++) {
+        if (read(fd, &rec, sizeof(rec)) != sizeof(rec)) {
+            CHECK(!"segment ends early");
+            break;
+        }
+
+        CHECK_INT(rec.bytes, 1000 + i);
+        CHECK_INT(rec.status, i % 2 ? 404 : 200);
+        CHECK_INT(rec.route, i % 2 ? TILS_ACCESS_NO_ROUTE : i);
+        CHECK_INT(rec.method, i % 3);
+        CHECK_INT(rec.flags, i % 2 ? 0 : TILS_ACCESS_CHUNKED);
+
+        /* Stored as wall clock time */
+        CHECK(rec.time_ns >= *last_ns);
+        *last_ns = rec.time_ns;
+    }
+
+    close(fd);
+}
+
+void test_access_log_rotate() {
+    char dir[] = "/tmp/tils-access-XXXXXX";
+    char path[ACCESS_PATH_LEN];
+    tils_access_log_t *log;
+    tils_access_rec_t rec;
+    glob_t segs;
+
+    if (mkdtemp(dir) == NULL) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+
+    CHECK_INT(tils_access_log_config(dir, ACCESS_SEGMENT_MIN), 0);
+    CHECK_INT(tils_access_log_open(&log, TEST_ACCESS_WORKER), 0);
+    CHECK(log != NULL);
+    if (log == NULL)
+        goto cleanup_dir;
+
+    for (int i = 0; i < TEST_ACCESS_RECORDS; i++) {
+        /* The next segment is asked for half way through, and has to be
+         * ready before the first is full or records are dropped */
+        if (i == TEST_ACCESS_PER_SEG)
+            CHECK_INT(_access_wait_spare(log), 0);
+
+        memset(&rec, 0, sizeof(rec));
+        rec.time_ns = tils_access_clock();
+        rec.bytes = 1000 + i;
+        rec.status = i % 2 ? 404 : 200;
+        rec.route = i % 2 ? TILS_ACCESS_NO_ROUTE : i;
+        rec.method = i % 3;
+        rec.flags = i % 2 ? 0 : TILS_ACCESS_CHUNKED;
+        tils_access_log_append(log, &rec);
+    }
+
+    CHECK_INT(log->dropped, 0);
+    tils_access_log_close(log);
+
+    /* The segments, numbered in order; the unused spare is removed */
+    snprintf(path, sizeof(path), "%s/access-*.tlog", dir);
+    CHECK_INT(glob(path, 0, NULL, &segs), 0);
+    CHECK_INT(segs.gl_pathc, 2);
+
+    if (segs.gl_pathc == 2) {
+        int64_t last_ns = 0;
+        _access_check_segment(segs.gl_pathv[0], 0, TEST_ACCESS_PER_SEG,
+                &last_ns);
+        _access_check_segment(segs.gl_pathv[1], TEST_ACCESS_PER_SEG,
+                TEST_ACCESS_RECORDS - TEST_ACCESS_PER_SEG, &last_ns);
+    }
+
+    for (size_t i = 0; i < segs.gl_pathc; i++)
+        unlink(segs.gl_pathv[i]);
+    globfree(&segs);
+
+cleanup_dir:
+    snprintf(path, sizeof(path), ACCESS_ROUTES_NAME, dir);
+    CHECK(access(path, F_OK) == 0);
+    unlink(path);
+    rmdir(dir);
+}
@@ -0,0 +1,104 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/alloc_test.c
+ *
+ * @brief Tests of the arena & the buffer pool
+ *
+ * @author Lars Wander
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <lib/arena.h>
+#include <lib/pool.h>
+
+#include "test.h"
+
+void test_arena() {
+    arena_t *arena = arena_new(1024);
+    CHECK(arena != NULL);
+    if (arena == NULL)
+        return;
+
+    char *a = arena_alloc(arena, 10);
+    char *b = arena_alloc(arena, 10);
+    CHECK(a != NULL && b != NULL);
+    CHECK((uintptr_t)a % 16 == 0 && (uintptr_t)b % 16 == 0);
+    CHECK(b >= a + 10);
+
+    /* Larger than a block */
+    char *big = arena_alloc(arena, 5000);
+    CHECK(big != NULL);
+    if (big != NULL) {
+        memset(big, 0x5a, 5000);
+        CHECK(big[4999] == 0x5a);
+    }
+
+    /* Growing into more blocks keeps earlier allocations */
+    strcpy(a, "untouched");
+    for (int i = 0; i < 100; i++)
+        CHECK(arena_alloc(arena, 100) != NULL);
+    CHECK_STR(a, "untouched");
+
+    CHECK_STR(arena_strndup(arena, "hello world", 5), "hello");
+
+    /* Reset hands the same memory out again */
+    arena_reset(arena);
+    CHECK(arena_alloc(arena, 10) == a);
+
+    arena_free(arena);
+}
+
+void test_pool() {
+    pool_t *pool = pool_new();
+    int cap = 0;
+    CHECK(pool != NULL);
+    if (pool == NULL)
+        return;
+
+    /* Rounded up to the size classes: 1K, 4K, 16K, 64K */
+    void *small = pool_get(pool, 100, &cap);
+    CHECK(small != NULL);
+    CHECK_INT(cap, 1024);
+
+    /* Buffers come back out of the class they were put in */
+    pool_put(pool, small, cap);
+    CHECK(pool_get(pool, 1000, &cap) == small);
+    CHECK_INT(cap, 1024);
+    pool_put(pool, small, cap);
+
+    void *mid = pool_get(pool, 5000, &cap);
+    CHECK_INT(cap, 16 << 10);
+    memset(mid, 0, cap);
+    pool_put(pool, mid, cap);
+
+    void *other = pool_get(pool, 1025, &cap);
+    CHECK(other != mid && other != small);
+    CHECK_INT(cap, 4 << 10);
+    pool_put(pool, other, cap);
+
+    /* Past the largest class they're just malloc'd */
+    void *huge = pool_get(pool, 100000, &cap);
+    CHECK(huge != NULL);
+    CHECK_INT(cap, 100000);
+    pool_put(pool, huge, cap);
+
+    pool_free(pool);
+}
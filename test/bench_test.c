@@ -0,0 +1,71 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/bench_test.c
+ *
+ * @brief Tests of the log-linear buckets latencies are counted in
+ *
+ * @author Lars Wander
+ */
+
+#include <stdint.h>
+
+#include <lib/bench.h>
+
+#include "test.h"
+
+/* Internals of src/lib/bench.c */
+int _bench_bucket(uint64_t v);
+uint64_t _bench_bucket_max(int bucket);
+
+/**
+ * @brief Check the bucket of a value holds it, within the precision kept.
+ */
+void _check_bench_value(uint64_t v) {
+    int b = _bench_bucket(v);
+    CHECK(b >= 0 && b < BENCH_BUCKETS - 1);
+    CHECK(_bench_bucket_max(b) >= v);
+    CHECK(b == 0 || _bench_bucket_max(b - 1) < v);
+    CHECK(_bench_bucket_max(b) - v <= v >> BENCH_SUB_BITS);
+}
+
+void test_bench_bucket() {
+    /* Small values are exact */
+    for (uint64_t v = 0; v < BENCH_SUB_COUNT; v++) {
+        CHECK_INT(_bench_bucket(v), v);
+        CHECK_INT(_bench_bucket_max(v), v);
+    }
+
+    for (uint64_t v = BENCH_SUB_COUNT; v < 100000; v++) {
+        _check_bench_value(v);
+        CHECK(_bench_bucket(v) >= _bench_bucket(v - 1));
+    }
+
+    /* Either side of every power of 2 told apart */
+    for (int exp = BENCH_SUB_BITS; exp <= BENCH_MAX_EXP; exp++) {
+        uint64_t p = (uint64_t)1 << exp;
+        _check_bench_value(p - 1);
+        _check_bench_value(p);
+        _check_bench_value(p + 1);
+    }
+
+    /* Anything larger lands in the last bucket */
+    CHECK_INT(_bench_bucket((uint64_t)1 << (BENCH_MAX_EXP + 1)),
+            BENCH_BUCKETS - 1);
+    CHECK_INT(_bench_bucket(UINT64_MAX), BENCH_BUCKETS - 1);
+}
@@ -0,0 +1,223 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/deflate_test.c
+ *
+ * @brief Tests of the chunked gzip stream sent for uncached files
+ *
+ * @author Lars Wander
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <zlib.h>
+
+#include <lib/pool.h>
+#include <tils/deflate.h>
+
+#include "test.h"
+
+/* Size of the file compressed */
+#define TEST_DEFLATE_SIZE (3 << 20)
+
+/**
+ * @brief Write a file of text-like data, returning its contents.
+ *
+ * @param[in,out] path mkstemp template, the file's path on return.
+ * @param zeros Nonzero to write only zeros instead.
+ */
+char *_deflate_file(char *path, int zeros) {
+    char *data = malloc(TEST_DEFLATE_SIZE);
+    if (data == NULL)
+        return NULL;
+
+    uint32_t x = 12345;
+    for (int i = 0; i < TEST_DEFLATE_SIZE; i++) {
+        x = x * 1103515245 + 12345;
+        data[i] = zeros ? 0 : "abcdefgh \n"[(x >> 16) % 10];
+    }
+
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, data, TEST_DEFLATE_SIZE) != TEST_DEFLATE_SIZE) {
+        if (fd >= 0)
+            close(fd);
+        free(data);
+        return NULL;
+    }
+
+    close(fd);
+    return data;
+}
+
+/**
+ * @brief Run a stream to its end, checking the framing of every chunk.
+ *
+ * @param d The stream.
+ * @param[out] gz The gzip data, less the chunk framing.
+ * @param cap Room in gz.
+ * @param[out] empty Chunks with nothing in them, may be NULL.
+ *
+ * @return Length of the gzip data, -1 if the stream or its framing is bad.
+ */
+long _deflate_run(tils_deflate_t *d, char *gz, size_t cap, int *empty) {
+    size_t len = 0;
+
+    for (;;) {
+        off_t before = d->file_off;
+        if (tils_deflate_fill(d) != 1)
+            break;
+
+        char *p = d->send;
+        char *end = d->send + d->send_len;
+
+        CHECK(d->file_off - before <= TILS_DEFLATE_FILL_MAX);
+        if (d->send_len == 0 && empty != NULL)
+            (*empty)++;
+
+        /* Data chunks, then the last chunk only once the stream is over */
+        while (p < end) {
+            char *line;
+            unsigned long size = strtoul(p, &line, 16);
+            if (line == p || strncmp(line, "\r\n", 2) != 0)
+                return -1;
+
+            p = line + 2;
+            if (size == 0)
+                return strncmp(p, "\r\n", 2) == 0 && p + 2 == end &&
+                    d->done ? (long)len : -1;
+
+            if (size > TILS_DEFLATE_OUT || p + size + 2 > end ||
+                    strncmp(p + size, "\r\n", 2) != 0 || len + size > cap)
+                return -1;
+
+            memcpy(gz + len, p, size);
+            len += size;
+            p += size + 2;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Inflate a gzip stream, checking it's what was compressed.
+ */
+int _deflate_matches(char *gz, long len, char *data, size_t data_len) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (len < 0 || inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        return 0;
+
+    char *plain = malloc(data_len + 1);
+    zs.next_in = (unsigned char *)gz;
+    zs.avail_in = len;
+    zs.next_out = (unsigned char *)plain;
+    zs.avail_out = data_len + 1;
+
+    int res = plain != NULL && inflate(&zs, Z_FINISH) == Z_STREAM_END &&
+        zs.total_out == data_len && zs.avail_in == 0 &&
+        memcmp(plain, data, data_len) == 0;
+
+    inflateEnd(&zs);
+    free(plain);
+    return res;
+}
+
+void test_deflate_chunks() {
+    char path[] = "/tmp/tils-deflate-XXXXXX";
+    char *data = _deflate_file(path, 0);
+    tils_zpool_t *zp = tils_zpool_new();
+    pool_t *pool = pool_new();
+    char *gz = malloc(TEST_DEFLATE_SIZE);
+    CHECK(data != NULL && zp != NULL && pool != NULL && gz != NULL);
+    if (data == NULL || zp == NULL || pool == NULL || gz == NULL)
+        goto cleanup;
+
+    tils_deflate_t *d = tils_deflate_new(zp, pool, open(path, O_RDONLY), 0,
+            TEST_DEFLATE_SIZE, 6);
+    CHECK(d != NULL);
+    if (d != NULL) {
+        long len = _deflate_run(d, gz, TEST_DEFLATE_SIZE, NULL);
+        CHECK(len > 0);
+        CHECK(_deflate_matches(gz, len, data, TEST_DEFLATE_SIZE));
+        CHECK_INT(tils_deflate_fill(d), 0);
+        tils_deflate_free(d);
+    }
+
+    /* A range, on a compressor back from the pool at another level */
+    CHECK_INT(zp->idle_count, 1);
+    d = tils_deflate_new(zp, pool, open(path, O_RDONLY), 1000, 70000, 1);
+    CHECK(d != NULL);
+    if (d != NULL) {
+        CHECK_INT(zp->idle_count, 0);
+        long len = _deflate_run(d, gz, TEST_DEFLATE_SIZE, NULL);
+        CHECK(_deflate_matches(gz, len, data + 1000, 70000));
+        tils_deflate_free(d);
+    }
+
+    /* An empty range is still a whole gzip stream */
+    d = tils_deflate_new(zp, pool, open(path, O_RDONLY), 0, 0, 6);
+    CHECK(d != NULL);
+    if (d != NULL) {
+        long len = _deflate_run(d, gz, TEST_DEFLATE_SIZE, NULL);
+        CHECK(_deflate_matches(gz, len, data, 0));
+        tils_deflate_free(d);
+    }
+
+cleanup:
+    unlink(path);
+    free(data);
+    free(gz);
+    tils_zpool_free(zp);
+    pool_free(pool);
+}
+
+void test_deflate_fill_max() {
+    char path[] = "/tmp/tils-deflate-XXXXXX";
+    char *data = _deflate_file(path, 1);
+    tils_zpool_t *zp = tils_zpool_new();
+    pool_t *pool = pool_new();
+    char *gz = malloc(TEST_DEFLATE_SIZE);
+    CHECK(data != NULL && zp != NULL && pool != NULL && gz != NULL);
+    if (data == NULL || zp == NULL || pool == NULL || gz == NULL)
+        goto cleanup;
+
+    /* Zeros compress so well a fill reads all it may before it has a chunk
+     * to show for it, and returns an empty one. */
+    tils_deflate_t *d = tils_deflate_new(zp, pool, open(path, O_RDONLY), 0,
+            TEST_DEFLATE_SIZE, 9);
+    CHECK(d != NULL);
+    if (d != NULL) {
+        int empty = 0;
+        long len = _deflate_run(d, gz, TEST_DEFLATE_SIZE, &empty);
+        CHECK(_deflate_matches(gz, len, data, TEST_DEFLATE_SIZE));
+        CHECK(empty > 0);
+        tils_deflate_free(d);
+    }
+
+cleanup:
+    unlink(path);
+    free(data);
+    free(gz);
+    tils_zpool_free(zp);
+    pool_free(pool);
+}
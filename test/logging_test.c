@@ -0,0 +1,128 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/logging_test.c
+ *
+ * @brief Tests of packing log arguments & formatting them later
+ *
+ * @author Lars Wander
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lib/logging.h>
+
+#include "../src/lib/logging_private.h"
+
+#include "test.h"
+
+/* Internals of src/lib/logging.c */
+int _log_pack(const char *format, va_list ap, char *args);
+int _log_unpack(log_record_t *rec, char *buf, int cap);
+
+/**
+ * @brief Pack a call's arguments into a record & format it, like the writer.
+ *
+ * @param[out] buf MAX_LOG_LENGTH bytes.
+ *
+ * @return buf.
+ */
+__attribute__((format(printf, 2, 3)))
+const char *_logged(char *buf, const char *format, ...) {
+    log_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.format = format;
+
+    va_list ap;
+    va_start(ap, format);
+    rec.args_len = _log_pack(format, ap, rec.args);
+    va_end(ap);
+
+    _log_unpack(&rec, buf, MAX_LOG_LENGTH);
+    return buf;
+}
+
+void test_log_format() {
+    char buf[MAX_LOG_LENGTH];
+    char expect[64];
+    int x = 0;
+
+    CHECK_STR(_logged(buf, "plain"), "plain");
+    CHECK_STR(_logged(buf, "%d %i %u %x %X %o %c", -5, 6, 7u, 255, 255, 8,
+                'z'), "-5 6 7 ff FF 10 z");
+    CHECK_STR(_logged(buf, "%hhd %hd %ld %lld %lu %zu", 1, 2, -3L, -4LL, 5UL,
+                (size_t)6), "1 2 -3 -4 5 6");
+    CHECK_STR(_logged(buf, "100%% of %s", "it"), "100% of it");
+    char *volatile null = NULL;
+    CHECK_STR(_logged(buf, "%s", null), "(null)");
+    CHECK_STR(_logged(buf, "%.2f %e %g", 3.14159, 1e10, 0.5),
+            "3.14 1.000000e+10 0.5");
+
+    snprintf(expect, sizeof(expect), "%p", (void *)&x);
+    CHECK_STR(_logged(buf, "%p", (void *)&x), expect);
+
+    /* Flags, widths & precisions written out */
+    CHECK_STR(_logged(buf, "[%5d|%-5d|%05d|%+d]", 42, 42, 42, 42),
+            "[   42|42   |00042|+42]");
+    CHECK_STR(_logged(buf, "[%8s|%-8s|%.3s]", "abc", "abc", "abcdef"),
+            "[     abc|abc     |abc]");
+}
+
+void test_log_star() {
+    char buf[MAX_LOG_LENGTH];
+
+    CHECK_STR(_logged(buf, "[%*d]", 6, 42), "[    42]");
+    CHECK_STR(_logged(buf, "[%-*d]", 6, 42), "[42    ]");
+    CHECK_STR(_logged(buf, "[%.*d]", 4, 42), "[0042]");
+    CHECK_STR(_logged(buf, "[%*.*f]", 8, 2, 3.14159), "[    3.14]");
+    CHECK_STR(_logged(buf, "[%*s|%d]", 5, "ab", 7), "[   ab|7]");
+
+    /* A negative width is a left adjusted one, a negative precision none */
+    CHECK_STR(_logged(buf, "[%*d]", -4, 1), "[1   ]");
+    CHECK_STR(_logged(buf, "[%.*d]", -1, 42), "[42]");
+    CHECK_STR(_logged(buf, "[%.*s]", -1, "abc"), "[abc]");
+
+    /* Strings are only read up to their precision */
+    struct { char slice[3]; char after[8]; } unterminated = {
+        { 'x', 'y', 'z' }, "garbage"
+    };
+    CHECK_STR(_logged(buf, "[%.*s]", 3, unterminated.slice), "[xyz]");
+    CHECK_STR(_logged(buf, "[%.3s]", unterminated.slice), "[xyz]");
+    CHECK_STR(_logged(buf, "[%.*s] %d", 2, unterminated.slice, 9), "[xy] 9");
+}
+
+void test_log_truncated() {
+    char buf[MAX_LOG_LENGTH];
+    char big[200];
+
+    /* Arguments that don't fit in the record are left out */
+    memset(big, 'a', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    _logged(buf, "%s %s", big, "second");
+    CHECK(strncmp(buf, big, LOG_ARGS_SIZE - 1) == 0);
+    CHECK(strcmp(buf + strlen(buf) - 3, "...") == 0);
+
+    CHECK_STR(_logged(buf, "%d %d %d %d %d %d %d %d %d %d %d %d %d %d", 1, 2,
+                3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14),
+            "1 2 3 4 5 6 7 8 9 10 11 12 13 ...");
+    CHECK_STR(_logged(buf, "%d %d %d %d %d %d %d %d %d %d %d %d %*d", 1, 2,
+                3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 3, 13),
+            "1 2 3 4 5 6 7 8 9 10 11 12 ...");
+}
@@ -0,0 +1,107 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/mime_test.c
+ *
+ * @brief Tests of the MIME registry & its perfect hash
+ *
+ * @author Lars Wander
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tils/mime.h>
+
+#include "test.h"
+
+/* Types written to the mime.types file, each with two extensions */
+#define TEST_MIME_TYPES (500)
+
+/**
+ * @brief Write a mime.types file, returning its path in path.
+ */
+int _mime_file(char *path, int len) {
+    snprintf(path, len, "/tmp/tils-test-mime-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+
+    FILE *file = fdopen(fd, "w");
+    if (file == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    fprintf(file, "# comment\n\n");
+    fprintf(file, "application/xhtml+xml html  # replaces the built in\n");
+    fprintf(file, "no-slash ignored\n");
+    for (int i = 0; i < TEST_MIME_TYPES; i++)
+        fprintf(file, "application/x-test%d\tt%d t%dx\n", i, i, i);
+
+    fclose(file);
+    return 0;
+}
+
+void test_mime_lookup() {
+    char path[64];
+    char name[64];
+    char type[64];
+
+    CHECK_INT(tils_mime_init(), 0);
+    CHECK_INT(_mime_file(path, sizeof(path)), 0);
+    CHECK_INT(tils_mime_load(path), 0);
+    unlink(path);
+    CHECK_INT(tils_mime_build(), 0);
+
+    CHECK_STR(tils_mime_lookup("/common.css")->type,
+            "text/css; charset=utf-8");
+    CHECK_INT(tils_mime_lookup("/common.css")->compressible, 1);
+    CHECK_STR(tils_mime_lookup("/favicon.png")->type, "image/png");
+    CHECK_INT(tils_mime_lookup("/favicon.png")->compressible, 0);
+    CHECK_STR(tils_mime_lookup("/IMAGE.PNG")->type, "image/png");
+    CHECK_STR(tils_mime_lookup("/index.html")->type, "application/xhtml+xml");
+    CHECK_INT(tils_mime_lookup("/index.html")->compressible, 1);
+
+    /* Unknown & missing extensions, and dots in directory names */
+    CHECK_STR(tils_mime_lookup("/file.nope")->type,
+            "application/octet-stream");
+    CHECK_STR(tils_mime_lookup("/README")->type, "application/octet-stream");
+    CHECK_STR(tils_mime_lookup("/v1.2/README")->type,
+            "application/octet-stream");
+    CHECK_STR(tils_mime_lookup("/f.ignored")->type,
+            "application/octet-stream");
+
+    /* Every extension is placed, and nothing similar matches */
+    for (int i = 0; i < TEST_MIME_TYPES; i++) {
+        snprintf(type, sizeof(type), "application/x-test%d", i);
+
+        snprintf(name, sizeof(name), "/f.t%d", i);
+        CHECK_STR(tils_mime_lookup(name)->type, type);
+
+        snprintf(name, sizeof(name), "/f.T%dX", i);
+        CHECK_STR(tils_mime_lookup(name)->type, type);
+
+        snprintf(name, sizeof(name), "/f.t%dy", i);
+        CHECK_STR(tils_mime_lookup(name)->type, "application/octet-stream");
+    }
+
+    tils_mime_cleanup();
+}
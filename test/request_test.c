@@ -0,0 +1,282 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/request_test.c
+ *
+ * @brief Tests of request parsing, pipelining, keep-alive, Range &
+ *        Accept-Encoding
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <lib/arena.h>
+#include <tils/conn.h>
+#include <tils/request.h>
+
+#include "test.h"
+
+#define TEST_ARENA_BLOCK (1 << 12)
+
+/**
+ * @brief Parse a whole request, headers and blank line included.
+ */
+tils_http_request_t *_parse(arena_t *arena, const char *text) {
+    char *buf = arena_strndup(arena, text, strlen(text));
+    if (buf == NULL)
+        return NULL;
+
+    return tils_parse_request(arena, buf, strlen(buf));
+}
+
+void test_request_parse() {
+    arena_t *arena = arena_new(TEST_ARENA_BLOCK);
+    tils_http_request_t *req;
+
+    req = _parse(arena, "GET /index.html HTTP/1.1\r\n"
+            "Host: example.com\r\n"
+            "Accept:  text/html \r\n\r\n");
+    CHECK(req != NULL);
+    if (req != NULL) {
+        CHECK_INT(req->request_type, TILS_GET);
+        CHECK_STR(req->resource, "/index.html");
+        CHECK_INT(req->minor_version, 1);
+        CHECK_INT(req->header_count, 2);
+        CHECK_STR(tils_request_header(req, "Host"), "example.com");
+        CHECK_STR(tils_request_header(req, "accept"), "text/html");
+        CHECK(tils_request_header(req, "Range") == NULL);
+        CHECK_INT(req->body_len, 0);
+    }
+
+    req = _parse(arena, "HEAD / HTTP/1.0\r\n\r\n");
+    CHECK(req != NULL && req->request_type == TILS_HEAD);
+    CHECK(req != NULL && req->minor_version == 0);
+
+    req = _parse(arena, "BREW /pot HTTP/1.1\r\n\r\n");
+    CHECK(req != NULL && req->request_type == TILS_UNKNOWN);
+
+    req = _parse(arena, "POST /form HTTP/1.1\r\nContent-Length: 42\r\n\r\n");
+    CHECK(req != NULL && req->request_type == TILS_POST);
+    CHECK(req != NULL && req->body_len == 42);
+
+    /* Headers past MAX_HEADERS are ignored, not an error */
+    char many[4096] = "GET / HTTP/1.1\r\n";
+    for (int i = 0; i < MAX_HEADERS + 8; i++)
+        snprintf(many + strlen(many), sizeof(many) - strlen(many),
+                "X-Header-%d: %d\r\n", i, i);
+    strcat(many, "\r\n");
+    req = _parse(arena, many);
+    CHECK(req != NULL && req->header_count == MAX_HEADERS);
+
+    /* Malformed */
+    CHECK(_parse(arena, "GET /\r\n\r\n") == NULL);
+    CHECK(_parse(arena, "GET  HTTP/1.1\r\n\r\n") == NULL);
+    CHECK(_parse(arena, "GET / HTTP/2.0\r\n\r\n") == NULL);
+    CHECK(_parse(arena, "GET / HTTP/1.x\r\n\r\n") == NULL);
+    CHECK(_parse(arena, "GET / HTTP/1.1\r\nNo colon here\r\n\r\n") == NULL);
+    CHECK(_parse(arena, "GET / HTTP/1.1\r\n: empty name\r\n\r\n") == NULL);
+    CHECK(_parse(arena, "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n") ==
+            NULL);
+    CHECK(_parse(arena, "GET / HTTP/1.1\r\nContent-Length: -5\r\n\r\n") ==
+            NULL);
+
+    arena_free(arena);
+}
+
+void test_request_pipelining() {
+    arena_t *arena = arena_new(TEST_ARENA_BLOCK);
+    char buf[] = "GET /a HTTP/1.1\r\n\r\n"
+        "POST /b HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+        "GET /c HTTP/1.1\r\nHost: x\r\n\r\n"
+        "GET /d HTTP/1.1\r\nHo";
+    int len = strlen(buf);
+    int off = 0;
+
+    int first = tils_request_length(buf, len);
+    CHECK_INT(first, strlen("GET /a HTTP/1.1\r\n\r\n"));
+    tils_http_request_t *req = tils_parse_request(arena, buf, first);
+    CHECK(req != NULL && strcmp(req->resource, "/a") == 0);
+    off += first;
+
+    /* The body is skipped to find the next request */
+    int second = tils_request_length(buf + off, len - off);
+    CHECK(second > 0);
+    req = tils_parse_request(arena, buf + off, second);
+    CHECK(req != NULL && strcmp(req->resource, "/b") == 0);
+    CHECK(req != NULL && req->body_len == 5);
+    off += second + (req != NULL ? req->body_len : 0);
+    CHECK(strncmp(buf + off, "GET /c", 6) == 0);
+
+    int third = tils_request_length(buf + off, len - off);
+    req = tils_parse_request(arena, buf + off, third);
+    CHECK(req != NULL && strcmp(req->resource, "/c") == 0);
+    CHECK(req != NULL && req->header_count == 1);
+    off += third;
+
+    /* The last one hasn't all arrived */
+    CHECK_INT(tils_request_length(buf + off, len - off), 0);
+    CHECK_INT(tils_request_length(buf, 0), 0);
+
+    arena_free(arena);
+}
+
+void test_request_keep_alive() {
+    arena_t *arena = arena_new(TEST_ARENA_BLOCK);
+    tils_http_request_t *req;
+    tils_conn_t conn;
+
+    /* HTTP/1.1 stays open unless told otherwise, HTTP/1.0 the reverse */
+    req = _parse(arena, "GET / HTTP/1.1\r\n\r\n");
+    CHECK(req != NULL && req->keep_alive);
+    req = _parse(arena, "GET / HTTP/1.0\r\n\r\n");
+    CHECK(req != NULL && !req->keep_alive);
+
+    req = _parse(arena, "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(req != NULL && !req->keep_alive);
+    req = _parse(arena, "GET / HTTP/1.1\r\nConnection: Upgrade, CLOSE\r\n\r\n");
+    CHECK(req != NULL && !req->keep_alive);
+    req = _parse(arena, "GET / HTTP/1.1\r\nConnection: closed\r\n\r\n");
+    CHECK(req != NULL && req->keep_alive);
+
+    req = _parse(arena, "GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n");
+    CHECK(req != NULL && req->keep_alive);
+    req = _parse(arena, "GET / HTTP/1.0\r\nConnection: x, keep-alive \r\n"
+            "\r\n");
+    CHECK(req != NULL && req->keep_alive);
+
+    /* A connection is closed after its last allowed request */
+    memset(&conn, 0, sizeof(conn));
+    tils_conn_max_requests(3);
+    CHECK_INT(tils_conn_count_request(&conn), 0);
+    CHECK_INT(tils_conn_count_request(&conn), 0);
+    CHECK_INT(tils_conn_count_request(&conn), 1);
+
+    tils_conn_max_requests(0);
+    memset(&conn, 0, sizeof(conn));
+    for (int i = 0; i < 5000; i++)
+        CHECK_INT(tils_conn_count_request(&conn), 0);
+
+    /* Or as soon as it's closing */
+    conn.closing = 1;
+    CHECK_INT(tils_conn_count_request(&conn), 1);
+    tils_conn_max_requests(MAX_REQUESTS);
+
+    arena_free(arena);
+}
+
+/**
+ * @brief Resolve a Range header against a 1000 byte body.
+ */
+int _ranges(char *value, tils_http_range_t *ranges) {
+    return tils_request_ranges(value, 1000, ranges, TILS_RANGE_MAX);
+}
+
+void test_request_ranges() {
+    tils_http_range_t r[TILS_RANGE_MAX];
+
+    CHECK_INT(_ranges("bytes=0-99", r), 1);
+    CHECK(r[0].first == 0 && r[0].last == 99);
+
+    CHECK_INT(_ranges("bytes=500-", r), 1);
+    CHECK(r[0].first == 500 && r[0].last == 999);
+
+    CHECK_INT(_ranges("bytes=-100", r), 1);
+    CHECK(r[0].first == 900 && r[0].last == 999);
+
+    /* Suffixes longer than the body are the whole body */
+    CHECK_INT(_ranges("bytes=-2000", r), 1);
+    CHECK(r[0].first == 0 && r[0].last == 999);
+
+    /* Ends past the body are cut short */
+    CHECK_INT(_ranges("bytes=900-5000", r), 1);
+    CHECK(r[0].first == 900 && r[0].last == 999);
+
+    /* Kept in the order asked for */
+    CHECK_INT(_ranges("bytes=0-99, 200-299,-50", r), 3);
+    CHECK(r[0].first == 0 && r[0].last == 99);
+    CHECK(r[1].first == 200 && r[1].last == 299);
+    CHECK(r[2].first == 950 && r[2].last == 999);
+
+    CHECK_INT(_ranges(" BYTES=0-0", r), 1);
+    CHECK(r[0].first == 0 && r[0].last == 0);
+
+    CHECK_INT(_ranges("bytes=0-1,,2-3", r), 2);
+
+    /* Unsatisfiable ranges are dropped, and if none is left it's a 416 */
+    CHECK_INT(_ranges("bytes=1000-", r), -1);
+    CHECK_INT(_ranges("bytes=-0", r), -1);
+    CHECK_INT(_ranges("bytes=2000-3000,0-9", r), 1);
+    CHECK(r[0].first == 0 && r[0].last == 9);
+    CHECK_INT(tils_request_ranges("bytes=0-", 0, r, TILS_RANGE_MAX), -1);
+
+    /* Invalid headers are ignored */
+    CHECK_INT(_ranges("bytes=5-2", r), 0);
+    CHECK_INT(_ranges("items=0-5", r), 0);
+    CHECK_INT(_ranges("bytes=", r), 0);
+    CHECK_INT(_ranges("bytes=abc", r), 0);
+    CHECK_INT(_ranges("bytes=-", r), 0);
+    CHECK_INT(_ranges("bytes=1-2-3", r), 0);
+    CHECK_INT(_ranges("bytes=0-9999999999999999999", r), 0);
+
+    /* So are requests for too many ranges */
+    char many[256] = "bytes=";
+    for (int i = 0; i <= TILS_RANGE_MAX; i++)
+        snprintf(many + strlen(many), sizeof(many) - strlen(many), "%s%d-%d",
+                i == 0 ? "" : ",", i * 10, i * 10 + 5);
+    CHECK_INT(_ranges(many, r), 0);
+}
+
+/**
+ * @brief Codings accepted by a request sending this Accept-Encoding.
+ */
+int _encodings(arena_t *arena, const char *accept) {
+    char text[256];
+    snprintf(text, sizeof(text), "GET / HTTP/1.1\r\nAccept-Encoding: %s\r\n"
+            "\r\n", accept);
+
+    tils_http_request_t *req = _parse(arena, text);
+    return req != NULL ? tils_request_encodings(req) : -1;
+}
+
+void test_request_encodings() {
+    arena_t *arena = arena_new(TEST_ARENA_BLOCK);
+    int id = 1 << TILS_ENC_IDENTITY;
+    int gzip = 1 << TILS_ENC_GZIP;
+    int br = 1 << TILS_ENC_BR;
+
+    tils_http_request_t *req = _parse(arena, "GET / HTTP/1.1\r\n\r\n");
+    CHECK(req != NULL && tils_request_encodings(req) == id);
+
+    CHECK_INT(_encodings(arena, "gzip, deflate, br"), id | gzip | br);
+    CHECK_INT(_encodings(arena, "gzip"), id | gzip);
+    CHECK_INT(_encodings(arena, "x-gzip"), id | gzip);
+    CHECK_INT(_encodings(arena, "GZIP ; q=0.5"), id | gzip);
+    CHECK_INT(_encodings(arena, "gzip;q=0, br"), id | br);
+    CHECK_INT(_encodings(arena, "br;q=0.000"), id);
+    CHECK_INT(_encodings(arena, "*"), id | gzip | br);
+    CHECK_INT(_encodings(arena, "*, gzip;q=0"), id | br);
+    CHECK_INT(_encodings(arena, "*;q=0"), id);
+    CHECK_INT(_encodings(arena, "compress, deflate"), id);
+
+    /* Identity can't be refused */
+    CHECK_INT(_encodings(arena, "identity;q=0"), id);
+
+    arena_free(arena);
+}
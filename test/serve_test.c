@@ -0,0 +1,614 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/serve_test.c
+ *
+ * @brief Tests of the choices made serving a file: the coding sent, whether
+ *        the client's copy is current, ranges, and files changing under a
+ *        route
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <lib/arena.h>
+#include <lib/blob.h>
+#include <lib/pool.h>
+#include <tils/deflate.h>
+#include <tils/mime.h>
+#include <tils/out.h>
+#include <tils/request.h>
+#include <tils/response.h>
+#include <tils/routes.h>
+#include <tils/worker_thread.h>
+
+#include "test.h"
+
+#define TEST_ARENA_BLOCK (1 << 12)
+
+/* Larger than the route cache, so the file is read on every request */
+#define TEST_SERVE_SIZE ((1 << 20) + 4096)
+
+/* Room for a whole response to the routed file */
+#define TEST_SERVE_CAP (TEST_SERVE_SIZE + 4096)
+
+/* Internals of src/tils/serve.c */
+tils_http_encoding_e _tils_serve_encoding(tils_route_t *route, int accepted);
+int _tils_serve_etag_match(char *list, char *etag);
+int _tils_serve_not_modified(tils_route_t *route, tils_http_encoding_e enc,
+        tils_http_request_t *request, int current);
+int _tils_serve_if_range(tils_route_t *route, tils_http_encoding_e enc,
+        tils_http_request_t *request, int current);
+int _tils_serve_file(tils_wt_t *self, tils_out_t *out, tils_route_t *route,
+        tils_http_request_t *request);
+
+/* Stands in for a worker, only what serving a file touches is set up */
+static tils_wt_t _wt;
+
+/* The routed file, and the resource it's routed from */
+static char _serve_path[] = "/tmp/tils-serve-XXXXXX";
+static char _serve_source[] = "/big";
+
+/**
+ * @brief Parse a request sending one header.
+ */
+tils_http_request_t *_request(arena_t *arena, const char *header) {
+    char text[256];
+    snprintf(text, sizeof(text), "GET / HTTP/1.1\r\n%s\r\n\r\n", header);
+
+    char *buf = arena_strndup(arena, text, strlen(text));
+    return buf != NULL ? tils_parse_request(arena, buf, strlen(buf)) : NULL;
+}
+
+/**
+ * @brief (Re)write a file to route to, with modification time mtime.
+ *
+ * Every byte is a letter depending on its offset & seed, the first is
+ * 'a' + seed.
+ */
+int _serve_write(const char *path, int seed, time_t mtime) {
+    struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+    int res = -1;
+    char *data = malloc(TEST_SERVE_SIZE);
+    if (data == NULL)
+        return -1;
+
+    for (int i = 0; i < TEST_SERVE_SIZE; i++)
+        data[i] = 'a' + (i + seed) % 26;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0 && write(fd, data, TEST_SERVE_SIZE) == TEST_SERVE_SIZE &&
+            futimens(fd, times) == 0)
+        res = 0;
+
+    if (fd >= 0)
+        close(fd);
+    free(data);
+    return res;
+}
+
+/**
+ * @brief Route _serve_source to a fresh file, and set up _wt.
+ *
+ * @return The route, NULL on error.
+ */
+tils_route_t *_serve_setup(time_t mtime) {
+    tils_route_t *route = NULL;
+    int fd = mkstemp(_serve_path);
+    if (fd < 0)
+        return NULL;
+    close(fd);
+
+    _wt.arena = arena_new(TEST_ARENA_BLOCK);
+    _wt.pool = pool_new();
+    _wt.zpool = tils_zpool_new();
+
+    if (_serve_write(_serve_path, 0, mtime) < 0 || tils_mime_init() < 0 ||
+            tils_mime_build() < 0 || tils_routes_init() < 0 ||
+            tils_route_add(_serve_source, _serve_path, NULL) < 0 ||
+            tils_route_lookup(_serve_source, &route) != 0)
+        return NULL;
+
+    return route;
+}
+
+void _serve_teardown() {
+    unlink(_serve_path);
+    strcpy(_serve_path + strlen(_serve_path) - 6, "XXXXXX");
+    tils_routes_cleanup();
+    tils_mime_cleanup();
+    arena_free(_wt.arena);
+    pool_free(_wt.pool);
+    tils_zpool_free(_wt.zpool);
+    memset(&_wt, 0, sizeof(_wt));
+}
+
+/**
+ * @brief Serve the routed file, rendering the whole response into buf.
+ *
+ * @param method e.g. "GET".
+ * @param headers Request headers, each ending in CRLF.
+ * @param[out] buf TEST_SERVE_CAP bytes, the response is NUL terminated.
+ *
+ * @return The response's length, -1 if the file couldn't be served.
+ */
+long _serve(const char *method, const char *headers, char *buf) {
+    char text[512];
+    tils_route_t *route;
+    long len = 0;
+
+    arena_reset(_wt.arena);
+    snprintf(text, sizeof(text), "%s %s HTTP/1.1\r\nHost: test\r\n%s\r\n",
+            method, _serve_source, headers);
+    char *raw = arena_strndup(_wt.arena, text, strlen(text));
+    tils_http_request_t *req = raw == NULL ? NULL :
+        tils_parse_request(_wt.arena, raw, strlen(raw));
+    tils_out_t *out = tils_out_new(_wt.arena);
+
+    if (req == NULL || out == NULL ||
+            tils_route_lookup(_serve_source, &route) != 0 ||
+            _tils_serve_file(&_wt, out, route, req) < 0)
+        return -1;
+
+    for (tils_out_seg_t *seg = out->head; seg != NULL; seg = seg->next) {
+        if (seg->kind == OUT_DEFLATE || len + seg->len >= TEST_SERVE_CAP) {
+            len = -1;
+            break;
+        }
+
+        if (seg->kind != OUT_FILE)
+            memcpy(buf + len, seg->data, seg->len);
+        else if (pread(seg->file_fd, buf + len, seg->len, seg->file_off) !=
+                (ssize_t)seg->len)
+            len = -1;
+
+        if (len < 0)
+            break;
+        len += seg->len;
+    }
+
+    tils_out_release(out);
+    if (len >= 0)
+        buf[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief Check a response's header block for a header.
+ *
+ * @param res The response.
+ * @param name Header name, colon included, e.g. "ETag:".
+ *
+ * @return 1 if it's there, 0 if not.
+ */
+int _has_header(const char *res, const char *name) {
+    const char *end = strstr(res, "\r\n\r\n");
+    const char *at = strstr(res, name);
+    return end != NULL && at != NULL && at < end;
+}
+
+/**
+ * @brief The body of a response.
+ */
+const char *_body(const char *res) {
+    const char *end = strstr(res, "\r\n\r\n");
+    return end != NULL ? end + 4 : "";
+}
+
+/**
+ * @brief Whether ranges apply to a request with this If-Range header.
+ */
+int _if_range(arena_t *arena, tils_route_t *route, tils_http_encoding_e enc,
+        const char *value) {
+    char header[128];
+    snprintf(header, sizeof(header), "If-Range: %s", value);
+
+    tils_http_request_t *req = _request(arena, header);
+    return req != NULL ? _tils_serve_if_range(route, enc, req, 1) : -1;
+}
+
+void test_if_range() {
+    arena_t *arena = arena_new(TEST_ARENA_BLOCK);
+    tils_route_t route;
+    char date[TILS_HTTP_DATE_LEN + 1];
+    char earlier[TILS_HTTP_DATE_LEN + 1];
+
+    memset(&route, 0, sizeof(route));
+    strcpy(route.etag[TILS_ENC_IDENTITY], "\"5f2b-1b4e\"");
+    strcpy(route.etag[TILS_ENC_GZIP], "\"5f2b-1b4e-gz\"");
+    route.mtime = 1700000000;
+
+    memset(date, 0, sizeof(date));
+    memset(earlier, 0, sizeof(earlier));
+    tils_http_date(route.mtime, date);
+    tils_http_date(route.mtime - 1, earlier);
+
+    tils_http_request_t *req = _request(arena, "Range: bytes=0-1");
+    CHECK(req != NULL && _tils_serve_if_range(&route, TILS_ENC_IDENTITY,
+                req, 1) == 1);
+    CHECK(req != NULL && _tils_serve_if_range(&route, TILS_ENC_IDENTITY,
+                req, 0) == 1);
+
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_IDENTITY, "\"5f2b-1b4e\""),
+            1);
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_IDENTITY, "\"other\""), 0);
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_GZIP, "\"5f2b-1b4e\""), 0);
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_GZIP, "\"5f2b-1b4e-gz\""), 1);
+
+    /* Weak tags never match */
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_IDENTITY,
+                "W/\"5f2b-1b4e\""), 0);
+
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_IDENTITY, date), 1);
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_IDENTITY, earlier), 0);
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_IDENTITY, "yesterday"), 0);
+
+    /* Nor does anything once the body isn't what the validators describe */
+    req = _request(arena, "If-Range: \"5f2b-1b4e\"");
+    CHECK(req != NULL && _tils_serve_if_range(&route, TILS_ENC_IDENTITY,
+                req, 0) == 0);
+
+    /* Without a modification time no date matches */
+    route.mtime = 0;
+    CHECK_INT(_if_range(arena, &route, TILS_ENC_IDENTITY, date), 0);
+
+    arena_free(arena);
+}
+
+void test_serve_encoding() {
+    tils_route_t route;
+    int id = 1 << TILS_ENC_IDENTITY;
+    int gzip = 1 << TILS_ENC_GZIP;
+    int br = 1 << TILS_ENC_BR;
+
+    memset(&route, 0, sizeof(route));
+    route.body[TILS_ENC_IDENTITY] = blob_new(1000);
+    route.body[TILS_ENC_GZIP] = blob_new(300);
+    route.body[TILS_ENC_BR] = blob_new(250);
+
+    CHECK_INT(_tils_serve_encoding(&route, id), TILS_ENC_IDENTITY);
+    CHECK_INT(_tils_serve_encoding(&route, id | gzip), TILS_ENC_GZIP);
+    CHECK_INT(_tils_serve_encoding(&route, id | br), TILS_ENC_BR);
+
+    /* The smallest body the client can decode */
+    CHECK_INT(_tils_serve_encoding(&route, id | gzip | br), TILS_ENC_BR);
+    blob_unref(route.body[TILS_ENC_GZIP]);
+    route.body[TILS_ENC_GZIP] = blob_new(200);
+    CHECK_INT(_tils_serve_encoding(&route, id | gzip | br), TILS_ENC_GZIP);
+
+    /* Codings that didn't make the body smaller aren't kept */
+    blob_unref(route.body[TILS_ENC_BR]);
+    route.body[TILS_ENC_BR] = NULL;
+    CHECK_INT(_tils_serve_encoding(&route, id | br), TILS_ENC_IDENTITY);
+
+    /* Files too large to keep have only their compressed bodies cached */
+    blob_unref(route.body[TILS_ENC_IDENTITY]);
+    route.body[TILS_ENC_IDENTITY] = NULL;
+    CHECK_INT(_tils_serve_encoding(&route, id | gzip), TILS_ENC_GZIP);
+    CHECK_INT(_tils_serve_encoding(&route, id), TILS_ENC_IDENTITY);
+
+    blob_unref(route.body[TILS_ENC_GZIP]);
+}
+
+void test_etag_match() {
+    CHECK_INT(_tils_serve_etag_match("\"a\", \"b\"", "\"b\""), 1);
+    CHECK_INT(_tils_serve_etag_match("\"a\",\"b\"", "\"a\""), 1);
+    CHECK_INT(_tils_serve_etag_match("\"c\"", "\"a\""), 0);
+    CHECK_INT(_tils_serve_etag_match("\"ab\"", "\"a\""), 0);
+    CHECK_INT(_tils_serve_etag_match("*", "\"a\""), 1);
+    CHECK_INT(_tils_serve_etag_match("", "\"a\""), 0);
+
+    /* The weak comparison ignores W/ on either side */
+    CHECK_INT(_tils_serve_etag_match("W/\"a\"", "\"a\""), 1);
+    CHECK_INT(_tils_serve_etag_match("\"a\"", "W/\"a\""), 1);
+}
+
+/**
+ * @brief Whether a request sending this header would be answered with a 304.
+ */
+int _not_modified(arena_t *arena, tils_route_t *route, const char *header,
+        int current) {
+    tils_http_request_t *req = _request(arena, header);
+    return req != NULL ?
+        _tils_serve_not_modified(route, TILS_ENC_IDENTITY, req, current) : -1;
+}
+
+void test_not_modified() {
+    arena_t *arena = arena_new(TEST_ARENA_BLOCK);
+    tils_route_t route;
+    char header[128];
+    char date[TILS_HTTP_DATE_LEN + 1];
+
+    memset(&route, 0, sizeof(route));
+    strcpy(route.etag[TILS_ENC_IDENTITY], "\"5f2b-1b4e\"");
+    route.mtime = 1700000000;
+
+    CHECK_INT(_not_modified(arena, &route, "Host: x", 1), 0);
+    CHECK_INT(_not_modified(arena, &route, "If-None-Match: \"5f2b-1b4e\"", 1),
+            1);
+    CHECK_INT(_not_modified(arena, &route, "If-None-Match: \"other\"", 1), 0);
+    CHECK_INT(_not_modified(arena, &route, "If-None-Match: *", 1), 1);
+
+    tils_http_date(route.mtime, date);
+    snprintf(header, sizeof(header), "If-Modified-Since: %s", date);
+    CHECK_INT(_not_modified(arena, &route, header, 1), 1);
+    tils_http_date(route.mtime + 60, date);
+    snprintf(header, sizeof(header), "If-Modified-Since: %s", date);
+    CHECK_INT(_not_modified(arena, &route, header, 1), 1);
+    tils_http_date(route.mtime - 1, date);
+    snprintf(header, sizeof(header), "If-Modified-Since: %s", date);
+    CHECK_INT(_not_modified(arena, &route, header, 1), 0);
+    CHECK_INT(_not_modified(arena, &route, "If-Modified-Since: today", 1), 0);
+
+    /* If-None-Match wins, even when the date alone would match */
+    tils_http_date(route.mtime, date);
+    snprintf(header, sizeof(header), "If-None-Match: \"other\"\r\n"
+            "If-Modified-Since: %s", date);
+    CHECK_INT(_not_modified(arena, &route, header, 1), 0);
+
+    /* Validators that no longer describe the file never match */
+    CHECK_INT(_not_modified(arena, &route, "If-None-Match: \"5f2b-1b4e\"", 0),
+            0);
+    CHECK_INT(_not_modified(arena, &route, "If-None-Match: *", 0), 0);
+
+    arena_free(arena);
+}
+
+void test_http_date() {
+    char date[TILS_HTTP_DATE_LEN + 1];
+    time_t t = 0;
+
+    CHECK_INT(tils_parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT", &t), 0);
+    CHECK_INT(t, 784111777);
+
+    /* Every date formatted parses back to the same time */
+    time_t times[] = { 0, 951782400, 1700000000, 2147483648, 4102444799 };
+    for (int i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        tils_http_date(times[i], date);
+        CHECK_INT(strlen(date), TILS_HTTP_DATE_LEN);
+        CHECK_INT(tils_parse_http_date(date, &t), 0);
+        CHECK_INT(t, times[i]);
+    }
+
+    tils_http_date(951782400, date);
+    CHECK_STR(date, "Tue, 29 Feb 2000 00:00:00 GMT");
+
+    /* Only the preferred format is understood */
+    CHECK_INT(tils_parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT", &t), -1);
+    CHECK_INT(tils_parse_http_date("Sun Nov  6 08:49:37 1994", &t), -1);
+    CHECK_INT(tils_parse_http_date("Sun, 06 Nov 1994 08:49:37 UTC", &t), -1);
+    CHECK_INT(tils_parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT ", &t), -1);
+    CHECK_INT(tils_parse_http_date("Sun, 06 Nvo 1994 08:49:37 GMT", &t), -1);
+    CHECK_INT(tils_parse_http_date("Sun, 06 Nov 1994 24:49:37 GMT", &t), -1);
+    CHECK_INT(tils_parse_http_date("Sun, 00 Nov 1994 08:49:37 GMT", &t), -1);
+    CHECK_INT(tils_parse_http_date("", &t), -1);
+}
+
+void test_serve_changed() {
+    time_t mtime = 1700000000;
+    char etag[TILS_ROUTE_ETAG_LEN];
+    char date[TILS_HTTP_DATE_LEN + 1];
+    char if_none_match[128];
+    char if_modified_since[128];
+    char other[] = "/tmp/tils-serve-XXXXXX";
+    char *res = malloc(TEST_SERVE_CAP);
+    tils_route_t *route = _serve_setup(mtime);
+    CHECK(route != NULL && res != NULL);
+    if (route == NULL || res == NULL)
+        goto cleanup;
+
+    strcpy(etag, route->etag[TILS_ENC_IDENTITY]);
+    tils_http_date(mtime, date);
+    snprintf(if_none_match, sizeof(if_none_match), "If-None-Match: %s\r\n",
+            etag);
+    snprintf(if_modified_since, sizeof(if_modified_since),
+            "If-Modified-Since: %s\r\n", date);
+
+    /* While the file is as it was the validators hold */
+    CHECK(_serve("GET", "", res) > TEST_SERVE_SIZE);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+    CHECK(_has_header(res, etag) && _has_header(res, date));
+    CHECK_INT(strlen(_body(res)), TEST_SERVE_SIZE);
+
+    CHECK(_serve("GET", if_none_match, res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 304 ", 13) == 0);
+    CHECK(_serve("GET", if_modified_since, res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 304 ", 13) == 0);
+    CHECK(_serve("HEAD", if_none_match, res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 304 ", 13) == 0);
+
+    /* Edited in place: same inode & size, but a later mtime. The new content
+     * is sent, and without the validators of the old. */
+    CHECK_INT(_serve_write(_serve_path, 1, mtime + 1), 0);
+    CHECK(_serve("GET", if_none_match, res) > TEST_SERVE_SIZE);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+    CHECK(!_has_header(res, "ETag:") && !_has_header(res, "Last-Modified:"));
+    CHECK(_body(res)[0] == 'b');
+
+    CHECK(_serve("GET", if_modified_since, res) > TEST_SERVE_SIZE);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+    CHECK(_serve("HEAD", if_none_match, res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+    CHECK(!_has_header(res, "ETag:"));
+
+    /* Back as it was */
+    CHECK_INT(_serve_write(_serve_path, 0, mtime), 0);
+    CHECK(_serve("GET", if_none_match, res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 304 ", 13) == 0);
+
+    /* Replaced by another file of the same size & mtime */
+    int fd = mkstemp(other);
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        close(fd);
+        CHECK_INT(_serve_write(other, 2, mtime), 0);
+        CHECK_INT(rename(other, _serve_path), 0);
+    }
+    CHECK(_serve("GET", if_none_match, res) > TEST_SERVE_SIZE);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+    CHECK(_body(res)[0] == 'c');
+
+cleanup:
+    free(res);
+    _serve_teardown();
+}
+
+/**
+ * @brief Check part of a response is a range of the file written with seed.
+ */
+int _is_range(const char *data, long first, long last, int seed) {
+    for (long i = first; i <= last; i++) {
+        if (data[i - first] != 'a' + (i + seed) % 26)
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Check a response is a multipart/byteranges body of these ranges.
+ *
+ * @param res The response.
+ * @param ranges First & last byte of every range, in the order sent.
+ * @param count The number of ranges.
+ * @param seed Seed of the file written.
+ *
+ * @return 1 if it is, 0 if not.
+ */
+int _is_multipart(const char *res, long ranges[][2], int count, int seed) {
+    char boundary[128];
+    char expect[256];
+    const char *type = strstr(res, "boundary=");
+    const char *body = _body(res);
+    const char *length = strstr(res, "Content-Length: ");
+    if (type == NULL || length == NULL ||
+            sscanf(type, "boundary=%100[^\r]", boundary) != 1 ||
+            strtol(length + 16, NULL, 10) != (long)strlen(body))
+        return 0;
+
+    for (int i = 0; i < count; i++) {
+        long len = ranges[i][1] - ranges[i][0] + 1;
+        int n = snprintf(expect, sizeof(expect), "\r\n--%s\r\n"
+                "Content-Type: application/octet-stream\r\n"
+                "Content-Range: bytes %ld-%ld/%d\r\n\r\n", boundary,
+                ranges[i][0], ranges[i][1], TEST_SERVE_SIZE);
+        if (strncmp(body, expect, n) != 0 ||
+                !_is_range(body + n, ranges[i][0], ranges[i][1], seed))
+            return 0;
+
+        body += n + len;
+    }
+
+    snprintf(expect, sizeof(expect), "\r\n--%s--\r\n", boundary);
+    return strcmp(body, expect) == 0;
+}
+
+void test_serve_ranges() {
+    char *res = malloc(TEST_SERVE_CAP);
+    char expect[128];
+    tils_route_t *route = _serve_setup(1700000000);
+    CHECK(route != NULL && res != NULL);
+    if (route == NULL || res == NULL)
+        goto cleanup;
+
+    CHECK(_serve("GET", "Range: bytes=100-199\r\n", res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 206 ", 13) == 0);
+    snprintf(expect, sizeof(expect), "Content-Range: bytes 100-199/%d\r\n",
+            TEST_SERVE_SIZE);
+    CHECK(_has_header(res, expect));
+    CHECK(_has_header(res, "Content-Length: 100\r\n"));
+    CHECK_INT(strlen(_body(res)), 100);
+    CHECK(_is_range(_body(res), 100, 199, 0));
+
+    /* Several ranges, each a part of its own */
+    long ranges[][2] = { { 0, 9 }, { 500000, 500099 },
+        { TEST_SERVE_SIZE - 5, TEST_SERVE_SIZE - 1 } };
+    CHECK(_serve("GET", "Range: bytes=0-9,500000-500099,-5\r\n", res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 206 ", 13) == 0);
+    CHECK(_has_header(res, "Content-Type: multipart/byteranges; boundary="));
+    CHECK(_is_multipart(res, ranges, 3, 0));
+
+    /* Ranges the file doesn't have */
+    CHECK(_serve("GET", "Range: bytes=5000000-\r\n", res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 416 ", 13) == 0);
+    snprintf(expect, sizeof(expect), "Content-Range: bytes */%d\r\n",
+            TEST_SERVE_SIZE);
+    CHECK(_has_header(res, expect));
+
+    /* HEAD ignores Range */
+    CHECK(_serve("HEAD", "Range: bytes=0-9\r\n", res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+
+cleanup:
+    free(res);
+    _serve_teardown();
+}
+
+void test_serve_if_range_changed() {
+    time_t mtime = 1700000000;
+    char etag_range[128];
+    char date_range[128];
+    char date[TILS_HTTP_DATE_LEN + 1];
+    char *res = malloc(TEST_SERVE_CAP);
+    tils_route_t *route = _serve_setup(mtime);
+    CHECK(route != NULL && res != NULL);
+    if (route == NULL || res == NULL)
+        goto cleanup;
+
+    tils_http_date(mtime, date);
+    snprintf(etag_range, sizeof(etag_range), "Range: bytes=10-19\r\n"
+            "If-Range: %s\r\n", route->etag[TILS_ENC_IDENTITY]);
+    snprintf(date_range, sizeof(date_range), "Range: bytes=10-19\r\n"
+            "If-Range: %s\r\n", date);
+
+    /* The client's partial copy is current, it gets the rest */
+    CHECK(_serve("GET", etag_range, res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 206 ", 13) == 0);
+    CHECK(_is_range(_body(res), 10, 19, 0));
+    CHECK(_serve("GET", date_range, res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 206 ", 13) == 0);
+
+    /* Once the file changes, a range of it would be spliced into a copy of
+     * the old one: the whole new file is sent instead. */
+    CHECK_INT(_serve_write(_serve_path, 1, mtime + 1), 0);
+    CHECK(_serve("GET", etag_range, res) > TEST_SERVE_SIZE);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+    CHECK_INT(strlen(_body(res)), TEST_SERVE_SIZE);
+    CHECK(_is_range(_body(res), 0, TEST_SERVE_SIZE - 1, 1));
+    CHECK(!_has_header(res, "ETag:"));
+
+    CHECK(_serve("GET", date_range, res) > TEST_SERVE_SIZE);
+    CHECK(strncmp(res, "HTTP/1.1 200 ", 13) == 0);
+
+    /* A plain Range request still gets its range, of the new file */
+    CHECK(_serve("GET", "Range: bytes=10-19\r\n", res) > 0);
+    CHECK(strncmp(res, "HTTP/1.1 206 ", 13) == 0);
+    CHECK(_is_range(_body(res), 10, 19, 1));
+    CHECK(!_has_header(res, "ETag:") && !_has_header(res, "Last-Modified:"));
+
+cleanup:
+    free(res);
+    _serve_teardown();
+}
@@ -0,0 +1,95 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/stats_test.c
+ *
+ * @brief Tests of histogram bucketing & of the stats page's tables
+ *
+ * @author Lars Wander
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tils/request.h>
+#include <tils/stats.h>
+
+#include "../src/tils/stats_private.h"
+
+#include "test.h"
+
+/* Internals of src/tils/stats.c */
+int _tils_stats_bucket(const stats_bound_t *bounds, int count,
+        int64_t value);
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+void test_stats_bucket() {
+    /* Bounds are inclusive, past the last is +Inf */
+    CHECK_INT(_tils_stats_bucket(_latency_bounds, COUNT(_latency_bounds), 0),
+            0);
+    CHECK_INT(_tils_stats_bucket(_latency_bounds, COUNT(_latency_bounds),
+                1000), 0);
+    CHECK_INT(_tils_stats_bucket(_latency_bounds, COUNT(_latency_bounds),
+                1001), 1);
+    CHECK_INT(_tils_stats_bucket(_latency_bounds, COUNT(_latency_bounds),
+                250000000), COUNT(_latency_bounds) - 1);
+    CHECK_INT(_tils_stats_bucket(_latency_bounds, COUNT(_latency_bounds),
+                250000001), COUNT(_latency_bounds));
+    CHECK_INT(_tils_stats_bucket(_latency_bounds, COUNT(_latency_bounds),
+                -5), 0);
+
+    CHECK_INT(_tils_stats_bucket(_count_bounds, COUNT(_count_bounds), 0), 0);
+    CHECK_INT(_tils_stats_bucket(_count_bounds, COUNT(_count_bounds), 3), 3);
+    CHECK_INT(_tils_stats_bucket(_count_bounds, COUNT(_count_bounds), 4), 3);
+    CHECK_INT(_tils_stats_bucket(_count_bounds, COUNT(_count_bounds), 5000),
+            COUNT(_count_bounds));
+
+    CHECK_INT(_tils_stats_bucket(_rate_bounds, COUNT(_rate_bounds),
+                10000000000), COUNT(_rate_bounds) - 1);
+}
+
+void test_stats_tables() {
+    /* Every histogram's bounds ascend, & are printed as their value */
+    for (int h = 0; h < COUNT(_histograms); h++) {
+        const stats_bound_t *bounds = _histograms[h].bounds;
+        CHECK(strncmp(_histograms[h].name, "tils_", 5) == 0);
+        for (int b = 0; b < _histograms[h].count; b++) {
+            double error = strtod(bounds[b].le, NULL) -
+                bounds[b].value * _histograms[h].scale;
+            double slack = bounds[b].value * _histograms[h].scale * 1e-9;
+            CHECK(error <= slack && -error <= slack);
+            CHECK(b == 0 || bounds[b].value > bounds[b - 1].value);
+        }
+    }
+
+    for (int c = 0; c < COUNT(_counters); c++) {
+        CHECK(strncmp(_counters[c].name, "tils_", 5) == 0);
+        CHECK(_counters[c].offset + sizeof(atomic_ulong) <=
+                sizeof(tils_stats_t));
+    }
+
+    for (int m = 0; m < COUNT(_offender_metrics); m++)
+        CHECK(strncmp(_offender_metrics[m].name, "tils_", 5) == 0);
+
+    /* Requests are labelled by method */
+    CHECK_STR(tils_request_method_name(TILS_GET), "GET");
+    CHECK_STR(tils_request_method_name(TILS_OPTIONS), "OPTIONS");
+    CHECK_STR(tils_request_method_name(TILS_UNKNOWN), "UNKNOWN");
+}
@@ -0,0 +1,103 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/test.c
+ *
+ * @brief Runs the unit tests
+ *
+ *   ./test-tils [name...]
+ *
+ * runs every test, or only those whose name starts with one of the
+ * arguments.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+
+int test_failures = 0;
+
+static const struct {
+    const char *name;
+    void (*run)();
+} _tests[] = {
+    { "request_parse", test_request_parse },
+    { "request_pipelining", test_request_pipelining },
+    { "request_keep_alive", test_request_keep_alive },
+    { "request_ranges", test_request_ranges },
+    { "if_range", test_if_range },
+    { "request_encodings", test_request_encodings },
+    { "serve_encoding", test_serve_encoding },
+    { "etag_match", test_etag_match },
+    { "not_modified", test_not_modified },
+    { "http_date", test_http_date },
+    { "serve_changed", test_serve_changed },
+    { "serve_ranges", test_serve_ranges },
+    { "serve_if_range_changed", test_serve_if_range_changed },
+    { "deflate_chunks", test_deflate_chunks },
+    { "deflate_fill_max", test_deflate_fill_max },
+    { "mime_lookup", test_mime_lookup },
+    { "access_log_rotate", test_access_log_rotate },
+    { "bench_bucket", test_bench_bucket },
+    { "stats_bucket", test_stats_bucket },
+    { "stats_tables", test_stats_tables },
+    { "log_format", test_log_format },
+    { "log_star", test_log_star },
+    { "log_truncated", test_log_truncated },
+    { "arena", test_arena },
+    { "pool", test_pool },
+};
+
+int _selected(const char *name, char **names, int count) {
+    if (count == 0)
+        return 1;
+
+    for (int i = 0; i < count; i++) {
+        if (strncmp(name, names[i], strlen(names[i])) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int run = 0;
+    int failed = 0;
+
+    for (int i = 0; i < sizeof(_tests) / sizeof(_tests[0]); i++) {
+        if (!_selected(_tests[i].name, argv + 1, argc - 1))
+            continue;
+
+        test_failures = 0;
+        _tests[i].run();
+        run++;
+
+        if (test_failures > 0) {
+            printf("FAIL %s (%d)\n", _tests[i].name, test_failures);
+            failed++;
+        } else {
+            printf("ok   %s\n", _tests[i].name);
+        }
+    }
+
+    printf("%d of %d tests passed\n", run - failed, run);
+    return failed > 0;
+}
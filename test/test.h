@@ -0,0 +1,92 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test/test.h
+ *
+ * @brief Unit test harness
+ *
+ * A test is a function making CHECK_* assertions. A failed assertion is
+ * reported with its location and the test carries on, so one run lists
+ * every failure. `test-tils' exits nonzero if any assertion failed.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include <string.h>
+
+/* Assertions failed by the running test */
+extern int test_failures;
+
+#define _TEST_FAIL(...) \
+    do { \
+        fprintf(stderr, "  %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        test_failures++; \
+    } while (0)
+
+#define CHECK(cond) \
+    do { if (!(cond)) _TEST_FAIL("%s", #cond); } while (0)
+
+#define CHECK_INT(a, b) \
+    do { \
+        long long _a = (a), _b = (b); \
+        if (_a != _b) \
+            _TEST_FAIL("%s == %s: %lld != %lld", #a, #b, _a, _b); \
+    } while (0)
+
+#define CHECK_STR(a, b) \
+    do { \
+        const char *_a = (a), *_b = (b); \
+        if (_a == NULL || _b == NULL || strcmp(_a, _b) != 0) \
+            _TEST_FAIL("%s == %s: \"%s\" != \"%s\"", #a, #b, \
+                    _a ? _a : "(null)", _b ? _b : "(null)"); \
+    } while (0)
+
+/* Every test, see test.c */
+void test_request_parse();
+void test_request_pipelining();
+void test_request_keep_alive();
+void test_request_ranges();
+void test_if_range();
+void test_request_encodings();
+void test_serve_encoding();
+void test_etag_match();
+void test_not_modified();
+void test_http_date();
+void test_serve_changed();
+void test_serve_ranges();
+void test_serve_if_range_changed();
+void test_deflate_chunks();
+void test_deflate_fill_max();
+void test_mime_lookup();
+void test_access_log_rotate();
+void test_bench_bucket();
+void test_stats_bucket();
+void test_stats_tables();
+void test_log_format();
+void test_log_star();
+void test_log_truncated();
+void test_arena();
+void test_pool();
+
+#endif /* _TEST_H_ */
@@ -0,0 +1,227 @@
+/*
+ *  This file is part of tils.
+ *
+ *  tils is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tils is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tils.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file tools/logcat.c
+ *
+ * @brief Print access log segments as text or JSON.
+ *
+ * Reads segments written by `tils -a dir', e.g.
+ *
+ *   ./tils-logcat logs/access-*.tlog
+ *   ./tils-logcat -j logs/access-*.tlog | jq .
+ *
+ * Route ids are resolved to paths with the `routes' file in the directory of
+ * each segment, or with the file given by -r.
+ *
+ * @author Lars Wander
+ */
+
+#define _GNU_SOURCE
+
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tils/access_log.h>
+#include <tils/io_util.h>
+#include <tils/request.h>
+
+#define PATH_LEN (4096)
+
+/* Route id to source, from a routes file */
+static char **_routes = NULL;
+static int _route_count = 0;
+
+/**
+ * @brief Load a routes file, replacing the routes loaded before.
+ *
+ * @return 0 on success, -1 if it can't be read.
+ */
+int _load_routes(const char *path) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    FILE *file = fopen(path, "r");
+
+    for (int i = 0; i < _route_count; i++)
+        free(_routes[i]);
+    _route_count = 0;
+
+    if (file == NULL)
+        return -1;
+
+    while ((len = getline(&line, &line_cap, file)) > 0) {
+        char *tab = strchr(line, '\t');
+        int id = atoi(line);
+        if (tab == NULL || id < 0)
+            continue;
+
+        if (line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        if (id >= _route_count) {
+            char **routes = realloc(_routes, sizeof(char *) * (id + 1));
+            if (routes == NULL)
+                break;
+
+            _routes = routes;
+            while (_route_count <= id)
+                _routes[_route_count++] = NULL;
+        }
+
+        free(_routes[id]);
+        _routes[id] = strdup(tab + 1);
+    }
+
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+const char *_route_name(int id) {
+    if (id >= 0 && id < _route_count && _routes[id] != NULL)
+        return _routes[id];
+
+    return id == TILS_ACCESS_NO_ROUTE ? "-" : "?";
+}
+
+/**
+ * @brief Print s as the contents of a JSON string.
+ */
+void _json_string(const char *s) {
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+}
+
+void _print_record(const tils_access_hdr_t *hdr, const tils_access_rec_t *rec,
+        int json) {
+    char addr[TILS_ADDRSTRLEN];
+    char date[32];
+    struct tm tm_info;
+    time_t sec = rec->time_ns / 1000000000;
+    const char *method = tils_request_method_name(rec->method);
+
+    tils_addr_format(&rec->addr, addr, sizeof(addr));
+    gmtime_r(&sec, &tm_info);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm_info);
+
+    if (!json) {
+        printf("%s.%06dZ %s:%u %s %s %u %llu %.1fus %.1fus%s\n", date,
+                (int)(rec->time_ns % 1000000000 / 1000), addr,
+                ntohs(rec->addr.port), method, _route_name(rec->route),
+                rec->status, (unsigned long long)rec->bytes,
+                rec->parse_ns / 1e3, rec->serve_ns / 1e3,
+                rec->flags & TILS_ACCESS_CHUNKED ? " chunked" : "");
+        return;
+    }
+
+    printf("{\"time\":\"%s.%06dZ\",\"time_ns\":%lld,\"worker\":%u,"
+            "\"addr\":\"%s\",\"port\":%u,\"method\":\"%s\",\"route\":%d,"
+            "\"path\":\"", date, (int)(rec->time_ns % 1000000000 / 1000),
+            (long long)rec->time_ns, hdr->worker, addr,
+            ntohs(rec->addr.port), method, (int)rec->route);
+    _json_string(_route_name(rec->route));
+    printf("\",\"status\":%u,\"bytes\":%llu,\"parse_ns\":%llu,"
+            "\"serve_ns\":%llu,\"chunked\":%s}\n", rec->status,
+            (unsigned long long)rec->bytes, (unsigned long long)rec->parse_ns,
+            (unsigned long long)rec->serve_ns,
+            rec->flags & TILS_ACCESS_CHUNKED ? "true" : "false");
+}
+
+/**
+ * @brief Print every record of a segment.
+ *
+ * @return 0 on success, -1 if it isn't a readable segment.
+ */
+int _print_segment(const char *path, int json) {
+    tils_access_hdr_t hdr;
+    tils_access_rec_t rec;
+    int res = -1;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+            memcmp(hdr.magic, TILS_ACCESS_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != TILS_ACCESS_VERSION ||
+            hdr.record_size < sizeof(rec)) {
+        fprintf(stderr, "%s: not an access log segment\n", path);
+        goto cleanup_file;
+    }
+
+    /* Later versions may only grow records */
+    long skip = hdr.record_size - sizeof(rec);
+    while (fread(&rec, sizeof(rec), 1, file) == 1 && rec.time_ns != 0) {
+        _print_record(&hdr, &rec, json);
+        if (skip > 0 && fseek(file, skip, SEEK_CUR) < 0)
+            break;
+    }
+
+    res = 0;
+
+cleanup_file:
+    fclose(file);
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    char routes_path[PATH_LEN];
+    char dir_buf[PATH_LEN];
+    char *routes = NULL;
+    int json = 0;
+    int res = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "jr:")) != -1) {
+        switch (opt) {
+            case 'j': json = 1; break;
+            case 'r': routes = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-j] [-r routes] segment...\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+
+    if (routes != NULL && _load_routes(routes) < 0)
+        perror(routes);
+
+    for (int i = optind; i < argc; i++) {
+        if (routes == NULL) {
+            snprintf(dir_buf, PATH_LEN, "%s", argv[i]);
+            snprintf(routes_path, PATH_LEN, "%s/routes", dirname(dir_buf));
+            _load_routes(routes_path);
+        }
+
+        if (_print_segment(argv[i], json) < 0)
+            res = -1;
+    }
+
+    return res;
+}